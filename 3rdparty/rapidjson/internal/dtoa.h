@@ -112,7 +112,11 @@ inline void DigitGen(const DiyFp& W, const DiyFp& Mp, uint64_t delta, char* buff
         kappa--;
         if (p2 < delta) {
             *K += kappa;
-            GrisuRound(buffer, *len, delta, p2, one.f, wp_w.f * kPow10[-kappa]);
+            // kPow10 has 10 entries, so kPow10[-kappa] would read past its end for more fractional digits. The
+            // last digit is then not rounded towards the exact value (as in upstream rapidjson), which still
+            // yields a string that reads back as the same double
+            int index = -kappa;
+            GrisuRound(buffer, *len, delta, p2, one.f, wp_w.f * (index < 10 ? kPow10[index] : 0));
             return;
         }
     }
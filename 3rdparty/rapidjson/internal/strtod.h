@@ -159,11 +159,15 @@ inline bool StrtodDiyFp(const char* decimals, size_t length, size_t decimalPosit
     size_t remaining = length - i;
     const unsigned kUlpShift = 3;
     const unsigned kUlp = 1 << kUlpShift;
-    int error = (remaining == 0) ? 0 : kUlp / 2;
+    // 64 bits, as the error is shifted by up to 63 bits below (upstream rapidjson uses an int, for which shifts of
+    // 32 bits or more are undefined). It is only non-zero if digits were dropped, in which case the significand
+    // (nearly) fills 64 bits and the shift is a few bits at most
+    int64_t error = (remaining == 0) ? 0 : kUlp / 2;
 
     DiyFp v(significand, 0);
     v = v.Normalize();
-    error <<= -v.e;
+    if (error != 0)
+        error <<= -v.e;
 
     const int dExp = (int)decimalPosition - (int)i + exp;
 
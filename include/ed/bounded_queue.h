@@ -0,0 +1,156 @@
+#ifndef ED_BOUNDED_QUEUE_H_
+#define ED_BOUNDED_QUEUE_H_
+
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <vector>
+#include <cstddef>
+
+namespace ed
+{
+
+/**
+ * @brief The BoundedQueue class
+ *
+ * Fixed-capacity lock-free FIFO queue (D. Vyukov's bounded MPMC queue). Every slot carries a sequence
+ * number that tells producers and consumers whether it is free or filled, so push and pop only need a
+ * single compare-and-swap on the queue position. Elements can be of any copyable type (e.g. shared
+ * pointers): an element is only copied in or out by the thread that won the slot.
+ *
+ * Multiple threads may push and pop concurrently. The capacity is exact as long as there is a single
+ * producer; with multiple producers the queue may overshoot it by at most (#producers - 1) elements.
+ */
+template<typename T>
+class BoundedQueue : boost::noncopyable
+{
+
+public:
+
+    explicit BoundedQueue(std::size_t capacity)
+        : capacity_(capacity < 1 ? 1 : capacity), enqueue_pos_(0), dequeue_pos_(0)
+    {
+        // The buffer size must be a power of two and at least 2 (with a single slot a full queue
+        // would look empty to the producer)
+        std::size_t buffer_size = 2;
+        while (buffer_size < capacity_)
+            buffer_size *= 2;
+
+        mask_ = buffer_size - 1;
+        buffer_ = std::vector<Cell>(buffer_size);
+        for(std::size_t i = 0; i < buffer_size; ++i)
+            buffer_[i].sequence.store(i, boost::memory_order_relaxed);
+    }
+
+    // Returns false if the queue is full
+    bool push(const T& value)
+    {
+        if (size() >= capacity_)
+            return false;
+
+        Cell* cell;
+        std::size_t pos = enqueue_pos_.load(boost::memory_order_relaxed);
+        for(;;)
+        {
+            cell = &buffer_[pos & mask_];
+            std::size_t seq = cell->sequence.load(boost::memory_order_acquire);
+            std::ptrdiff_t diff = (std::ptrdiff_t)seq - (std::ptrdiff_t)pos;
+
+            if (diff == 0)
+            {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, boost::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+                return false; // full
+            else
+                pos = enqueue_pos_.load(boost::memory_order_relaxed);
+        }
+
+        cell->value = value;
+        cell->sequence.store(pos + 1, boost::memory_order_release);
+        return true;
+    }
+
+    // Returns false if the queue is empty
+    bool pop(T& value)
+    {
+        Cell* cell;
+        std::size_t pos = dequeue_pos_.load(boost::memory_order_relaxed);
+        for(;;)
+        {
+            cell = &buffer_[pos & mask_];
+            std::size_t seq = cell->sequence.load(boost::memory_order_acquire);
+            std::ptrdiff_t diff = (std::ptrdiff_t)seq - (std::ptrdiff_t)(pos + 1);
+
+            if (diff == 0)
+            {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, boost::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+                return false; // empty
+            else
+                pos = dequeue_pos_.load(boost::memory_order_relaxed);
+        }
+
+        value = cell->value;
+        cell->value = T(); // Do not keep the element alive in the buffer
+        cell->sequence.store(pos + mask_ + 1, boost::memory_order_release);
+        return true;
+    }
+
+    // Approximate if other threads are pushing or popping at the same time
+    std::size_t size() const
+    {
+        std::size_t dequeue_pos = dequeue_pos_.load(boost::memory_order_acquire);
+        std::size_t enqueue_pos = enqueue_pos_.load(boost::memory_order_acquire);
+        return enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+
+    bool full() const { return size() >= capacity_; }
+
+    std::size_t capacity() const { return capacity_; }
+
+private:
+
+    struct Cell
+    {
+        Cell() : sequence(0) {}
+
+        // std::vector requires copyable elements; cells are only copied on construction
+        Cell(const Cell& c) : sequence(c.sequence.load(boost::memory_order_relaxed)), value(c.value) {}
+
+        Cell& operator=(const Cell& c)
+        {
+            sequence.store(c.sequence.load(boost::memory_order_relaxed), boost::memory_order_relaxed);
+            value = c.value;
+            return *this;
+        }
+
+        boost::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    std::size_t capacity_;
+
+    std::size_t mask_;
+
+    std::vector<Cell> buffer_;
+
+    // Keep the producer and consumer positions on separate cache lines
+    char pad0_[64];
+
+    boost::atomic<std::size_t> enqueue_pos_;
+
+    char pad1_[64];
+
+    boost::atomic<std::size_t> dequeue_pos_;
+
+};
+
+}
+
+#endif
@@ -6,11 +6,27 @@
 namespace ed
 {
 
+// The edges, normals, extents and point coordinates are derived from the points. After changing the points,
+// call convex_hull::calculateEdgesAndNormals(), otherwise collision checks use the derived data of the old points
 struct ConvexHull
 {
+    // Range of the projections of the points on a normal, relative to the start point of the edge of that normal
+    struct Extent
+    {
+        float min, max;
+    };
+
     std::vector<geo::Vec2f> points;
     std::vector<geo::Vec2f> edges;
     std::vector<geo::Vec2f> normals;
+
+    // Calculated with the edges and normals, such that collision checks do not have to project all points again
+    std::vector<Extent> extents;
+
+    // The points as a structure of arrays (all x, then all y, both padded), for the vectorized projections in
+    // collision checks. Also calculated with the edges and normals
+    std::vector<float> point_coords;
+
     float z_min, z_max;
     float area; // is calculated based on points
     bool complete;
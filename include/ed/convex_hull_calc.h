@@ -13,14 +13,40 @@ void create(const std::vector<geo::Vec2f>& points, float z_min, float z_max, Con
 
 void createAbsolute(const std::vector<geo::Vec2f>& points, float z_min, float z_max, ConvexHull& c);
 
+// Same as create, for points that already form a convex polygon (such as the result of calculateHull or mergeHulls)
+void createFromHull(const std::vector<geo::Vec2f>& hull_points, float z_min, float z_max, ConvexHull& c,
+                    geo::Pose3D& pose);
+
+// Calculates the 2D convex hull of the points (Andrew's monotone chain). The hull is counter-clockwise, starts at the
+// lexicographically smallest point and has no collinear points. Sorts the points and removes duplicates. 'hull' must
+// be a different vector; its memory is reused
+void calculateHull(std::vector<geo::Vec2f>& points, std::vector<geo::Vec2f>& hull);
+
+// Calculates the convex hull of two convex polygons (in either orientation) in O(n + m), in the same form as
+// calculateHull. Other point sets are sorted first, so the result is always the convex hull of all points. 'hull' may
+// be one of the inputs
+void mergeHulls(const std::vector<geo::Vec2f>& hull1, const std::vector<geo::Vec2f>& hull2,
+                std::vector<geo::Vec2f>& hull);
+
 void calculateEdgesAndNormals(ConvexHull& c);
 
 bool collide(const ConvexHull& c1, const geo::Vector3& pos1,
              const ConvexHull& c2, const geo::Vector3& pos2,
              float xy_padding = 0, float z_padding = 0);
 
+// Returns true if point p lies within the convex hull (at position pos) in the xy-plane
+bool contains(const ConvexHull& c, const geo::Vector3& pos, const geo::Vec2& p);
+
 void calculateArea(ConvexHull& c);
 
+// Selects the points that are vertices of the 3D convex hull of 'points'. If the points do not span a volume
+// (e.g., a flat shape), all points are returned
+void calculateHullVertices(const std::vector<geo::Vector3>& points, std::vector<geo::Vector3>& hull_vertices);
+
+// Instruction set used for the calculations on the points of convex hulls: "avx", "sse2" or "scalar". Set the
+// environment variable ED_CONVEX_HULL_KERNELS to "sse2" or "scalar" to limit it (e.g., to compare performance)
+const char* instructionSet();
+
 }
 
 }
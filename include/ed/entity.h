@@ -9,6 +9,7 @@
 #include <tue/config/data.h>
 
 #include <boost/circular_buffer.hpp>
+#include <boost/atomic.hpp>
 #include <ros/time.h>
 
 #include "ed/property.h"
@@ -50,44 +51,46 @@ public:
     void addMeasurement(MeasurementConstPtr measurement);
 
     inline geo::ShapeConstPtr shape() const { return shape_; }
+
+    // If the mesh of the shape is changed in place, setShape must be called again (with the same shape) for the
+    // convex hull to follow. The mesh is only read here, not each time the pose changes
     void setShape(const geo::ShapeConstPtr& shape);
 
     inline int shapeRevision() const{ return shape_ ? shape_revision_ : 0; }
 
-    inline const ConvexHull& convexHull() const { return convex_hull_new_; }
-
-    void setConvexHull(const ConvexHull& convex_hull, const geo::Pose3D& pose, double time, const std::string& source = "")
+    // The convex hull is calculated on first access after it was invalidated (thread-safe)
+    inline const ConvexHull& convexHull() const
     {
-        if (convex_hull.points.empty())
-        {
-            // This signals that the measurement convex hull must be removed
-            convex_hull_map_.erase(source);
-        }
-        else
-        {
-            ed::MeasurementConvexHull& m = convex_hull_map_[source];
-            m.convex_hull = convex_hull;
-            m.pose = pose;
-            m.timestamp = time;
-        }
-
-        updateConvexHull();
+        if (geometry_.state.load(boost::memory_order_acquire) != Geometry::UP_TO_DATE)
+            updateConvexHull();
+        return geometry_.convex_hull;
     }
 
+    void setConvexHull(const ConvexHull& convex_hull, const geo::Pose3D& pose, double time, const std::string& source = "");
+
     const std::map<std::string, MeasurementConvexHull>& convexHullMap() const { return convex_hull_map_; }
 
     inline const geo::Pose3D& pose() const
     {
         if (!has_pose_)
             log::warning() << "Someone's accessing an entity's pose while it doesnt have one." << std::endl;
-        return pose_;
+
+        // The pose of an entity with multiple measurement convex hulls follows from their combination
+        if (geometry_.state.load(boost::memory_order_acquire) == Geometry::FROM_MEASUREMENTS)
+            updateConvexHull();
+
+        return geometry_.pose;
     }
 
     inline void setPose(const geo::Pose3D& pose)
     {
-        pose_ = pose;
+        // Make sure a pending combination of measurement convex hulls does not overwrite the pose later on
+        if (geometry_.state.load(boost::memory_order_relaxed) == Geometry::FROM_MEASUREMENTS)
+            updateConvexHull();
+
+        geometry_.pose = pose;
         if (shape_)
-            updateConvexHullFromShape();
+            geometry_.state.store(Geometry::FROM_SHAPE, boost::memory_order_relaxed);
 
         has_pose_ = true;
     }
@@ -233,10 +236,35 @@ private:
     int shape_revision_;
 
     std::map<std::string, MeasurementConvexHull> convex_hull_map_;
-    ConvexHull convex_hull_new_;
 
     bool has_pose_;
-    geo::Pose3D pose_;
+
+    // Pose and convex hull. Setting the pose or shape only marks the convex hull as outdated, as it is often
+    // not read at all (e.g., for robot links), and calculating it from the shape vertices is expensive. It is
+    // calculated by the first reader, which may be any of the threads sharing this entity
+    struct Geometry
+    {
+        enum State { UP_TO_DATE, FROM_SHAPE, FROM_MEASUREMENTS };
+
+        Geometry() : state(UP_TO_DATE), pose(geo::Pose3D::identity()), shape_fingerprint(0) {}
+
+        // Copying locks the source, as another thread may be calculating its convex hull
+        Geometry(const Geometry& other);
+
+        Geometry& operator=(const Geometry& other);
+
+        boost::atomic<int> state;
+        ConvexHull convex_hull;
+        geo::Pose3D pose;
+
+        // Vertices of the 3D convex hull of the shape (shared by all entities with the same shape)
+        boost::shared_ptr<const std::vector<geo::Vector3> > shape_hull_vertices;
+
+        // Fingerprint of the mesh of the shape when it was set
+        std::size_t shape_fingerprint;
+    };
+
+    mutable Geometry geometry_;
 
 //    double creation_time_;
 
@@ -248,9 +276,12 @@ private:
     // Generic property map
     std::map<Idx, Property> properties_;
 
-    void updateConvexHull();
+    // Brings the convex hull (and pose) in geometry_ up to date
+    void updateConvexHull() const;
+
+    void calculateConvexHullFromMeasurements() const;
 
-    void updateConvexHullFromShape();
+    void calculateConvexHullFromShape() const;
 
     std::set<std::string> flags_;
 
@@ -1,7 +1,7 @@
 #ifndef ED_EVENT_CLOCK_H_
 #define ED_EVENT_CLOCK_H_
 
-#include <sys/time.h>
+#include <time.h>
 
 namespace ed
 {
@@ -16,10 +16,7 @@ public:
 
     bool triggers()
     {
-        struct timeval now;
-        gettimeofday(&now, NULL);
-
-        double t_secs = now.tv_sec + now.tv_usec / 1e6;
+        double t_secs = now();
         if ((t_secs - t_last_trigger_) > cycle_duration_)
         {
             t_last_trigger_ = t_secs;
@@ -28,9 +25,23 @@ public:
         return false;
     }
 
+    // Time (in seconds) until this clock will trigger again. Is zero if it triggers right now.
+    double timeUntilTrigger() const
+    {
+        double dt = t_last_trigger_ + cycle_duration_ - now();
+        return dt > 0 ? dt : 0;
+    }
+
 private:
     double cycle_duration_;
     double t_last_trigger_;
+
+    static double now()
+    {
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return t.tv_sec + t.tv_nsec / 1e9;
+    }
 };
 
 }
@@ -0,0 +1,61 @@
+#ifndef ED_IO_BINARY_FORMAT_H_
+#define ED_IO_BINARY_FORMAT_H_
+
+namespace ed
+{
+
+namespace io
+{
+
+/**
+ * Binary encoding written by BinaryWriter and read by BinaryReader.
+ *
+ * The data starts with a header: the magic bytes 'E', 'D', 'B' followed by the format version (one byte). Then
+ * follow the members of the root group, closed by END.
+ *
+ * Each member of a group starts with its type tag (one byte) and its key. Keys are stored in a label dictionary
+ * that is built up while writing: a key is written as varint 0, followed by the label itself (varint length and
+ * characters) the first time it is used, and as varint 'label index + 1' after that. Array items have no key.
+ *
+ *     GROUP        key, members, END
+ *     ARRAY        key, ITEMs, END
+ *     ITEM         members, END
+ *     FLOAT        key, 4 bytes
+ *     DOUBLE       key, 8 bytes
+ *     INT          key, zigzag varint
+ *     STRING       key, varint length, characters
+ *     FLOAT_ARRAY  key, varint size, size * 4 bytes
+ *     INT_ARRAY    key, varint size, size * zigzag varint
+ *     STRING_ARRAY key, varint size, size * (varint length, characters)
+ *
+ * Floating point numbers are stored as IEEE 754 in little endian byte order.
+ */
+namespace binary
+{
+
+const unsigned char MAGIC[3] = { 'E', 'D', 'B' };
+
+const unsigned char VERSION = 1;
+
+enum Tag
+{
+    END          = 'e',
+    GROUP        = 'g',
+    ARRAY        = 'a',
+    ITEM         = 'i',
+    FLOAT        = 'f',
+    DOUBLE       = 'd',
+    INT          = 'n',
+    STRING       = 's',
+    FLOAT_ARRAY  = 'F',
+    INT_ARRAY    = 'N',
+    STRING_ARRAY = 'S'
+};
+
+} // end namespace binary
+
+}
+
+} // end namespace ed
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef ED_IO_BINARY_READER_H_
+#define ED_IO_BINARY_READER_H_
+
+#include "ed/io/reader.h"
+
+namespace ed
+{
+
+namespace io
+{
+
+/**
+ * @brief The BinaryReader class
+ *
+ * Reads the binary encoding written by BinaryWriter (see ed/io/binary_format.h). On construction, the data is
+ * scanned once to build an index of all groups and their members; values are decoded from the data when they
+ * are read. The data must therefore stay valid during the lifetime of the reader.
+ */
+class BinaryReader : public Reader
+{
+
+public:
+
+    BinaryReader(const char* data, std::size_t size);
+
+    virtual ~BinaryReader();
+
+    bool readGroup(const std::string& name);
+    bool endGroup();
+
+    bool readArray(const std::string& name);
+    bool endArray();
+
+    bool nextArrayItem();
+
+    bool readValue(const std::string&, float& f);
+    bool readValue(const std::string&, double& d);
+    bool readValue(const std::string&, int& i);
+    bool readValue(const std::string&, std::string& s);
+
+    bool readValue(const std::string&, std::vector<float>& fs);
+    bool readValue(const std::string&, std::vector<int>& is);
+
+    bool ok() { return error_.empty(); }
+
+    std::string error() { return error_; }
+
+private:
+
+    struct Member
+    {
+        unsigned int label;
+
+        unsigned char tag;
+
+        // Next member of the same group (INVALID if none)
+        unsigned int next;
+
+        // For values: position of the value in the data. For groups: the group index. For arrays: the group
+        // index of the first item (INVALID if empty)
+        std::size_t pos;
+    };
+
+    struct Group
+    {
+        Group(unsigned int parent_) : first(INVALID), last(INVALID), next_item(INVALID), parent(parent_) {}
+
+        unsigned int first;
+
+        unsigned int last;
+
+        // If the group is an array item: the next item of the same array (INVALID if none)
+        unsigned int next_item;
+
+        unsigned int parent;
+    };
+
+    struct ArrayState
+    {
+        // Group that contains the array, and the array item to visit next
+        unsigned int parent;
+
+        unsigned int next_item;
+    };
+
+    static const unsigned int INVALID = static_cast<unsigned int>(-1);
+
+    const unsigned char* data_;
+
+    std::size_t size_;
+
+    std::vector<std::string> labels_;
+
+    std::vector<Member> members_;
+
+    // Group 0 is the root
+    std::vector<Group> groups_;
+
+    // Current group (INVALID if the current position is an array)
+    unsigned int group_;
+
+    std::vector<ArrayState> array_stack_;
+
+    std::string error_;
+
+    bool parse();
+
+    unsigned int addMember(unsigned int group, unsigned int label, unsigned char tag, std::size_t pos);
+
+    const Member* find(const std::string& key) const;
+
+    bool readVarint(std::size_t& pos, unsigned long& v) const;
+
+    bool skipValue(unsigned char tag, std::size_t& pos) const;
+
+    float decodeFloat(std::size_t pos) const;
+
+    double decodeDouble(std::size_t pos) const;
+
+};
+
+}
+
+} // end namespace ed
+
+#endif
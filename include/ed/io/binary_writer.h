@@ -1,137 +1,106 @@
-#ifndef ERA_TUE_IO_BINARY_WRITER_H_
-#define ERA_TUE_IO_BINARY_WRITER_H_
+#ifndef ED_IO_BINARY_WRITER_H_
+#define ED_IO_BINARY_WRITER_H_
 
-#include "era/io/writer.h"
+#include "ed/io/writer.h"
 
 #include <map>
-#include <stdint.h>
+#include <string>
+#include <vector>
 
-namespace era
+namespace ed
 {
 
 namespace io
 {
 
-class BinaryWriter : Writer
+/**
+ * @brief The BinaryWriter class
+ *
+ * Writes the compact binary encoding described in ed/io/binary_format.h. Buffering is the same as for the
+ * JSONWriter: the output is either passed to a sink (or stream) in chunks, or written into a buffer given
+ * by the caller.
+ */
+class BinaryWriter : public Writer
 {
 
 public:
 
-    BinaryWriter(Data& data) : Writer(data) {}
+    static const std::size_t DEFAULT_CHUNK_SIZE = 1 << 16;
 
-    ~BinaryWriter() {}
+    // Streams the output to 'out'
+    BinaryWriter(std::ostream& out);
 
-    void writeGroup(const std::string& name)
-    {
-        writeLabel("g" + name);
-    }
+    // Streams the output to 'sink', every time at least 'chunk_size' bytes are written
+    BinaryWriter(OutputSink& sink, std::size_t chunk_size = DEFAULT_CHUNK_SIZE);
 
-    void endGroup()
-    {
-        write('e');
-    }
+    // Writes the output into 'buffer' (which is cleared first, but keeps its capacity)
+    BinaryWriter(std::string& buffer);
 
-    void writeValue(const std::string& key, float f)
-    {
-        writeLabel("f" + key);
-        write<float>(f);
-    }
+    // Passes the remaining output to the sink (but does not close open groups and arrays: see finish)
+    ~BinaryWriter();
 
-    void writeValue(const std::string& key, int i)
-    {
-        writeLabel("i" + key);
-        write<int32_t>(i);
-    }
+    void writeGroup(const std::string& name);
+    void endGroup();
 
-    void writeValue(const std::string& key, const std::string& s)
-    {
-        writeLabel("s" + key);
-        temp_data_.insert(temp_data_.end(), &s[0], &s[s.size() + 1]);
-    }
+    void writeValue(const std::string& key, float f);
+    void writeValue(const std::string& key, double d);
+    void writeValue(const std::string& key, int i);
+    void writeValue(const std::string& key, const std::string& s);
 
-    void writeValue(const std::string& key, const float* fs, std::size_t size)
-    {
-        writeLabel("F" + key);
-        temp_data_.insert(temp_data_.end(), (const char*)fs, (const char*)fs + size * sizeof(float));
-    }
+    void writeValue(const std::string& key, const float* fs, std::size_t size);
+    void writeValue(const std::string& key, const int* is, std::size_t size);
+    void writeValue(const std::string& key, const std::string* ss, std::size_t size);
 
-    void writeValue(const std::string& key, const int* is, std::size_t size)
-    {
-        // ...
-    }
+    using Writer::writeValue;
 
-    void writeValue(const std::string& key, const std::string* ss, std::size_t size)
-    {
-        // ...
-    }
+    void writeArray(const std::string& key);
+    void addArrayItem();
+    void endArrayItem();
+    void endArray();
 
-    void writeArray(const std::string& key)
-    {
-        writeLabel("a" + key);
-    }
+    // Closes all open groups and arrays (and the root group), and passes all output to the sink
+    void finish();
 
-    void addArrayItem() {}
-    void endArrayItem() {}
+private:
 
-    void endArray()
-    {
-        write('e');
-    }
+    StreamSink stream_sink_;
 
-    void finish()
-    {
-        // Add all labels
-        for(std::vector<std::string>::const_iterator it = labels_.begin(); it != labels_.end(); ++it)
-        {
-            const std::string& s = *it;
-            data_.insert(data_.end(), &s[0], &s[s.size() + 1]);
-        }
-
-        data_.insert(data_.end(), temp_data_.begin(), temp_data_.end());
-    }
+    OutputSink* sink_;
 
-private:
+    std::size_t chunk_size_;
 
-    std::vector<std::string> labels_;
-    std::map<std::string, std::size_t> label_to_index_;
+    std::string own_buffer_;
 
-    void writeLabel(const std::string& label)
-    {
-        std::map<std::string, std::size_t>::const_iterator it = label_to_index_.find(label);
-
-        std::size_t idx;
-        if (it != label_to_index_.end())
-            idx = it->second;
-        else
-        {
-            std::size_t idx = labels_.size();
-            label_to_index_[label] = idx;
-            labels_.push_back(label);
-        }
-
-        if (idx < 255)
-        {
-            temp_data_.push_back(idx);
-        }
-        else
-        {
-            temp_data_.push_back(255);
-            write<uint32_t>(idx);
-        }
-    }
+    std::string* buffer_;
+
+    // Label dictionary: label index per key
+    std::map<std::string, unsigned int> label_to_index_;
+
+    // Open groups ('g'), arrays ('a') and array items ('i')
+    std::vector<char> type_stack_;
+
+    void init();
+
+    void writeMember(unsigned char tag, const std::string& key);
+
+    void writeVarint(unsigned long v);
+
+    void writeString(const std::string& s);
+
+    void close(char type);
 
-    template<typename T>
-    inline void write(const T& d)
+    inline void flushIfFull()
     {
-        temp_data_.insert(temp_data_.end(), (char*)&d, (char*)&d + sizeof(T));
+        if (sink_ && buffer_->size() >= chunk_size_)
+            flush();
     }
 
-    std::vector<unsigned char> temp_data_;
+    void flush();
 
 };
 
 }
 
-} // end namespace era
+} // end namespace ed
 
 #endif
@@ -2,9 +2,6 @@
 #define ED_IO_JSON_READER_H_
 
 #include "ed/io/reader.h"
-#include "ed/io/data.h"
-
-#include <sstream>
 
 namespace ed
 {
@@ -12,13 +9,28 @@ namespace ed
 namespace io
 {
 
+/**
+ * @brief The JSONReader class
+ *
+ * Parses the JSON in situ: strings (keys and values) are decoded in the source buffer itself and referred to from
+ * there, and the members of each object are stored in a flat array, sorted by key. Parsing therefore only
+ * allocates to grow a few arrays.
+ */
 class JSONReader : public Reader
 {
 
 public:
 
+    // Tag for the constructor that parses in situ
+    enum InSitu { IN_SITU };
+
+    // Copies the string and parses the copy
     JSONReader(const char* s);
 
+    // Parses the (null-terminated) buffer in situ. The buffer is modified, and must stay valid during the
+    // lifetime of the reader
+    JSONReader(char* buffer, InSitu);
+
     virtual ~JSONReader();
 
     bool readGroup(const std::string& name);
@@ -34,33 +46,101 @@ public:
     bool readValue(const std::string&, int& i);
     bool readValue(const std::string&, std::string& s);
 
+    bool readValue(const std::string&, std::vector<float>& fs);
+    bool readValue(const std::string&, std::vector<int>& is);
+
     bool ok() { return error_.empty(); }
 
     std::string error() { return error_; }
 
 private:
 
-    Data data_;
-    Node n_current_;
-    std::vector<unsigned int> array_index_stack_;
+    enum ValueType
+    {
+        NULL_VALUE,
+        INT,
+        DOUBLE,
+        STRING,
+        OBJECT,
+        ARRAY
+    };
+
+    struct Value
+    {
+        unsigned char type;
 
-    std::string error_;
+        // String length
+        unsigned int length;
+
+        union
+        {
+            int i;
+            double d;
+            const char* str;
 
-    template<typename T>
-    bool value(const std::string& key, T& value) const
+            // Object or array index
+            unsigned int idx;
+        };
+    };
+
+    struct Member
     {
-        const std::map<std::string, Node>& map = data_.maps[n_current_.idx];
-        std::map<std::string, Node>::const_iterator it = map.find(key);
-        if (it == map.end())
-            return false;
+        const char* key;
+
+        unsigned int key_length;
 
-        const Variant& v = data_.values[it->second.idx];
+        Value value;
+    };
+
+    // Part of members_ (objects) or elements_ (arrays)
+    struct Range
+    {
+        unsigned int first;
+
+        unsigned int size;
+    };
+
+    struct ArrayState
+    {
+        unsigned int array;
+
+        unsigned int next;
+
+        // Object that contains the array
+        unsigned int parent;
+    };
+
+    // rapidjson handler that fills the arrays below
+    struct Handler;
+
+    static const unsigned int INVALID = static_cast<unsigned int>(-1);
+
+    // Copy of the source (if not parsed in the buffer of the caller)
+    std::string own_buffer_;
+
+    // Members of all objects; the members of one object are contiguous and sorted by key
+    std::vector<Member> members_;
+
+    // Elements of all arrays
+    std::vector<Value> elements_;
+
+    // Object 0 is the root
+    std::vector<Range> objects_;
+
+    std::vector<Range> arrays_;
+
+    // Current object (INVALID if the current position is an array, or an array item that is not an object)
+    unsigned int current_;
+
+    std::vector<unsigned int> group_stack_;
+
+    std::vector<ArrayState> array_stack_;
+
+    std::string error_;
 
-        if (!v.getValue(value))
-            return false;
+    void parse(char* buffer);
 
-        return true;
-    }
+    const Value* find(const std::string& key) const;
 
 };
 
@@ -3,7 +3,8 @@
 
 #include "ed/io/writer.h"
 
-#include <sstream>
+#include <string>
+#include <vector>
 
 namespace ed
 {
@@ -11,182 +12,92 @@ namespace ed
 namespace io
 {
 
+/**
+ * @brief The JSONWriter class
+ *
+ * Writes JSON into a byte buffer that only grows, such that writing does not allocate once the buffer is large
+ * enough. The buffer is either owned by the writer, in which case it is passed to the output sink (or stream)
+ * in chunks, or given by the caller, in which case the complete JSON string ends up in it.
+ *
+ * Numbers are written with the shortest representation that reads back to the same value; strings are escaped.
+ */
 class JSONWriter : public Writer
 {
 
 public:
 
-    JSONWriter(std::ostream& out) : Writer(out), add_comma_(false)
-    {
-        out << "{";
-    }
+    static const std::size_t DEFAULT_CHUNK_SIZE = 1 << 16;
 
-    ~JSONWriter() {}
+    // Streams the output to 'out'
+    JSONWriter(std::ostream& out);
 
-    void writeGroup(const std::string& name)
-    {
-        if (add_comma_)
-            out_ << ",";
+    // Streams the output to 'sink', every time at least 'chunk_size' bytes are written
+    JSONWriter(OutputSink& sink, std::size_t chunk_size = DEFAULT_CHUNK_SIZE);
 
-        out_ << "\"" << name << "\":{";
-        type_stack_.push_back('g');
-        add_comma_ = false;
-    }
+    // Writes the output into 'buffer' (which is cleared first, but keeps its capacity)
+    JSONWriter(std::string& buffer);
 
-    void endGroup()
-    {
-        out_ << "}";
-        if (type_stack_.empty() || type_stack_.back() != 'g')
-            std::cout << "JSONWriter::endArray(): no group to close." << std::endl;
-        else
-            type_stack_.pop_back();
-        add_comma_ = true;
-    }
+    // Passes the remaining output to the sink (but does not close open groups and arrays: see finish)
+    ~JSONWriter();
 
-    void writeValue(const std::string& key, float f)
-    {
-        if (add_comma_)
-            out_ << ",";
+    void writeGroup(const std::string& name);
+    void endGroup();
 
-        out_ << "\"" << key << "\":" << f;
-        add_comma_ = true;
-    }
+    void writeValue(const std::string& key, float f);
+    void writeValue(const std::string& key, double d);
+    void writeValue(const std::string& key, int i);
+    void writeValue(const std::string& key, const std::string& s);
 
-    void writeValue(const std::string& key, int i)
-    {
-        if (add_comma_)
-            out_ << ",";
+    void writeValue(const std::string& key, const float* fs, std::size_t size);
+    void writeValue(const std::string& key, const int* is, std::size_t size);
+    void writeValue(const std::string& key, const std::string* ss, std::size_t size);
 
-        out_ << "\"" << key << "\":" << i;
-        add_comma_ = true;
-    }
+    using Writer::writeValue;
 
-    void writeValue(const std::string& key, const std::string& s)
-    {
-        if (add_comma_)
-            out_ << ",";
+    void writeArray(const std::string& key);
+    void addArrayItem();
+    void endArrayItem();
+    void endArray();
 
-        out_ << "\"" << key << "\":\"" << s << "\"";
-        add_comma_ = true;
-    }
+    // Closes all open groups and arrays, and passes all output to the sink
+    void finish();
 
-    void writeValue(const std::string& key, double d)
-    {
-        if (add_comma_)
-            out_ << ",";
+private:
 
-        out_ << "\"" << key << "\":" << d;
-        add_comma_ = true;
-    }
+    StreamSink stream_sink_;
 
-    void writeValue(const std::string& key, const float* fs, std::size_t size)
-    {
-        if (add_comma_)
-            out_ << ",";
-
-        out_ << "\"" << key << "\":[";
-
-        if (size > 0)
-        {
-            out_ << fs[0];
-            for(unsigned int i = 1; i < size; ++i)
-                out_ << "," << fs[i];
-        }
-        out_ << "]";
-    }
+    OutputSink* sink_;
 
-    void writeValue(const std::string& key, const int* is, std::size_t size)
-    {
-        if (add_comma_)
-            out_ << ",";
-
-        out_ << "\"" << key << "\":[";
-
-        if (size > 0)
-        {
-            out_ << is[0];
-            for(unsigned int i = 1; i < size; ++i)
-                out_ << "," << is[i];
-        }
-        out_ << "]";
-    }
+    std::size_t chunk_size_;
 
-    void writeValue(const std::string& key, const std::string* ss, std::size_t size)
-    {
-        if (add_comma_)
-            out_ << ",";
-
-        out_ << "\"" << key << "\":[";
-
-        if (size > 0)
-        {
-            out_ << "\"" << ss[0] << "\"";
-            for(unsigned int i = 1; i < size; ++i)
-                out_ << "\"" << ss[i] << "\"";
-        }
-        out_ << "]";
-    }
+    std::string own_buffer_;
 
-    void writeArray(const std::string& key)
-    {
-        if (add_comma_)
-            out_ << ",";
+    std::string* buffer_;
 
-        out_ << "\"" << key << "\":[";
-        type_stack_.push_back('a');
-        add_comma_ = false;
-    }
+    bool add_comma_;
 
-    void addArrayItem()
-    {
-        if (add_comma_)
-            out_ << ",";
+    std::vector<char> type_stack_;
 
-        out_ << "{";
-        type_stack_.push_back('i');
-        add_comma_ = false;
-    }
-    void endArrayItem()
-    {
-        out_ << "}";
-        if (type_stack_.empty() || type_stack_.back() != 'i')
-            std::cout << "JSONWriter::endArray(): no array item to close." << std::endl;
-        else
-            type_stack_.pop_back();
-        add_comma_ = true;
-    }
+    void init();
 
-    void endArray()
-    {
-        out_ << "]";
-        if (type_stack_.empty() || type_stack_.back() != 'a')
-            std::cout << "JSONWriter::endArray(): no array to close." << std::endl;
-        else
-            type_stack_.pop_back();
-        add_comma_ = true;
-    }
+    void writeKey(const std::string& key);
+
+    void writeString(const std::string& s);
+
+    void writeNumber(float f);
+
+    void writeNumber(double d);
+
+    void writeNumber(int i);
 
-    void finish()
+    // Passes the buffer to the sink if it is larger than the chunk size
+    inline void flushIfFull()
     {
-        while(!type_stack_.empty())
-        {
-            char t = type_stack_.back();
-            type_stack_.pop_back();
-
-            if (t == 'g')
-                endGroup();
-            else if (t == 'i')
-                endArrayItem();
-            else if (t == 'a')
-                endArray();
-        }
-        out_ << "}";
+        if (sink_ && buffer_->size() >= chunk_size_)
+            flush();
     }
 
-private:
-
-    bool add_comma_;
-    std::vector<char> type_stack_;
+    void flush();
 
 };
 
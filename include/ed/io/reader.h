@@ -34,6 +34,10 @@ public:
     virtual bool readValue(const std::string&, int& i) = 0;
     virtual bool readValue(const std::string&, std::string& s) = 0;
 
+    // Arrays of numbers (as written by Writer::writeValue with a float or int array)
+    virtual bool readValue(const std::string&, std::vector<float>& fs) = 0;
+    virtual bool readValue(const std::string&, std::vector<int>& is) = 0;
+
     virtual bool ok() = 0;
 
     virtual std::string error() = 0;
@@ -14,12 +14,47 @@ namespace ed
 namespace io
 {
 
+/**
+ * @brief The OutputSink class
+ *
+ * Destination for the bytes produced by a writer. Writers buffer their output and pass it to the sink in chunks.
+ */
+class OutputSink
+{
+
+public:
+
+    virtual ~OutputSink() {}
+
+    virtual void write(const char* data, std::size_t size) = 0;
+
+};
+
+// ----------------------------------------------------------------------------------------------------
+
+class StreamSink : public OutputSink
+{
+
+public:
+
+    StreamSink(std::ostream& out) : out_(out) {}
+
+    void write(const char* data, std::size_t size) { out_.write(data, size); }
+
+private:
+
+    std::ostream& out_;
+
+};
+
+// ----------------------------------------------------------------------------------------------------
+
 class Writer
 {
 
 public:
 
-    Writer(std::ostream& out) : out_(out) {}
+    Writer() {}
 
     virtual ~Writer() {}
 
@@ -35,9 +70,9 @@ public:
     virtual void writeValue(const std::string& key, const int* is, std::size_t size) = 0;
     virtual void writeValue(const std::string& key, const std::string* ss, std::size_t size) = 0;
 
-    virtual void writeValue(const std::string& key, const std::vector<float>& fs) { writeValue(key, &fs[0], fs.size()); }
-    virtual void writeValue(const std::string& key, const std::vector<int>& is) { writeValue(key, &is[0], is.size()); }
-    virtual void writeValue(const std::string& key, const std::vector<std::string>& ss) { writeValue(key, &ss[0], ss.size()); }
+    virtual void writeValue(const std::string& key, const std::vector<float>& fs) { writeValue(key, fs.empty() ? 0 : &fs[0], fs.size()); }
+    virtual void writeValue(const std::string& key, const std::vector<int>& is) { writeValue(key, is.empty() ? 0 : &is[0], is.size()); }
+    virtual void writeValue(const std::string& key, const std::vector<std::string>& ss) { writeValue(key, ss.empty() ? 0 : &ss[0], ss.size()); }
 
     virtual void writeArray(const std::string& key) = 0;
     virtual void addArrayItem() = 0;
@@ -46,10 +81,6 @@ public:
 
     virtual void finish() {}
 
-protected:
-
-    std::ostream& out_;
-
 };
 
 }
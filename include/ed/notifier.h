@@ -0,0 +1,67 @@
+#ifndef ED_NOTIFIER_H_
+#define ED_NOTIFIER_H_
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/chrono.hpp>
+#include <boost/shared_ptr.hpp>
+
+namespace ed
+{
+
+/**
+ * @brief The Notifier class
+ *
+ * Lets one thread sleep until another thread signals that there is work to do (or a timeout passes),
+ * instead of polling at a fixed rate. Notifications are not lost: a notify() that happens while nobody is
+ * waiting makes the next wait() return immediately.
+ */
+class Notifier
+{
+
+public:
+
+    Notifier() : notified_(false) {}
+
+    void notify()
+    {
+        {
+            boost::lock_guard<boost::mutex> lg(mutex_);
+            notified_ = true;
+        }
+        cond_.notify_all();
+    }
+
+    // Blocks until notify() is called or timeout (in seconds) has passed. Returns true if notified.
+    bool wait(double timeout)
+    {
+        boost::chrono::steady_clock::time_point deadline = boost::chrono::steady_clock::now()
+                + boost::chrono::microseconds((long long)(timeout * 1e6));
+
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        while (!notified_)
+        {
+            if (cond_.wait_until(lock, deadline) == boost::cv_status::timeout)
+                break;
+        }
+
+        bool notified = notified_;
+        notified_ = false;
+        return notified;
+    }
+
+private:
+
+    boost::mutex mutex_;
+
+    boost::condition_variable cond_;
+
+    bool notified_;
+
+};
+
+typedef boost::shared_ptr<Notifier> NotifierPtr;
+
+}
+
+#endif
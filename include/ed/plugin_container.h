@@ -3,11 +3,15 @@
 
 #include "ed/types.h"
 #include "ed/update_request.h"
+#include "ed/notifier.h"
+#include "ed/bounded_queue.h"
 
 #include <tue/profiling/timer.h>
 #include <tue/config/configuration.h>
 
+#include <boost/atomic.hpp>
 #include <boost/thread.hpp>
+#include <boost/scoped_ptr.hpp>
 
 #include <queue>
 
@@ -39,23 +43,39 @@ public:
 
     const std::string& name() const { return name_; }
 
-    UpdateRequestConstPtr updateRequest() const
+    // What to do when a plugin produces an update request while its queue is full
+    enum UpdateQueuePolicy
     {
-        boost::lock_guard<boost::mutex> lg(mutex_update_request_);
-        return update_request_;
-    }
+        BLOCK,          // Skip process cycles until the server has taken a request from the queue
+        DROP_OLDEST,    // Discard the oldest queued request
+        COALESCE        // Merge the request with the requests that are produced until there is room again
+    };
 
-    void clearUpdateRequest()
-    {
-        boost::lock_guard<boost::mutex> lg(mutex_update_request_);
-        update_request_.reset();
-    }
+    // Called by the server. Returns false if there is no pending update request
+    bool popUpdateRequest(UpdateRequestConstPtr& req);
 
-    void setWorld(const WorldModelConstPtr& world)
-    {
-        boost::lock_guard<boost::mutex> lg(mutex_world_);
-        world_new_ = world;
-    }
+    // Called by the server after publishing a world model that contains the popped requests
+    void notifyRequestsHandled();
+
+    UpdateQueuePolicy updateQueuePolicy() const { return update_queue_policy_; }
+
+    std::size_t updateQueueSize() const { return update_queue_->size(); }
+
+    std::size_t updateQueueCapacity() const { return update_queue_->capacity(); }
+
+    // Statistics
+
+    unsigned long numPostedRequests() const { return num_posted_requests_; }
+
+    unsigned long numDroppedRequests() const { return num_dropped_requests_; }
+
+    unsigned long numCoalescedRequests() const { return num_coalesced_requests_; }
+
+    unsigned long numBlockedCycles() const { return num_blocked_cycles_; }
+
+    // The world is processed in the next cycle. Wakes up the plugin thread if it was waiting for its requests to
+    // be handled; cycles never start more often than the loop frequency
+    void setWorld(const WorldModelConstPtr& world);
 
     void setLoopFrequency(double freq) { loop_frequency_ = freq; }
 
@@ -73,6 +93,9 @@ public:
 
     bool isRunning() const { return is_running_; }
 
+    // Is notified each time this container posts a new update request
+    void setUpdateNotifier(const NotifierPtr& notifier) { update_notifier_ = notifier; }
+
 protected:
 
     class_loader::ClassLoader*  class_loader_;
@@ -90,9 +113,33 @@ protected:
 
     double loop_frequency_;
 
+    // Update requests produced by the plugin, waiting to be applied by the server
+    boost::scoped_ptr<BoundedQueue<UpdateRequestConstPtr> > update_queue_;
+
+    UpdateQueuePolicy update_queue_policy_;
+
+    // Used by the COALESCE policy: requests that did not fit in the queue, merged into one
+    UpdateRequestPtr pending_update_request_;
+
+    // Statistics, written by the plugin thread and read by the server
+
+    boost::atomic<unsigned long> num_posted_requests_;
+
+    boost::atomic<unsigned long> num_dropped_requests_;
+
+    boost::atomic<unsigned long> num_coalesced_requests_;
+
+    boost::atomic<unsigned long> num_blocked_cycles_;
+
+    // Number of requests taken from the queue by the server, of which the resulting world is not yet published
+    std::size_t num_unpublished_requests_;
+
     mutable boost::mutex mutex_update_request_;
 
-    UpdateRequestPtr update_request_;
+    // Signals that the server handled requests from the queue, published a new world, or that a stop was requested
+    boost::condition_variable cond_update_request_;
+
+    NotifierPtr update_notifier_;
 
     boost::shared_ptr<boost::thread> thread_;
 
@@ -116,6 +163,13 @@ protected:
 
     void run();
 
+    void postUpdateRequest(const UpdateRequestPtr& req);
+
+    bool pushUpdateRequest(const UpdateRequestConstPtr& req);
+
+    // Blocks until there is room in the update queue. Returns false if a stop was requested
+    bool waitForQueueSpace();
+
 
     // buffer of delta's since last process call
     std::vector<UpdateRequestConstPtr> world_deltas_;
@@ -6,6 +6,12 @@
 
 #include <geolib/datatypes.h>
 
+#include "ed/types.h"
+#include "ed/uuid.h"
+
+#include <set>
+#include <vector>
+
 namespace tue {
 namespace config {
 class Reader;
@@ -34,7 +40,17 @@ namespace ed
 
 // SERIALIZATION
 
-//void serialize(const WorldModel& wm, ed::io::Writer& w, unsigned long since_revision = 0);
+/**
+ * @brief Writes the entities that changed after 'since_revision' (as 'entities'), and the IDs of the entities
+ *        that were removed after it (as 'removed_entities', tombstones that are read back as removals). Only
+ *        the changes after 'since_revision' are visited. If the world model no longer knows all removals after
+ *        'since_revision', all entities are written completely instead, marked as 'complete': the receiver has
+ *        to remove the entities that are not listed.
+ * @param ids If not empty, only these entities are written
+ * @param property_idxs If not empty, only these properties are written
+ */
+void serialize(const WorldModel& wm, ed::io::Writer& w, unsigned long since_revision = 0,
+               const std::set<UUID>& ids = std::set<UUID>(), const std::vector<Idx>& property_idxs = std::vector<Idx>());
 
 
 //void serialize(const Entity& wm, ed::io::Writer& w, unsigned long since_revision = 0);
@@ -42,6 +58,13 @@ namespace ed
 
 bool deserialize(io::Reader &r, UpdateRequest& req);
 
+/**
+ * @brief Same, but keeps track of the entities that were received. 'ids' contains the entities that were received
+ *        before, and is updated with the listed and removed entities. If the data is a complete snapshot, the
+ *        entities in 'ids' that are not listed are removed.
+ */
+bool deserialize(io::Reader &r, UpdateRequest& req, std::set<UUID>& ids);
+
 
 void serialize(const geo::Pose3D& pose, ed::io::Writer& w);
 
@@ -57,7 +80,14 @@ void serialize(const ConvexHull& ch, ed::io::Writer& w);
 bool deserialize(ed::io::Reader& r, ConvexHull& ch);
 
 
-void serialize(const geo::Shape& s, ed::io::Writer& w);
+/**
+ * @brief Writes the mesh as flat arrays: 'vertex_array' (x, y, z per vertex) and 'triangle_array' (three vertex
+ *        indices per triangle)
+ * @param quantization If larger than 0, the vertex coordinates are rounded to multiples of this value and written
+ *        as integers (which the binary format stores compactly). Meshes of which the coordinates do not fit in an
+ *        int at this quantization are written as floats
+ */
+void serialize(const geo::Shape& s, ed::io::Writer& w, double quantization = 0);
 
 bool deserialize(ed::io::Reader& r, geo::Shape& s);
 
@@ -13,6 +13,7 @@
 #include <ed/models/model_loader.h>
 
 #include "ed/property_key_db.h"
+#include "ed/notifier.h"
 
 #include "tue/config/configuration.h"
 
@@ -50,6 +51,9 @@ public:
 
     void stepPlugins();
 
+    // Blocks until a plugin posts an update request, or timeout (in seconds) has passed
+    bool waitForUpdateRequests(double timeout) { return update_notifier_->wait(timeout); }
+
     void publishStatistics() const;
 
     const PropertyKeyDBEntry* getPropertyKeyDBEntry(const std::string& name) const
@@ -84,6 +88,9 @@ private:
     std::map<std::string, PluginContainerPtr> plugin_containers_;
     std::map<std::string, PluginContainerPtr> inactive_plugin_containers_;
 
+    //! Notified by the plugin containers when they post an update request
+    NotifierPtr update_notifier_;
+
     //! Profiling
     tue::ProfilePublisher pub_profile_;
     tue::Profiler profiler_;
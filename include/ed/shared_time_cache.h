@@ -0,0 +1,197 @@
+#ifndef ED_SHARED_TIME_CACHE_H_
+#define ED_SHARED_TIME_CACHE_H_
+
+#include "ed/time.h"
+
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+
+#include <limits>
+#include <utility>
+
+namespace ed
+{
+
+/**
+ * @brief The SharedTimeCache class
+ *
+ * Append-only history of values ordered in time, that is written by one thread while other threads read it.
+ * It is meant for histories that are shared by relations in many world model revisions (e.g., joint positions):
+ * values are added in place, and each relation only looks at the values that were inserted before it was created
+ * (its time window, see numInserted()). That way, world model revisions keep seeing the same values, and new
+ * values are published by setting a new relation, without copying the history.
+ *
+ * The writer never blocks. Values are stored in a ring buffer of twice the visible size; after writing a value,
+ * the writer publishes it by increasing the (atomic) number of values. Readers check afterwards that the writer
+ * did not overwrite any of the values they read in the meantime (otherwise they retry, as in a seqlock). The
+ * values themselves are atomics as well, such that reading a value that is being overwritten is not a data race.
+ * Values must therefore be small and trivially copyable (e.g., floats).
+ *
+ * A time window only stays readable until 'size' more values have been inserted after it. Readers that may hold
+ * on to a window for longer (e.g., world model revisions that are kept by a slow plugin) capture a Window, which
+ * also holds a copy of its last value: once the window has been overwritten, that value is returned instead.
+ */
+template<typename T>
+class SharedTimeCache : boost::noncopyable
+{
+
+public:
+
+    typedef std::pair<Time, T> value_type;
+
+    // The first 'num_inserted' values, and a copy of the last of them (if any)
+    struct Window
+    {
+        Window() : num_inserted(0), has_last(false) {}
+
+        unsigned long num_inserted;
+        bool has_last;
+        value_type last;
+    };
+
+    // 'size' is the number of (most recent) values that can be looked up
+    explicit SharedTimeCache(unsigned int size)
+        : size_(size < 1 ? 1 : size), buffer_size_(2 * size_), buffer_(new Slot[buffer_size_]), num_inserted_(0) {}
+
+    // Only one thread may insert at a time. Values must be newer than the last one; others are ignored
+    void insert(const Time& t, const T& value)
+    {
+        unsigned long n = num_inserted_.load(boost::memory_order_relaxed);
+        if (n > 0 && !(buffer_[(n - 1) % buffer_size_].t.load(boost::memory_order_relaxed) < t.seconds()))
+            return;
+
+        // Readers that see (part of) the overwritten slot must also see the number of values inserted before,
+        // such that they notice it was overwritten (as in a seqlock)
+        boost::atomic_thread_fence(boost::memory_order_release);
+
+        Slot& slot = buffer_[n % buffer_size_];
+        slot.t.store(t.seconds(), boost::memory_order_relaxed);
+        slot.value.store(value, boost::memory_order_relaxed);
+
+        num_inserted_.store(n + 1, boost::memory_order_release);
+    }
+
+    // Number of values inserted so far. Readers that pass it to getLowerUpper() do not see later values
+    unsigned long numInserted() const { return num_inserted_.load(boost::memory_order_acquire); }
+
+    /**
+     * @brief Looks up the last value at or before t (lower) and the first value after t (upper), among the (at
+     *        most 'size') most recent values of the first 'num_inserted' values. Either can be missing if t lies
+     *        outside that time window.
+     * @return false if there are no values in the time window. This is also the case if all of them have been
+     *         overwritten, which happens after 'size' more values were inserted (and the window shrinks before)
+     */
+    bool getLowerUpper(const Time& t, unsigned long num_inserted, value_type& lower, bool& has_lower,
+                       value_type& upper, bool& has_upper) const
+    {
+        for(;;)
+        {
+            unsigned long n = num_inserted_.load(boost::memory_order_acquire);
+            unsigned long end = num_inserted < n ? num_inserted : n;
+            unsigned long first = end > size_ ? end - size_ : 0;
+
+            // The value the writer inserts next overwrites value n - buffer size
+            if (n >= buffer_size_ && first <= n - buffer_size_)
+                first = n - buffer_size_ + 1;
+
+            if (first >= end)
+                return false;
+
+            // Binary search for the first value after t
+            unsigned long low = first;
+            unsigned long high = end;
+            while (low < high)
+            {
+                unsigned long mid = low + (high - low) / 2;
+                if (t.seconds() < buffer_[mid % buffer_size_].t.load(boost::memory_order_relaxed))
+                    high = mid;
+                else
+                    low = mid + 1;
+            }
+
+            has_lower = (low > first);
+            if (has_lower)
+                lower = buffer_[(low - 1) % buffer_size_].load();
+
+            has_upper = (low < end);
+            if (has_upper)
+                upper = buffer_[low % buffer_size_].load();
+
+            // The writer overwrites value i while writing value i + buffer size. If it did not get that far,
+            // everything that was read is valid
+            boost::atomic_thread_fence(boost::memory_order_acquire);
+            if (num_inserted_.load(boost::memory_order_relaxed) < first + buffer_size_)
+                return true;
+        }
+    }
+
+    // Same, among the most recent values
+    bool getLowerUpper(const Time& t, value_type& lower, bool& has_lower, value_type& upper, bool& has_upper) const
+    {
+        return getLowerUpper(t, (unsigned long)-1, lower, has_lower, upper, has_upper);
+    }
+
+    // Captures the current time window (see Window)
+    Window window() const
+    {
+        Window w;
+        w.num_inserted = numInserted();
+
+        // The last value of the window is the lower value of any time after it
+        value_type upper;
+        bool has_upper;
+        getLowerUpper(std::numeric_limits<double>::max(), w.num_inserted, w.last, w.has_last, upper, has_upper);
+
+        return w;
+    }
+
+    // Same as getLowerUpper() above, within the given window. If all values of the window have been overwritten
+    // in the meantime, its last value is used (as lower value if t lies after it, otherwise as upper value)
+    bool getLowerUpper(const Time& t, const Window& w, value_type& lower, bool& has_lower, value_type& upper,
+                       bool& has_upper) const
+    {
+        if (getLowerUpper(t, w.num_inserted, lower, has_lower, upper, has_upper))
+            return true;
+
+        if (!w.has_last)
+            return false;
+
+        has_lower = !(t < w.last.first);
+        has_upper = !has_lower;
+        if (has_lower)
+            lower = w.last;
+        else
+            upper = w.last;
+
+        return true;
+    }
+
+private:
+
+    struct Slot
+    {
+        Slot() : t(0), value(T()) {}
+
+        value_type load() const
+        {
+            return value_type(t.load(boost::memory_order_relaxed), value.load(boost::memory_order_relaxed));
+        }
+
+        boost::atomic<double> t;
+        boost::atomic<T> value;
+    };
+
+    unsigned int size_;
+
+    unsigned int buffer_size_;
+
+    boost::scoped_array<Slot> buffer_;
+
+    boost::atomic<unsigned long> num_inserted_;
+
+};
+
+} // end namespace ed
+
+#endif
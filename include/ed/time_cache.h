@@ -2,67 +2,212 @@
 #define ED_TIME_CACHE_H_
 
 #include "ed/time.h"
-#include <map>
+
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <iterator>
 
 namespace ed
 {
 
+/**
+ * @brief The TimeCache class
+ *
+ * Values ordered in time, stored in a contiguous ring buffer. Values normally arrive in time order, so inserting
+ * is O(1) (appending, and overwriting the oldest value if the maximum size is reached). Out-of-order values are
+ * inserted at their position in time, which is O(n). Looking up values around a time is a binary search.
+ *
+ * As the buffer is contiguous, copying a cache is a single allocation.
+ */
 template<typename T>
 class TimeCache
 {
 
 public:
 
-    typedef typename std::map<Time, T>::const_iterator const_iterator;
+    typedef std::pair<Time, T> value_type;
+
+    class const_iterator : public std::iterator<std::bidirectional_iterator_tag, value_type>
+    {
+
+    public:
+
+        const_iterator() : cache_(0), i_(0) {}
+
+        const_iterator(const TimeCache* cache, unsigned int i) : cache_(cache), i_(i) {}
+
+        inline const value_type& operator*() const { return cache_->at(i_); }
+
+        inline const value_type* operator->() const { return &cache_->at(i_); }
+
+        inline const_iterator& operator++() { ++i_; return *this; }
+
+        inline const_iterator operator++(int) { const_iterator tmp(*this); ++i_; return tmp; }
+
+        inline const_iterator& operator--() { --i_; return *this; }
+
+        inline const_iterator operator--(int) { const_iterator tmp(*this); --i_; return tmp; }
+
+        inline bool operator==(const const_iterator& rhs) const { return i_ == rhs.i_; }
+
+        inline bool operator!=(const const_iterator& rhs) const { return i_ != rhs.i_; }
+
+    private:
+
+        const TimeCache* cache_;
 
-    TimeCache() : max_size_(0) {}
+        unsigned int i_;
+
+    };
+
+    TimeCache() : start_(0), size_(0), max_size_(0) {}
 
     ~TimeCache() {}
 
     void insert(const Time& t, const T& value)
     {
-        if (max_size_ > 0 && cache_.size() == max_size_)
-            cache_.erase(cache_.begin());
-        cache_[t] = value;
-    }
-
-    void getLowerUpper(const Time& t, const_iterator& lower, const_iterator& upper) const
-    {
-        if (cache_.empty())
+        // Common case: the value is newer than all others
+        if (size_ == 0 || at(size_ - 1).first < t)
         {
-            lower = cache_.end();
-            upper = cache_.end();
+            append(t, value);
             return;
         }
 
-        // std::map::upper_bound returns first iterator after key
-        upper = cache_.upper_bound(t);
+        unsigned int i = upperBound(t);
 
-        if (upper == cache_.begin())
+        // Overwrite the value if the time is already present
+        if (i > 0 && !(at(i - 1).first < t))
         {
-            lower = cache_.end();
+            at(i - 1).second = value;
+            return;
         }
-        else
+
+        if (max_size_ > 0 && size_ == max_size_)
         {
-            lower = upper;
-            --lower;
+            // Remove the oldest value. If the new value is older than all others, it takes its place
+            if (i == 0)
+            {
+                at(0) = value_type(t, value);
+                return;
+            }
+
+            start_ = index(1);
+            --size_;
+            --i;
         }
+
+        // Make room at the end, then move the newer values up by one
+        append(t, value);
+        for(unsigned int j = size_ - 1; j > i; --j)
+            at(j) = at(j - 1);
+        at(i) = value_type(t, value);
+    }
+
+    void getLowerUpper(const Time& t, const_iterator& lower, const_iterator& upper) const
+    {
+        // First value after t
+        unsigned int i = upperBound(t);
+
+        upper = const_iterator(this, i);
+
+        if (i == 0)
+            lower = end();
+        else
+            lower = const_iterator(this, i - 1);
     }
 
-    inline const_iterator begin() const { return cache_.begin(); }
-    inline const_iterator end() const { return cache_.end(); }
+    inline const_iterator begin() const { return const_iterator(this, 0); }
+    inline const_iterator end() const { return const_iterator(this, size_); }
 
-    inline unsigned int size() const { return cache_.size(); }
+    inline unsigned int size() const { return size_; }
+
+    void setMaxSize(unsigned int n)
+    {
+        max_size_ = n;
 
-    void setMaxSize(unsigned int n) { max_size_ = n; }
+        // Remove the oldest values that do not fit
+        if (max_size_ > 0 && size_ > max_size_)
+        {
+            start_ = index(size_ - max_size_);
+            size_ = max_size_;
+        }
+    }
 
 private:
 
-    // Cache with items ordered in time
-    std::map<Time, T> cache_;
+    // Ring buffer. Only grows (up to the maximum size)
+    std::vector<value_type> buffer_;
+
+    // Position of the oldest value in the buffer
+    unsigned int start_;
+
+    unsigned int size_;
 
     unsigned int max_size_;
 
+    // Position in the buffer of the i-th oldest value
+    inline unsigned int index(unsigned int i) const
+    {
+        unsigned int j = start_ + i;
+        return j < buffer_.size() ? j : j - buffer_.size();
+    }
+
+    inline const value_type& at(unsigned int i) const { return buffer_[index(i)]; }
+
+    inline value_type& at(unsigned int i) { return buffer_[index(i)]; }
+
+    struct TimeLess
+    {
+        inline bool operator()(const Time& t, const value_type& v) const { return t < v.first; }
+    };
+
+    // Number of values at or before t
+    unsigned int upperBound(const Time& t) const
+    {
+        // The values are stored in at most two contiguous parts: from start_ up to the end of the buffer,
+        // and from the start of the buffer on. Binary search in the part that contains t
+        typename std::vector<value_type>::const_iterator it_begin = buffer_.begin();
+        unsigned int n1 = std::min<unsigned int>(size_, buffer_.size() - start_);
+
+        if (n1 < size_ && !(t < buffer_[0].first))
+            return n1 + (std::upper_bound(it_begin, it_begin + (size_ - n1), t, TimeLess()) - it_begin);
+
+        return std::upper_bound(it_begin + start_, it_begin + start_ + n1, t, TimeLess()) - (it_begin + start_);
+    }
+
+    // Adds the value as newest, removing the oldest if the maximum size is reached
+    void append(const Time& t, const T& value)
+    {
+        if (max_size_ > 0 && size_ >= max_size_)
+        {
+            // Use the next slot (the oldest value, unless the maximum size was lowered) and drop the oldest value
+            buffer_[index(size_)] = value_type(t, value);
+            start_ = index(1);
+            return;
+        }
+
+        if (size_ == buffer_.size())
+        {
+            // Grow the buffer, and put the values in order at the start
+            std::size_t capacity = std::max<std::size_t>(4, 2 * buffer_.size());
+            if (max_size_ > 0 && capacity > max_size_)
+                capacity = max_size_;
+
+            std::vector<value_type> buffer;
+            buffer.reserve(capacity);
+            for(unsigned int i = 0; i < size_; ++i)
+                buffer.push_back(at(i));
+            buffer.resize(capacity);
+
+            buffer_.swap(buffer);
+            start_ = 0;
+        }
+
+        buffer_[index(size_)] = value_type(t, value);
+        ++size_;
+    }
+
 };
 
 } // end namespace ed
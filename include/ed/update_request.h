@@ -9,7 +9,9 @@
 
 #include <tue/config/data_pointer.h>
 
+#include <algorithm>
 #include <map>
+#include <set>
 #include <vector>
 #include <geolib/datatypes.h>
 
@@ -25,161 +27,346 @@ class UpdateRequest
 
 public:
 
-    UpdateRequest() : is_sync_update(false) {}
+    // Bits that tell which fields of an EntityUpdate are set
+    enum Field
+    {
+        MEASUREMENTS          = 1 << 0,
+        POSE                  = 1 << 1,
+        SHAPE                 = 1 << 2,
+        CONVEX_HULLS          = 1 << 3,
+        TYPE                  = 1 << 4,
+        TYPES_ADDED           = 1 << 5,
+        TYPES_REMOVED         = 1 << 6,
+        EXISTENCE_PROBABILITY = 1 << 7,
+        LAST_UPDATE_TIMESTAMP = 1 << 8,
+        RELATIONS             = 1 << 9,
+        FLAG_ADDED            = 1 << 10,
+        FLAG_REMOVED          = 1 << 11,
+        DATA                  = 1 << 12,
+        PROPERTIES            = 1 << 13,
+        REMOVED               = 1 << 14,
+
+        // Fields that are stored in an EntityUpdateExtra, as they are less common
+        EXTRA_FIELDS = MEASUREMENTS | CONVEX_HULLS | TYPES_ADDED | TYPES_REMOVED | RELATIONS | FLAG_ADDED
+                       | FLAG_REMOVED | DATA | PROPERTIES
+    };
+
+    // Everything that is changed about one entity. The common fields are stored inline, such that a request
+    // that for instance only updates poses is one contiguous array
+    struct EntityUpdate
+    {
+        EntityUpdate(const UUID& id_) : id(id_), fields(0), updated(false), extra(NO_EXTRA),
+            existence_probability(0), last_update_timestamp(0) {}
+
+        bool has(unsigned int f) const { return (fields & f) != 0; }
+
+        // If the entity is in a world model, id.idx caches its index after the request has been applied once
+        UUID id;
+
+        // Bitmask of Fields
+        unsigned int fields;
+
+        // Whether the entity is flagged as updated (setting existence probabilities or timestamps alone does not)
+        bool updated;
+
+        // Index of the EntityUpdateExtra (if any of the EXTRA_FIELDS is set)
+        unsigned int extra;
+
+        geo::Pose3D pose;
+        geo::ShapeConstPtr shape;
+        std::string type;
+        double existence_probability;
+        double last_update_timestamp;
+    };
+
+    struct EntityUpdateExtra
+    {
+        std::vector<MeasurementConstPtr> measurements;
+        std::map<std::string, ed::MeasurementConvexHull> convex_hulls;
+        std::set<std::string> types_added;
+        std::set<std::string> types_removed;
+        std::map<UUID, RelationConstPtr> relations; // relations from this entity to others
+        std::string added_flag;
+        std::string removed_flag;
+        tue::config::DataConstPointer data;
+        std::map<Idx, Property> properties;
+    };
+
+    static const unsigned int NO_EXTRA = (unsigned int)-1;
+
+    UpdateRequest() : is_sync_update(false), num_updated_(0) {}
 
 
     // MEASUREMENTS
 
-    std::map<UUID, std::vector<MeasurementConstPtr> > measurements;
-    void addMeasurement(const UUID& id, const MeasurementConstPtr& m) { measurements[id].push_back(m); flagUpdated(id); }
+    void addMeasurement(const UUID& id, const MeasurementConstPtr& m)
+    {
+        EntityUpdate& u = entityUpdate(id);
+        extra(u).measurements.push_back(m);
+        u.fields |= MEASUREMENTS;
+        flagUpdated(u);
+    }
 
     void addMeasurements(const UUID& id, const std::vector<MeasurementConstPtr>& measurements_)
     {
         if (measurements_.empty())
             return;
 
-        std::vector<MeasurementConstPtr>& v = measurements[id];
+        EntityUpdate& u = entityUpdate(id);
+        std::vector<MeasurementConstPtr>& v = extra(u).measurements;
         v.insert(v.end(), measurements_.begin(), measurements_.end());
-
-        flagUpdated(id);
+        u.fields |= MEASUREMENTS;
+        flagUpdated(u);
     }
 
 
     // SHAPES
 
-    std::map<UUID, geo::ShapeConstPtr> shapes;
-    void setShape(const UUID& id, const geo::ShapeConstPtr& shape) { shapes[id] = shape; flagUpdated(id); }
+    void setShape(const UUID& id, const geo::ShapeConstPtr& shape)
+    {
+        EntityUpdate& u = entityUpdate(id);
+        u.shape = shape;
+        u.fields |= SHAPE;
+        flagUpdated(u);
+    }
 
 
 
 
     // CONVEX HULLS NEW
 
-    std::map<UUID, std::map<std::string, ed::MeasurementConvexHull> > convex_hulls_new;
     void setConvexHullNew(const UUID& id, const ed::ConvexHull& convex_hull, const geo::Pose3D& pose, double time, std::string source = "")
     {
-        ed::MeasurementConvexHull& m = convex_hulls_new[id][source];
+        EntityUpdate& u = entityUpdate(id);
+        ed::MeasurementConvexHull& m = extra(u).convex_hulls[source];
         m.convex_hull = convex_hull;
         m.pose = pose;
         m.timestamp = time;
-        flagUpdated(id);
+        u.fields |= CONVEX_HULLS;
+        flagUpdated(u);
     }
 
     void removeConvexHullNew(const UUID& id, const std::string& source)
     {
         // For now, signal that the convex hull must be removed by setting an empty chull
-        ed::MeasurementConvexHull& m = convex_hulls_new[id][source];
+        EntityUpdate& u = entityUpdate(id);
+        extra(u).convex_hulls[source];
+        u.fields |= CONVEX_HULLS;
     }
 
 
     // TYPES
 
-    std::map<UUID, std::string> types;
-    void setType(const UUID& id, const std::string& type) { types[id] = type; flagUpdated(id); }
+    void setType(const UUID& id, const std::string& type)
+    {
+        EntityUpdate& u = entityUpdate(id);
+        u.type = type;
+        u.fields |= TYPE;
+        flagUpdated(u);
+    }
 
-    std::map<UUID, std::set<std::string> > type_sets_added;
-    void addType(const UUID& id, const std::string& type) { type_sets_added[id].insert(type); flagUpdated(id); }
+    void addType(const UUID& id, const std::string& type)
+    {
+        EntityUpdate& u = entityUpdate(id);
+        extra(u).types_added.insert(type);
+        u.fields |= TYPES_ADDED;
+        flagUpdated(u);
+    }
 
-    std::map<UUID, std::set<std::string> > type_sets_removed;
-    void removeType(const UUID& id, const std::string& type) { type_sets_removed[id].insert(type); flagUpdated(id); }
+    void removeType(const UUID& id, const std::string& type)
+    {
+        EntityUpdate& u = entityUpdate(id);
+        extra(u).types_removed.insert(type);
+        u.fields |= TYPES_REMOVED;
+        flagUpdated(u);
+    }
 
 
     // PROBABILITY OF EXISTENCE
 
-    std::map<UUID, double> existence_probabilities;
-
-    void setExistenceProbability(const UUID& id, double prob) { existence_probabilities[id] = prob; }
+    void setExistenceProbability(const UUID& id, double prob)
+    {
+        EntityUpdate& u = entityUpdate(id);
+        u.existence_probability = prob;
+        u.fields |= EXISTENCE_PROBABILITY;
+    }
 
 
     // LAST UPDATE TIMESTAMP
 
-    std::map<UUID, double> last_update_timestamps;
-
-    void setLastUpdateTimestamp(const UUID& id, double t) { last_update_timestamps[id] = t; }
+    void setLastUpdateTimestamp(const UUID& id, double t)
+    {
+        EntityUpdate& u = entityUpdate(id);
+        u.last_update_timestamp = t;
+        u.fields |= LAST_UPDATE_TIMESTAMP;
+    }
 
 
     // POSES
 
-    std::map<UUID, geo::Pose3D> poses;
-    void setPose(const UUID& id, const geo::Pose3D& pose) { poses[id] = pose; flagUpdated(id); }
+    void setPose(const UUID& id, const geo::Pose3D& pose)
+    {
+        EntityUpdate& u = entityUpdate(id);
+        u.pose = pose;
+        u.fields |= POSE;
+        flagUpdated(u);
+    }
+
+    // Sets the poses of many entities at once ('ids' and 'poses' must be of equal size)
+    void setPoses(const std::vector<UUID>& ids, const std::vector<geo::Pose3D>& poses)
+    {
+        if (updates_.capacity() < updates_.size() + ids.size())
+            updates_.reserve(std::max(updates_.size() + ids.size(), 2 * updates_.capacity()));
+
+        for(std::size_t i = 0; i < ids.size(); ++i)
+            setPose(ids[i], poses[i]);
+    }
 
 
     // RELATIONS
 
-    std::map<UUID, std::map<UUID, RelationConstPtr> > relations;
-    void setRelation(const UUID& id1, const UUID& id2, const RelationConstPtr& r) { relations[id1][id2] = r; flagUpdated(id1); flagUpdated(id2);}
+    void setRelation(const UUID& id1, const UUID& id2, const RelationConstPtr& r)
+    {
+        // Flag the child first, as adding it may invalidate references to other entity updates
+        flagUpdated(entityUpdate(id2));
 
+        EntityUpdate& u = entityUpdate(id1);
+        extra(u).relations[id2] = r;
+        u.fields |= RELATIONS;
+        flagUpdated(u);
+    }
 
-    // DATA
 
-    std::map<UUID, tue::config::DataConstPointer> datas;
+    // DATA
 
     void addData(const UUID& id, const tue::config::DataConstPointer& data)
     {
-        std::map<UUID, tue::config::DataConstPointer>::iterator it = datas.find(id);
-        if (it == datas.end())
+        EntityUpdate& u = entityUpdate(id);
+        EntityUpdateExtra& x = extra(u);
+        if (!u.has(DATA))
         {
-            datas[id] = data;
+            x.data = data;
         }
         else
         {
             tue::config::DataPointer data_total;
-            data_total.add(it->second);
+            data_total.add(x.data);
             data_total.add(data);
 
-            it->second = data_total;
+            x.data = data_total;
         }
 
-        flagUpdated(id);
+        u.fields |= DATA;
+        flagUpdated(u);
     }
 
-    std::map<UUID, std::map<Idx, Property> > properties;
-
     template<typename T>
     void setProperty(const UUID& id, const PropertyKey<T>& key, const T& value)
     {
         if (!key.valid())
             return;
 
-        Property& p = properties[id][key.idx];
+        EntityUpdate& u = entityUpdate(id);
+        Property& p = extra(u).properties[key.idx];
         p.entry = key.entry;
         p.value = value;
-        flagUpdated(id);
+        u.fields |= PROPERTIES;
+        flagUpdated(u);
     }
 
     void setProperty(const UUID& id, const PropertyKeyDBEntry* entry, const ed::Variant& v)
     {
-        Property& p = properties[id][entry->idx];
+        EntityUpdate& u = entityUpdate(id);
+        Property& p = extra(u).properties[entry->idx];
         p.entry = entry;
         p.value = v;
-        flagUpdated(id);
+        u.fields |= PROPERTIES;
+        flagUpdated(u);
     }
 
 
     // REMOVED ENTITIES
 
-    std::set<UUID> removed_entities;
-
-    void removeEntity(const UUID& id) { removed_entities.insert(id); flagUpdated(id); }
+    void removeEntity(const UUID& id)
+    {
+        EntityUpdate& u = entityUpdate(id);
+        u.fields |= REMOVED;
+        flagUpdated(u);
+    }
 
 
     // FLAGS
 
-    std::map<ed::UUID, std::string> added_flags;
+    void setFlag(const UUID& id, const std::string& flag)
+    {
+        EntityUpdate& u = entityUpdate(id);
+        extra(u).added_flag = flag;
+        u.fields |= FLAG_ADDED;
+        flagUpdated(u);
+    }
 
-    void setFlag(const UUID& id, const std::string& flag) { added_flags[id] = flag; flagUpdated(id); }
+    void removeFlag(const UUID& id, const std::string& flag)
+    {
+        EntityUpdate& u = entityUpdate(id);
+        extra(u).removed_flag = flag;
+        u.fields |= FLAG_REMOVED;
+        flagUpdated(u);
+    }
 
-    std::map<ed::UUID, std::string> removed_flags;
 
-    void removeFlag(const UUID& id, const std::string& flag) { removed_flags[id] = flag; flagUpdated(id); }
 
+    // UPDATED (AND REMOVED) ENTITIES
 
+    bool empty() const { return num_updated_ == 0; }
 
-    // UPDATED (AND REMOVED) ENTITIES
+    bool updated(const UUID& id) const
+    {
+        const EntityUpdate* u = find(id);
+        return u && u->updated;
+    }
+
+
+    // READING
+
+    typedef std::vector<EntityUpdate>::const_iterator const_iterator;
+
+    // Iterates over the entity updates, in the order in which the entities were first touched
+    const_iterator begin() const { return updates_.begin(); }
+
+    const_iterator end() const { return updates_.end(); }
+
+    std::size_t size() const { return updates_.size(); }
+
+    // Returns 0 if the entity is not touched by this request
+    const EntityUpdate* find(const UUID& id) const;
 
-    std::set<UUID> updated_entities;
+    // Only valid if u has one of the EXTRA_FIELDS
+    const EntityUpdateExtra& extra(const EntityUpdate& u) const { return extras_[u.extra]; }
 
-    bool empty() const { return updated_entities.empty(); }
+
+    // READING (COMPATIBILITY)
+
+    // The fields in the form of the public maps of earlier versions, for code that reads requests (for instance
+    // PluginInput::deltas). They are built together on the first call (which may be from any thread) and kept until
+    // the request is modified, so the returned references stay valid until then. Prefer begin(), end() and find()
+    // in new code
+
+    const std::map<UUID, std::vector<MeasurementConstPtr> >& measurements() const;
+    const std::map<UUID, geo::ShapeConstPtr>& shapes() const;
+    const std::map<UUID, std::map<std::string, ed::MeasurementConvexHull> >& convex_hulls_new() const;
+    const std::map<UUID, std::string>& types() const;
+    const std::map<UUID, std::set<std::string> >& type_sets_added() const;
+    const std::map<UUID, std::set<std::string> >& type_sets_removed() const;
+    const std::map<UUID, double>& existence_probabilities() const;
+    const std::map<UUID, double>& last_update_timestamps() const;
+    const std::map<UUID, geo::Pose3D>& poses() const;
+    const std::map<UUID, std::map<UUID, RelationConstPtr> >& relations() const;
+    const std::map<UUID, tue::config::DataConstPointer>& datas() const;
+    const std::map<UUID, std::map<Idx, Property> >& properties() const;
+    const std::set<UUID>& removed_entities() const;
+    const std::map<UUID, std::string>& added_flags() const;
+    const std::map<UUID, std::string>& removed_flags() const;
+    const std::set<UUID>& updated_entities() const;
 
 
     // Is true if the update was created for synchronization only (used by ed_cloud)
@@ -189,12 +376,96 @@ public:
     void setSyncUpdate(bool b = true) { is_sync_update = b; }
 
 
+    // MERGING
+
+    /**
+     * @brief Merges 'other' into this request, such that applying the result has the same effect as applying
+     *        this request followed by 'other'. Fields that are set in both requests take the value of 'other'
+     *        (last writer wins); measurements are appended and type and flag additions and removals cancel
+     *        each other out.
+     * @return false (and leaves this request untouched) if the combination can not be expressed in a single
+     *         request, i.e., if 'other' updates an entity that this request removes, if both requests add
+     *         (or remove) a different flag on the same entity, or if 'other' sets data, or sets or removes a
+     *         type, of an entity of which this request sets data (as the type in the entity data is set each
+     *         time data is applied).
+     */
+    bool merge(const UpdateRequest& other);
+
+
 private:
 
-    void flagUpdated(const ed::UUID& id) { updated_entities.insert(id); }
+    std::vector<EntityUpdate> updates_;
+
+    std::vector<EntityUpdateExtra> extras_;
+
+    // Open addressing hash table (linear probing) on UUID::hash(), containing indices in updates_ plus one
+    // (zero means empty). Its size is a power of two, and at least twice the number of entity updates
+    std::vector<unsigned int> index_;
+
+    unsigned int num_updated_;
+
+    // The compatibility maps (see above)
+    struct CompatibilityMaps;
+
+    // Copies start without maps, such that copying never reads maps that another thread is building
+    struct CompatibilityMapsPtr
+    {
+        CompatibilityMapsPtr() {}
+        CompatibilityMapsPtr(const CompatibilityMapsPtr&) {}
+        CompatibilityMapsPtr& operator=(const CompatibilityMapsPtr&) { ptr.reset(); return *this; }
+
+        boost::shared_ptr<const CompatibilityMaps> ptr;
+    };
+
+    mutable CompatibilityMapsPtr compatibility_maps_;
+
+    const CompatibilityMaps& compatibilityMaps() const;
+
+    // Returns the update for the given entity, adds one if it does not exist yet. The returned reference is
+    // invalidated by the next call. The caller modifies the update, so the compatibility maps are outdated
+    EntityUpdate& entityUpdate(const UUID& id)
+    {
+        compatibility_maps_.ptr.reset();
+
+        // Setters are often called multiple times in a row for the same entity
+        if (!updates_.empty() && updates_.back().id == id)
+            return updates_.back();
+
+        return findOrAdd(id);
+    }
+
+    EntityUpdate& findOrAdd(const UUID& id);
+
+    void rebuildIndex(std::size_t capacity);
+
+    EntityUpdateExtra& extra(EntityUpdate& u)
+    {
+        if (u.extra == NO_EXTRA)
+        {
+            u.extra = extras_.size();
+            extras_.push_back(EntityUpdateExtra());
+        }
+        return extras_[u.extra];
+    }
+
+    void flagUpdated(EntityUpdate& u)
+    {
+        if (!u.updated)
+        {
+            u.updated = true;
+            ++num_updated_;
+        }
+    }
 
 };
 
+/**
+ * @brief Merges a sequence of update requests into as few requests as possible (normally one), keeping the
+ *        effect of applying them in order. A new batch is started whenever UpdateRequest::merge refuses.
+ *        Requests are only copied if they need to be merged with others.
+ */
+void mergeUpdateRequests(const std::vector<UpdateRequestConstPtr>& requests, std::vector<UpdateRequestConstPtr>& batches);
+
 }
 
 #endif
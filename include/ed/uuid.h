@@ -12,20 +12,35 @@ class UUID
 
 public:
 
-    UUID() : idx(INVALID_IDX) {}
-    UUID(const char* s) : id_(s), idx(INVALID_IDX) {}
-    UUID(const std::string& s) : id_(s), idx(INVALID_IDX) {}
+    UUID() : hash_(calculateHash(std::string())), idx(INVALID_IDX) {}
+    UUID(const char* s) : id_(s), hash_(calculateHash(id_)), idx(INVALID_IDX) {}
+    UUID(const std::string& s) : id_(s), hash_(calculateHash(id_)), idx(INVALID_IDX) {}
 
     inline bool operator<(const UUID& rhs) const { return id_ < rhs.id_; }
 
-    inline bool operator==(const UUID& rhs) const { return id_ == rhs.id_; }
+    inline bool operator==(const UUID& rhs) const { return hash_ == rhs.hash_ && id_ == rhs.id_; }
 
-    inline bool operator!=(const UUID& rhs) const { return id_ != rhs.id_; }
+    inline bool operator!=(const UUID& rhs) const { return !(*this == rhs); }
 
     inline const char* c_str() const { return id_.c_str(); }
 
     inline const std::string& str() const { return id_; }
 
+    // Hash of the id string, calculated once on construction
+    inline uint64_t hash() const { return hash_; }
+
+    // 64-bit FNV-1a
+    static uint64_t calculateHash(const std::string& s)
+    {
+        uint64_t h = 14695981039346656037ULL;
+        for(std::string::const_iterator it = s.begin(); it != s.end(); ++it)
+        {
+            h ^= (unsigned char)*it;
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
     friend std::ostream& operator<< (std::ostream& out, const UUID& d)
     {
         out << d.id_;
@@ -36,6 +51,8 @@ private:
 
     std::string id_;
 
+    uint64_t hash_;
+
 public:
 
     mutable Idx idx;
@@ -3,6 +3,10 @@
 
 #include "ed/types.h"
 #include "ed/time.h"
+#include "ed/world_model/entity_index.h"
+#include "ed/world_model/chunked_vector.h"
+#include "ed/world_model/revision_log.h"
+#include "ed/world_model/label_index.h"
 
 #include <geolib/datatypes.h>
 
@@ -14,6 +18,12 @@ namespace ed
 class PropertyKeyDB;
 class PropertyKeyDBEntry;
 
+namespace world_model
+{
+class TransformTree;
+class SpatialIndex;
+}
+
 // ----------------------------------------------------------------------------------------------------
 
 class WorldModel
@@ -21,21 +31,49 @@ class WorldModel
 
 public:
 
+    typedef world_model::ChunkedVector<EntityConstPtr> EntityVector;
+    typedef world_model::ChunkedVector<RelationConstPtr> RelationVector;
+    typedef world_model::ChunkedVector<unsigned long> RevisionVector;
+
+    // Entity that was changed (or removed) in the given revision, and the fields that changed (UpdateRequest::Field bits)
+    struct EntityChange
+    {
+        EntityChange() : revision(0), idx(INVALID_IDX), fields(0) {}
+        EntityChange(unsigned long revision_, Idx idx_, unsigned int fields_) : revision(revision_), idx(idx_), fields(fields_) {}
+
+        unsigned long revision;
+        Idx idx;
+        unsigned int fields;
+    };
+
+    // Entity that was removed in the given revision
+    struct RemovedEntity
+    {
+        RemovedEntity() : revision(0) {}
+        RemovedEntity(unsigned long revision_, const UUID& id_) : revision(revision_), id(id_) {}
+
+        unsigned long revision;
+        UUID id;
+    };
+
+    typedef world_model::RevisionLog<EntityChange> ChangeLog;
+    typedef world_model::RevisionLog<RemovedEntity> RemovedEntityLog;
+
     class EntityIterator : public std::iterator<std::forward_iterator_tag, EntityConstPtr>
     {
 
     public:
 
-        EntityIterator(const std::vector<EntityConstPtr>& v) : it_(v.begin()), it_end_(v.end())
+        EntityIterator(const EntityVector& v) : it_(v.begin()), it_end_(v.end())
         {
             // Skip possible zero-entities (deleted entities) at the beginning
             while(it_ != it_end_ && !(*it_))
                 ++it_;
         }
 
-        EntityIterator(const EntityIterator& it) : it_(it.it_) {}
+        EntityIterator(const EntityIterator& it) : it_(it.it_), it_end_(it.it_end_) {}
 
-        EntityIterator(const std::vector<EntityConstPtr>::const_iterator& it) : it_(it) {}
+        EntityIterator(const EntityVector::const_iterator& it) : it_(it) {}
 
         EntityIterator& operator++()
         {
@@ -54,8 +92,8 @@ public:
 
     private:
 
-        std::vector<EntityConstPtr>::const_iterator it_;
-        std::vector<EntityConstPtr>::const_iterator it_end_;
+        EntityVector::const_iterator it_;
+        EntityVector::const_iterator it_end_;
 
     };
 
@@ -90,17 +128,70 @@ public:
 
     bool calculateTransform(const UUID& source, const UUID& target, const Time& time, geo::Pose3D& tf) const;
 
+    // Calculates the transforms of all targets relative to the source, as calculateTransform() does. Paths shared by
+    // multiple targets are calculated only once. valid[i] tells if the transform of targets[i] could be calculated.
+    // Returns true if all transforms could be calculated
+    bool calculateTransforms(const UUID& source, const std::vector<UUID>& targets, const Time& time,
+                             std::vector<geo::Pose3D>& tfs, std::vector<bool>& valid) const;
+
     /// Warning: the return vector may return null-pointers
-    const std::vector<EntityConstPtr>& entities() const { return entities_; }
+    const EntityVector& entities() const { return entities_; }
 
     /// Warning: the return vector may return null-pointers
-    const std::vector<RelationConstPtr>& relations() const { return relations_; }
+    const RelationVector& relations() const { return relations_; }
 
     unsigned long revision() const { return revision_; }
 
-    const std::vector<unsigned long>& entity_revisions() const { return entity_revisions_; }
+    const RevisionVector& entity_revisions() const { return entity_revisions_; }
+
+    const RevisionVector& entity_shape_revisions() const { return entity_shape_revisions_; }
+
+    // The most recent entity changes, ordered by revision. An entity is listed once per revision in which it changed
+    const ChangeLog& entity_changes() const { return entity_changes_; }
+
+    const RemovedEntityLog& removed_entities() const { return removed_entities_; }
+
+    // Adds the entities that changed after the given revision, ordered by index. Each entity is listed once, with
+    // the fields that changed in all those revisions combined (an entity pointer that is now null means the entity
+    // was removed). Only visits the changes after the given revision. Returns false (and adds nothing) if the
+    // change log does not reach back to that revision; the caller then has to compare entity_revisions() instead
+    bool changesSince(unsigned long revision, std::vector<EntityChange>& changes) const;
+
+    // Adds the IDs of all entities that were removed after the given revision, and that do not exist (again).
+    // Returns false if the log of removed entities does not reach back to that revision (then only the removals
+    // that are still in the log are added)
+    bool removedEntities(unsigned long since_revision, std::vector<UUID>& ids) const;
+
+    // Maximum number of entity changes (and removed entities) that is kept. Older changes are dropped
+    void setChangeLogSize(std::size_t n);
+
+    // World model revision in which each relation was last set
+    const RevisionVector& relation_revisions() const { return relation_revisions_; }
+
+    // Changes when relations are added or entities are removed or replaced, i.e., when the structure of the
+    // relation graph may have changed (not when only the transforms of existing relations change)
+    unsigned long relationsRevision() const { return relations_revision_; }
+
+    // Spatial queries. The footprint of an entity is the axis-aligned bounding box (in the xy-plane) of its position
+    // and convex hull; entities without a pose are never found. The queries use an index that is built on the first
+    // query, and is brought up to date on the first query after entities changed, so they take time proportional to
+    // the number of entities found (and changed), not to the number of entities in the world model.
+
+    // Adds the indices of the entities whose footprint intersects the box
+    void queryBox(const geo::Vec2& min, const geo::Vec2& max, std::vector<Idx>& idxs) const;
+
+    // Adds the indices of the entities whose footprint lies (partly) within the radius of the center
+    void queryRadius(const geo::Vec2& center, double radius, std::vector<Idx>& idxs) const;
 
-    const std::vector<unsigned long>& entity_shape_revisions() const { return entity_shape_revisions_; }
+    // Adds the indices of the entities whose convex hull contains the point (in the xy-plane)
+    void queryPoint(const geo::Vec2& p, std::vector<Idx>& idxs) const;
+
+    // Entities that have the given type (in their set of types) or flag, in order of index. Iterating the set
+    // yields entity indices. The sets are kept up to date on every update, and remain valid as long as this world
+    // model is not modified
+    const world_model::IdxSet& entitiesWithType(const std::string& type) const { return type_index_.entities(type); }
+
+    const world_model::IdxSet& entitiesWithFlag(const std::string& flag) const { return flag_index_.entities(flag); }
 
     const PropertyKeyDBEntry* getPropertyInfo(const std::string& name) const;
 
@@ -108,26 +199,87 @@ private:
 
     unsigned long revision_;
 
-    std::map<UUID, Idx> entity_map_;
+    world_model::EntityIndex entity_map_;
+
+    // All containers below share their (unmodified) chunks with copies of this world model,
+    // so creating a new world model revision only costs O(changed entities)
+
+    EntityVector entities_;
 
-    std::vector<EntityConstPtr> entities_;
+    RevisionVector entity_revisions_;
 
-    std::vector<unsigned long> entity_revisions_;
+    RevisionVector entity_shape_revisions_;
 
-    std::vector<unsigned long> entity_shape_revisions_;
+    ChangeLog entity_changes_;
+
+    // Sequence number in entity_changes_ of the last change of each entity
+    RevisionVector entity_last_changes_;
+
+    RemovedEntityLog removed_entities_;
 
     std::queue<Idx> entity_empty_spots_;
 
-    std::vector<RelationConstPtr> relations_;
+    // Inverted indices from types and flags to the entities that have them
+    world_model::LabelIndex type_index_;
+
+    world_model::LabelIndex flag_index_;
+
+    RelationVector relations_;
+
+    RevisionVector relation_revisions_;
 
     const PropertyKeyDB* property_info_db_;
 
+    // Revision of the relation graph: changes when relations are added or entities are removed or replaced
+    unsigned long relations_revision_;
+
+    // Pointer to data derived from this world model (such as the transform tree) that is built on demand by const
+    // methods and shared by copies of this world model. Copying uses an atomic load, as another thread may be
+    // storing new data in the world model that is copied
+    template<typename T>
+    struct SharedDerivedPtr
+    {
+        SharedDerivedPtr() {}
+
+        SharedDerivedPtr(const SharedDerivedPtr& other) : ptr(boost::atomic_load(&other.ptr)) {}
+
+        SharedDerivedPtr& operator=(const SharedDerivedPtr& other)
+        {
+            boost::atomic_store(&ptr, boost::atomic_load(&other.ptr));
+            return *this;
+        }
+
+        boost::shared_ptr<const T> ptr;
+    };
+
+    // Spanning tree of the relation graph, built on the first transform calculation after the relation graph
+    // changed. Shared by copies of this world model, until they change their relations
+    mutable SharedDerivedPtr<world_model::TransformTree> transform_tree_;
+
+    // Spatial index of the entities, brought up to date on the first query after entities changed. A copy of this
+    // world model starts from the index of the original, so it only has to update the entities that changed since
+    mutable SharedDerivedPtr<world_model::SpatialIndex> spatial_index_;
+
+    boost::shared_ptr<const world_model::SpatialIndex> spatialIndex() const;
+
+    boost::shared_ptr<const world_model::TransformTree> transformTree() const;
+
+    // Calculates the transform of entity 'idx' relative to its parent in the transform tree
+    bool calculateParentTransform(const world_model::TransformTree& tree, Idx idx, const Time& time, geo::Pose3D& tf) const;
+
     Idx addRelation(const RelationConstPtr& r);
 
-    EntityPtr getOrAddEntity(const UUID& id, std::map<UUID, EntityPtr>& new_entities);
+    // Creates a copy of the entity with the given id (or a new entity) that can be modified in this revision
+    EntityPtr getOrAddEntity(const UUID& id, Idx& idx);
 
     Idx addNewEntity(const EntityConstPtr& e);
 
+    // Updates the type and flag indices for entity 'idx' changing from e_old to e_new (either may be null)
+    void updateLabelIndices(Idx idx, const Entity* e_old, const Entity* e_new);
+
+    // Marks the given fields of the entity as changed in this revision
+    void setEntityRevision(Idx idx, unsigned int fields);
+
 
 };
 
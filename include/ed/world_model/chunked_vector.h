@@ -0,0 +1,167 @@
+#ifndef ED_WORLD_MODEL_CHUNKED_VECTOR_H_
+#define ED_WORLD_MODEL_CHUNKED_VECTOR_H_
+
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+
+#include <vector>
+#include <iterator>
+
+namespace ed
+{
+namespace world_model
+{
+
+/**
+ * @brief The ChunkedVector class
+ *
+ * Vector that stores its items in fixed-size chunks which are shared (copy-on-write) between copies of the
+ * vector. Copying a ChunkedVector only copies the chunk pointers, and modifying an item only copies the chunk
+ * it lives in if that chunk is still shared with another copy. This makes world model snapshots cheap: a new
+ * snapshot costs O(size / CHUNK_SIZE + changed items) instead of O(size).
+ *
+ * Modifying a copy is not thread-safe, but reading other copies while one copy is being modified is.
+ */
+template<typename T, unsigned int CHUNK_BITS = 8>
+class ChunkedVector
+{
+
+    typedef std::vector<T> Chunk;
+    typedef boost::shared_ptr<Chunk> ChunkPtr;
+
+public:
+
+    enum { CHUNK_SIZE = 1 << CHUNK_BITS };
+
+    class const_iterator
+    {
+
+    public:
+
+        typedef std::random_access_iterator_tag iterator_category;
+        typedef T value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const T* pointer;
+        typedef const T& reference;
+
+        const_iterator() : v_(0), i_(0) {}
+
+        const_iterator(const ChunkedVector* v, std::size_t i) : v_(v), i_(i) {}
+
+        const T& operator*() const { return (*v_)[i_]; }
+
+        const T* operator->() const { return &(*v_)[i_]; }
+
+        const_iterator& operator++() { ++i_; return *this; }
+
+        const_iterator operator++(int) { const_iterator tmp(*this); ++i_; return tmp; }
+
+        const_iterator& operator--() { --i_; return *this; }
+
+        const_iterator& operator+=(std::ptrdiff_t n) { i_ += n; return *this; }
+
+        const_iterator operator+(std::ptrdiff_t n) const { return const_iterator(v_, i_ + n); }
+
+        std::ptrdiff_t operator-(const const_iterator& rhs) const { return (std::ptrdiff_t)i_ - (std::ptrdiff_t)rhs.i_; }
+
+        bool operator==(const const_iterator& rhs) const { return i_ == rhs.i_; }
+
+        bool operator!=(const const_iterator& rhs) const { return i_ != rhs.i_; }
+
+        bool operator<(const const_iterator& rhs) const { return i_ < rhs.i_; }
+
+        std::size_t index() const { return i_; }
+
+    private:
+
+        const ChunkedVector* v_;
+        std::size_t i_;
+
+    };
+
+    ChunkedVector() : size_(0) {}
+
+    ChunkedVector(std::size_t n, const T& value = T()) : size_(0) { resize(n, value); }
+
+    inline std::size_t size() const { return size_; }
+
+    inline bool empty() const { return size_ == 0; }
+
+    inline const T& operator[](std::size_t i) const { return (*chunks_[i >> CHUNK_BITS])[i & (CHUNK_SIZE - 1)]; }
+
+    inline const T& back() const { return (*this)[size_ - 1]; }
+
+    inline const_iterator begin() const { return const_iterator(this, 0); }
+
+    inline const_iterator end() const { return const_iterator(this, size_); }
+
+    // Returns a writable reference to item i. Copies the chunk the item lives in if it is shared
+    T& modify(std::size_t i)
+    {
+        ChunkPtr& chunk = chunks_[i >> CHUNK_BITS];
+        if (!chunk.unique())
+            chunk = boost::make_shared<Chunk>(*chunk);
+        return (*chunk)[i & (CHUNK_SIZE - 1)];
+    }
+
+    inline void set(std::size_t i, const T& value) { modify(i) = value; }
+
+    void push_back(const T& value)
+    {
+        if ((size_ & (CHUNK_SIZE - 1)) == 0)
+            chunks_.push_back(boost::make_shared<Chunk>((std::size_t)CHUNK_SIZE));
+
+        ++size_;
+        modify(size_ - 1) = value;
+    }
+
+    void resize(std::size_t n, const T& value = T())
+    {
+        if (n < size_)
+        {
+            // Reset the items that are no longer used, such that they do not keep resources alive
+            for(std::size_t i = n; i < size_ && (i & (CHUNK_SIZE - 1)) != 0; ++i)
+                modify(i) = T();
+
+            chunks_.resize((n + CHUNK_SIZE - 1) >> CHUNK_BITS);
+            size_ = n;
+        }
+        else
+        {
+            while(size_ < n)
+                push_back(value);
+        }
+    }
+
+    void clear()
+    {
+        chunks_.clear();
+        size_ = 0;
+    }
+
+    // Removes the first n items. Only whole chunks can be removed, so n must be a multiple of CHUNK_SIZE
+    void eraseFront(std::size_t n)
+    {
+        chunks_.erase(chunks_.begin(), chunks_.begin() + (n >> CHUNK_BITS));
+        size_ -= n;
+    }
+
+    void swap(ChunkedVector& other)
+    {
+        chunks_.swap(other.chunks_);
+        std::swap(size_, other.size_);
+    }
+
+private:
+
+    std::vector<ChunkPtr> chunks_;
+
+    std::size_t size_;
+
+};
+
+} // end namespace world_model
+
+} // end namespace ed
+
+#endif
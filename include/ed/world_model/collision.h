@@ -0,0 +1,40 @@
+#ifndef ED_WORLD_MODEL_COLLISION_H_
+#define ED_WORLD_MODEL_COLLISION_H_
+
+#include "ed/types.h"
+#include "ed/convex_hull.h"
+
+#include <vector>
+
+namespace ed
+{
+
+class WorldModel;
+
+namespace world_model
+{
+
+// Collision queries on the convex hulls of the entities in a world model. Two convex hulls collide if
+// convex_hull::collide returns true in both directions, i.e., if none of the normals of either hull separates
+// them by more than the padding (and they overlap in z, with padding). Entities without a pose or without a
+// convex hull never collide.
+
+// Adds the indices of the entities that collide with the convex hull at the given position. Candidates are found
+// with the spatial index of the world model (WorldModel::queryBox)
+void collideAll(const WorldModel& wm, const ConvexHull& chull, const geo::Vector3& pos, float xy_padding,
+                float z_padding, std::vector<Idx>& idxs);
+
+// Adds all pairs of entities that collide with each other (with the lowest index first). Candidate pairs are found
+// by sweep and prune over the bounding boxes of the convex hulls
+void collidingPairs(const WorldModel& wm, float xy_padding, float z_padding, std::vector<std::pair<Idx, Idx> >& pairs);
+
+// Distance by which the bounding box of the convex hull must be grown, such that it contains every convex hull that
+// collides with it with the given padding. This is more than the padding, as it is applied per normal: at a sharp
+// corner the allowed distance is larger
+float collisionMargin(const ConvexHull& chull, float xy_padding);
+
+} // end namespace world_model
+
+} // end namespace ed
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef ED_WORLD_MODEL_ENTITY_INDEX_H_
+#define ED_WORLD_MODEL_ENTITY_INDEX_H_
+
+#include "ed/types.h"
+#include "ed/uuid.h"
+#include "ed/world_model/chunked_vector.h"
+
+namespace ed
+{
+namespace world_model
+{
+
+/**
+ * @brief The EntityIndex class
+ *
+ * Maps entity IDs to entity indices using an open-addressing hash table with linear probing. The hash of the ID
+ * is cached inside the UUID, so a lookup only needs string comparisons for (very rare) hash collisions.
+ * The slots are stored in a ChunkedVector, so copies of the index share all chunks that were not modified.
+ */
+class EntityIndex
+{
+
+public:
+
+    EntityIndex();
+
+    bool find(const UUID& id, Idx& idx) const;
+
+    // Inserts the id, or overwrites the index if the id is already present
+    void insert(const UUID& id, Idx idx);
+
+    bool erase(const UUID& id);
+
+    void clear();
+
+    inline std::size_t size() const { return size_; }
+
+private:
+
+    enum SlotState
+    {
+        EMPTY,
+        OCCUPIED,
+        DELETED
+    };
+
+    struct Slot
+    {
+        Slot() : idx(INVALID_IDX), state(EMPTY) {}
+        UUID id;
+        Idx idx;
+        unsigned char state;
+    };
+
+    // Size is always a power of two (or zero)
+    ChunkedVector<Slot> slots_;
+
+    // Number of occupied slots
+    std::size_t size_;
+
+    // Number of deleted slots (tombstones)
+    std::size_t num_deleted_;
+
+    // Returns the slot containing id, or slots_.size() if not found
+    std::size_t findSlot(const UUID& id) const;
+
+    void rehash(std::size_t capacity);
+
+};
+
+} // end namespace world_model
+
+} // end namespace ed
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef ED_WORLD_MODEL_IDX_SET_H_
+#define ED_WORLD_MODEL_IDX_SET_H_
+
+#include "ed/types.h"
+#include "ed/world_model/chunked_vector.h"
+
+#include <boost/cstdint.hpp>
+
+#include <iterator>
+
+namespace ed
+{
+namespace world_model
+{
+
+/**
+ * @brief The IdxSet class
+ *
+ * Set of entity indices, stored as a bitset. The bits are stored in a ChunkedVector, so copies of the set share
+ * all chunks that were not modified. Iterating visits the indices in increasing order, and skips 64 indices
+ * at a time where none are in the set.
+ */
+class IdxSet
+{
+
+public:
+
+    class const_iterator : public std::iterator<std::forward_iterator_tag, Idx>
+    {
+
+    public:
+
+        const_iterator() : s_(0), idx_(0) {}
+
+        const_iterator(const IdxSet* s, Idx idx) : s_(s), idx_(idx) {}
+
+        inline Idx operator*() const { return idx_; }
+
+        inline const_iterator& operator++() { idx_ = s_->next(idx_ + 1); return *this; }
+
+        inline const_iterator operator++(int) { const_iterator tmp(*this); operator++(); return tmp; }
+
+        inline bool operator==(const const_iterator& rhs) const { return idx_ == rhs.idx_; }
+
+        inline bool operator!=(const const_iterator& rhs) const { return idx_ != rhs.idx_; }
+
+    private:
+
+        const IdxSet* s_;
+        Idx idx_;
+
+    };
+
+    IdxSet() : size_(0) {}
+
+    inline bool contains(Idx idx) const
+    {
+        std::size_t w = idx >> 6;
+        return w < words_.size() && ((words_[w] >> (idx & 63)) & 1);
+    }
+
+    void insert(Idx idx)
+    {
+        std::size_t w = idx >> 6;
+        while (words_.size() <= w)
+            words_.push_back(0);
+
+        boost::uint64_t bit = boost::uint64_t(1) << (idx & 63);
+        if (!(words_[w] & bit))
+        {
+            words_.modify(w) |= bit;
+            ++size_;
+        }
+    }
+
+    void erase(Idx idx)
+    {
+        if (!contains(idx))
+            return;
+
+        words_.modify(idx >> 6) &= ~(boost::uint64_t(1) << (idx & 63));
+        --size_;
+    }
+
+    inline std::size_t size() const { return size_; }
+
+    inline bool empty() const { return size_ == 0; }
+
+    inline const_iterator begin() const { return const_iterator(this, next(0)); }
+
+    inline const_iterator end() const { return const_iterator(this, words_.size() << 6); }
+
+private:
+
+    ChunkedVector<boost::uint64_t> words_;
+
+    std::size_t size_;
+
+    // Returns the first index in the set that is not smaller than idx, or the end index if there is none
+    Idx next(Idx idx) const
+    {
+        std::size_t w = idx >> 6;
+        if (w >= words_.size())
+            return words_.size() << 6;
+
+        boost::uint64_t bits = words_[w] & (~boost::uint64_t(0) << (idx & 63));
+        while (bits == 0)
+        {
+            if (++w == words_.size())
+                return words_.size() << 6;
+            bits = words_[w];
+        }
+
+        return (w << 6) + __builtin_ctzll(bits);
+    }
+
+};
+
+} // end namespace world_model
+
+} // end namespace ed
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef ED_WORLD_MODEL_LABEL_INDEX_H_
+#define ED_WORLD_MODEL_LABEL_INDEX_H_
+
+#include "ed/world_model/idx_set.h"
+
+#include <boost/shared_ptr.hpp>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace ed
+{
+namespace world_model
+{
+
+/**
+ * @brief The LabelIndex class
+ *
+ * Inverted index from labels (such as entity types or flags) to the entities that have them. Labels are interned:
+ * each label that is ever added gets an id, and the entities with that label are stored in an IdxSet under this
+ * id. The label ids are shared by all copies of the index, and the sets share their unmodified chunks, so copying
+ * the index (for every world model snapshot) only costs O(number of labels).
+ */
+class LabelIndex
+{
+
+public:
+
+    LabelIndex();
+
+    // Returns the entities that have the label (an empty set if the label is unknown)
+    const IdxSet& entities(const std::string& label) const;
+
+    // Same, for a label id (see findId)
+    const IdxSet& entities(unsigned int id) const { return sets_[id]; }
+
+    // Updates the labels of entity 'idx' from old_labels to new_labels
+    void update(Idx idx, const std::set<std::string>& old_labels, const std::set<std::string>& new_labels);
+
+    void add(Idx idx, const std::string& label);
+
+    void remove(Idx idx, const std::string& label);
+
+    // Returns false if the label was never added
+    bool findId(const std::string& label, unsigned int& id) const;
+
+private:
+
+    typedef std::map<std::string, unsigned int> IdMap;
+
+    // Only ever grows, so copies can share it until they add a label
+    boost::shared_ptr<const IdMap> ids_;
+
+    // Indexed by label id
+    std::vector<IdxSet> sets_;
+
+    unsigned int getOrAddId(const std::string& label);
+
+};
+
+} // end namespace world_model
+
+} // end namespace ed
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef ED_WORLD_MODEL_REVISION_LOG_H_
+#define ED_WORLD_MODEL_REVISION_LOG_H_
+
+#include "ed/world_model/chunked_vector.h"
+
+namespace ed
+{
+namespace world_model
+{
+
+/**
+ * @brief The RevisionLog class
+ *
+ * Append-only log of items (with a member 'revision') ordered by revision. Items are addressed by sequence
+ * number, which keeps counting when the oldest items are dropped. The log is bounded: once it holds more than
+ * the maximum number of items, the oldest ones are dropped (whole chunks at a time). Like the ChunkedVector it
+ * is stored in, copies share their chunks.
+ */
+template<typename T>
+class RevisionLog
+{
+
+    typedef ChunkedVector<T> Items;
+
+public:
+
+    explicit RevisionLog(std::size_t max_size = 0) : first_(0), min_revision_(0), max_size_(max_size) {}
+
+    // Sequence numbers of the oldest item, and one past the newest
+    inline unsigned long begin() const { return first_; }
+    inline unsigned long end() const { return first_ + items_.size(); }
+
+    inline const T& operator[](unsigned long seq) const { return items_[seq - first_]; }
+
+    inline T& modify(unsigned long seq) { return items_.modify(seq - first_); }
+
+    // The log contains all items with a revision after this one
+    inline unsigned long minRevision() const { return min_revision_; }
+
+    // Adds the item and returns its sequence number. Revisions must not decrease
+    unsigned long push_back(const T& item)
+    {
+        items_.push_back(item);
+
+        if (max_size_ > 0 && items_.size() >= max_size_ + Items::CHUNK_SIZE)
+        {
+            // Drop the oldest chunks. Items of the last dropped revision may remain, but are incomplete
+            std::size_t n = (items_.size() - max_size_) / Items::CHUNK_SIZE * Items::CHUNK_SIZE;
+            min_revision_ = items_[n - 1].revision;
+            items_.eraseFront(n);
+            first_ += n;
+        }
+
+        return end() - 1;
+    }
+
+    // Sequence number of the first item with a revision after the given one
+    unsigned long upperBound(unsigned long revision) const
+    {
+        std::size_t low = 0;
+        std::size_t high = items_.size();
+        while (low < high)
+        {
+            std::size_t mid = low + (high - low) / 2;
+            if (revision < items_[mid].revision)
+                high = mid;
+            else
+                low = mid + 1;
+        }
+
+        return first_ + low;
+    }
+
+    void setMaxSize(std::size_t n) { max_size_ = n; }
+
+    inline std::size_t size() const { return items_.size(); }
+
+private:
+
+    Items items_;
+
+    unsigned long first_;
+
+    unsigned long min_revision_;
+
+    std::size_t max_size_;
+
+};
+
+} // end namespace world_model
+
+} // end namespace ed
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef ED_WORLD_MODEL_SPATIAL_INDEX_H_
+#define ED_WORLD_MODEL_SPATIAL_INDEX_H_
+
+#include "ed/types.h"
+#include "ed/world_model/chunked_vector.h"
+
+#include <geolib/datatypes.h>
+
+#include <vector>
+
+namespace ed
+{
+
+class WorldModel;
+
+namespace world_model
+{
+
+/**
+ * @brief The SpatialIndex class
+ *
+ * Uniform grid over the footprints of the entities of a world model. The footprint of an entity is the
+ * axis-aligned bounding box (in the xy-plane) of its position and convex hull; entities without a pose are not
+ * indexed. Grid cells are hashed into a power-of-two number of buckets, so the grid has no bounds. Entities that
+ * cover many cells (walls, floors) are kept in a separate list that is checked on every query.
+ *
+ * The buckets and footprints are stored in ChunkedVectors, so a copy of the index shares everything that is not
+ * modified. An index is brought up to date with a newer world model revision by only re-inserting the entities
+ * that changed since, which makes keeping an index per world model snapshot cheap.
+ */
+class SpatialIndex
+{
+
+public:
+
+    struct Box
+    {
+        Box() {}
+        Box(float min_x_, float min_y_, float max_x_, float max_y_)
+            : min_x(min_x_), min_y(min_y_), max_x(max_x_), max_y(max_y_) {}
+
+        float min_x, min_y, max_x, max_y;
+    };
+
+    SpatialIndex(double cell_size = 1.0);
+
+    // Updates the index to the revision of the world model. The world model must be the one this index was
+    // built from, or a later revision of it
+    void update(const WorldModel& wm);
+
+    // Adds the entities whose footprint intersects the given box. Each entity is added once
+    void query(const Box& box, std::vector<Idx>& idxs) const;
+
+    // Returns false if the entity is not indexed
+    bool footprint(Idx idx, Box& box) const;
+
+    // World model revision this index represents
+    inline unsigned long revision() const { return revision_; }
+
+    inline std::size_t size() const { return size_; }
+
+private:
+
+    enum EntryState
+    {
+        NOT_INDEXED,
+        IN_GRID,
+        LARGE
+    };
+
+    struct Entry
+    {
+        Entry() : state(NOT_INDEXED) {}
+
+        Box box;
+
+        // Range of grid cells covered (if in the grid)
+        int cx0, cy0, cx1, cy1;
+
+        unsigned char state;
+    };
+
+    typedef ChunkedVector<std::vector<Idx>, 6> BucketVector;
+
+    double cell_size_;
+
+    double inv_cell_size_;
+
+    unsigned long revision_;
+
+    // Indexed by entity index
+    ChunkedVector<Entry> entries_;
+
+    // Size is always a power of two
+    BucketVector buckets_;
+
+    // Entities that cover too many cells to put them in the grid
+    std::vector<Idx> large_;
+
+    // Number of indexed entities
+    std::size_t size_;
+
+    // Returns false if the range covers too many cells (or is not finite)
+    bool cellRange(const Box& box, int& cx0, int& cy0, int& cx1, int& cy1, std::size_t max_cells) const;
+
+    inline std::size_t bucket(int cx, int cy) const
+    {
+        return ((static_cast<unsigned int>(cx) * 73856093u) ^ (static_cast<unsigned int>(cy) * 19349663u))
+                & (buckets_.size() - 1);
+    }
+
+    void addToBuckets(Idx idx, const Entry& entry);
+
+    void insert(Idx idx, const Box& box);
+
+    void remove(Idx idx);
+
+    void rehash(std::size_t num_buckets);
+
+    void rebuild(const WorldModel& wm);
+
+};
+
+} // end namespace world_model
+
+} // end namespace ed
+
+#endif
@@ -3,9 +3,10 @@
 
 #include "ed/types.h"
 #include "ed/time.h"
+#include "ed/uuid.h"
 #include <geolib/datatypes.h>
 
-#include <queue>
+#include <vector>
 
 namespace ed
 {
@@ -18,41 +19,111 @@ namespace world_model
  * Starting with the given entity ID, this class crawls the world model transformation graph in a breadth-first manner.
  * Each node (world model entity) is only visited once. For each visited entity, the transformation from the root entity
  * (i.e., the given entity) is calculated.
+ *
+ * The crawler can be kept and started again (e.g., every cycle), in which case it reuses its buffers. After a crawl,
+ * update() calculates the transforms again, but only for the entities below relations that changed.
  */
 class TransformCrawler
 {
 
     struct Node
     {
-        Node(Idx entity_idx_, const geo::Pose3D& transform_)
-            : entity_idx(entity_idx_), transform(transform_) {}
+        Node(Idx entity_idx_, Idx parent_, Idx relation_, bool inverse_)
+            : entity_idx(entity_idx_), parent(parent_), relation(relation_), inverse(inverse_), valid(false),
+              has_children(false) {}
+
         Idx entity_idx;
+
+        // Position of the parent node in nodes_ (INVALID_IDX for children of the root)
+        Idx parent;
+
+        Idx relation;
+
+        // If true, the relation points from this entity to its parent
+        bool inverse;
+
+        // False if the transform could not be calculated (the entity is then skipped, as are its children)
+        bool valid;
+
+        // True if other nodes were crawled from this one
+        bool has_children;
+
         geo::Pose3D transform;
     };
 
 public:
 
+    TransformCrawler();
+
     TransformCrawler(const WorldModel& wm, const UUID& start_id, const Time& time);
 
+    // Crawls the world model from the given root
+    void start(const WorldModel& wm, const UUID& root_id, const Time& time);
+
+    // Same, but does not enter the given entities (e.g., entities of which the transforms are calculated otherwise)
+    void start(const WorldModel& wm, const UUID& root_id, const Time& time, const std::vector<Idx>& skip_entities);
+
+    // Crawls from the same root as the previous crawl, reusing its transforms for all entities whose path to the
+    // root does not contain a changed relation. Relations count as changed if they were set in the world model after
+    // the previous crawl, or if they are in 'changed_relations': relations whose transform changed in place, or
+    // depends on the (new) time. Falls back to a full crawl if the structure of the relation graph changed
+    void update(const WorldModel& wm, const Time& time, const std::vector<Idx>& changed_relations = std::vector<Idx>());
+
     bool next();
 
-    bool hasNext() const { return !queue_.empty(); }
+    bool hasNext() const { return pos_ < nodes_.size(); }
 
-    const geo::Pose3D& transform() const { return queue_.front().transform; }
+    const geo::Pose3D& transform() const { return nodes_[pos_].transform; }
 
     const EntityConstPtr& entity() const;
 
+    // Number of relation transforms calculated in the last crawl or update
+    unsigned int numCalculatedTransforms() const { return num_calculated_; }
+
 private:
 
-    const WorldModel& wm_;
+    const WorldModel* wm_;
 
     Time time_;
 
-    std::set<Idx> visited_;
+    UUID root_id_;
+
+    // Entities that are not crawled
+    std::vector<Idx> skip_entities_;
+
+    // All nodes of the crawl in breadth-first order, i.e., parents before children
+    std::vector<Node> nodes_;
+
+    // Position of the current node
+    std::size_t pos_;
+
+    // Visited flags per entity index
+    std::vector<bool> visited_;
+
+    // Changed flags per relation index (used by update)
+    std::vector<bool> changed_;
+
+    // Changed flags per node (used by update)
+    std::vector<bool> node_changed_;
+
+    // World model and relation graph revisions of the last crawl
+    unsigned long revision_;
+
+    unsigned long relations_revision_;
+
+    unsigned int num_calculated_;
+
+    // Crawls from root_id_, excluding skip_entities_
+    void restart(const WorldModel& wm, const Time& time);
+
+    void crawl(Idx root_idx);
+
+    void pushChildren(Idx entity_idx, Idx parent);
 
-    std::queue<Node> queue_;
+    bool calculateTransform(Node& node);
 
-    void pushChildren(const Entity& e, const geo::Pose3D& transform);
+    // Skips nodes of which the transform is not valid
+    void skipInvalid();
 
 };
 
@@ -0,0 +1,69 @@
+#ifndef ED_WORLD_MODEL_TRANSFORM_TREE_H_
+#define ED_WORLD_MODEL_TRANSFORM_TREE_H_
+
+#include "ed/types.h"
+
+#include <vector>
+
+namespace ed
+{
+
+class WorldModel;
+
+namespace world_model
+{
+
+/**
+ * @brief The TransformTree class
+ *
+ * Spanning forest of the relation graph of a world model. Every entity points to its parent in the tree and to
+ * the relation that connects them, such that the path between two entities can be found by walking up to their
+ * lowest common ancestor, instead of searching the whole graph. Entities without a parent relation are used as
+ * roots, so for tree-shaped relation graphs (the normal case) the tree is the relation graph itself.
+ *
+ * The tree only depends on which relations exist, not on their transforms, so it stays valid until relations
+ * are added or entities are removed.
+ */
+class TransformTree
+{
+
+public:
+
+    struct Node
+    {
+        Node() : parent(INVALID_IDX), relation(INVALID_IDX), inverse(false), depth(0) {}
+
+        // INVALID_IDX for roots (and non-existing entities)
+        Idx parent;
+
+        Idx relation;
+
+        // If true, the relation points from this entity to its parent, so its transform must be inverted
+        bool inverse;
+
+        unsigned int depth;
+    };
+
+    TransformTree(const WorldModel& wm, unsigned long revision);
+
+    // Entities added after the tree was built have no relations yet, so they are their own root
+    inline const Node& node(Idx idx) const { return idx < nodes_.size() ? nodes_[idx] : empty_node_; }
+
+    // Revision of the relation graph this tree was built from
+    inline unsigned long revision() const { return revision_; }
+
+private:
+
+    std::vector<Node> nodes_;
+
+    Node empty_node_;
+
+    unsigned long revision_;
+
+};
+
+} // end namespace world_model
+
+} // end namespace ed
+
+#endif
@@ -13,49 +13,86 @@
 #include <geolib/Importer.h>
 #include <geolib/Box.h>
 
-#include <ed/world_model/transform_crawler.h>
-
 // ----------------------------------------------------------------------------------------------------
 
-bool JointRelation::calculateTransform(const ed::Time& t, geo::Pose3D& tf) const
+namespace
 {
-    ed::TimeCache<float>::const_iterator it_low, it_up;
-    joint_pos_cache_.getLowerUpper(t, it_low, it_up);
 
+// Interpolates the joint position at time t between the lower and upper position
+float interpolateJointPosition(const ed::Time& t, const ed::SharedTimeCache<float>::value_type& low, bool has_low,
+                               const ed::SharedTimeCache<float>::value_type& up, bool has_up)
+{
     float joint_pos;
 
-    if (it_low == joint_pos_cache_.end())
+    if (!has_low)
     {
-        if (it_up == joint_pos_cache_.end())
-            // No upper or lower bound (cache is empty)
-            return false;
-
         // Requested time is in the past
-        joint_pos = it_up->second;
+        joint_pos = up.second;
     }
     else
     {
-        if (it_up == joint_pos_cache_.end())
+        if (!has_up)
         {
             // Requested time is in the future
-            joint_pos = it_low->second;
+            joint_pos = low.second;
         }
         else
         {
             // Interpolate
-            float p1 = it_low->second;
-            float p2 = it_up->second;
+            float p1 = low.second;
+            float p2 = up.second;
 
-            float dt1 = t.seconds() - it_low->first.seconds();
-            float dt2 = it_up->first.seconds() - t.seconds();
+            float dt1 = t.seconds() - low.first.seconds();
+            float dt2 = up.first.seconds() - t.seconds();
 
             // Linearly interpolate joint positions
             joint_pos = (p1 * dt2 + p2 * dt1) / (dt1 + dt2);
         }
     }
 
+    return joint_pos;
+}
+
+} // end anonymous namespace
+
+// ----------------------------------------------------------------------------------------------------
+
+bool JointHistory::calculateJointPosition(const ed::Time& t, const ed::SharedTimeCache<float>::Window& window, float& joint_pos) const
+{
+    ed::SharedTimeCache<float>::value_type low, up;
+    bool has_low, has_up;
+    if (!joint_pos_cache_.getLowerUpper(t, window, low, has_low, up, has_up))
+        // No upper or lower bound (cache is empty)
+        return false;
+
+    joint_pos = interpolateJointPosition(t, low, has_low, up, has_up);
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool JointHistory::calculateJointPosition(const ed::Time& t, float& joint_pos) const
+{
+    ed::SharedTimeCache<float>::value_type low, up;
+    bool has_low, has_up;
+    if (!joint_pos_cache_.getLowerUpper(t, low, has_low, up, has_up))
+        // No upper or lower bound (cache is empty)
+        return false;
+
+    joint_pos = interpolateJointPosition(t, low, has_low, up, has_up);
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool JointRelation::calculateTransform(const ed::Time& t, geo::Pose3D& tf) const
+{
+    float joint_pos;
+    if (!calculateJointPosition(t, joint_pos))
+        return false;
+
     // Calculate joint pose for this joint position
-    KDL::Frame pose_kdl = segment_.pose(joint_pos);
+    KDL::Frame pose_kdl = history_->segment().pose(joint_pos);
 
     // Convert to geolib transform
     tf.R = geo::Matrix3(pose_kdl.M.data);
@@ -66,6 +103,100 @@ bool JointRelation::calculateTransform(const ed::Time& t, geo::Pose3D& tf) const
 
 // ----------------------------------------------------------------------------------------------------
 
+unsigned int ForwardKinematics::addSegment(ed::Idx parent, const boost::shared_ptr<const JointHistory>& joint)
+{
+    Segment s;
+    s.parent = parent;
+    s.joint = joint;
+    s.joint_pos = 0;
+    s.valid = false;
+    s.changed = false;
+    segments_.push_back(s);
+
+    local_frames_.resize(segments_.size());
+    frames_.resize(segments_.size());
+
+    return segments_.size() - 1;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+unsigned int ForwardKinematics::calculate(const ed::Time& t)
+{
+    unsigned int num_changed = 0;
+
+    for(unsigned int i = 0; i < segments_.size(); ++i)
+    {
+        Segment& s = segments_[i];
+        bool was_valid = s.valid;
+
+        float joint_pos;
+        if ((s.parent != ed::INVALID_IDX && !segments_[s.parent].valid) || !s.joint->calculateJointPosition(t, joint_pos))
+        {
+            s.valid = false;
+            s.changed = was_valid;
+            num_changed += s.changed;
+            continue;
+        }
+
+        bool parent_changed = (s.parent != ed::INVALID_IDX && segments_[s.parent].changed);
+
+        s.changed = !was_valid || parent_changed || joint_pos != s.joint_pos;
+        if (!s.changed)
+            continue;
+
+        Frame& local = local_frames_[i];
+        if (!was_valid || joint_pos != s.joint_pos)
+        {
+            KDL::Frame f = s.joint->segment().pose(joint_pos);
+            for(unsigned int r = 0; r < 3; ++r)
+            {
+                local.m[4 * r] = f.M.data[3 * r];
+                local.m[4 * r + 1] = f.M.data[3 * r + 1];
+                local.m[4 * r + 2] = f.M.data[3 * r + 2];
+                local.m[4 * r + 3] = f.p.data[r];
+            }
+        }
+
+        Frame& frame = frames_[i];
+        if (s.parent == ed::INVALID_IDX)
+        {
+            frame = local;
+        }
+        else
+        {
+            // frame = parent * local. The translation of 'local' is treated as fourth column, so each row
+            // of the result is a linear combination of the rows of 'local' (plus the parent translation)
+            const Frame& parent = frames_[s.parent];
+            for(unsigned int r = 0; r < 3; ++r)
+            {
+                const double* p = parent.m + 4 * r;
+                double* out = frame.m + 4 * r;
+                for(unsigned int c = 0; c < 4; ++c)
+                    out[c] = p[0] * local.m[c] + p[1] * local.m[4 + c] + p[2] * local.m[8 + c];
+                out[3] += p[3];
+            }
+        }
+
+        s.joint_pos = joint_pos;
+        s.valid = true;
+        ++num_changed;
+    }
+
+    return num_changed;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void ForwardKinematics::getPose(unsigned int i, geo::Pose3D& pose) const
+{
+    const double* m = frames_[i].m;
+    pose.R = geo::Matrix3(m[0], m[1], m[2], m[4], m[5], m[6], m[8], m[9], m[10]);
+    pose.t = geo::Vector3(m[3], m[7], m[11]);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
 geo::ShapePtr linkToShape(const boost::shared_ptr<urdf::Link>& link)
 {
     geo::ShapePtr shape;
@@ -165,7 +296,44 @@ geo::ShapePtr linkToShape(const boost::shared_ptr<urdf::Link>& link)
 
 // ----------------------------------------------------------------------------------------------------
 
-RobotPlugin::RobotPlugin() : model_initialized_(true)
+namespace
+{
+
+bool equal(const geo::Pose3D& p1, const geo::Pose3D& p2)
+{
+    const geo::Matrix3& R1 = p1.R;
+    const geo::Matrix3& R2 = p2.R;
+    return p1.t.x == p2.t.x && p1.t.y == p2.t.y && p1.t.z == p2.t.z
+            && R1.xx == R2.xx && R1.xy == R2.xy && R1.xz == R2.xz
+            && R1.yx == R2.yx && R1.yy == R2.yy && R1.yz == R2.yz
+            && R1.zx == R2.zx && R1.zy == R2.zy && R1.zz == R2.zz;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// True if the entity has a relation with an entity that is not marked
+bool hasRelationsOutside(const ed::Entity& e, const std::vector<bool>& marked)
+{
+    for(std::map<ed::Idx, ed::Idx>::const_iterator it = e.relationsTo().begin(); it != e.relationsTo().end(); ++it)
+    {
+        if (it->first >= marked.size() || !marked[it->first])
+            return true;
+    }
+
+    for(std::map<ed::Idx, ed::Idx>::const_iterator it = e.relationsFrom().begin(); it != e.relationsFrom().end(); ++it)
+    {
+        if (it->first >= marked.size() || !marked[it->first])
+            return true;
+    }
+
+    return false;
+}
+
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+RobotPlugin::RobotPlugin() : model_initialized_(true), has_last_robot_pose_(false)
 {
 }
 
@@ -177,7 +345,8 @@ RobotPlugin::~RobotPlugin()
 
 // ----------------------------------------------------------------------------------------------------
 
-void RobotPlugin::constructRobot(const ed::UUID& parent_id, const KDL::SegmentMap::const_iterator& it_segment, ed::UpdateRequest& req)
+void RobotPlugin::constructRobot(const ed::UUID& parent_id, ed::Idx parent_segment, const KDL::SegmentMap::const_iterator& it_segment,
+                                 std::map<std::string, unsigned int>& link_to_segment, ed::UpdateRequest& req)
 {
     const KDL::Segment& segment = it_segment->second.segment;
 
@@ -187,23 +356,31 @@ void RobotPlugin::constructRobot(const ed::UUID& parent_id, const KDL::SegmentMa
     // Set the entity type (robot_link)
     req.setType(child_id, "robot_link");
 
-    // Create a joint relation and add id
-    boost::shared_ptr<JointRelation> r(new JointRelation(segment));
-    r->setCacheSize(joint_cache_size_);
-    r->insert(0, 0);
-    req.setRelation(parent_id, child_id, r);
+    // Create the joint history, and a joint relation that looks at it
+    boost::shared_ptr<JointHistory> history(new JointHistory(segment, joint_cache_size_));
+    history->insert(0, 0);
+    req.setRelation(parent_id, child_id, boost::shared_ptr<JointRelation>(new JointRelation(history)));
 
     // Generate relation info that will be used to update the relation
     RelationInfo& rel_info = joint_name_to_rel_info_[segment.getJoint().getName()];
     rel_info.parent_id = parent_id;
     rel_info.child_id = child_id;
-    rel_info.r_idx = ed::INVALID_IDX;
-    rel_info.last_rel = r;
+    rel_info.history = history;
+    rel_info.num_published = history->numInserted();
+
+    // Forward kinematics uses the most recent joint positions. Children are added after their parent
+    unsigned int segment_idx = fk_.addSegment(parent_segment, history);
+    link_to_segment[segment.getName()] = segment_idx;
+
+    LinkInfo info;
+    info.id = child_id;
+    info.segment = segment_idx;
+    all_links_.push_back(info);
 
     // Recursively add all children
     const std::vector<KDL::SegmentMap::const_iterator>& children = it_segment->second.children;
     for (unsigned int i = 0; i < children.size(); i++)
-        constructRobot(child_id, children[i], req);
+        constructRobot(child_id, segment_idx, children[i], link_to_segment, req);
 }
 
 // ----------------------------------------------------------------------------------------------------
@@ -224,17 +401,8 @@ void RobotPlugin::jointCallback(const sensor_msgs::JointState::ConstPtr& msg)
         std::map<std::string, RelationInfo>::iterator it_r = joint_name_to_rel_info_.find(name);
         if (it_r != joint_name_to_rel_info_.end())
         {
-            RelationInfo& info = it_r->second;
-
-            // Make a copy of the last relation
-            boost::shared_ptr<JointRelation> r(new JointRelation(*info.last_rel));
-            r->setCacheSize(joint_cache_size_);
-
-            r->insert(msg->header.stamp.toSec(), pos);
-
-            update_req_->setRelation(info.parent_id, info.child_id, r);
-
-            info.last_rel = r;
+            // Added in place; the positions are published to the world model in process()
+            it_r->second.history->insert(msg->header.stamp.toSec(), pos);
         }
         else
         {
@@ -310,6 +478,10 @@ void RobotPlugin::process(const ed::WorldModel& world, ed::UpdateRequest& req)
 {
     if (!model_initialized_)
     {
+        // Create the joints
+        std::map<std::string, unsigned int> link_to_segment;
+        constructRobot(robot_name_, ed::INVALID_IDX, tree_.getRootSegment(), link_to_segment, req);
+
         // Create the links
         std::vector<boost::shared_ptr<urdf::Link> > links;
         robot_model_.getLinks(links);
@@ -323,11 +495,19 @@ void RobotPlugin::process(const ed::WorldModel& world, ed::UpdateRequest& req)
             {
                 std::string id = robot_name_ + "/" + link->name;
                 req.setShape(id, shape);
+                req.setFlag(id, "self"); // mark as self
+
+                std::map<std::string, unsigned int>::const_iterator it_s = link_to_segment.find(link->name);
+                if (it_s != link_to_segment.end())
+                {
+                    LinkInfo info;
+                    info.id = id;
+                    info.segment = it_s->second;
+                    links_.push_back(info);
+                }
             }
         }
 
-        // Create the joints
-        constructRobot(robot_name_, tree_.getRootSegment(), req);
         model_initialized_ = true;
 
         req.setType(robot_name_, "robot");
@@ -335,21 +515,118 @@ void RobotPlugin::process(const ed::WorldModel& world, ed::UpdateRequest& req)
         return;
     }
 
-    update_req_ = &req;
     cb_queue_.callAvailable();
 
+    // Publish the new joint positions, with one relation per joint that moved. The world model revisions that have
+    // the previous relations keep seeing the positions they had
+    for(std::map<std::string, RelationInfo>::iterator it = joint_name_to_rel_info_.begin(); it != joint_name_to_rel_info_.end(); ++it)
+    {
+        RelationInfo& info = it->second;
+        unsigned long num_inserted = info.history->numInserted();
+        if (num_inserted == info.num_published)
+            continue;
+
+        req.setRelation(info.parent_id, info.child_id, boost::shared_ptr<JointRelation>(new JointRelation(info.history)));
+        info.num_published = num_inserted;
+    }
+
     ed::EntityConstPtr e_robot = world.getEntity(robot_name_);
-    if (e_robot && e_robot->has_pose())
+    if (!e_robot || !e_robot->has_pose())
+        return;
+
+    ed::Time time = ros::Time::now().toSec();
+
+    // Calculate the link poses relative to the robot
+    fk_.calculate(time);
+
+    // If the robot did not move, only the poses of links that moved relative to the robot need to be set
+    const geo::Pose3D& robot_pose = e_robot->pose();
+    bool robot_moved = !has_last_robot_pose_ || !equal(robot_pose, last_robot_pose_);
+
+    std::vector<ed::UUID> ids;
+    std::vector<geo::Pose3D> poses;
+    for(std::vector<LinkInfo>::iterator it = links_.begin(); it != links_.end(); ++it)
     {
-        // Calculate absolute poses
-        for(ed::world_model::TransformCrawler tc(world, robot_name_, ros::Time::now().toSec()); tc.hasNext(); tc.next())
+        LinkInfo& link = *it;
+
+        // Also caches the entity index in the id, which speeds up applying the request
+        ed::Idx idx;
+        if (!world.findEntityIdx(link.id, idx))
+            continue;
+
+        // The flag may have been removed by others (or the entity was removed and added again)
+        if (!world.entities()[idx]->hasFlag("self"))
+            req.setFlag(link.id, "self");
+
+        if (!fk_.valid(link.segment) || (!robot_moved && !fk_.changed(link.segment)))
+            continue;
+
+        geo::Pose3D pose;
+        fk_.getPose(link.segment, pose);
+
+        ids.push_back(link.id);
+        poses.push_back(robot_pose * pose);
+    }
+
+    req.setPoses(ids, poses);
+
+    last_robot_pose_ = robot_pose;
+    has_last_robot_pose_ = true;
+
+    // Entities that are attached to the robot or its links are not part of the kinematic tree, so their poses are
+    // determined by crawling the world model from the robot entities, without entering the links
+    robot_entity_idxs_.clear();
+    for(std::vector<LinkInfo>::const_iterator it = all_links_.begin(); it != all_links_.end(); ++it)
+    {
+        ed::Idx idx;
+        if (world.findEntityIdx(it->id, idx))
+            robot_entity_idxs_.push_back(idx);
+    }
+
+    ed::Idx robot_idx;
+    if (world.findEntityIdx(robot_name_, robot_idx))
+        robot_entity_idxs_.push_back(robot_idx);
+
+    if (is_robot_entity_.size() < world.entities().size())
+        is_robot_entity_.resize(world.entities().size(), false);
+
+    for(std::vector<ed::Idx>::const_iterator it = robot_entity_idxs_.begin(); it != robot_entity_idxs_.end(); ++it)
+        is_robot_entity_[*it] = true;
+
+    setAttachedPoses(world, robot_name_, robot_pose, time, req);
+
+    for(std::vector<LinkInfo>::const_iterator it = all_links_.begin(); it != all_links_.end(); ++it)
+    {
+        if (!fk_.valid(it->segment))
+            continue;
+
+        geo::Pose3D pose;
+        fk_.getPose(it->segment, pose);
+        setAttachedPoses(world, it->id, robot_pose * pose, time, req);
+    }
+
+    // Only the marked entries are reset, so this does not cost O(#entities)
+    for(std::vector<ed::Idx>::const_iterator it = robot_entity_idxs_.begin(); it != robot_entity_idxs_.end(); ++it)
+        is_robot_entity_[*it] = false;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void RobotPlugin::setAttachedPoses(const ed::WorldModel& world, const ed::UUID& id, const geo::Pose3D& pose,
+                                   const ed::Time& time, ed::UpdateRequest& req)
+{
+    ed::Idx idx;
+    if (!world.findEntityIdx(id, idx) || !hasRelationsOutside(*world.entities()[idx], is_robot_entity_))
+        return;
+
+    for(crawler_.start(world, id, time, robot_entity_idxs_); crawler_.hasNext(); crawler_.next())
+    {
+        const ed::EntityConstPtr& e = crawler_.entity();
+        if (e->shape())
         {
-            const ed::EntityConstPtr& e = tc.entity();
-            if (e->shape())
-            {
-                req.setPose(e->id(), e_robot->pose() * tc.transform());
+            req.setPose(e->id(), pose * crawler_.transform());
+            if (!e->hasFlag("self"))
                 req.setFlag(e->id(), "self"); // mark as self
-            }
         }
     }
 }
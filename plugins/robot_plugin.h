@@ -3,8 +3,9 @@
 
 #include <ed/plugin.h>
 #include <ed/relation.h>
-#include <ed/time_cache.h>
+#include <ed/shared_time_cache.h>
 #include <ed/uuid.h>
+#include <ed/world_model/transform_crawler.h>
 
 #include <ros/subscriber.h>
 #include <ros/callback_queue.h>
@@ -13,32 +14,74 @@
 #include <kdl/tree.hpp>
 #include <geolib/datatypes.h>
 
+#include <boost/noncopyable.hpp>
+
 #include <urdf/model.h>
 
 // ----------------------------------------------------------------------------------------------------
 
-class JointRelation : public ed::Relation
+// Positions of a joint over time, and the segment that calculates the joint pose. The robot plugin inserts
+// positions in place, while joint relations in world model revisions read them
+class JointHistory : boost::noncopyable
 {
 
 public:
 
-    JointRelation(const KDL::Segment& segment) : segment_(segment) {}
+    JointHistory(const KDL::Segment& segment, unsigned int cache_size) : joint_pos_cache_(cache_size), segment_(segment) {}
 
-    bool calculateTransform(const ed::Time& t, geo::Pose3D& tf) const;
+    // Looks up (interpolates) the joint position at time t, among the positions of the window (see
+    // SharedTimeCache::Window). Returns false if there is none
+    bool calculateJointPosition(const ed::Time& t, const ed::SharedTimeCache<float>::Window& window, float& joint_pos) const;
+
+    // Same, among the most recent positions
+    bool calculateJointPosition(const ed::Time& t, float& joint_pos) const;
 
+    inline const KDL::Segment& segment() const { return segment_; }
+
+    // Only one thread may insert. Positions older than the last one are ignored
     void insert(const ed::Time& t, float joint_pos) { joint_pos_cache_.insert(t, joint_pos); }
 
-    inline unsigned int size() const { return joint_pos_cache_.size(); }
+    inline unsigned long numInserted() const { return joint_pos_cache_.numInserted(); }
 
-    void setCacheSize(unsigned int n) { joint_pos_cache_.setMaxSize(n); }
+    inline ed::SharedTimeCache<float>::Window window() const { return joint_pos_cache_.window(); }
 
 private:
 
-    ed::TimeCache<float> joint_pos_cache_;
+    ed::SharedTimeCache<float> joint_pos_cache_;
     KDL::Segment segment_; // calculates the joint pose
 
 };
 
+// ----------------------------------------------------------------------------------------------------
+
+// Relation between two robot links. It is immutable: it only sees the joint positions that were inserted in the
+// (shared) joint history before it was created, so a world model revision keeps seeing the same positions. New
+// positions are published by setting a new JointRelation, which is cheap as it does not copy the history. Once
+// the history has overwritten those positions, the last of them is used
+class JointRelation : public ed::Relation
+{
+
+public:
+
+    JointRelation(const boost::shared_ptr<const JointHistory>& history)
+        : history_(history), window_(history->window()) {}
+
+    bool calculateTransform(const ed::Time& t, geo::Pose3D& tf) const;
+
+    bool calculateJointPosition(const ed::Time& t, float& joint_pos) const
+    {
+        return history_->calculateJointPosition(t, window_, joint_pos);
+    }
+
+private:
+
+    boost::shared_ptr<const JointHistory> history_;
+
+    // Joint positions in the history when this relation was created
+    ed::SharedTimeCache<float>::Window window_;
+
+};
+
 
 // ----------------------------------------------------------------------------------------------------
 
@@ -46,8 +89,73 @@ struct RelationInfo
 {
     ed::UUID parent_id;
     ed::UUID child_id;
-    ed::Idx r_idx;
-    boost::shared_ptr<const JointRelation> last_rel;
+    boost::shared_ptr<JointHistory> history;
+
+    // Number of joint positions in the history when the last relation was set
+    unsigned long num_published;
+};
+
+// ----------------------------------------------------------------------------------------------------
+
+/**
+ * @brief The ForwardKinematics class
+ *
+ * The kinematic tree of the robot, compiled into a flat array of segments in which parents come before their
+ * children. calculate() determines the poses of all segments (relative to the root) in one pass, in which
+ * segments are skipped if neither their joint position nor the pose of their parent changed.
+ */
+class ForwardKinematics
+{
+
+public:
+
+    // Adds a segment and returns its index. The parent must have been added before (INVALID_IDX for the root)
+    unsigned int addSegment(ed::Idx parent, const boost::shared_ptr<const JointHistory>& joint);
+
+    // Returns the number of segments of which the pose changed (or became invalid)
+    unsigned int calculate(const ed::Time& t);
+
+    inline unsigned int size() const { return segments_.size(); }
+
+    // False if a joint position on the path to the root is missing
+    inline bool valid(unsigned int i) const { return segments_[i].valid; }
+
+    inline bool changed(unsigned int i) const { return segments_[i].changed; }
+
+    void getPose(unsigned int i, geo::Pose3D& pose) const;
+
+private:
+
+    // Row-major 3x4 matrix: rotation followed by translation per row
+    struct Frame
+    {
+        double m[12];
+    };
+
+    struct Segment
+    {
+        ed::Idx parent;
+        boost::shared_ptr<const JointHistory> joint;
+        float joint_pos;
+        bool valid;
+        bool changed;
+    };
+
+    std::vector<Segment> segments_;
+
+    // Pose of each segment relative to its parent, and relative to the root
+    std::vector<Frame> local_frames_;
+
+    std::vector<Frame> frames_;
+
+};
+
+// ----------------------------------------------------------------------------------------------------
+
+struct LinkInfo
+{
+    ed::UUID id;
+    unsigned int segment;
 };
 
 // ----------------------------------------------------------------------------------------------------
@@ -79,11 +187,36 @@ private:
 
     std::map<std::string, RelationInfo> joint_name_to_rel_info_;
 
-    ed::UpdateRequest* update_req_;
-
     unsigned int joint_cache_size_;
 
-    void constructRobot(const ed::UUID& parent_id, const KDL::SegmentMap::const_iterator& it_segment, ed::UpdateRequest& req);
+    ForwardKinematics fk_;
+
+    // Links with a shape, of which the poses are set
+    std::vector<LinkInfo> links_;
+
+    // All links (also those without shape). Entities that are attached to them, but are not part of the kinematic
+    // tree (e.g., grasped objects or sensor frames), are crawled from them
+    std::vector<LinkInfo> all_links_;
+
+    // Entity indices of the robot and its links, which are not entered when crawling the attached entities
+    std::vector<ed::Idx> robot_entity_idxs_;
+
+    // Marks the robot entity indices, by entity index
+    std::vector<bool> is_robot_entity_;
+
+    ed::world_model::TransformCrawler crawler_;
+
+    // Robot pose with which the link poses were last set
+    geo::Pose3D last_robot_pose_;
+
+    bool has_last_robot_pose_;
+
+    void constructRobot(const ed::UUID& parent_id, ed::Idx parent_segment, const KDL::SegmentMap::const_iterator& it_segment,
+                        std::map<std::string, unsigned int>& link_to_segment, ed::UpdateRequest& req);
+
+    // Sets the poses of the entities that are attached to the given robot entity (robot or link) with pose 'pose'
+    void setAttachedPoses(const ed::WorldModel& world, const ed::UUID& id, const geo::Pose3D& pose, const ed::Time& time,
+                          ed::UpdateRequest& req);
 
 
     // ROS Communication
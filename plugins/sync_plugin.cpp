@@ -44,17 +44,20 @@ void SyncPlugin::process(const ed::PluginInput& data, ed::UpdateRequest& req)
         return;
     }
 
-    ed::io::JSONReader r(query.response.human_readable.c_str());
+    // Parse in the response itself, which is not used afterwards
+    ed::io::JSONReader r(&query.response.human_readable[0], ed::io::JSONReader::IN_SITU);
 
     if (!r.ok())
     {
-        ROS_ERROR_STREAM("[ED SyncPlugin] Could not parse query response received from '" << sync_client_.getService() << "': " << query.response);
+        ROS_ERROR_STREAM("[ED SyncPlugin] Could not parse query response received from '" << sync_client_.getService() << "': " << r.error());
         return;
     }
 
 //    std::cout << "Response size: " << query.response.human_readable.size() << std::endl;
 
-    ed::deserialize(r, req);
+    // If the response is a complete snapshot, the synced entities that are not in it are removed
+    std::set<ed::UUID> ids = synced_ids_;
+    ed::deserialize(r, req, ids);
 
     if (!r.ok())
     {
@@ -66,6 +69,7 @@ void SyncPlugin::process(const ed::PluginInput& data, ed::UpdateRequest& req)
     else
     {
         rev_number_ = query.response.new_revision;
+        synced_ids_.swap(ids);
     }
 }
 
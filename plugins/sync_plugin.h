@@ -2,9 +2,12 @@
 #define ED_HELLO_WORLD_PLUGIN_H_
 
 #include <ed/plugin.h>
+#include <ed/uuid.h>
 
 #include <ros/service_client.h>
 
+#include <set>
+
 class SyncPlugin : public ed::Plugin
 {
 
@@ -22,6 +25,9 @@ private:
 
     uint64_t rev_number_;
 
+    // Entities received from the server
+    std::set<ed::UUID> synced_ids_;
+
     ros::ServiceClient sync_client_;
 
 };
@@ -1,6 +1,10 @@
 #include "ed/convex_hull_calc.h"
+#include "convex_hull_kernels.h"
 
-#include <opencv2/imgproc/imgproc.hpp>
+#include <algorithm>
+#include <set>
+#include <map>
+#include <cmath>
 
 namespace ed
 {
@@ -8,34 +12,204 @@ namespace ed
 namespace convex_hull
 {
 
+namespace
+{
+
+// Triangle of the 3D convex hull. The vertices are ordered counter-clockwise when seen from outside
+struct HullFace
+{
+    HullFace(const std::vector<geo::Vector3>& points, unsigned int i1, unsigned int i2, unsigned int i3) : alive(true)
+    {
+        v[0] = i1;
+        v[1] = i2;
+        v[2] = i3;
+        adjacent[0] = adjacent[1] = adjacent[2] = 0;
+        normal = (points[i2] - points[i1]).cross(points[i3] - points[i1]);
+        offset = normal.dot(points[i1]);
+        length = normal.length();
+    }
+
+    // Positive if p lies outside the plane of the face. Scaled by the length of the (unnormalized) normal
+    double distance(const geo::Vector3& p) const { return normal.dot(p) - offset; }
+
+    unsigned int v[3];
+
+    // Neighboring face on the other side of edge v[i] -> v[i + 1]
+    unsigned int adjacent[3];
+
+    geo::Vector3 normal;
+    double offset;
+    double length;
+
+    bool alive;
+
+    // Points that lie outside this face (and were not assigned to another face)
+    std::vector<unsigned int> outside;
+};
+
 // ----------------------------------------------------------------------------------------------------
 
-void create(const std::vector<geo::Vec2f>& points, float z_min, float z_max, ConvexHull& chull, geo::Pose3D& pose)
+// Adds point 'i' to the outside set of the first face in [begin, end) it lies outside of. Returns false if
+// it lies inside all of them
+bool assignToFace(const std::vector<geo::Vector3>& points, unsigned int i, double eps, std::vector<HullFace>& faces,
+                  unsigned int begin, unsigned int end)
 {
-    cv::Mat_<cv::Vec2f> points_2d(1, points.size());
-    for(unsigned int i = 0; i < points.size(); ++i)
-        points_2d.at<cv::Vec2f>(i) = cv::Vec2f(points[i].x, points[i].y);
+    for(unsigned int j = begin; j < end; ++j)
+    {
+        HullFace& f = faces[j];
+        if (f.distance(points[i]) > eps * f.length)
+        {
+            f.outside.push_back(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// Copies the points to c.point_coords, in the layout of the vectorized kernels (see convex_hull_kernels.h)
+void calculatePointCoords(ConvexHull& c)
+{
+    std::size_t n = c.points.size();
+    std::size_t stride = kernels::stride(n);
+
+    c.point_coords.resize(2 * stride);
+    for(std::size_t i = 0; i < stride; ++i)
+    {
+        const geo::Vec2f& p = c.points[i < n ? i : 0];
+        c.point_coords[i] = p.x;
+        c.point_coords[stride + i] = p.y;
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// Positive if o -> a -> b turns counter-clockwise, zero if the points are collinear
+inline double cross(const geo::Vec2f& o, const geo::Vec2f& a, const geo::Vec2f& b)
+{
+    return ((double)a.x - o.x) * ((double)b.y - o.y) - ((double)a.y - o.y) * ((double)b.x - o.x);
+}
+
+inline bool lexicographicLess(const geo::Vec2f& a, const geo::Vec2f& b)
+{
+    return a.x < b.x || (a.x == b.x && a.y < b.y);
+}
+
+inline bool equalPoints(const geo::Vec2f& a, const geo::Vec2f& b)
+{
+    return a.x == b.x && a.y == b.y;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// Andrew's monotone chain, for lexicographically sorted points without duplicates. The hull is counter-clockwise,
+// starts at the first point and has no collinear points
+void monotoneChain(const std::vector<geo::Vec2f>& sorted, std::vector<geo::Vec2f>& hull)
+{
+    std::size_t n = sorted.size();
+    if (n < 3)
+    {
+        hull = sorted;
+        return;
+    }
+
+    hull.resize(2 * n);
+    std::size_t k = 0;
 
+    // Lower hull, from left to right
+    for(std::size_t i = 0; i < n; ++i)
+    {
+        while (k >= 2 && cross(hull[k - 2], hull[k - 1], sorted[i]) <= 0)
+            --k;
+        hull[k++] = sorted[i];
+    }
+
+    // Upper hull, from right to left
+    for(std::size_t i = n - 1, t = k + 1; i > 0; --i)
+    {
+        while (k >= t && cross(hull[k - 2], hull[k - 1], sorted[i - 1]) <= 0)
+            --k;
+        hull[k++] = sorted[i - 1];
+    }
+
+    // The last point is the first one again
+    hull.resize(k - 1);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// Appends the points of the polygon in lexicographic order. For a convex polygon (in either orientation), both
+// chains from its lexicographic minimum to its maximum are sorted, so they only have to be merged
+void appendSorted(const std::vector<geo::Vec2f>& polygon, std::vector<geo::Vec2f>& sorted)
+{
+    std::size_t n = polygon.size();
+    if (n == 0)
+        return;
+
+    std::size_t i_min = 0;
+    std::size_t i_max = 0;
+    for(std::size_t i = 1; i < n; ++i)
+    {
+        if (lexicographicLess(polygon[i], polygon[i_min]))
+            i_min = i;
+        if (lexicographicLess(polygon[i_max], polygon[i]))
+            i_max = i;
+    }
+
+    std::size_t begin = sorted.size();
+    sorted.push_back(polygon[i_min]);
+
+    // Chain forward to the maximum (including it) and chain backward (excluding it)
+    std::size_t n_forward = (i_max + n - i_min) % n;
+    std::size_t n_backward = n - 1 - n_forward;
+    std::size_t i = (i_min + 1) % n;
+    std::size_t j = (i_min + n - 1) % n;
+    while (n_forward > 0 || n_backward > 0)
+    {
+        if (n_backward == 0 || (n_forward > 0 && lexicographicLess(polygon[i], polygon[j])))
+        {
+            sorted.push_back(polygon[i]);
+            i = (i + 1) % n;
+            --n_forward;
+        }
+        else
+        {
+            sorted.push_back(polygon[j]);
+            j = (j + n - 1) % n;
+            --n_backward;
+        }
+    }
+
+    // Not a convex polygon after all
+    for(std::size_t k = begin + 1; k < sorted.size(); ++k)
+    {
+        if (lexicographicLess(sorted[k], sorted[k - 1]))
+        {
+            std::sort(sorted.begin() + begin, sorted.end(), lexicographicLess);
+            break;
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// Calculates the pose (at the center of the bounding box) and moves the points of the hull to its frame
+void finishCreate(float z_min, float z_max, ConvexHull& chull, geo::Pose3D& pose)
+{
     pose = geo::Pose3D::identity();
 
     pose.t.z = (z_min + z_max) / 2;
 
-    std::vector<int> chull_indices;
-    cv::convexHull(points_2d, chull_indices);
-
     chull.z_min = z_min - pose.t.z;
     chull.z_max = z_max - pose.t.z;
 
     geo::Vec2f xy_min(1e9, 1e9);
     geo::Vec2f xy_max(-1e9, -1e9);
 
-    chull.points.clear();
-    for(unsigned int i = 0; i < chull_indices.size(); ++i)
+    for(unsigned int i = 0; i < chull.points.size(); ++i)
     {
-        const cv::Vec2f& p_cv = points_2d.at<cv::Vec2f>(chull_indices[i]);
-        geo::Vec2f p(p_cv[0], p_cv[1]);
-
-        chull.points.push_back(p);
+        const geo::Vec2f& p = chull.points[i];
 
         xy_min.x = std::min(xy_min.x, p.x);
         xy_min.y = std::min(xy_min.y, p.y);
@@ -63,26 +237,37 @@ void create(const std::vector<geo::Vec2f>& points, float z_min, float z_max, Con
     calculateArea(chull);
 }
 
+} // end anonymous namespace
+
 // ----------------------------------------------------------------------------------------------------
 
-void createAbsolute(const std::vector<geo::Vec2f>& points, float z_min, float z_max, ConvexHull& c)
+void create(const std::vector<geo::Vec2f>& points, float z_min, float z_max, ConvexHull& chull, geo::Pose3D& pose)
 {
-    cv::Mat_<cv::Vec2f> points_2d(1, points.size());
-    for(unsigned int i = 0; i < points.size(); ++i)
-        points_2d.at<cv::Vec2f>(i) = cv::Vec2f(points[i].x, points[i].y);
+    std::vector<geo::Vec2f> sorted(points);
+    calculateHull(sorted, chull.points);
+
+    finishCreate(z_min, z_max, chull, pose);
+}
 
+// ----------------------------------------------------------------------------------------------------
+
+void createFromHull(const std::vector<geo::Vec2f>& hull_points, float z_min, float z_max, ConvexHull& chull,
+                    geo::Pose3D& pose)
+{
+    chull.points = hull_points;
+
+    finishCreate(z_min, z_max, chull, pose);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void createAbsolute(const std::vector<geo::Vec2f>& points, float z_min, float z_max, ConvexHull& c)
+{
     c.z_min = z_min;
     c.z_max = z_max;
 
-    std::vector<int> chull_indices;
-    cv::convexHull(points_2d, chull_indices);
-
-    c.points.resize(chull_indices.size());
-    for(unsigned int i = 0; i < chull_indices.size(); ++i)
-    {
-        const cv::Vec2f& p_cv = points_2d.at<cv::Vec2f>(chull_indices[i]);
-        c.points[i] = geo::Vec2f(p_cv[0], p_cv[1]);
-    }
+    std::vector<geo::Vec2f> sorted(points);
+    calculateHull(sorted, c.points);
 
     // Calculate normals and edges
     convex_hull::calculateEdgesAndNormals(c);
@@ -93,25 +278,98 @@ void createAbsolute(const std::vector<geo::Vec2f>& points, float z_min, float z_
 
 // ----------------------------------------------------------------------------------------------------
 
+void calculateHull(std::vector<geo::Vec2f>& points, std::vector<geo::Vec2f>& hull)
+{
+    std::sort(points.begin(), points.end(), lexicographicLess);
+    points.erase(std::unique(points.begin(), points.end(), equalPoints), points.end());
+
+    monotoneChain(points, hull);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void mergeHulls(const std::vector<geo::Vec2f>& hull1, const std::vector<geo::Vec2f>& hull2,
+                std::vector<geo::Vec2f>& hull)
+{
+    std::vector<geo::Vec2f> sorted;
+    sorted.reserve(hull1.size() + hull2.size());
+
+    appendSorted(hull1, sorted);
+    appendSorted(hull2, sorted);
+    std::inplace_merge(sorted.begin(), sorted.begin() + hull1.size(), sorted.end(), lexicographicLess);
+    sorted.erase(std::unique(sorted.begin(), sorted.end(), equalPoints), sorted.end());
+
+    monotoneChain(sorted, hull);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
 void calculateEdgesAndNormals(ConvexHull& c)
 {
-    c.edges.resize(c.points.size());
-    c.normals.resize(c.points.size());
+    std::size_t n = c.points.size();
 
-    for(unsigned int i = 0; i < c.points.size(); ++i)
+    c.edges.resize(n);
+    c.normals.resize(n);
+    c.extents.resize(n);
+
+    if (n == 0)
     {
-        unsigned int j = (i + 1) % c.points.size();
+        c.point_coords.clear();
+        return;
+    }
+
+    calculatePointCoords(c);
 
+    const kernels::Kernels& kern = kernels::get();
+    std::size_t stride = kernels::stride(n);
+    const float* xs = &c.point_coords[0];
+    const float* ys = xs + stride;
+
+    // Calculate edges and normals
+    std::vector<float> en(4 * stride);
+    kern.edgesAndNormals(xs, ys, n, stride, &en[0], &en[stride], &en[2 * stride], &en[3 * stride]);
+
+    for(std::size_t i = 0; i < n; ++i)
+    {
+        c.edges[i] = geo::Vec2f(en[i], en[stride + i]);
+        c.normals[i] = geo::Vec2f(en[2 * stride + i], en[3 * stride + i]);
+    }
+
+    // Calculate the extents of the hull along the normals
+    for(std::size_t i = 0; i < n; ++i)
+    {
         const geo::Vec2f& p1 = c.points[i];
-        const geo::Vec2f& p2 = c.points[j];
+        const geo::Vec2f& normal = c.normals[i];
+        kern.projectMinMax(xs, ys, stride, p1.x, p1.y, normal.x, normal.y, c.extents[i].min, c.extents[i].max);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool contains(const ConvexHull& c, const geo::Vector3& pos, const geo::Vec2& p)
+{
+    if (c.points.size() < 3)
+        return false;
 
-        // Calculate edge
-        geo::Vec2f e = p2 - p1;
-        c.edges[i] = e;
+    double x = p.x - pos.x;
+    double y = p.y - pos.y;
+
+    // The point is inside if it lies on the same side of all edges (the hull may be ordered either way)
+    bool has_pos = false;
+    bool has_neg = false;
+    for(unsigned int i = 0; i < c.points.size(); ++i)
+    {
+        const geo::Vec2f& p1 = c.points[i];
+        const geo::Vec2f& p2 = c.points[(i + 1) % c.points.size()];
 
-        // Calculate normal
-        c.normals[i] = geo::Vec2f(e.y, -e.x).normalized();
+        double cross = (p2.x - p1.x) * (y - p1.y) - (p2.y - p1.y) * (x - p1.x);
+        has_pos = has_pos || cross > 0;
+        has_neg = has_neg || cross < 0;
+        if (has_pos && has_neg)
+            return false;
     }
+
+    return true;
 }
 
 // ----------------------------------------------------------------------------------------------------
@@ -130,20 +388,41 @@ bool collide(const ConvexHull& c1, const geo::Vector3& pos1,
 
     geo::Vec2f pos_diff(pos2.x - pos1.x, pos2.y - pos1.y);
 
+    // Hulls of which the edges and normals were calculated also have their extents
+    bool has_extents = (c1.extents.size() == c1.points.size());
+
+    // ... and c2's points as arrays, of which the projections can be calculated with vector instructions (if the
+    // CPU has them; otherwise the loop below is faster, as it can stop at the first overlapping points)
+    const kernels::Kernels& kern = kernels::get();
+    std::size_t stride2 = kernels::stride(c2.points.size());
+    // Like the normals, the arrays belong to the current points (see ConvexHull)
+    bool has_coords = kern.vectorized && (c2.point_coords.size() == 2 * stride2);
+    const float* xs2 = has_coords ? &c2.point_coords[0] : 0;
+    const float* ys2 = has_coords ? &c2.point_coords[stride2] : 0;
+
     for(unsigned int i = 0; i < c1.points.size(); ++i)
     {
         const geo::Vec2f& p1 = c1.points[i];
         const geo::Vec2f& n = c1.normals[i];
 
-        // Calculate min and max projection of c1
-        float min1 = n.dot(c1.points[0] - p1);
-        float max1 = min1;
-        for(unsigned int k = 1; k < c1.points.size(); ++k)
+        // Min and max projection of c1
+        float min1, max1;
+        if (has_extents)
         {
-            // Calculate projection
-            float p = n.dot(c1.points[k] - p1);
-            min1 = std::min(min1, p);
-            max1 = std::max(max1, p);
+            min1 = c1.extents[i].min;
+            max1 = c1.extents[i].max;
+        }
+        else
+        {
+            min1 = n.dot(c1.points[0] - p1);
+            max1 = min1;
+            for(unsigned int k = 1; k < c1.points.size(); ++k)
+            {
+                // Calculate projection
+                float p = n.dot(c1.points[k] - p1);
+                min1 = std::min(min1, p);
+                max1 = std::max(max1, p);
+            }
         }
 
         // Apply padding to both sides
@@ -156,26 +435,36 @@ bool collide(const ConvexHull& c1, const geo::Vector3& pos1,
         // If this bool stays true, there is definitely no collision
         bool no_collision = true;
 
-        // True if projected points are found below c1's bounds
-        bool below = false;
-
-        // True if projected points are found above c1's bounds
-        bool above = false;
-
-        // Check if c2's points overlap with c1's bounds
-        for(unsigned int k = 0; k < c2.points.size(); ++k)
+        if (has_coords)
+        {
+            // Range of c2's projections on p1's normal. Overlap with c1's bounds means we may have a collision
+            float min2, max2;
+            kern.projectMinMax(xs2, ys2, stride2, p1_c2.x, p1_c2.y, n.x, n.y, min2, max2);
+            no_collision = !(min2 < max1 && max2 > min1);
+        }
+        else
         {
-            // Calculate projection on p1's normal
-            float p = n.dot(c2.points[k] - p1_c2);
+            // True if projected points are found below c1's bounds
+            bool below = false;
 
-            below = below || (p < max1);
-            above = above || (p > min1);
+            // True if projected points are found above c1's bounds
+            bool above = false;
 
-            if (below && above)
+            // Check if c2's points overlap with c1's bounds
+            for(unsigned int k = 0; k < c2.points.size(); ++k)
             {
-                // There is overlap with c1's bound, so we may have a collision
-                no_collision = false;
-                break;
+                // Calculate projection on p1's normal
+                float p = n.dot(c2.points[k] - p1_c2);
+
+                below = below || (p < max1);
+                above = above || (p > min1);
+
+                if (below && above)
+                {
+                    // There is overlap with c1's bound, so we may have a collision
+                    no_collision = false;
+                    break;
+                }
             }
         }
 
@@ -192,15 +481,270 @@ bool collide(const ConvexHull& c1, const geo::Vector3& pos1,
 void calculateArea(ConvexHull& c)
 {
     c.area = 0;
-    for(unsigned int i = 0; i < c.points.size(); ++i)
+    if (c.points.empty())
+        return;
+
+    // The points may have changed since the edges and normals were calculated
+    calculatePointCoords(c);
+
+    std::size_t stride = kernels::stride(c.points.size());
+    c.area = 0.5 * kernels::get().crossSum(&c.point_coords[0], &c.point_coords[stride], c.points.size(), stride);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void calculateHullVertices(const std::vector<geo::Vector3>& points, std::vector<geo::Vector3>& hull_vertices)
+{
+    hull_vertices.clear();
+
+    if (points.size() < 5)
     {
-        unsigned int j = (i + 1) % c.points.size();
+        hull_vertices = points;
+        return;
+    }
 
-        const geo::Vec2f& p1 = c.points[i];
-        const geo::Vec2f& p2 = c.points[j];
+    // Incremental convex hull, starting with a tetrahedron of (nearly) extreme points
+
+    geo::Vector3 p_min = points[0];
+    geo::Vector3 p_max = points[0];
+    unsigned int i1 = 0;
+    for(unsigned int i = 1; i < points.size(); ++i)
+    {
+        const geo::Vector3& p = points[i];
+        if (p.x < p_min.x)
+        {
+            p_min.x = p.x;
+            i1 = i;
+        }
+        p_min.y = std::min(p_min.y, p.y);
+        p_min.z = std::min(p_min.z, p.z);
+        p_max.x = std::max(p_max.x, p.x);
+        p_max.y = std::max(p_max.y, p.y);
+        p_max.z = std::max(p_max.z, p.z);
+    }
 
-        c.area += 0.5 * (p1.x * p2.y - p2.x * p1.y);
+    // Points closer than this to a face are considered to lie inside the hull
+    double eps = 1e-6 * (p_max - p_min).length();
+
+    // Farthest point from the first one
+    unsigned int i2 = i1;
+    double d_max = 0;
+    for(unsigned int i = 0; i < points.size(); ++i)
+    {
+        double d = (points[i] - points[i1]).length2();
+        if (d > d_max)
+        {
+            d_max = d;
+            i2 = i;
+        }
     }
+
+    // Farthest point from the line through both
+    geo::Vector3 dir = points[i2] - points[i1];
+    unsigned int i3 = i1;
+    d_max = 0;
+    for(unsigned int i = 0; i < points.size(); ++i)
+    {
+        double d = (points[i] - points[i1]).cross(dir).length2();
+        if (d > d_max)
+        {
+            d_max = d;
+            i3 = i;
+        }
+    }
+
+    // Farthest point from the plane through all three
+    geo::Vector3 n = dir.cross(points[i3] - points[i1]);
+    unsigned int i4 = i1;
+    d_max = 0;
+    for(unsigned int i = 0; i < points.size(); ++i)
+    {
+        double d = std::abs(n.dot(points[i] - points[i1]));
+        if (d > d_max)
+        {
+            d_max = d;
+            i4 = i;
+        }
+    }
+
+    if (eps == 0 || d_max <= eps * n.length())
+    {
+        // The points do not span a volume
+        hull_vertices = points;
+        return;
+    }
+
+    // Orient the tetrahedron such that all faces point outwards
+    if (n.dot(points[i4] - points[i1]) > 0)
+        std::swap(i2, i3);
+
+    std::vector<HullFace> faces;
+    faces.push_back(HullFace(points, i1, i2, i3));
+    faces.push_back(HullFace(points, i1, i4, i2));
+    faces.push_back(HullFace(points, i2, i4, i3));
+    faces.push_back(HullFace(points, i3, i4, i1));
+
+    for(unsigned int j = 0; j < 4; ++j)
+    {
+        for(unsigned int k = 0; k < 3; ++k)
+        {
+            unsigned int a = faces[j].v[k];
+            unsigned int b = faces[j].v[(k + 1) % 3];
+            for(unsigned int j2 = 0; j2 < 4; ++j2)
+            {
+                for(unsigned int k2 = 0; k2 < 3; ++k2)
+                {
+                    if (faces[j2].v[k2] == b && faces[j2].v[(k2 + 1) % 3] == a)
+                        faces[j].adjacent[k] = j2;
+                }
+            }
+        }
+    }
+
+    for(unsigned int i = 0; i < points.size(); ++i)
+        assignToFace(points, i, eps, faces, 0, 4);
+
+    // Quickhull: repeatedly add the farthest outside point of a face to the hull, replacing all faces that
+    // can be seen from it. Only the outside points of those faces have to be checked against the new ones
+
+    std::vector<unsigned int> open_faces;
+    for(unsigned int j = 0; j < 4; ++j)
+        open_faces.push_back(j);
+
+    std::vector<unsigned int> visible;
+    std::vector<std::pair<unsigned int, unsigned int> > horizon; // (visible face, edge index)
+    std::map<unsigned int, unsigned int> face_from, face_to;     // new face per horizon edge start and end
+
+    while (!open_faces.empty())
+    {
+        unsigned int f_idx = open_faces.back();
+        open_faces.pop_back();
+
+        if (!faces[f_idx].alive || faces[f_idx].outside.empty())
+            continue;
+
+        // Farthest point outside this face is certainly a vertex of the hull
+        unsigned int p_idx = faces[f_idx].outside.front();
+        double d_max = faces[f_idx].distance(points[p_idx]);
+        for(std::vector<unsigned int>::const_iterator it = faces[f_idx].outside.begin(); it != faces[f_idx].outside.end(); ++it)
+        {
+            double d = faces[f_idx].distance(points[*it]);
+            if (d > d_max)
+            {
+                d_max = d;
+                p_idx = *it;
+            }
+        }
+
+        const geo::Vector3& p = points[p_idx];
+
+        // Find all faces visible from p, starting at this one, and the horizon around them
+        visible.clear();
+        horizon.clear();
+        visible.push_back(f_idx);
+        faces[f_idx].alive = false;
+        for(unsigned int j = 0; j < visible.size(); ++j)
+        {
+            for(unsigned int k = 0; k < 3; ++k)
+            {
+                unsigned int adj_idx = faces[visible[j]].adjacent[k];
+                HullFace& adj = faces[adj_idx];
+                if (!adj.alive)
+                    continue; // Already found visible
+
+                if (adj.distance(p) > eps * adj.length)
+                {
+                    adj.alive = false;
+                    visible.push_back(adj_idx);
+                }
+                else
+                    horizon.push_back(std::make_pair(visible[j], k));
+            }
+        }
+
+        // A face found visible after its neighbor already took it as horizon would break the hull. Due
+        // to rounding this could in theory happen; in that case, fall back to all points
+        for(std::vector<std::pair<unsigned int, unsigned int> >::const_iterator it = horizon.begin(); it != horizon.end(); ++it)
+        {
+            if (!faces[faces[it->first].adjacent[it->second]].alive)
+            {
+                hull_vertices = points;
+                return;
+            }
+        }
+
+        // Connect p to the horizon
+        unsigned int first_new = faces.size();
+        face_from.clear();
+        face_to.clear();
+        for(std::vector<std::pair<unsigned int, unsigned int> >::const_iterator it = horizon.begin(); it != horizon.end(); ++it)
+        {
+            unsigned int a = faces[it->first].v[it->second];
+            unsigned int b = faces[it->first].v[(it->second + 1) % 3];
+            unsigned int adj_idx = faces[it->first].adjacent[it->second];
+
+            unsigned int new_idx = faces.size();
+            faces.push_back(HullFace(points, a, b, p_idx));
+            faces.back().adjacent[0] = adj_idx;
+
+            HullFace& adj = faces[adj_idx];
+            for(unsigned int k = 0; k < 3; ++k)
+            {
+                if (adj.adjacent[k] == it->first && adj.v[k] == b)
+                    adj.adjacent[k] = new_idx;
+            }
+
+            if (!face_from.insert(std::make_pair(a, new_idx)).second || !face_to.insert(std::make_pair(b, new_idx)).second)
+            {
+                // The horizon is not a single loop (see above)
+                hull_vertices = points;
+                return;
+            }
+        }
+
+        for(unsigned int j = first_new; j < faces.size(); ++j)
+        {
+            HullFace& f = faces[j];
+            f.adjacent[1] = face_from[f.v[1]];  // edge b -> p
+            f.adjacent[2] = face_to[f.v[0]];    // edge p -> a
+        }
+
+        // Distribute the outside points of the removed faces over the new ones
+        for(std::vector<unsigned int>::const_iterator it = visible.begin(); it != visible.end(); ++it)
+        {
+            std::vector<unsigned int> outside;
+            outside.swap(faces[*it].outside);
+            for(std::vector<unsigned int>::const_iterator it2 = outside.begin(); it2 != outside.end(); ++it2)
+            {
+                if (*it2 != p_idx)
+                    assignToFace(points, *it2, eps, faces, first_new, faces.size());
+            }
+        }
+
+        for(unsigned int j = first_new; j < faces.size(); ++j)
+        {
+            if (!faces[j].outside.empty())
+                open_faces.push_back(j);
+        }
+    }
+
+    std::set<unsigned int> vertex_indices;
+    for(std::vector<HullFace>::const_iterator it = faces.begin(); it != faces.end(); ++it)
+    {
+        if (it->alive)
+            vertex_indices.insert(it->v, it->v + 3);
+    }
+
+    hull_vertices.reserve(vertex_indices.size());
+    for(std::set<unsigned int>::const_iterator it = vertex_indices.begin(); it != vertex_indices.end(); ++it)
+        hull_vertices.push_back(points[*it]);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+const char* instructionSet()
+{
+    return kernels::get().name;
 }
 
 // ----------------------------------------------------------------------------------------------------
@@ -0,0 +1,348 @@
+#include "convex_hull_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#define ED_CONVEX_HULL_X86
+#include <immintrin.h>
+#endif
+
+namespace ed
+{
+
+namespace convex_hull
+{
+
+namespace kernels
+{
+
+namespace
+{
+
+// All kernels compute the same expressions in the same order (no fused multiply-add), such that projections,
+// edges and normals are equal for every instruction set. Only the summation order of crossSum differs
+
+void projectMinMaxScalar(const float* xs, const float* ys, std::size_t stride, float ox, float oy, float nx, float ny,
+                         float& min, float& max)
+{
+    float lo = (xs[0] - ox) * nx + (ys[0] - oy) * ny;
+    float hi = lo;
+    for(std::size_t i = 1; i < stride; ++i)
+    {
+        float p = (xs[i] - ox) * nx + (ys[i] - oy) * ny;
+        lo = std::min(lo, p);
+        hi = std::max(hi, p);
+    }
+
+    min = lo;
+    max = hi;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// Edges and normals for i in [begin, n)
+void edgesAndNormalsTail(const float* xs, const float* ys, std::size_t begin, std::size_t n,
+                         float* ex, float* ey, float* nx, float* ny)
+{
+    for(std::size_t i = begin; i < n; ++i)
+    {
+        ex[i] = xs[i + 1] - xs[i];
+        ey[i] = ys[i + 1] - ys[i];
+
+        float length = std::sqrt(ey[i] * ey[i] + ex[i] * ex[i]);
+        nx[i] = ey[i] / length;
+        ny[i] = -ex[i] / length;
+    }
+}
+
+void edgesAndNormalsScalar(const float* xs, const float* ys, std::size_t n, std::size_t /*stride*/,
+                           float* ex, float* ey, float* nx, float* ny)
+{
+    edgesAndNormalsTail(xs, ys, 0, n, ex, ey, nx, ny);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+float crossSumScalar(const float* xs, const float* ys, std::size_t n, std::size_t /*stride*/)
+{
+    float sum = 0;
+    for(std::size_t i = 0; i < n; ++i)
+        sum += xs[i] * ys[i + 1] - xs[i + 1] * ys[i];
+    return sum;
+}
+
+#ifdef ED_CONVEX_HULL_X86
+
+// ----------------------------------------------------------------------------------------------------
+//
+//                                                SSE2
+//
+// ----------------------------------------------------------------------------------------------------
+
+inline float horizontalMin(__m128 v)
+{
+    v = _mm_min_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_min_ss(v, _mm_shuffle_ps(v, v, 1));
+    return _mm_cvtss_f32(v);
+}
+
+inline float horizontalMax(__m128 v)
+{
+    v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_max_ss(v, _mm_shuffle_ps(v, v, 1));
+    return _mm_cvtss_f32(v);
+}
+
+inline float horizontalSum(__m128 v)
+{
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+    return _mm_cvtss_f32(v);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void projectMinMaxSSE2(const float* xs, const float* ys, std::size_t stride, float ox, float oy, float nx, float ny,
+                       float& min, float& max)
+{
+    __m128 vox = _mm_set1_ps(ox);
+    __m128 voy = _mm_set1_ps(oy);
+    __m128 vnx = _mm_set1_ps(nx);
+    __m128 vny = _mm_set1_ps(ny);
+
+    __m128 vmin = _mm_set1_ps(std::numeric_limits<float>::infinity());
+    __m128 vmax = _mm_set1_ps(-std::numeric_limits<float>::infinity());
+    for(std::size_t i = 0; i < stride; i += 4)
+    {
+        __m128 p = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(xs + i), vox), vnx),
+                              _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(ys + i), voy), vny));
+        vmin = _mm_min_ps(vmin, p);
+        vmax = _mm_max_ps(vmax, p);
+    }
+
+    min = horizontalMin(vmin);
+    max = horizontalMax(vmax);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void edgesAndNormalsSSE2(const float* xs, const float* ys, std::size_t n, std::size_t stride,
+                         float* ex, float* ey, float* nx, float* ny)
+{
+    // Reads point i + 4, so stop before the end of the arrays and do the rest in scalar code
+    std::size_t i = 0;
+    for(; i < n && i + 4 < stride; i += 4)
+    {
+        __m128 vex = _mm_sub_ps(_mm_loadu_ps(xs + i + 1), _mm_loadu_ps(xs + i));
+        __m128 vey = _mm_sub_ps(_mm_loadu_ps(ys + i + 1), _mm_loadu_ps(ys + i));
+        __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(vey, vey), _mm_mul_ps(vex, vex)));
+
+        _mm_storeu_ps(ex + i, vex);
+        _mm_storeu_ps(ey + i, vey);
+        _mm_storeu_ps(nx + i, _mm_div_ps(vey, length));
+        _mm_storeu_ps(ny + i, _mm_div_ps(_mm_xor_ps(vex, _mm_set1_ps(-0.0f)), length));
+    }
+
+    edgesAndNormalsTail(xs, ys, i, n, ex, ey, nx, ny);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+float crossSumSSE2(const float* xs, const float* ys, std::size_t n, std::size_t stride)
+{
+    // Reads point i + 4 as well (see edgesAndNormalsSSE2)
+    __m128 sum = _mm_setzero_ps();
+    std::size_t i = 0;
+    for(; i < n && i + 4 < stride; i += 4)
+    {
+        sum = _mm_add_ps(sum, _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(xs + i), _mm_loadu_ps(ys + i + 1)),
+                                         _mm_mul_ps(_mm_loadu_ps(xs + i + 1), _mm_loadu_ps(ys + i))));
+    }
+
+    float s = horizontalSum(sum);
+    for(; i < n; ++i)
+        s += xs[i] * ys[i + 1] - xs[i + 1] * ys[i];
+    return s;
+}
+
+// ----------------------------------------------------------------------------------------------------
+//
+//                                                AVX
+//
+// ----------------------------------------------------------------------------------------------------
+
+// Compiled for AVX regardless of the compiler flags, and only used if the CPU supports it
+
+__attribute__((target("avx")))
+void projectMinMaxAVX(const float* xs, const float* ys, std::size_t stride, float ox, float oy, float nx, float ny,
+                      float& min, float& max)
+{
+    __m256 vox = _mm256_set1_ps(ox);
+    __m256 voy = _mm256_set1_ps(oy);
+    __m256 vnx = _mm256_set1_ps(nx);
+    __m256 vny = _mm256_set1_ps(ny);
+
+    __m256 vmin = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+    __m256 vmax = _mm256_set1_ps(-std::numeric_limits<float>::infinity());
+    for(std::size_t i = 0; i < stride; i += 8)
+    {
+        __m256 p = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(xs + i), vox), vnx),
+                                 _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(ys + i), voy), vny));
+        vmin = _mm256_min_ps(vmin, p);
+        vmax = _mm256_max_ps(vmax, p);
+    }
+
+    min = horizontalMin(_mm_min_ps(_mm256_castps256_ps128(vmin), _mm256_extractf128_ps(vmin, 1)));
+    max = horizontalMax(_mm_max_ps(_mm256_castps256_ps128(vmax), _mm256_extractf128_ps(vmax, 1)));
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+__attribute__((target("avx")))
+void edgesAndNormalsAVX(const float* xs, const float* ys, std::size_t n, std::size_t stride,
+                        float* ex, float* ey, float* nx, float* ny)
+{
+    std::size_t i = 0;
+    for(; i < n && i + 8 < stride; i += 8)
+    {
+        __m256 vex = _mm256_sub_ps(_mm256_loadu_ps(xs + i + 1), _mm256_loadu_ps(xs + i));
+        __m256 vey = _mm256_sub_ps(_mm256_loadu_ps(ys + i + 1), _mm256_loadu_ps(ys + i));
+        __m256 length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(vey, vey), _mm256_mul_ps(vex, vex)));
+
+        _mm256_storeu_ps(ex + i, vex);
+        _mm256_storeu_ps(ey + i, vey);
+        _mm256_storeu_ps(nx + i, _mm256_div_ps(vey, length));
+        _mm256_storeu_ps(ny + i, _mm256_div_ps(_mm256_xor_ps(vex, _mm256_set1_ps(-0.0f)), length));
+    }
+
+    edgesAndNormalsTail(xs, ys, i, n, ex, ey, nx, ny);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+__attribute__((target("avx")))
+float crossSumAVX(const float* xs, const float* ys, std::size_t n, std::size_t stride)
+{
+    __m256 sum = _mm256_setzero_ps();
+    std::size_t i = 0;
+    for(; i < n && i + 8 < stride; i += 8)
+    {
+        sum = _mm256_add_ps(sum, _mm256_sub_ps(_mm256_mul_ps(_mm256_loadu_ps(xs + i), _mm256_loadu_ps(ys + i + 1)),
+                                               _mm256_mul_ps(_mm256_loadu_ps(xs + i + 1), _mm256_loadu_ps(ys + i))));
+    }
+
+    float s = horizontalSum(_mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1)));
+    for(; i < n; ++i)
+        s += xs[i] * ys[i + 1] - xs[i + 1] * ys[i];
+    return s;
+}
+
+#endif
+
+// ----------------------------------------------------------------------------------------------------
+
+Kernels makeKernels(const char* name)
+{
+    Kernels k;
+    k.projectMinMax = projectMinMaxScalar;
+    k.edgesAndNormals = edgesAndNormalsScalar;
+    k.crossSum = crossSumScalar;
+    k.name = "scalar";
+    k.vectorized = false;
+
+#ifdef ED_CONVEX_HULL_X86
+    if (std::strcmp(name, "sse2") == 0)
+    {
+        k.projectMinMax = projectMinMaxSSE2;
+        k.edgesAndNormals = edgesAndNormalsSSE2;
+        k.crossSum = crossSumSSE2;
+        k.name = "sse2";
+        k.vectorized = true;
+    }
+    else if (std::strcmp(name, "avx") == 0)
+    {
+        k.projectMinMax = projectMinMaxAVX;
+        k.edgesAndNormals = edgesAndNormalsAVX;
+        k.crossSum = crossSumAVX;
+        k.name = "avx";
+        k.vectorized = true;
+    }
+#endif
+
+    return k;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool supported(const char* name)
+{
+    if (std::strcmp(name, "scalar") == 0)
+        return true;
+
+#ifdef ED_CONVEX_HULL_X86
+    if (std::strcmp(name, "sse2") == 0)
+        return true;
+
+    __builtin_cpu_init();
+    if (std::strcmp(name, "avx") == 0)
+        return __builtin_cpu_supports("avx");
+#endif
+
+    return false;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+Kernels select()
+{
+    const char* limit = std::getenv("ED_CONVEX_HULL_KERNELS");
+    if (limit && std::strcmp(limit, "scalar") == 0)
+        return makeKernels("scalar");
+
+    if (limit && std::strcmp(limit, "sse2") == 0)
+        return makeKernels(supported("sse2") ? "sse2" : "scalar");
+
+    if (supported("avx"))
+        return makeKernels("avx");
+
+    return makeKernels(supported("sse2") ? "sse2" : "scalar");
+}
+
+} // end anonymous namespace
+
+// ----------------------------------------------------------------------------------------------------
+
+const Kernels& get()
+{
+    static const Kernels kernels = select();
+    return kernels;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+const Kernels* get(const char* name)
+{
+    static const Kernels scalar = makeKernels("scalar");
+    static const Kernels sse2 = makeKernels("sse2");
+    static const Kernels avx = makeKernels("avx");
+
+    if (!supported(name))
+        return 0;
+
+    if (std::strcmp(name, "sse2") == 0)
+        return &sse2;
+    else if (std::strcmp(name, "avx") == 0)
+        return &avx;
+    else
+        return &scalar;
+}
+
+} // end namespace kernels
+
+} // end namespace convex_hull
+
+} // end namespace ed
@@ -0,0 +1,57 @@
+#ifndef ED_CONVEX_HULL_KERNELS_H_
+#define ED_CONVEX_HULL_KERNELS_H_
+
+#include <cstddef>
+
+namespace ed
+{
+
+namespace convex_hull
+{
+
+namespace kernels
+{
+
+// The kernels work on polygons stored as a structure of arrays: all x-coordinates, followed by all y-coordinates.
+// Each array holds the n points, then the first point again (to close the polygon), and is padded with copies of
+// the first point up to 'stride' floats, a multiple of PADDING. That way the kernels never need a masked tail:
+// the padding does not change projection ranges, and adds zero-length edges to the polygon
+
+const std::size_t PADDING = 8;
+
+inline std::size_t stride(std::size_t n) { return (n + PADDING) / PADDING * PADDING; }
+
+struct Kernels
+{
+    // Range of the projections of the points (x - ox, y - oy) on the vector (nx, ny)
+    void (*projectMinMax)(const float* xs, const float* ys, std::size_t stride, float ox, float oy, float nx, float ny,
+                          float& min, float& max);
+
+    // Edges (from point i to i + 1) and their unit normals, for i < n. The output arrays must hold 'stride' floats
+    void (*edgesAndNormals)(const float* xs, const float* ys, std::size_t n, std::size_t stride,
+                            float* ex, float* ey, float* nx, float* ny);
+
+    // Twice the signed area (sum of the cross products of consecutive points)
+    float (*crossSum)(const float* xs, const float* ys, std::size_t n, std::size_t stride);
+
+    const char* name;
+
+    // False for the scalar fallback. Callers that can stop projecting early (such as collide) should do so instead
+    bool vectorized;
+};
+
+// Kernels for the best instruction set the CPU supports. Chosen on the first call; the environment variable
+// ED_CONVEX_HULL_KERNELS ("scalar" or "sse2") can be used to choose a lower instruction set
+const Kernels& get();
+
+// Kernels for the given instruction set ("avx", "sse2" or "scalar"), or 0 if the CPU does not support it (e.g., to
+// check that all instruction sets give the same results)
+const Kernels* get(const char* name);
+
+} // end namespace kernels
+
+} // end namespace convex_hull
+
+} // end namespace ed
+
+#endif
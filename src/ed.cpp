@@ -113,7 +113,8 @@ bool srvReset(ed_msgs::Reset::Request& req, ed_msgs::Reset::Response& res)
 
 bool srvUpdate(ed_msgs::UpdateSrv::Request& req, ed_msgs::UpdateSrv::Response& res)
 {
-    ed::io::JSONReader r(req.request.c_str());
+    // Parse in the request itself, which is not used afterwards
+    ed::io::JSONReader r(&req.request[0], ed::io::JSONReader::IN_SITU);
 
     if (!r.ok())
     {
@@ -243,7 +244,7 @@ bool srvQuery(ed_msgs::Query::Request& req, ed_msgs::Query::Response& res)
     timer.start();
 
     // Set of queried ids
-    std::set<std::string> ids(req.ids.begin(), req.ids.end());
+    std::set<ed::UUID> ids(req.ids.begin(), req.ids.end());
 
     // convert property names to indexes
     std::vector<ed::Idx> property_idxs;
@@ -254,143 +255,18 @@ bool srvQuery(ed_msgs::Query::Request& req, ed_msgs::Query::Response& res)
             property_idxs.push_back(entry->idx);
     }
 
-    const std::vector<unsigned long>& entity_revs = ed_wm->world_model()->entity_revisions();
-    const std::vector<ed::EntityConstPtr>&  entities = ed_wm->world_model()->entities();
+    // Take the world model once, such that the revision matches the written entities
+    ed::WorldModelConstPtr wm = ed_wm->world_model();
 
-    std::vector<std::string> removed_entities;
+    // Write directly into the response
+    ed::io::JSONWriter w(res.human_readable);
 
-    std::stringstream out;
-    ed::io::JSONWriter w(out);
-
-    w.writeArray("entities");
-
-    for(ed::Idx i = 0; i < entity_revs.size(); ++i)
-    {
-        if (req.since_revision >= entity_revs[i])
-            continue;
-
-        const ed::EntityConstPtr& e = entities[i];
-        if (!e)
-            continue;
-
-        if (!ids.empty() && ids.find(e->id().str()) == ids.end())
-            continue;
-
-        if (e)
-        {
-            w.addArrayItem();
-            w.writeValue("id", e->id().str());
-            w.writeValue("idx", (int)i);
-
-            // Write type
-            w.writeValue("type", e->type());
-
-            w.writeValue("existence_prob", e->existenceProbability());
-
-            w.writeGroup("timestamp");
-            {
-                ed::serializeTimestamp(e->lastUpdateTimestamp(), w);
-                w.endGroup();
-            }
-
-            // Write convex hull
-            if (!e->convexHull().points.empty() && ed_wm->world_model()->entity_shape_revisions()[i] > req.since_revision)
-            {
-                w.writeGroup("convex_hull");
-                ed::serialize(e->convexHull(), w);
-                w.endGroup();
-            }
-
-            // Pose
-            if (e->has_pose())
-            {
-                w.writeGroup("pose");
-                ed::serialize(e->pose(), w);
-                w.endGroup();
-            }
-
-            // Mesh
-            if (e->shape() && ed_wm->world_model()->entity_shape_revisions()[i] > req.since_revision)
-            {
-                w.writeGroup("mesh");
-                ed::serialize(*e->shape(), w);
-                w.endGroup();
-            }
-
-            // Data
-            if (!e->data().empty())
-            {
-                tue::config::YAMLEmitter emitter;
-                std::stringstream out;
-                emitter.emit(e->data(), out);
-
-                std::string data_str = out.str();
-
-                std::replace(data_str.begin(), data_str.end(), '"', '|');
-                std::replace(data_str.begin(), data_str.end(), '\n', '^');
-
-                w.writeValue("data", data_str);
-            }
-
-            w.writeArray("properties");
-
-            const std::map<ed::Idx, ed::Property>& properties = e->properties();
-
-            if (req.properties.empty())
-            {
-                for(std::map<ed::Idx, ed::Property>::const_iterator it = properties.begin(); it != properties.end(); ++it)
-                {
-                    const ed::Property& prop = it->second;
-                    if (req.since_revision < prop.revision && prop.entry->info->serializable())
-                    {
-                        w.addArrayItem();
-                        w.writeValue("name", prop.entry->name);
-                        prop.entry->info->serialize(prop.value, w);
-                        w.endArrayItem();
-                    }
-                }
-            }
-            else
-            {
-                for(std::vector<ed::Idx>::const_iterator it = property_idxs.begin(); it != property_idxs.end(); ++it)
-                {
-                    std::map<ed::Idx, ed::Property>::const_iterator it_prop = properties.find(*it);
-                    if (it_prop != properties.end())
-                    {
-                        const ed::Property& prop = it_prop->second;
-                        if (req.since_revision < prop.revision && prop.entry->info->serializable())
-                        {
-                            w.addArrayItem();
-                            w.writeValue("name", prop.entry->name);
-                            prop.entry->info->serialize(prop.value, w);
-                            w.endArrayItem();
-                        }
-                    }
-                }
-            }
-
-            w.endArray();
-
-            w.endArrayItem();
-        }
-        else
-        {
-            // Was removed
-            removed_entities.push_back(e->id().str());
-        }
-    }
-
-//    std::cout << out.str() << std::endl;
-
-    w.endArray();
-
-    if (!removed_entities.empty())
-        w.writeValue("removed_entities", &removed_entities[0], removed_entities.size());
+    // Only visits the entities changed after the given revision, and reports the removed ones
+    ed::serialize(*wm, w, req.since_revision, ids, property_idxs);
 
     w.finish();
 
-    res.human_readable = out.str();
-    res.new_revision = ed_wm->world_model()->revision();
+    res.new_revision = wm->revision();
 
 //    std::cout << "[ED] Quering took " << timer.getElapsedTimeInMilliSec() << " ms." << std::endl;
 
@@ -405,10 +281,31 @@ bool srvSimpleQuery(ed_msgs::SimpleQuery::Request& req, ed_msgs::SimpleQuery::Re
     geo::Vector3 center_point;
     geo::convert(req.center_point, center_point);
 
-    for(ed::WorldModel::const_iterator it = ed_wm->world_model()->begin(); it != ed_wm->world_model()->end(); ++it)
+    ed::WorldModelConstPtr wm = ed_wm->world_model();
+
+    // With a radius, only visit the entities near the center point, and with a type only the entities of that type
+    std::vector<ed::EntityConstPtr> candidates;
+    if (radius > 0)
+    {
+        std::vector<ed::Idx> idxs;
+        wm->queryRadius(geo::Vec2(center_point.x, center_point.y), radius, idxs);
+        for(std::vector<ed::Idx>::const_iterator it = idxs.begin(); it != idxs.end(); ++it)
+            candidates.push_back(wm->entities()[*it]);
+    }
+    else if (!req.type.empty() && req.type != "unknown")
+    {
+        const ed::world_model::IdxSet& idxs = wm->entitiesWithType(req.type);
+        for(ed::world_model::IdxSet::const_iterator it = idxs.begin(); it != idxs.end(); ++it)
+            candidates.push_back(wm->entities()[*it]);
+    }
+    else
     {
-//        std::cout << it->first << std::endl;
+        for(ed::WorldModel::const_iterator it = wm->begin(); it != wm->end(); ++it)
+            candidates.push_back(*it);
+    }
 
+    for(std::vector<ed::EntityConstPtr>::const_iterator it = candidates.begin(); it != candidates.end(); ++it)
+    {
         const ed::EntityConstPtr& e = *it;
         if (!req.id.empty() && e->id() != ed::UUID(req.id))
             continue;
@@ -670,14 +567,12 @@ int main(int argc, char** argv)
     ed::EventClock trigger_config(10);
     ed::EventClock trigger_ed(10);
     ed::EventClock trigger_stats(2);
-    ed::EventClock trigger_plugins(1000);
     ed::EventClock trigger_cb(100);
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
     errc.change("ED server", "main loop");
 
-    ros::Rate r(1000);
     while(ros::ok()) {
 
         if (trigger_cb.triggers())
@@ -690,13 +585,16 @@ int main(int argc, char** argv)
         if (trigger_ed.triggers())
             ed_wm->update();
 
-        if (trigger_plugins.triggers())
-            ed_wm->stepPlugins();
+        // Handle all pending plugin update requests
+        ed_wm->stepPlugins();
 
         if (trigger_stats.triggers())
             ed_wm->publishStatistics();
 
-        r.sleep();
+        // Sleep until one of the clocks triggers, or until a plugin posts an update request
+        double t_wait = std::min(std::min(trigger_cb.timeUntilTrigger(), trigger_config.timeUntilTrigger()),
+                                 std::min(trigger_ed.timeUntilTrigger(), trigger_stats.timeUntilTrigger()));
+        ed_wm->waitForUpdateRequests(t_wait);
     }
 
     return 0;
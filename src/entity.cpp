@@ -8,6 +8,13 @@
 
 #include "ed/convex_hull_calc.h"
 
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/lock_guard.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/functional/hash.hpp>
+
+#include <cstring>
+
 // ----------------------------------------------------------------------------------------------------
 
 namespace ed
@@ -25,8 +32,7 @@ Entity::Entity(const UUID& id, const TYPE& type, const unsigned int& measurement
     measurements_seq_(0),
     shape_revision_(0),
 //    creation_time_(creation_time),
-    has_pose_(false),
-    pose_(geo::Pose3D::identity())
+    has_pose_(false)
 {
 }
 
@@ -39,32 +45,205 @@ Entity::~Entity()
 
 // ----------------------------------------------------------------------------------------------------
 
-void Entity::updateConvexHull()
+namespace
 {
-    if (convex_hull_map_.empty())
+
+// Striped locks for the lazy convex hull calculation, such that entities do not need a mutex each
+const std::size_t NUM_GEOMETRY_MUTEXES = 64;
+boost::mutex geometry_mutexes[NUM_GEOMETRY_MUTEXES];
+
+boost::mutex& geometryMutex(const void* p)
+{
+    return geometry_mutexes[((std::size_t)p >> 4) % NUM_GEOMETRY_MUTEXES];
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+typedef boost::shared_ptr<const std::vector<geo::Vector3> > VerticesConstPtr;
+
+// Fingerprint of the mesh points. Shapes may be changed in place (geo::Shape::setMesh), and geolib does not keep
+// a revision, so this tells whether vertices calculated earlier still belong to the shape. It is calculated when
+// the shape is set, not each time the convex hull is calculated
+std::size_t meshFingerprint(const std::vector<geo::Vector3>& points)
+{
+    std::size_t num_bytes = points.size() * sizeof(geo::Vector3);
+    const unsigned char* bytes = num_bytes > 0 ? reinterpret_cast<const unsigned char*>(&points[0]) : 0;
+
+    std::size_t seed = num_bytes;
+    std::size_t i = 0;
+    for(; i + sizeof(std::size_t) <= num_bytes; i += sizeof(std::size_t))
     {
-        convex_hull_new_.points.clear();
-        return;
+        std::size_t word;
+        std::memcpy(&word, bytes + i, sizeof(word));
+        boost::hash_combine(seed, word);
     }
 
-    std::map<std::string, MeasurementConvexHull>::const_iterator it = convex_hull_map_.begin();
-    const MeasurementConvexHull& m = it->second;
+    for(; i < num_bytes; ++i)
+        boost::hash_combine(seed, bytes[i]);
+
+    return seed;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+struct ShapeHull
+{
+    std::size_t fingerprint;
+    VerticesConstPtr vertices;
+};
+
+// Convex hull vertices per shape, such that entities using the same shape (e.g., instances of a model) share
+// them. The fingerprint of the mesh is stored with them, as the shape may have changed since. The weak pointers
+// are compared by ownership, so a new shape at the address of a deleted one is not mixed up
+boost::mutex shape_hull_mutex;
+std::map<boost::weak_ptr<const geo::Shape>, ShapeHull> shape_hull_cache;
+std::size_t shape_hull_cache_prune_size = 64;
+
+VerticesConstPtr shapeHullVertices(const geo::ShapeConstPtr& shape, std::size_t fingerprint)
+{
+    boost::weak_ptr<const geo::Shape> key(shape);
 
-    if (convex_hull_map_.size() == 1)
     {
-        convex_hull_new_ = m.convex_hull;
-        pose_ = m.pose;
+        boost::lock_guard<boost::mutex> lg(shape_hull_mutex);
+        std::map<boost::weak_ptr<const geo::Shape>, ShapeHull>::const_iterator it = shape_hull_cache.find(key);
+        if (it != shape_hull_cache.end() && it->second.fingerprint == fingerprint)
+            return it->second.vertices;
+    }
+
+    // Calculate without holding the lock, other threads may need other shapes
+    boost::shared_ptr<std::vector<geo::Vector3> > vertices(new std::vector<geo::Vector3>);
+    convex_hull::calculateHullVertices(shape->getMesh().getPoints(), *vertices);
+
+    boost::lock_guard<boost::mutex> lg(shape_hull_mutex);
+
+    ShapeHull& shape_hull = shape_hull_cache[key];
+
+    // Another thread may have been first
+    if (shape_hull.vertices && shape_hull.fingerprint == fingerprint)
+        return shape_hull.vertices;
+
+    shape_hull.fingerprint = fingerprint;
+    shape_hull.vertices = vertices;
+    VerticesConstPtr result = shape_hull.vertices;
+
+    // Every now and then, remove the vertices of shapes that no longer exist
+    if (shape_hull_cache.size() >= shape_hull_cache_prune_size)
+    {
+        for(std::map<boost::weak_ptr<const geo::Shape>, ShapeHull>::iterator it = shape_hull_cache.begin(); it != shape_hull_cache.end();)
+        {
+            if (it->first.expired())
+                shape_hull_cache.erase(it++);
+            else
+                ++it;
+        }
+
+        shape_hull_cache_prune_size = std::max<std::size_t>(64, 2 * shape_hull_cache.size());
+    }
+
+    return result;
+}
+
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+Entity::Geometry::Geometry(const Geometry& other) : state(UP_TO_DATE)
+{
+    boost::lock_guard<boost::mutex> lg(geometryMutex(&other));
+    state.store(other.state.load(boost::memory_order_relaxed), boost::memory_order_relaxed);
+    convex_hull = other.convex_hull;
+    pose = other.pose;
+    shape_hull_vertices = other.shape_hull_vertices;
+    shape_fingerprint = other.shape_fingerprint;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+Entity::Geometry& Entity::Geometry::operator=(const Geometry& other)
+{
+    if (this == &other)
+        return *this;
+
+    boost::lock_guard<boost::mutex> lg(geometryMutex(&other));
+    state.store(other.state.load(boost::memory_order_relaxed), boost::memory_order_relaxed);
+    convex_hull = other.convex_hull;
+    pose = other.pose;
+    shape_hull_vertices = other.shape_hull_vertices;
+    shape_fingerprint = other.shape_fingerprint;
+    return *this;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void Entity::setConvexHull(const ConvexHull& convex_hull, const geo::Pose3D& pose, double time, const std::string& source)
+{
+    if (convex_hull.points.empty())
+    {
+        // The pose of the pending combination of measurement convex hulls is kept after all are removed
+        if (geometry_.state.load(boost::memory_order_relaxed) == Geometry::FROM_MEASUREMENTS)
+            updateConvexHull();
+
+        // This signals that the measurement convex hull must be removed
+        convex_hull_map_.erase(source);
+    }
+    else
+    {
+        ed::MeasurementConvexHull& m = convex_hull_map_[source];
+        m.convex_hull = convex_hull;
+        m.pose = pose;
+        m.timestamp = time;
+    }
+
+    if (convex_hull_map_.empty())
+    {
+        geometry_.convex_hull.points.clear();
+        geometry_.state.store(Geometry::UP_TO_DATE, boost::memory_order_relaxed);
+    }
+    else if (convex_hull_map_.size() == 1)
+    {
+        const MeasurementConvexHull& m = convex_hull_map_.begin()->second;
+        geometry_.convex_hull = m.convex_hull;
+        geometry_.pose = m.pose;
+        geometry_.state.store(Geometry::UP_TO_DATE, boost::memory_order_relaxed);
         has_pose_ = true;
+    }
+    else
+    {
+        // Combining multiple convex hulls is expensive, so postpone it until the convex hull or pose is needed
+        geometry_.state.store(Geometry::FROM_MEASUREMENTS, boost::memory_order_relaxed);
+        has_pose_ = true;
+    }
+}
 
+// ----------------------------------------------------------------------------------------------------
+
+void Entity::updateConvexHull() const
+{
+    boost::lock_guard<boost::mutex> lg(geometryMutex(&geometry_));
+
+    // Another thread may have been first
+    int state = geometry_.state.load(boost::memory_order_relaxed);
+    if (state == Geometry::FROM_SHAPE)
+        calculateConvexHullFromShape();
+    else if (state == Geometry::FROM_MEASUREMENTS)
+        calculateConvexHullFromMeasurements();
+    else
         return;
-    }
 
-    float z_min = m.convex_hull.z_min + m.pose.t.z;
-    float z_max = m.convex_hull.z_max + m.pose.t.z;
+    geometry_.state.store(Geometry::UP_TO_DATE, boost::memory_order_release);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void Entity::calculateConvexHullFromMeasurements() const
+{
+    std::map<std::string, MeasurementConvexHull>::const_iterator it = convex_hull_map_.begin();
 
-    ++it;
+    float z_min = it->second.convex_hull.z_min + it->second.pose.t.z;
+    float z_max = it->second.convex_hull.z_max + it->second.pose.t.z;
 
-    std::vector<geo::Vec2f> points;
+    // Merge the convex hulls one by one, which is linear in their number of points
+    std::vector<geo::Vec2f> hull, points;
     for(; it != convex_hull_map_.end(); ++it)
     {
         const MeasurementConvexHull& m = it->second;
@@ -73,51 +252,72 @@ void Entity::updateConvexHull()
 
         geo::Vec2f offset(m.pose.t.x, m.pose.t.y);
 
+        points.resize(m.convex_hull.points.size());
         for(unsigned int i = 0; i < m.convex_hull.points.size(); ++i)
-            points.push_back(m.convex_hull.points[i] + offset);
-    }
+            points[i] = m.convex_hull.points[i] + offset;
 
-    ed::convex_hull::create(points, z_min, z_max, convex_hull_new_, pose_);
+        if (hull.empty())
+            hull.swap(points);
+        else
+            convex_hull::mergeHulls(hull, points, hull);
+    }
 
-    has_pose_ = true;
+    convex_hull::createFromHull(hull, z_min, z_max, geometry_.convex_hull, geometry_.pose);
 }
 
 // ----------------------------------------------------------------------------------------------------
 
-void Entity::updateConvexHullFromShape()
+void Entity::calculateConvexHullFromShape() const
 {
-    const std::vector<geo::Vector3>& vertices = shape_->getMesh().getPoints();
+    // Only the vertices of the 3D convex hull of the shape can end up in the convex hull of the entity. They are
+    // calculated once per shape revision (and shared with other entities that have the same shape)
+    if (!geometry_.shape_hull_vertices)
+        geometry_.shape_hull_vertices = shapeHullVertices(shape_, geometry_.shape_fingerprint);
+
+    const std::vector<geo::Vector3>& vertices = *geometry_.shape_hull_vertices;
 
     if (vertices.empty())
         return;
 
+    const geo::Pose3D& pose = geometry_.pose;
+
     float z_min = 1e9;
     float z_max = -1e9;
 
     std::vector<geo::Vec2f> points(vertices.size());
     for(unsigned int i = 0; i < vertices.size(); ++i)
     {
-        geo::Vector3 p_MAP = pose_ * vertices[i];
-        z_min = std::min<float>(z_min, p_MAP.z - pose_.t.z);
-        z_max = std::max<float>(z_max, p_MAP.z - pose_.t.z);
+        geo::Vector3 p_MAP = pose * vertices[i];
+        z_min = std::min<float>(z_min, p_MAP.z - pose.t.z);
+        z_max = std::max<float>(z_max, p_MAP.z - pose.t.z);
 
-        points[i] = geo::Vec2f(p_MAP.x - pose_.t.x, p_MAP.y - pose_.t.y);
+        points[i] = geo::Vec2f(p_MAP.x - pose.t.x, p_MAP.y - pose.t.y);
     }
 
-    convex_hull::createAbsolute(points, z_min, z_max, convex_hull_new_);
+    convex_hull::createAbsolute(points, z_min, z_max, geometry_.convex_hull);
 }
 
 // ----------------------------------------------------------------------------------------------------
 
 void Entity::setShape(const geo::ShapeConstPtr& shape)
 {
-    if (shape_ != shape)
-    {
-        ++shape_revision_;
-        shape_ = shape;
+    std::size_t fingerprint = shape ? meshFingerprint(shape->getMesh().getPoints()) : 0;
 
-        updateConvexHullFromShape();
-    }
+    // Setting the same shape again only counts as a change if its mesh was changed in place
+    if (shape_ == shape && (!shape_ || fingerprint == geometry_.shape_fingerprint))
+        return;
+
+    // Make sure a pending combination of measurement convex hulls is done with the current pose
+    if (geometry_.state.load(boost::memory_order_relaxed) == Geometry::FROM_MEASUREMENTS)
+        updateConvexHull();
+
+    ++shape_revision_;
+    shape_ = shape;
+    geometry_.shape_hull_vertices.reset();
+    geometry_.shape_fingerprint = fingerprint;
+
+    if (shape_)
+        geometry_.state.store(Geometry::FROM_SHAPE, boost::memory_order_relaxed);
 }
 
 // ----------------------------------------------------------------------------------------------------
@@ -0,0 +1,518 @@
+#include "ed/io/binary_reader.h"
+#include "ed/io/binary_format.h"
+
+#include <boost/cstdint.hpp>
+
+#include <cstring>
+
+namespace ed
+{
+
+namespace io
+{
+
+namespace
+{
+
+template<typename UInt>
+inline UInt readLittleEndian(const unsigned char* p)
+{
+    UInt v = 0;
+    for(unsigned int i = sizeof(UInt); i > 0; --i)
+        v = (v << 8) | p[i - 1];
+    return v;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+inline int unzigzag(unsigned long v)
+{
+    return static_cast<int>(static_cast<long>(v >> 1) ^ -static_cast<long>(v & 1));
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+struct Frame
+{
+    Frame(bool is_array_, unsigned int idx_, unsigned int last_item_)
+        : is_array(is_array_), idx(idx_), last_item(last_item_) {}
+
+    bool is_array;
+
+    // Group index, or member index of the array
+    unsigned int idx;
+
+    // Last item of the array
+    unsigned int last_item;
+};
+
+} // end anonymous namespace
+
+// ----------------------------------------------------------------------------------------------------
+
+BinaryReader::BinaryReader(const char* data, std::size_t size)
+    : data_(reinterpret_cast<const unsigned char*>(data)), size_(size), group_(0)
+{
+    if (!parse())
+    {
+        // Do not give access to a partially parsed tree
+        groups_.clear();
+        members_.clear();
+        groups_.push_back(Group(INVALID));
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+BinaryReader::~BinaryReader()
+{
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool BinaryReader::readVarint(std::size_t& pos, unsigned long& v) const
+{
+    v = 0;
+    for(unsigned int shift = 0; shift < 64; shift += 7)
+    {
+        if (pos >= size_)
+            return false;
+
+        unsigned char b = data_[pos++];
+        v |= static_cast<unsigned long>(b & 0x7F) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+
+    return false;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool BinaryReader::skipValue(unsigned char tag, std::size_t& pos) const
+{
+    unsigned long n, v;
+    switch (tag)
+    {
+    case binary::FLOAT:
+        pos += 4;
+        break;
+    case binary::DOUBLE:
+        pos += 8;
+        break;
+    case binary::INT:
+        return readVarint(pos, v);
+    case binary::STRING:
+        if (!readVarint(pos, n) || n > size_)
+            return false;
+        pos += n;
+        break;
+    case binary::FLOAT_ARRAY:
+        if (!readVarint(pos, n) || n > size_)
+            return false;
+        pos += 4 * n;
+        break;
+    case binary::INT_ARRAY:
+        if (!readVarint(pos, n))
+            return false;
+        for(unsigned long i = 0; i < n; ++i)
+        {
+            if (!readVarint(pos, v))
+                return false;
+        }
+        break;
+    case binary::STRING_ARRAY:
+        if (!readVarint(pos, n))
+            return false;
+        for(unsigned long i = 0; i < n; ++i)
+        {
+            if (!readVarint(pos, v) || v > size_)
+                return false;
+            pos += v;
+        }
+        break;
+    default:
+        return false;
+    }
+
+    return pos <= size_;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+unsigned int BinaryReader::addMember(unsigned int group, unsigned int label, unsigned char tag, std::size_t pos)
+{
+    Member m;
+    m.label = label;
+    m.tag = tag;
+    m.next = INVALID;
+    m.pos = pos;
+
+    unsigned int idx = members_.size();
+    members_.push_back(m);
+
+    Group& g = groups_[group];
+    if (g.last == INVALID)
+        g.first = idx;
+    else
+        members_[g.last].next = idx;
+    g.last = idx;
+
+    return idx;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool BinaryReader::parse()
+{
+    groups_.push_back(Group(INVALID));
+
+    if (size_ < 4 || std::memcmp(data_, binary::MAGIC, sizeof(binary::MAGIC)) != 0)
+    {
+        error_ = "Not in ED binary format";
+        return false;
+    }
+
+    if (data_[3] > binary::VERSION)
+    {
+        error_ = "Unsupported ED binary format version";
+        return false;
+    }
+
+    std::size_t pos = 4;
+
+    std::vector<Frame> stack;
+    stack.push_back(Frame(false, 0, INVALID));
+
+    while(!stack.empty())
+    {
+        if (pos >= size_)
+        {
+            error_ = "Unexpected end of data";
+            return false;
+        }
+
+        unsigned char tag = data_[pos++];
+
+        if (tag == binary::END)
+        {
+            stack.pop_back();
+            continue;
+        }
+
+        if (stack.back().is_array)
+        {
+            if (tag != binary::ITEM)
+            {
+                error_ = "Expected array item";
+                return false;
+            }
+
+            // Array items get the group that contains the array as parent
+            unsigned int g = groups_.size();
+            groups_.push_back(Group(stack[stack.size() - 2].idx));
+
+            Frame& frame = stack.back();
+            if (frame.last_item == INVALID)
+                members_[frame.idx].pos = g;
+            else
+                groups_[frame.last_item].next_item = g;
+            frame.last_item = g;
+
+            stack.push_back(Frame(false, g, INVALID));
+            continue;
+        }
+
+        // Key
+        unsigned long key;
+        if (!readVarint(pos, key))
+        {
+            error_ = "Unexpected end of data";
+            return false;
+        }
+
+        unsigned int label;
+        if (key == 0)
+        {
+            unsigned long length;
+            if (!readVarint(pos, length) || length > size_ - pos)
+            {
+                error_ = "Unexpected end of data";
+                return false;
+            }
+
+            label = labels_.size();
+            labels_.push_back(std::string(reinterpret_cast<const char*>(data_ + pos), length));
+            pos += length;
+        }
+        else if (key <= labels_.size())
+        {
+            label = key - 1;
+        }
+        else
+        {
+            error_ = "Invalid label";
+            return false;
+        }
+
+        unsigned int group = stack.back().idx;
+
+        if (tag == binary::GROUP)
+        {
+            unsigned int g = groups_.size();
+            groups_.push_back(Group(group));
+            addMember(group, label, tag, g);
+            stack.push_back(Frame(false, g, INVALID));
+        }
+        else if (tag == binary::ARRAY)
+        {
+            unsigned int m = addMember(group, label, tag, INVALID);
+            stack.push_back(Frame(true, m, INVALID));
+        }
+        else
+        {
+            addMember(group, label, tag, pos);
+            if (!skipValue(tag, pos))
+            {
+                error_ = "Invalid value";
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+const BinaryReader::Member* BinaryReader::find(const std::string& key) const
+{
+    if (group_ == INVALID)
+        return 0;
+
+    for(unsigned int i = groups_[group_].first; i != INVALID; i = members_[i].next)
+    {
+        const Member& m = members_[i];
+        if (labels_[m.label] == key)
+            return &m;
+    }
+
+    return 0;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+float BinaryReader::decodeFloat(std::size_t pos) const
+{
+    boost::uint32_t bits = readLittleEndian<boost::uint32_t>(data_ + pos);
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+double BinaryReader::decodeDouble(std::size_t pos) const
+{
+    boost::uint64_t bits = readLittleEndian<boost::uint64_t>(data_ + pos);
+    double d;
+    std::memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool BinaryReader::readGroup(const std::string& name)
+{
+    const Member* m = find(name);
+    if (!m || m->tag != binary::GROUP)
+        return false;
+
+    group_ = m->pos;
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool BinaryReader::endGroup()
+{
+    if (group_ == INVALID || groups_[group_].parent == INVALID)
+        return false;
+
+    group_ = groups_[group_].parent;
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool BinaryReader::readArray(const std::string& name)
+{
+    const Member* m = find(name);
+    if (!m || m->tag != binary::ARRAY)
+        return false;
+
+    ArrayState s;
+    s.parent = group_;
+    s.next_item = m->pos;
+    array_stack_.push_back(s);
+
+    group_ = INVALID;
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool BinaryReader::endArray()
+{
+    if (array_stack_.empty())
+        return false;
+
+    group_ = array_stack_.back().parent;
+    array_stack_.pop_back();
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool BinaryReader::nextArrayItem()
+{
+    if (array_stack_.empty())
+        return false;
+
+    ArrayState& s = array_stack_.back();
+    group_ = s.next_item;
+
+    if (group_ == INVALID)
+        return false;
+
+    s.next_item = groups_[group_].next_item;
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool BinaryReader::readValue(const std::string& key, float& f)
+{
+    const Member* m = find(key);
+    if (!m)
+        return false;
+
+    if (m->tag == binary::FLOAT)
+        f = decodeFloat(m->pos);
+    else if (m->tag == binary::DOUBLE)
+        f = decodeDouble(m->pos);
+    else
+    {
+        int i;
+        if (!readValue(key, i))
+            return false;
+        f = i;
+    }
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool BinaryReader::readValue(const std::string& key, double& d)
+{
+    const Member* m = find(key);
+    if (!m)
+        return false;
+
+    if (m->tag == binary::DOUBLE)
+        d = decodeDouble(m->pos);
+    else if (m->tag == binary::FLOAT)
+        d = decodeFloat(m->pos);
+    else
+    {
+        int i;
+        if (!readValue(key, i))
+            return false;
+        d = i;
+    }
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool BinaryReader::readValue(const std::string& key, int& i)
+{
+    const Member* m = find(key);
+    if (!m || m->tag != binary::INT)
+        return false;
+
+    std::size_t pos = m->pos;
+    unsigned long v;
+    readVarint(pos, v);
+    i = unzigzag(v);
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool BinaryReader::readValue(const std::string& key, std::string& s)
+{
+    const Member* m = find(key);
+    if (!m || m->tag != binary::STRING)
+        return false;
+
+    std::size_t pos = m->pos;
+    unsigned long length;
+    readVarint(pos, length);
+    s.assign(reinterpret_cast<const char*>(data_ + pos), length);
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool BinaryReader::readValue(const std::string& key, std::vector<float>& fs)
+{
+    const Member* m = find(key);
+    if (!m || m->tag != binary::FLOAT_ARRAY)
+        return false;
+
+    std::size_t pos = m->pos;
+    unsigned long size;
+    readVarint(pos, size);
+    fs.resize(size);
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    // The encoding is the in-memory representation
+    if (size > 0)
+        std::memcpy(&fs[0], data_ + pos, size * sizeof(float));
+#else
+    for(unsigned long i = 0; i < size; ++i)
+        fs[i] = decodeFloat(pos + 4 * i);
+#endif
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool BinaryReader::readValue(const std::string& key, std::vector<int>& is)
+{
+    const Member* m = find(key);
+    if (!m || m->tag != binary::INT_ARRAY)
+        return false;
+
+    std::size_t pos = m->pos;
+    unsigned long size;
+    readVarint(pos, size);
+    is.resize(size);
+
+    for(unsigned long i = 0; i < size; ++i)
+    {
+        unsigned long v;
+        readVarint(pos, v);
+        is[i] = unzigzag(v);
+    }
+
+    return true;
+}
+
+}
+
+} // end namespace ed
@@ -0,0 +1,302 @@
+#include "ed/io/binary_writer.h"
+#include "ed/io/binary_format.h"
+
+#include <boost/cstdint.hpp>
+
+#include <cstring>
+#include <iostream>
+
+namespace ed
+{
+
+namespace io
+{
+
+namespace
+{
+
+// Appends the value in little endian byte order
+template<typename UInt>
+inline void appendLittleEndian(std::string& b, UInt v)
+{
+    for(unsigned int i = 0; i < sizeof(UInt); ++i)
+    {
+        b.push_back(static_cast<char>(v & 0xFF));
+        v >>= 8;
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+inline void appendFloat(std::string& b, float f)
+{
+    boost::uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    appendLittleEndian(b, bits);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+inline void appendDouble(std::string& b, double d)
+{
+    boost::uint64_t bits;
+    std::memcpy(&bits, &d, sizeof(bits));
+    appendLittleEndian(b, bits);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// Maps signed to unsigned integers such that small negative numbers also get a short varint
+inline unsigned long zigzag(int i)
+{
+    return (static_cast<unsigned long>(i) << 1) ^ static_cast<unsigned long>(static_cast<long>(i) >> 31);
+}
+
+} // end anonymous namespace
+
+// ----------------------------------------------------------------------------------------------------
+
+BinaryWriter::BinaryWriter(std::ostream& out)
+    : stream_sink_(out), sink_(&stream_sink_), chunk_size_(DEFAULT_CHUNK_SIZE), buffer_(&own_buffer_)
+{
+    init();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+BinaryWriter::BinaryWriter(OutputSink& sink, std::size_t chunk_size)
+    : stream_sink_(std::cout), sink_(&sink), chunk_size_(chunk_size), buffer_(&own_buffer_)
+{
+    init();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+BinaryWriter::BinaryWriter(std::string& buffer)
+    : stream_sink_(std::cout), sink_(0), chunk_size_(0), buffer_(&buffer)
+{
+    init();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+BinaryWriter::~BinaryWriter()
+{
+    if (sink_)
+        flush();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void BinaryWriter::init()
+{
+    buffer_->clear();
+    if (sink_)
+        buffer_->reserve(chunk_size_ + 256);
+
+    buffer_->append(reinterpret_cast<const char*>(binary::MAGIC), sizeof(binary::MAGIC));
+    buffer_->push_back(binary::VERSION);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void BinaryWriter::flush()
+{
+    if (!buffer_->empty())
+        sink_->write(buffer_->data(), buffer_->size());
+
+    // Keeps the capacity
+    buffer_->clear();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void BinaryWriter::writeVarint(unsigned long v)
+{
+    while (v >= 0x80)
+    {
+        buffer_->push_back(static_cast<char>((v & 0x7F) | 0x80));
+        v >>= 7;
+    }
+    buffer_->push_back(static_cast<char>(v));
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void BinaryWriter::writeString(const std::string& s)
+{
+    writeVarint(s.size());
+    buffer_->append(s);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void BinaryWriter::writeMember(unsigned char tag, const std::string& key)
+{
+    buffer_->push_back(tag);
+
+    std::map<std::string, unsigned int>::iterator it = label_to_index_.lower_bound(key);
+    if (it != label_to_index_.end() && it->first == key)
+    {
+        writeVarint(it->second + 1);
+        return;
+    }
+
+    // First use of this label: add it to the dictionary
+    label_to_index_.insert(it, std::make_pair(key, label_to_index_.size()));
+    writeVarint(0);
+    writeString(key);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void BinaryWriter::close(char type)
+{
+    buffer_->push_back(binary::END);
+    if (type_stack_.empty() || type_stack_.back() != type)
+        std::cout << "BinaryWriter: no " << (type == 'g' ? "group" : (type == 'a' ? "array" : "array item"))
+                  << " to close." << std::endl;
+    else
+        type_stack_.pop_back();
+
+    flushIfFull();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void BinaryWriter::writeGroup(const std::string& name)
+{
+    writeMember(binary::GROUP, name);
+    type_stack_.push_back('g');
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void BinaryWriter::endGroup()
+{
+    close('g');
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void BinaryWriter::writeValue(const std::string& key, float f)
+{
+    writeMember(binary::FLOAT, key);
+    appendFloat(*buffer_, f);
+    flushIfFull();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void BinaryWriter::writeValue(const std::string& key, double d)
+{
+    writeMember(binary::DOUBLE, key);
+    appendDouble(*buffer_, d);
+    flushIfFull();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void BinaryWriter::writeValue(const std::string& key, int i)
+{
+    writeMember(binary::INT, key);
+    writeVarint(zigzag(i));
+    flushIfFull();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void BinaryWriter::writeValue(const std::string& key, const std::string& s)
+{
+    writeMember(binary::STRING, key);
+    writeString(s);
+    flushIfFull();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void BinaryWriter::writeValue(const std::string& key, const float* fs, std::size_t size)
+{
+    writeMember(binary::FLOAT_ARRAY, key);
+    writeVarint(size);
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    // The in-memory representation is the encoding
+    buffer_->append(reinterpret_cast<const char*>(fs), size * sizeof(float));
+#else
+    for(std::size_t i = 0; i < size; ++i)
+        appendFloat(*buffer_, fs[i]);
+#endif
+
+    flushIfFull();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void BinaryWriter::writeValue(const std::string& key, const int* is, std::size_t size)
+{
+    writeMember(binary::INT_ARRAY, key);
+    writeVarint(size);
+    for(std::size_t i = 0; i < size; ++i)
+        writeVarint(zigzag(is[i]));
+    flushIfFull();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void BinaryWriter::writeValue(const std::string& key, const std::string* ss, std::size_t size)
+{
+    writeMember(binary::STRING_ARRAY, key);
+    writeVarint(size);
+    for(std::size_t i = 0; i < size; ++i)
+        writeString(ss[i]);
+    flushIfFull();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void BinaryWriter::writeArray(const std::string& key)
+{
+    writeMember(binary::ARRAY, key);
+    type_stack_.push_back('a');
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void BinaryWriter::addArrayItem()
+{
+    buffer_->push_back(binary::ITEM);
+    type_stack_.push_back('i');
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void BinaryWriter::endArrayItem()
+{
+    close('i');
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void BinaryWriter::endArray()
+{
+    close('a');
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void BinaryWriter::finish()
+{
+    while(!type_stack_.empty())
+        close(type_stack_.back());
+
+    // Close the root group
+    buffer_->push_back(binary::END);
+
+    if (sink_)
+        flush();
+}
+
+}
+
+} // end namespace ed
@@ -1,10 +1,10 @@
 #include "ed/io/json_reader.h"
 
 #include "rapidjson/reader.h"
-#include "ed/io/data_writer.h"
 
-using namespace std;
-using namespace rapidjson;
+#include <algorithm>
+#include <cstring>
+#include <sstream>
 
 namespace ed
 {
@@ -12,124 +12,274 @@ namespace ed
 namespace io
 {
 
+namespace
+{
+
+inline int compareKeys(const char* s1, std::size_t n1, const char* s2, std::size_t n2)
+{
+    int c = std::memcmp(s1, s2, std::min(n1, n2));
+    if (c != 0)
+        return c;
+    return n1 < n2 ? -1 : (n1 > n2 ? 1 : 0);
+}
+
+} // end anonymous namespace
+
 // ----------------------------------------------------------------------------------------------------
 
-struct MyHandler {
+struct JSONReader::Handler
+{
 
-    MyHandler(DataWriter& w_) : w(w_)
+    struct Frame
     {
+        bool is_array;
+
+        // Position in the member or element stack where the members or elements of this object or array start
+        std::size_t start;
+
+        // Object or array index
+        unsigned int idx;
+    };
+
+    // Orders members by key. Keys are in the buffer, so among equal keys the one that came last in the JSON
+    // comes last (and is the one that is found)
+    struct MemberLess
+    {
+        bool operator()(const Member& m1, const Member& m2) const
+        {
+            int c = compareKeys(m1.key, m1.key_length, m2.key, m2.key_length);
+            return c < 0 || (c == 0 && m1.key < m2.key);
+        }
+    };
+
+    Handler(JSONReader& r_) : r(r_), key(0), key_length(0) {}
+
+    bool add(const Value& v)
+    {
+        // The root must be an object
+        if (frames.empty())
+            return false;
+
+        if (frames.back().is_array)
+        {
+            element_stack.push_back(v);
+        }
+        else
+        {
+            Member m;
+            m.key = key;
+            m.key_length = key_length;
+            m.value = v;
+            member_stack.push_back(m);
+        }
+
+        return true;
     }
 
-    bool Null() { return true; }
+    bool Null() { Value v; v.type = NULL_VALUE; return add(v); }
 
-    bool Bool(bool b) { int i = b; w.setValue(key, i); ; return true; }
+    bool Bool(bool b) { return Int(b); }
 
-    bool Int(int i) { w.setValue(key, i); return true; }
+    bool Int(int i) { Value v; v.type = INT; v.i = i; return add(v); }
 
-    bool Uint(unsigned u) { w.setValue(key, (int)u); return true; }
+    bool Uint(unsigned u) { return Int((int)u); }
 
-    bool Int64(int64_t i) { w.setValue(key, (int)i); return true; }
+    bool Int64(int64_t i) { return Int((int)i); }
 
-    bool Uint64(uint64_t u) { w.setValue(key, (int)u); return true; }
+    bool Uint64(uint64_t u) { return Int((int)u); }
 
-    bool Double(double d) { w.setValue(key, d); return true; }
+    bool Double(double d) { Value v; v.type = DOUBLE; v.d = d; return add(v); }
 
     bool String(const char* str, rapidjson::SizeType length, bool copy)
     {
-        w.setValue(key, str);
+        Value v;
+        v.type = STRING;
+        v.str = str;
+        v.length = length;
+        return add(v);
+    }
+
+    bool Key(const char* str, rapidjson::SizeType length, bool copy)
+    {
+        key = str;
+        key_length = length;
         return true;
     }
+
     bool StartObject()
     {
-        if (stack.empty())
-        {
-            stack.push_back('g');
-            return true;
-        }
+        Value v;
+        v.type = OBJECT;
+        v.idx = r.objects_.size();
 
-        if (stack.back() == 'a')
-        {
-            stack.push_back('i');
-            w.addArrayItem();
-        }
-        else
-        {
-            stack.push_back('g');
-            w.writeGroup(key);
-        }
+        if (!frames.empty() && !add(v))
+            return false;
+
+        r.objects_.push_back(Range());
+
+        Frame f;
+        f.is_array = false;
+        f.start = member_stack.size();
+        f.idx = v.idx;
+        frames.push_back(f);
 
         return true;
     }
 
-    bool Key(const char* str, rapidjson::SizeType length, bool copy) { key = str; return true; }
-
     bool EndObject(rapidjson::SizeType memberCount)
     {
-        if (stack.empty())
-            return true;
+        const Frame& f = frames.back();
 
-        if (stack.back() == 'i')
-            w.endArrayItem();
-        else
-            w.endGroup();
+        std::vector<Member>::iterator it_start = member_stack.begin() + f.start;
+        std::sort(it_start, member_stack.end(), MemberLess());
+
+        Range& range = r.objects_[f.idx];
+        range.first = r.members_.size();
+        range.size = member_stack.size() - f.start;
 
-        stack.pop_back();
+        r.members_.insert(r.members_.end(), it_start, member_stack.end());
+        member_stack.resize(f.start);
+
+        frames.pop_back();
         return true;
     }
 
     bool StartArray()
     {
-        w.writeArray(key);
-        stack.push_back('a');
+        Value v;
+        v.type = ARRAY;
+        v.idx = r.arrays_.size();
+
+        if (!add(v))
+            return false;
+
+        r.arrays_.push_back(Range());
+
+        Frame f;
+        f.is_array = true;
+        f.start = element_stack.size();
+        f.idx = v.idx;
+        frames.push_back(f);
+
         return true;
     }
 
     bool EndArray(rapidjson::SizeType elementCount)
     {
-        w.endArray();
-        stack.pop_back();
+        const Frame& f = frames.back();
+
+        Range& range = r.arrays_[f.idx];
+        range.first = r.elements_.size();
+        range.size = element_stack.size() - f.start;
+
+        r.elements_.insert(r.elements_.end(), element_stack.begin() + f.start, element_stack.end());
+        element_stack.resize(f.start);
+
+        frames.pop_back();
         return true;
     }
 
-    DataWriter& w;
-    std::string key;
-    std::vector<unsigned char> stack;
+    JSONReader& r;
+
+    const char* key;
+    unsigned int key_length;
+
+    std::vector<Frame> frames;
+
+    // Members and elements of the objects and arrays that are not closed yet
+    std::vector<Member> member_stack;
+    std::vector<Value> element_stack;
 
 };
 
 // ----------------------------------------------------------------------------------------------------
 
-JSONReader::JSONReader(const char* s) : n_current_(Node(0, MAP))
+JSONReader::JSONReader(const char* s) : own_buffer_(s), current_(0)
+{
+    parse(&own_buffer_[0]);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+JSONReader::JSONReader(char* buffer, InSitu) : current_(0)
+{
+    parse(buffer);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+JSONReader::~JSONReader()
+{
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void JSONReader::parse(char* buffer)
 {
-    DataWriter w(data_);
-    MyHandler handler(w);
-    rapidjson::StringStream ss(s);
+    Handler handler(*this);
+    rapidjson::InsituStringStream ss(buffer);
 
     rapidjson::Reader reader;
-    reader.Parse(ss, handler);
+    reader.Parse<rapidjson::kParseInsituFlag | rapidjson::kParseFullPrecisionFlag>(ss, handler);
 
-    if (reader.HasParseError())
+    if (reader.HasParseError() || objects_.empty())
     {
-        error_ = "Could not parse string";
+        std::stringstream s_error;
+        s_error << "Could not parse string (error at offset " << reader.GetErrorOffset() << ")";
+        error_ = s_error.str();
+
+        // Do not give access to a partially parsed tree
+        members_.clear();
+        elements_.clear();
+        objects_.assign(1, Range());
+        objects_[0].first = 0;
+        objects_[0].size = 0;
+        arrays_.clear();
     }
 }
 
 // ----------------------------------------------------------------------------------------------------
 
-JSONReader::~JSONReader()
+const JSONReader::Value* JSONReader::find(const std::string& key) const
 {
+    if (current_ == INVALID)
+        return 0;
+
+    const Range& range = objects_[current_];
+
+    // Binary search for the last member with this key
+    unsigned int low = range.first;
+    unsigned int high = range.first + range.size;
+    while (low < high)
+    {
+        unsigned int mid = low + (high - low) / 2;
+        const Member& m = members_[mid];
+        if (compareKeys(key.data(), key.size(), m.key, m.key_length) < 0)
+            high = mid;
+        else
+            low = mid + 1;
+    }
+
+    if (low == range.first)
+        return 0;
+
+    const Member& m = members_[low - 1];
+    if (compareKeys(key.data(), key.size(), m.key, m.key_length) != 0)
+        return 0;
+
+    return &m.value;
 }
 
 // ----------------------------------------------------------------------------------------------------
 
 bool JSONReader::readGroup(const std::string& key)
 {
-    std::map<std::string, Node>& map = data_.maps[n_current_.idx];
-    std::map<std::string, Node>::const_iterator it = map.find(key);
-    if (it == map.end())
+    const Value* v = find(key);
+    if (!v || v->type != OBJECT)
         return false;
 
-    n_current_ = it->second;
+    group_stack_.push_back(current_);
+    current_ = v->idx;
     return true;
 }
 
@@ -137,8 +287,11 @@ bool JSONReader::readGroup(const std::string& key)
 
 bool JSONReader::endGroup()
 {
-    n_current_.idx = data_.map_parents[n_current_.idx];
-    n_current_.type = MAP;
+    if (group_stack_.empty())
+        return false;
+
+    current_ = group_stack_.back();
+    group_stack_.pop_back();
     return true;
 }
 
@@ -146,14 +299,17 @@ bool JSONReader::endGroup()
 
 bool JSONReader::readArray(const std::string& key)
 {
-    std::map<std::string, Node>& map = data_.maps[n_current_.idx];
-    std::map<std::string, Node>::const_iterator it = map.find(key);
-    if (it == map.end())
+    const Value* v = find(key);
+    if (!v || v->type != ARRAY)
         return false;
 
-    n_current_ = it->second;
-    array_index_stack_.push_back(0);
+    ArrayState s;
+    s.array = v->idx;
+    s.next = 0;
+    s.parent = current_;
+    array_stack_.push_back(s);
 
+    current_ = INVALID;
     return true;
 }
 
@@ -161,19 +317,11 @@ bool JSONReader::readArray(const std::string& key)
 
 bool JSONReader::endArray()
 {
-    if (array_index_stack_.empty())
+    if (array_stack_.empty())
         return false;
 
-    unsigned int& i_next_array_item_ = array_index_stack_.back();
-    array_index_stack_.pop_back();
-
-    if (n_current_.type != ARRAY && i_next_array_item_ > 0)
-        n_current_.idx = data_.array_parents[data_.map_parents[n_current_.idx]];
-    else
-        n_current_.idx = data_.array_parents[n_current_.idx];
-
-    n_current_.type = MAP;
-
+    current_ = array_stack_.back().parent;
+    array_stack_.pop_back();
     return true;
 }
 
@@ -181,28 +329,23 @@ bool JSONReader::endArray()
 
 bool JSONReader::nextArrayItem()
 {
-    if (array_index_stack_.empty())
+    if (array_stack_.empty())
         return false;
 
-    unsigned int& i_next_array_item_ = array_index_stack_.back();
+    ArrayState& s = array_stack_.back();
+    const Range& range = arrays_[s.array];
 
-    if (n_current_.type != ARRAY)
+    if (s.next >= range.size)
     {
-        if (i_next_array_item_ == 0)
-            return false;
-
-        n_current_.idx = data_.map_parents[n_current_.idx];
-        n_current_.type = ARRAY;
-    }
-
-    std::vector<Node>& array = data_.arrays[n_current_.idx];
-
-    if (i_next_array_item_ >= array.size())
+        current_ = INVALID;
         return false;
+    }
 
-    n_current_ = array[i_next_array_item_];
-    ++i_next_array_item_;
+    const Value& v = elements_[range.first + s.next];
+    ++s.next;
 
+    // Only items that are objects have values that can be read
+    current_ = (v.type == OBJECT ? v.idx : INVALID);
     return true;
 }
 
@@ -210,29 +353,101 @@ bool JSONReader::nextArrayItem()
 
 bool JSONReader::readValue(const std::string& key, float& f)
 {
-    return value<float>(key, f);
+    double d;
+    if (!readValue(key, d))
+        return false;
+
+    f = d;
+    return true;
 }
 
 // ----------------------------------------------------------------------------------------------------
 
 bool JSONReader::readValue(const std::string& key, double& d)
 {
-    return value<double>(key, d);
+    const Value* v = find(key);
+    if (!v)
+        return false;
 
+    if (v->type == DOUBLE)
+        d = v->d;
+    else if (v->type == INT)
+        d = v->i;
+    else
+        return false;
+
+    return true;
 }
 
 // ----------------------------------------------------------------------------------------------------
 
 bool JSONReader::readValue(const std::string& key, int& i)
 {
-    return value<int>(key, i);
+    const Value* v = find(key);
+    if (!v || v->type != INT)
+        return false;
+
+    i = v->i;
+    return true;
 }
 
 // ----------------------------------------------------------------------------------------------------
 
 bool JSONReader::readValue(const std::string& key, std::string& s)
 {
-    return value<std::string>(key, s);
+    const Value* v = find(key);
+    if (!v || v->type != STRING)
+        return false;
+
+    s.assign(v->str, v->length);
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool JSONReader::readValue(const std::string& key, std::vector<float>& fs)
+{
+    const Value* v = find(key);
+    if (!v || v->type != ARRAY)
+        return false;
+
+    const Range& range = arrays_[v->idx];
+    fs.resize(range.size);
+
+    for(unsigned int i = 0; i < range.size; ++i)
+    {
+        const Value& e = elements_[range.first + i];
+        if (e.type == DOUBLE)
+            fs[i] = e.d;
+        else if (e.type == INT)
+            fs[i] = e.i;
+        else
+            return false;
+    }
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool JSONReader::readValue(const std::string& key, std::vector<int>& is)
+{
+    const Value* v = find(key);
+    if (!v || v->type != ARRAY)
+        return false;
+
+    const Range& range = arrays_[v->idx];
+    is.resize(range.size);
+
+    for(unsigned int i = 0; i < range.size; ++i)
+    {
+        const Value& e = elements_[range.first + i];
+        if (e.type != INT)
+            return false;
+        is[i] = e.i;
+    }
+
+    return true;
 }
 
 }
@@ -0,0 +1,459 @@
+#include "ed/io/json_writer.h"
+
+#include "rapidjson/rapidjson.h"
+#include "rapidjson/internal/dtoa.h"
+#include "rapidjson/internal/itoa.h"
+#include "rapidjson/internal/pow10.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace ed
+{
+
+namespace io
+{
+
+namespace
+{
+
+const char HEX_DIGITS[] = "0123456789abcdef";
+
+// ----------------------------------------------------------------------------------------------------
+
+// Rounds the decimal digits (value = digits * 10^k) to 'precision' digits and removes trailing zeros
+void roundDigits(char* digits, int& length, int& k, int precision)
+{
+    if (length > precision)
+    {
+        bool round_up = (digits[precision] >= '5');
+        k += length - precision;
+        length = precision;
+
+        if (round_up)
+        {
+            int i = length - 1;
+            while (i >= 0 && digits[i] == '9')
+                --i;
+
+            if (i < 0)
+            {
+                // All nines: 999 -> 1000
+                digits[0] = '1';
+                k += length;
+                length = 1;
+                return;
+            }
+
+            ++digits[i];
+            k += length - 1 - i;
+            length = i + 1;
+        }
+    }
+
+    while (length > 1 && digits[length - 1] == '0')
+    {
+        --length;
+        ++k;
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// Returns true if the decimal number (digits * 10^k) is read back as 'f' (which must be positive), i.e., if
+// it lies closer to f than to its neighbours. In case of doubt (the number is calculated as double, which is
+// not exact) returns false
+bool readsBackAs(const char* digits, int length, int k, float f)
+{
+    double d = 0;
+    for(int i = 0; i < length; ++i)
+        d = 10 * d + (digits[i] - '0');
+
+    if (k >= 0)
+        d *= rapidjson::internal::Pow10(k);
+    else
+        d /= rapidjson::internal::Pow10(-k);
+
+    double low = (static_cast<double>(f) + nextafterf(f, 0)) / 2;
+    double high = (static_cast<double>(f) + nextafterf(f, HUGE_VALF)) / 2;
+    double margin = d * 1e-14;
+
+    return d > low + margin && d < high - margin;
+}
+
+} // end anonymous namespace
+
+// ----------------------------------------------------------------------------------------------------
+
+JSONWriter::JSONWriter(std::ostream& out)
+    : stream_sink_(out), sink_(&stream_sink_), chunk_size_(DEFAULT_CHUNK_SIZE), buffer_(&own_buffer_)
+{
+    init();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+JSONWriter::JSONWriter(OutputSink& sink, std::size_t chunk_size)
+    : stream_sink_(std::cout), sink_(&sink), chunk_size_(chunk_size), buffer_(&own_buffer_)
+{
+    init();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+JSONWriter::JSONWriter(std::string& buffer)
+    : stream_sink_(std::cout), sink_(0), chunk_size_(0), buffer_(&buffer)
+{
+    init();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+JSONWriter::~JSONWriter()
+{
+    if (sink_)
+        flush();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void JSONWriter::init()
+{
+    buffer_->clear();
+    if (sink_)
+        buffer_->reserve(chunk_size_ + 256);
+
+    buffer_->push_back('{');
+    add_comma_ = false;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void JSONWriter::flush()
+{
+    if (!buffer_->empty())
+        sink_->write(buffer_->data(), buffer_->size());
+
+    // Keeps the capacity
+    buffer_->clear();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void JSONWriter::writeString(const std::string& s)
+{
+    std::string& b = *buffer_;
+    b.push_back('"');
+
+    // Append unescaped runs at once
+    const char* run = s.data();
+    const char* end = s.data() + s.size();
+    for(const char* c = run; c != end; ++c)
+    {
+        unsigned char u = *c;
+        if (u >= 0x20 && u != '"' && u != '\\')
+            continue;
+
+        b.append(run, c);
+        run = c + 1;
+
+        b.push_back('\\');
+        switch (u)
+        {
+        case '"': b.push_back('"'); break;
+        case '\\': b.push_back('\\'); break;
+        case '\b': b.push_back('b'); break;
+        case '\f': b.push_back('f'); break;
+        case '\n': b.push_back('n'); break;
+        case '\r': b.push_back('r'); break;
+        case '\t': b.push_back('t'); break;
+        default:
+            char hex[5] = { 'u', '0', '0', HEX_DIGITS[u >> 4], HEX_DIGITS[u & 0xF] };
+            b.append(hex, 5);
+        }
+    }
+
+    b.append(run, end);
+    b.push_back('"');
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void JSONWriter::writeKey(const std::string& key)
+{
+    if (add_comma_)
+        buffer_->push_back(',');
+
+    writeString(key);
+    buffer_->push_back(':');
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void JSONWriter::writeNumber(double d)
+{
+    // JSON has no representation for NaN and infinity
+    if (std::isnan(d) || std::isinf(d))
+    {
+        buffer_->append("null", 4);
+        return;
+    }
+
+    char buf[32];
+    char* end = rapidjson::internal::dtoa(d, buf);
+    buffer_->append(buf, end);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void JSONWriter::writeNumber(float f)
+{
+    if (std::isnan(f) || std::isinf(f))
+    {
+        buffer_->append("null", 4);
+        return;
+    }
+
+    char buf[32];
+    char* p = buf;
+
+    if (f == 0)
+    {
+        buffer_->append("0.0", 3);
+        return;
+    }
+
+    if (f < 0)
+    {
+        *p++ = '-';
+        f = -f;
+    }
+
+    // Shortest digits of the float as double (exact), rounded to the least number of digits that still reads
+    // back as the same float. 9 significant digits always suffice
+    char digits[32];
+    int length, k;
+    rapidjson::internal::Grisu2(f, digits, &length, &k);
+
+    int length_p, k_p;
+    for(int precision = 6; ; ++precision)
+    {
+        length_p = length;
+        k_p = k;
+        std::copy(digits, digits + length, p);
+        roundDigits(p, length_p, k_p, precision);
+
+        if (precision >= 9 || precision >= length || readsBackAs(p, length_p, k_p, f))
+            break;
+    }
+
+    char* end = rapidjson::internal::Prettify(p, length_p, k_p);
+    buffer_->append(buf, end);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void JSONWriter::writeNumber(int i)
+{
+    char buf[16];
+    char* end = rapidjson::internal::i32toa(i, buf);
+    buffer_->append(buf, end);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void JSONWriter::writeGroup(const std::string& name)
+{
+    writeKey(name);
+    buffer_->push_back('{');
+    type_stack_.push_back('g');
+    add_comma_ = false;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void JSONWriter::endGroup()
+{
+    buffer_->push_back('}');
+    if (type_stack_.empty() || type_stack_.back() != 'g')
+        std::cout << "JSONWriter::endGroup(): no group to close." << std::endl;
+    else
+        type_stack_.pop_back();
+    add_comma_ = true;
+
+    flushIfFull();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void JSONWriter::writeValue(const std::string& key, float f)
+{
+    writeKey(key);
+    writeNumber(f);
+    add_comma_ = true;
+
+    flushIfFull();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void JSONWriter::writeValue(const std::string& key, double d)
+{
+    writeKey(key);
+    writeNumber(d);
+    add_comma_ = true;
+
+    flushIfFull();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void JSONWriter::writeValue(const std::string& key, int i)
+{
+    writeKey(key);
+    writeNumber(i);
+    add_comma_ = true;
+
+    flushIfFull();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void JSONWriter::writeValue(const std::string& key, const std::string& s)
+{
+    writeKey(key);
+    writeString(s);
+    add_comma_ = true;
+
+    flushIfFull();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void JSONWriter::writeValue(const std::string& key, const float* fs, std::size_t size)
+{
+    writeKey(key);
+    buffer_->push_back('[');
+    for(std::size_t i = 0; i < size; ++i)
+    {
+        if (i > 0)
+            buffer_->push_back(',');
+        writeNumber(fs[i]);
+    }
+    buffer_->push_back(']');
+    add_comma_ = true;
+
+    flushIfFull();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void JSONWriter::writeValue(const std::string& key, const int* is, std::size_t size)
+{
+    writeKey(key);
+    buffer_->push_back('[');
+    for(std::size_t i = 0; i < size; ++i)
+    {
+        if (i > 0)
+            buffer_->push_back(',');
+        writeNumber(is[i]);
+    }
+    buffer_->push_back(']');
+    add_comma_ = true;
+
+    flushIfFull();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void JSONWriter::writeValue(const std::string& key, const std::string* ss, std::size_t size)
+{
+    writeKey(key);
+    buffer_->push_back('[');
+    for(std::size_t i = 0; i < size; ++i)
+    {
+        if (i > 0)
+            buffer_->push_back(',');
+        writeString(ss[i]);
+    }
+    buffer_->push_back(']');
+    add_comma_ = true;
+
+    flushIfFull();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void JSONWriter::writeArray(const std::string& key)
+{
+    writeKey(key);
+    buffer_->push_back('[');
+    type_stack_.push_back('a');
+    add_comma_ = false;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void JSONWriter::addArrayItem()
+{
+    if (add_comma_)
+        buffer_->push_back(',');
+
+    buffer_->push_back('{');
+    type_stack_.push_back('i');
+    add_comma_ = false;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void JSONWriter::endArrayItem()
+{
+    buffer_->push_back('}');
+    if (type_stack_.empty() || type_stack_.back() != 'i')
+        std::cout << "JSONWriter::endArrayItem(): no array item to close." << std::endl;
+    else
+        type_stack_.pop_back();
+    add_comma_ = true;
+
+    flushIfFull();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void JSONWriter::endArray()
+{
+    buffer_->push_back(']');
+    if (type_stack_.empty() || type_stack_.back() != 'a')
+        std::cout << "JSONWriter::endArray(): no array to close." << std::endl;
+    else
+        type_stack_.pop_back();
+    add_comma_ = true;
+
+    flushIfFull();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void JSONWriter::finish()
+{
+    while(!type_stack_.empty())
+    {
+        char t = type_stack_.back();
+
+        if (t == 'g')
+            endGroup();
+        else if (t == 'i')
+            endArrayItem();
+        else if (t == 'a')
+            endArray();
+    }
+    buffer_->push_back('}');
+
+    if (sink_)
+        flush();
+}
+
+}
+
+} // end namespace ed
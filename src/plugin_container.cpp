@@ -2,9 +2,6 @@
 
 #include "ed/plugin.h"
 
-// TODO: get rid of ros rate
-#include <ros/rate.h>
-
 #include <ed/error_context.h>
 
 namespace ed
@@ -13,8 +10,10 @@ namespace ed
 // --------------------------------------------------------------------------------
 
 PluginContainer::PluginContainer()
-    : class_loader_(0), request_stop_(false), is_running_(false), cycle_duration_(0.1), loop_frequency_(10), step_finished_(true), t_last_update_(0),
-      total_process_time_sec_(0)
+    : class_loader_(0), request_stop_(false), is_running_(false), cycle_duration_(0.1), loop_frequency_(10),
+      update_queue_(new BoundedQueue<UpdateRequestConstPtr>(1)), update_queue_policy_(BLOCK), num_posted_requests_(0),
+      num_dropped_requests_(0), num_coalesced_requests_(0), num_blocked_cycles_(0), num_unpublished_requests_(0),
+      step_finished_(true), t_last_update_(0), total_process_time_sec_(0)
 {
     timer_.start();
 }
@@ -85,6 +84,33 @@ void PluginContainer::configure(InitData& init, bool reconfigure)
     // Set plugin loop frequency
     setLoopFrequency(freq);
 
+    // The update queue can only be configured before the plugin thread is started
+    if (!reconfigure)
+    {
+        // Read optional update queue size and back-pressure policy
+        int queue_size = 1; // default: plugin waits until its previous request is handled
+        if (init.config.value("update_queue_size", queue_size, tue::config::OPTIONAL))
+        {
+            if (queue_size < 1)
+                init.config.addError("'update_queue_size' must be at least 1.");
+            else
+                update_queue_.reset(new BoundedQueue<UpdateRequestConstPtr>(queue_size));
+        }
+
+        std::string policy;
+        if (init.config.value("update_queue_policy", policy, tue::config::OPTIONAL))
+        {
+            if (policy == "block")
+                update_queue_policy_ = BLOCK;
+            else if (policy == "drop_oldest")
+                update_queue_policy_ = DROP_OLDEST;
+            else if (policy == "coalesce")
+                update_queue_policy_ = COALESCE;
+            else
+                init.config.addError("Unknown 'update_queue_policy': '" + policy + "'. Options are: 'block', 'drop_oldest', 'coalesce'.");
+        }
+    }
+
     if (init.config.readGroup("parameters"))
     {
         tue::Configuration scoped_config = init.config.limitScope();
@@ -132,15 +158,67 @@ void PluginContainer::run()
 
     total_timer_.start();
 
-    double innerloop_frequency = 1000; // TODO: magic number!
+    boost::chrono::steady_clock::time_point t_next_cycle = boost::chrono::steady_clock::now();
 
-    ros::Rate r(loop_frequency_);
-    ros::Rate ir(innerloop_frequency);
     while(!request_stop_)
     {
-        while (!step())
-            ir.sleep();
-        r.sleep();
+        bool cycle_due = false;
+
+        // The due cycle is counted as blocked once, however often we are woken up while waiting
+        bool blocked = false;
+
+        {
+            boost::unique_lock<boost::mutex> lock(mutex_update_request_);
+
+            // Sleep until the next cycle is due, or until there is room in the queue for a request that did not
+            // fit before. With the BLOCK policy, cycles are skipped as long as the queue is full. notifyRequestsHandled()
+            // and setWorld() wake us up when the server has published a world containing our requests
+            while (!request_stop_)
+            {
+                if (pending_update_request_ && !update_queue_->full())
+                    break;
+
+                if (boost::chrono::steady_clock::now() >= t_next_cycle)
+                {
+                    // With the BLOCK policy, requests that were taken by the server still count until the world
+                    // model containing them is published, such that we never process a world that misses them
+                    if (!(update_queue_policy_ == BLOCK && update_queue_->size() + num_unpublished_requests_ >= update_queue_->capacity()))
+                    {
+                        cycle_due = true;
+                        break;
+                    }
+
+                    if (!blocked)
+                    {
+                        ++num_blocked_cycles_;
+                        blocked = true;
+                    }
+
+                    cond_update_request_.wait(lock);
+                }
+                else
+                    cond_update_request_.wait_until(lock, t_next_cycle);
+            }
+        }
+
+        if (request_stop_)
+            break;
+
+        // Flush the request that is waiting for room in the queue
+        if (pending_update_request_ && pushUpdateRequest(pending_update_request_))
+            pending_update_request_.reset();
+
+        if (!cycle_due)
+            continue;
+
+        boost::chrono::steady_clock::time_point t_cycle = boost::chrono::steady_clock::now();
+
+        step();
+
+        // The loop frequency is an upper bound: the next cycle is due one period after this one started, also if
+        // new worlds arrive before then (or if this cycle was late). Read the frequency every cycle, as it may be
+        // reconfigured
+        t_next_cycle = t_cycle + boost::chrono::microseconds((long long)(1e6 / loop_frequency_));
     }
 
     is_running_ = false;
@@ -150,14 +228,6 @@ void PluginContainer::run()
 
 bool PluginContainer::step()
 {
-    // If we still have an update_request, it means the request is not yet handled,
-    // so we have to skip this cycle (and wait until the world model has handled it)
-    {
-        boost::lock_guard<boost::mutex> lg(mutex_update_request_);
-        if (update_request_)
-            return false;
-    }
-
     std::vector<UpdateRequestConstPtr> world_deltas;
 
     // Check if there is a new world. If so replace the current one with the new one
@@ -195,18 +265,146 @@ bool PluginContainer::step()
         timer.stop();
         total_process_time_sec_ += timer.getElapsedTimeInSec();
 
-        // If the received update_request was not empty, set it
+        // If the received update_request was not empty, queue it for the server
         if (!update_request->empty())
-            update_request_ = update_request;
+            postUpdateRequest(update_request);
     }
     return true;
 }
 
 // --------------------------------------------------------------------------------
 
+void PluginContainer::postUpdateRequest(const UpdateRequestPtr& req)
+{
+    ++num_posted_requests_;
+
+    if (pending_update_request_)
+    {
+        // There are already requests waiting for room in the queue; add this one to them, so that the
+        // order of the requests is preserved
+        if (pending_update_request_->merge(*req))
+        {
+            ++num_coalesced_requests_;
+            return;
+        }
+
+        // Could not be merged, so we have no choice but to wait until the pending request fits
+        ++num_blocked_cycles_;
+        if (!waitForQueueSpace())
+            return;
+
+        pushUpdateRequest(pending_update_request_);
+        pending_update_request_.reset();
+    }
+
+    if (pushUpdateRequest(req))
+        return;
+
+    switch (update_queue_policy_)
+    {
+    case DROP_OLDEST:
+    {
+        UpdateRequestConstPtr dropped;
+        while (!pushUpdateRequest(req))
+        {
+            if (update_queue_->pop(dropped))
+                ++num_dropped_requests_;
+        }
+        break;
+    }
+    case COALESCE:
+        // Keep the request until there is room in the queue. Requests produced in the meantime are merged into it
+        pending_update_request_ = req;
+        break;
+    default: // BLOCK
+        // Normally does not happen, as run() does not call step() while the queue is full
+        ++num_blocked_cycles_;
+        if (waitForQueueSpace())
+            pushUpdateRequest(req);
+    }
+}
+
+// --------------------------------------------------------------------------------
+
+bool PluginContainer::pushUpdateRequest(const UpdateRequestConstPtr& req)
+{
+    if (!update_queue_->push(req))
+        return false;
+
+    // Let the server know
+    if (update_notifier_)
+        update_notifier_->notify();
+
+    return true;
+}
+
+// --------------------------------------------------------------------------------
+
+bool PluginContainer::waitForQueueSpace()
+{
+    boost::unique_lock<boost::mutex> lock(mutex_update_request_);
+    while (!request_stop_ && update_queue_->full())
+        cond_update_request_.wait(lock);
+
+    return !request_stop_;
+}
+
+// --------------------------------------------------------------------------------
+
+bool PluginContainer::popUpdateRequest(UpdateRequestConstPtr& req)
+{
+    // Lock-free check first, as most of the time there is nothing to pop
+    if (update_queue_->empty())
+        return false;
+
+    boost::lock_guard<boost::mutex> lg(mutex_update_request_);
+    if (!update_queue_->pop(req))
+        return false;
+
+    ++num_unpublished_requests_;
+    return true;
+}
+
+// --------------------------------------------------------------------------------
+
+void PluginContainer::notifyRequestsHandled()
+{
+    {
+        boost::lock_guard<boost::mutex> lg(mutex_update_request_);
+        if (num_unpublished_requests_ == 0)
+            return;
+
+        num_unpublished_requests_ = 0;
+    }
+
+    // Wake up the plugin thread if it was waiting for its requests to be handled
+    cond_update_request_.notify_all();
+}
+
+// --------------------------------------------------------------------------------
+
+void PluginContainer::setWorld(const WorldModelConstPtr& world)
+{
+    {
+        boost::lock_guard<boost::mutex> lg(mutex_world_);
+        world_new_ = world;
+    }
+
+    // Lets a plugin thread that waits for its requests to be handled check again (the next cycle still waits for
+    // the loop frequency)
+    cond_update_request_.notify_all();
+}
+
+// --------------------------------------------------------------------------------
+
 void PluginContainer::requestStop()
 {
-    request_stop_ = true;
+    {
+        boost::lock_guard<boost::mutex> lg(mutex_update_request_);
+        request_stop_ = true;
+    }
+
+    cond_update_request_.notify_all();
 }
 
 // --------------------------------------------------------------------------------
@@ -5,6 +5,10 @@
 #include "ed/update_request.h"
 #include "ed/entity.h"
 #include "ed/convex_hull_calc.h"
+#include "ed/property.h"
+#include "ed/property_info.h"
+#include "ed/property_key_db.h"
+#include "ed/io/writer.h"
 
 #include <tue/config/reader.h>
 #include <tue/config/writer.h>
@@ -14,28 +18,223 @@
 
 #include <tue/config/configuration.h>
 #include <tue/config/loaders/yaml.h>
+#include <tue/config/yaml_emitter.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <sstream>
 
 namespace ed
 {
 
 // ----------------------------------------------------------------------------------------------------
 
-//void serialize(const WorldModel& wm, ed::io::Writer& w, unsigned long since_revision)
-//{
+namespace
+{
 
-//}
+void serializeProperty(const Property& prop, ed::io::Writer& w)
+{
+    w.addArrayItem();
+    w.writeValue("name", prop.entry->name);
+    prop.entry->info->serialize(prop.value, w);
+    w.endArrayItem();
+}
 
-//// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
 
-//void serialize(const Entity& wm, ed::io::Writer& w, unsigned long since_revision)
-//{
+void serializeEntity(const WorldModel& wm, Idx idx, ed::io::Writer& w, unsigned long since_revision,
+                     const std::vector<Idx>& property_idxs)
+{
+    const EntityConstPtr& e = wm.entities()[idx];
 
-//}
+    w.addArrayItem();
+    w.writeValue("id", e->id().str());
+    w.writeValue("idx", (int)idx);
+
+    // Write type
+    w.writeValue("type", e->type());
+
+    w.writeValue("existence_prob", e->existenceProbability());
+
+    w.writeGroup("timestamp");
+    {
+        ed::serializeTimestamp(e->lastUpdateTimestamp(), w);
+        w.endGroup();
+    }
+
+    bool shape_changed = wm.entity_shape_revisions()[idx] > since_revision;
+
+    // Write convex hull
+    if (!e->convexHull().points.empty() && shape_changed)
+    {
+        w.writeGroup("convex_hull");
+        ed::serialize(e->convexHull(), w);
+        w.endGroup();
+    }
+
+    // Pose
+    if (e->has_pose())
+    {
+        w.writeGroup("pose");
+        ed::serialize(e->pose(), w);
+        w.endGroup();
+    }
+
+    // Mesh
+    if (e->shape() && shape_changed)
+    {
+        w.writeGroup("mesh");
+        ed::serialize(*e->shape(), w);
+        w.endGroup();
+    }
+
+    // Data
+    if (!e->data().empty())
+    {
+        tue::config::YAMLEmitter emitter;
+        std::stringstream out;
+        emitter.emit(e->data(), out);
+
+        w.writeValue("data", out.str());
+    }
+
+    w.writeArray("properties");
+
+    const std::map<Idx, Property>& properties = e->properties();
+
+    if (property_idxs.empty())
+    {
+        for(std::map<Idx, Property>::const_iterator it = properties.begin(); it != properties.end(); ++it)
+        {
+            const Property& prop = it->second;
+            if (since_revision < prop.revision && prop.entry->info->serializable())
+                serializeProperty(prop, w);
+        }
+    }
+    else
+    {
+        for(std::vector<Idx>::const_iterator it = property_idxs.begin(); it != property_idxs.end(); ++it)
+        {
+            std::map<Idx, Property>::const_iterator it_prop = properties.find(*it);
+            if (it_prop != properties.end())
+            {
+                const Property& prop = it_prop->second;
+                if (since_revision < prop.revision && prop.entry->info->serializable())
+                    serializeProperty(prop, w);
+            }
+        }
+    }
+
+    w.endArray();
+
+    w.endArrayItem();
+}
+
+} // end anonymous namespace
+
+// ----------------------------------------------------------------------------------------------------
+
+void serialize(const WorldModel& wm, ed::io::Writer& w, unsigned long since_revision,
+               const std::set<UUID>& ids, const std::vector<Idx>& property_idxs)
+{
+    const WorldModel::EntityVector& entities = wm.entities();
+    const WorldModel::RevisionVector& entity_revs = wm.entity_revisions();
+
+    std::vector<Idx> idxs;
+    std::vector<UUID> removed_ids;
+
+    if (ids.empty())
+    {
+        if (!wm.removedEntities(since_revision, removed_ids))
+        {
+            // The log of removed entities does not reach back that far, so the receiver can not be told which
+            // entities were removed. Write a complete snapshot instead: the receiver removes all entities that
+            // are not listed
+            since_revision = 0;
+            removed_ids.clear();
+            w.writeValue("complete", 1);
+        }
+
+        std::vector<WorldModel::EntityChange> changes;
+        if (wm.changesSince(since_revision, changes))
+        {
+            for(std::vector<WorldModel::EntityChange>::const_iterator it = changes.begin(); it != changes.end(); ++it)
+                idxs.push_back(it->idx);
+        }
+        else
+        {
+            // The change log does not reach back that far, so compare the revisions of all entities
+            for(Idx i = 0; i < entity_revs.size(); ++i)
+            {
+                if (entity_revs[i] > since_revision)
+                    idxs.push_back(i);
+            }
+        }
+    }
+    else
+    {
+        // Only look up the requested entities. If the log of removed entities does not reach back to
+        // 'since_revision', all requested entities that do not exist are reported as removed
+        std::vector<UUID> all_removed_ids;
+        bool removals_complete = wm.removedEntities(since_revision, all_removed_ids);
+
+        for(std::set<UUID>::const_iterator it = ids.begin(); it != ids.end(); ++it)
+        {
+            Idx idx;
+            if (wm.findEntityIdx(*it, idx))
+            {
+                if (entity_revs[idx] > since_revision)
+                    idxs.push_back(idx);
+            }
+            else if (!removals_complete || std::binary_search(all_removed_ids.begin(), all_removed_ids.end(), *it))
+                removed_ids.push_back(*it);
+        }
+
+        std::sort(idxs.begin(), idxs.end());
+    }
+
+    w.writeArray("entities");
+
+    for(std::vector<Idx>::const_iterator it = idxs.begin(); it != idxs.end(); ++it)
+    {
+        // Removed entities are written below
+        if (entities[*it])
+            serializeEntity(wm, *it, w, since_revision, property_idxs);
+    }
+
+    w.endArray();
+
+    if (!removed_ids.empty())
+    {
+        w.writeArray("removed_entities");
+        for(std::vector<UUID>::const_iterator it = removed_ids.begin(); it != removed_ids.end(); ++it)
+        {
+            w.addArrayItem();
+            w.writeValue("id", it->str());
+            w.endArrayItem();
+        }
+        w.endArray();
+    }
+}
 
 // ----------------------------------------------------------------------------------------------------
 
 bool deserialize(io::Reader &r, UpdateRequest& req)
 {
+    std::set<UUID> ids;
+    return deserialize(r, req, ids);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool deserialize(io::Reader &r, UpdateRequest& req, std::set<UUID>& ids)
+{
+    int complete = 0;
+    r.readValue("complete", complete);
+
+    std::set<UUID> listed_ids;
+
     if (r.readArray("entities"))
     {
         while(r.nextArrayItem())
@@ -47,6 +246,8 @@ bool deserialize(io::Reader &r, UpdateRequest& req)
                 return false;
             }
 
+            listed_ids.insert(id);
+
             std::string type;
             if (r.readValue("type", type))
             {
@@ -96,9 +297,6 @@ bool deserialize(io::Reader &r, UpdateRequest& req)
             std::string data_str;
             if (r.readValue("data", data_str))
             {
-                std::replace(data_str.begin(), data_str.end(), '|', '"');
-                std::replace(data_str.begin(), data_str.end(), '^', '\n');
-
                 tue::Configuration cfg;
                 if (tue::config::loadFromYAMLString(data_str, cfg))
                     req.addData(id, cfg.data());
@@ -141,6 +339,35 @@ bool deserialize(io::Reader &r, UpdateRequest& req)
         r.endArray();
     }
 
+    if (r.readArray("removed_entities"))
+    {
+        while(r.nextArrayItem())
+        {
+            std::string id;
+            if (r.readValue("id", id))
+            {
+                req.removeEntity(id);
+                ids.erase(id);
+            }
+        }
+
+        r.endArray();
+    }
+
+    if (complete)
+    {
+        // A complete snapshot: the known entities that are not listed were removed
+        for(std::set<UUID>::const_iterator it = ids.begin(); it != ids.end(); ++it)
+        {
+            if (listed_ids.find(*it) == listed_ids.end())
+                req.removeEntity(*it);
+        }
+
+        ids.swap(listed_ids);
+    }
+    else
+        ids.insert(listed_ids.begin(), listed_ids.end());
+
     return true;
 }
 
@@ -302,30 +529,60 @@ bool deserialize(ed::io::Reader& r, ConvexHull& ch)
 
 // ----------------------------------------------------------------------------------------------------
 
-void serialize(const geo::Shape& s, ed::io::Writer& w)
+void serialize(const geo::Shape& s, ed::io::Writer& w, double quantization)
 {
-    w.writeArray("vertices");
     const std::vector<geo::Vector3>& vertices = s.getMesh().getPoints();
-    for(std::vector<geo::Vector3>::const_iterator it = vertices.begin(); it != vertices.end(); ++it)
+    const std::vector<geo::TriangleI>& triangles = s.getMesh().getTriangleIs();
+
+    // The quantized coordinates must fit in an int, otherwise the vertices are written as floats. The comparison
+    // also fails for non-finite coordinates
+    bool quantize = (quantization > 0);
+    double max_q = std::numeric_limits<int>::max() - 1;
+    for(unsigned int i = 0; quantize && i < vertices.size(); ++i)
     {
-        w.addArrayItem();
-        w.writeValue("x", it->x); w.writeValue("y", it->y); w.writeValue("z", it->z);
-        w.endArrayItem();
+        const geo::Vector3& p = vertices[i];
+        if (!(std::fabs(p.x) / quantization < max_q && std::fabs(p.y) / quantization < max_q
+              && std::fabs(p.z) / quantization < max_q))
+            quantize = false;
     }
-    w.endArray();
 
-    w.writeArray("triangles");
-    const std::vector<geo::TriangleI>& triangles = s.getMesh().getTriangleIs();
-    for(unsigned int i = 0; i < triangles.size(); ++i)
+    if (quantize)
     {
-        w.addArrayItem();
-        w.writeValue("i1", triangles[i].i1_);
-        w.writeValue("i2", triangles[i].i2_);
-        w.writeValue("i3", triangles[i].i3_);
-        w.endArrayItem();
+        std::vector<int> vertex_array(3 * vertices.size());
+        for(unsigned int i = 0; i < vertices.size(); ++i)
+        {
+            const geo::Vector3& p = vertices[i];
+            vertex_array[3 * i]     = (int)std::floor(p.x / quantization + 0.5);
+            vertex_array[3 * i + 1] = (int)std::floor(p.y / quantization + 0.5);
+            vertex_array[3 * i + 2] = (int)std::floor(p.z / quantization + 0.5);
+        }
 
+        w.writeValue("quantization", quantization);
+        w.writeValue("vertex_array", vertex_array);
     }
-    w.endArray();
+    else
+    {
+        std::vector<float> vertex_array(3 * vertices.size());
+        for(unsigned int i = 0; i < vertices.size(); ++i)
+        {
+            const geo::Vector3& p = vertices[i];
+            vertex_array[3 * i]     = p.x;
+            vertex_array[3 * i + 1] = p.y;
+            vertex_array[3 * i + 2] = p.z;
+        }
+
+        w.writeValue("vertex_array", vertex_array);
+    }
+
+    std::vector<int> triangle_array(3 * triangles.size());
+    for(unsigned int i = 0; i < triangles.size(); ++i)
+    {
+        triangle_array[3 * i]     = triangles[i].i1_;
+        triangle_array[3 * i + 1] = triangles[i].i2_;
+        triangle_array[3 * i + 2] = triangles[i].i3_;
+    }
+
+    w.writeValue("triangle_array", triangle_array);
 }
 
 // ----------------------------------------------------------------------------------------------------
@@ -334,6 +591,47 @@ bool deserialize(ed::io::Reader& r, geo::Shape& s)
 {
     geo::Mesh mesh;
 
+    std::vector<int> triangle_array;
+    if (r.readValue("triangle_array", triangle_array))
+    {
+        std::vector<float> vertex_array;
+        double quantization;
+        if (r.readValue("quantization", quantization))
+        {
+            std::vector<int> vertex_array_q;
+            if (!r.readValue("vertex_array", vertex_array_q))
+                return false;
+
+            vertex_array.resize(vertex_array_q.size());
+            for(unsigned int i = 0; i < vertex_array_q.size(); ++i)
+                vertex_array[i] = vertex_array_q[i] * quantization;
+        }
+        else if (!r.readValue("vertex_array", vertex_array))
+            return false;
+
+        unsigned int num_vertices = vertex_array.size() / 3;
+        if (vertex_array.size() != 3 * num_vertices || triangle_array.size() % 3 != 0)
+            return false;
+
+        for(unsigned int i = 0; i < vertex_array.size(); i += 3)
+            mesh.addPoint(vertex_array[i], vertex_array[i + 1], vertex_array[i + 2]);
+
+        for(unsigned int i = 0; i < triangle_array.size(); i += 3)
+        {
+            const int* t = &triangle_array[i];
+            if (t[0] < 0 || t[1] < 0 || t[2] < 0 || t[0] >= (int)num_vertices || t[1] >= (int)num_vertices
+                    || t[2] >= (int)num_vertices)
+                return false;
+
+            mesh.addTriangle(t[0], t[1], t[2]);
+        }
+
+        s.setMesh(mesh);
+        return true;
+    }
+
+    // Format of older versions: an object per vertex and per triangle
+
     // Vertices
     if (r.readArray("vertices"))
     {
@@ -33,7 +33,7 @@ namespace ed
 
 // ----------------------------------------------------------------------------------------------------
 
-Server::Server() : world_model_(new WorldModel(&property_key_db_))
+Server::Server() : world_model_(new WorldModel(&property_key_db_)), update_notifier_(new Notifier)
 {
 }
 
@@ -196,7 +196,7 @@ void Server::reset(bool keep_all_shapes)
         if (keep_all_shapes && e->shape())
             continue;
 
-        if (req_init_world->updated_entities.find(e->id()) == req_init_world->updated_entities.end())
+        if (!req_init_world->updated(e->id()))
             req_delete->removeEntity((*it)->id());
     }
 
@@ -258,6 +258,7 @@ PluginContainerPtr Server::loadPlugin(const std::string& plugin_name, tue::Confi
 
     // Create a plugin container
     PluginContainerPtr container(new PluginContainer());
+    container->setUpdateNotifier(update_notifier_);
 
     InitData init(property_key_db_, config);
 
@@ -279,34 +280,43 @@ void Server::stepPlugins()
 
     WorldModelPtr new_world_model;
 
-    // collect and apply all update requests
+    // collect all update requests
+    std::vector<UpdateRequestConstPtr> requests;
     std::vector<PluginContainerPtr> plugins_with_requests;
     for(std::map<std::string, PluginContainerPtr>::iterator it = plugin_containers_.begin(); it != plugin_containers_.end(); ++it)
     {
         PluginContainerPtr c = it->second;
 
-        if (c->updateRequest())
+        UpdateRequestConstPtr req;
+        while (c->popUpdateRequest(req))
         {
-            if (!new_world_model)
-            {
-                // Create world model copy (shallow)
-                new_world_model = boost::make_shared<WorldModel>(*world_model_);
-            }
+            requests.push_back(req);
 
-            new_world_model->update(*c->updateRequest());
-            plugins_with_requests.push_back(c);
+            if (plugins_with_requests.empty() || plugins_with_requests.back() != c)
+                plugins_with_requests.push_back(c);
 
             // Temporarily for Javier
             for(std::map<std::string, PluginContainerPtr>::iterator it2 = plugin_containers_.begin(); it2 != plugin_containers_.end(); ++it2)
             {
                 PluginContainerPtr c2 = it2->second;
-                c2->addDelta(c->updateRequest());
+                c2->addDelta(req);
             }
         }
     }
 
-    if (new_world_model)
+    if (!requests.empty())
     {
+        // Merge the requests before applying them, such that an entity that is touched by multiple requests
+        // is only copied (and its convex hull etc. only recalculated) once
+        std::vector<UpdateRequestConstPtr> batches;
+        mergeUpdateRequests(requests, batches);
+
+        // Create world model copy (shallow)
+        new_world_model = boost::make_shared<WorldModel>(*world_model_);
+
+        for(std::vector<UpdateRequestConstPtr>::const_iterator it = batches.begin(); it != batches.end(); ++it)
+            new_world_model->update(**it);
+
         // Set the new (updated) world
         for(std::map<std::string, PluginContainerPtr>::iterator it = plugin_containers_.begin(); it != plugin_containers_.end(); ++it)
         {
@@ -316,11 +326,11 @@ void Server::stepPlugins()
 
         world_model_ = new_world_model;
 
-        // Clear the requests of all plugins that had requests (which flags them to continue processing)
+        // Let the plugins that had requests know they are handled (which flags them to continue processing)
         for(std::vector<PluginContainerPtr>::iterator it = plugins_with_requests.begin(); it != plugins_with_requests.end(); ++it)
         {
             PluginContainerPtr c = *it;
-            c->clearUpdateRequest();
+            c->notifyRequestsHandled();
         }
     }
 }
@@ -599,7 +609,12 @@ void Server::publishStatistics() const
         // Calculate CPU usage percentage
         double cpu_perc = p->totalProcessingTime() * 100 / p->totalRunningTime();
 
-        s << "    " << p->name() << ": " << cpu_perc << " % (" << p->loopFrequency() << " hz)" << std::endl;
+        s << "    " << p->name() << ": " << cpu_perc << " % (" << p->loopFrequency() << " hz)"
+          << ", queue: " << p->updateQueueSize() << "/" << p->updateQueueCapacity()
+          << ", posted: " << p->numPostedRequests()
+          << ", dropped: " << p->numDroppedRequests()
+          << ", coalesced: " << p->numCoalescedRequests()
+          << ", blocked: " << p->numBlockedCycles() << std::endl;
     }
 
 
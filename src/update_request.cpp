@@ -2,14 +2,379 @@
 
 #include "ed/entity.h"
 
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/lock_guard.hpp>
+
 namespace ed
 {
 
+namespace
+{
+
+// Below this number of entity updates, a linear search is faster than building a hash index
+const std::size_t MIN_INDEXED_SIZE = 8;
+
+// ----------------------------------------------------------------------------------------------------
+
+// Returns true if 'u' sets or changes something on the entity (other than removing it)
+bool updatesEntity(const UpdateRequest::EntityUpdate& u)
+{
+    return !u.has(UpdateRequest::REMOVED) && (u.updated || u.fields != 0);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// Inserts 'source' into 'target' and erases it from 'opposite'
+void mergeTypeSet(std::set<std::string>& target, std::set<std::string>& opposite, const std::set<std::string>& source)
+{
+    for(std::set<std::string>::const_iterator it = source.begin(); it != source.end(); ++it)
+    {
+        target.insert(*it);
+        opposite.erase(*it);
+    }
+}
+
+} // end anonymous namespace
+
+// ----------------------------------------------------------------------------------------------------
+
+const UpdateRequest::EntityUpdate* UpdateRequest::find(const UUID& id) const
+{
+    if (index_.empty())
+    {
+        for(std::vector<EntityUpdate>::const_iterator it = updates_.begin(); it != updates_.end(); ++it)
+        {
+            if (it->id == id)
+                return &(*it);
+        }
+        return 0;
+    }
+
+    std::size_t mask = index_.size() - 1;
+    for(std::size_t i = id.hash() & mask; ; i = (i + 1) & mask)
+    {
+        unsigned int v = index_[i];
+        if (v == 0)
+            return 0;
+
+        if (updates_[v - 1].id == id)
+            return &updates_[v - 1];
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+UpdateRequest::EntityUpdate& UpdateRequest::findOrAdd(const UUID& id)
+{
+    if (index_.empty() && updates_.size() < MIN_INDEXED_SIZE)
+    {
+        for(std::vector<EntityUpdate>::iterator it = updates_.begin(); it != updates_.end(); ++it)
+        {
+            if (it->id == id)
+                return *it;
+        }
+
+        updates_.push_back(EntityUpdate(id));
+        return updates_.back();
+    }
+
+    // Keep the load factor below 0.5
+    if (index_.size() < 2 * (updates_.size() + 1))
+        rebuildIndex(std::max<std::size_t>(4 * MIN_INDEXED_SIZE, 2 * index_.size()));
+
+    std::size_t mask = index_.size() - 1;
+    for(std::size_t i = id.hash() & mask; ; i = (i + 1) & mask)
+    {
+        unsigned int v = index_[i];
+        if (v == 0)
+        {
+            updates_.push_back(EntityUpdate(id));
+            index_[i] = updates_.size();
+            return updates_.back();
+        }
+
+        if (updates_[v - 1].id == id)
+            return updates_[v - 1];
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void UpdateRequest::rebuildIndex(std::size_t capacity)
+{
+    index_.assign(capacity, 0);
+
+    std::size_t mask = capacity - 1;
+    for(std::size_t j = 0; j < updates_.size(); ++j)
+    {
+        std::size_t i = updates_[j].id.hash() & mask;
+        while (index_[i] != 0)
+            i = (i + 1) & mask;
+        index_[i] = j + 1;
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+struct UpdateRequest::CompatibilityMaps
+{
+    std::map<UUID, std::vector<MeasurementConstPtr> > measurements;
+    std::map<UUID, geo::ShapeConstPtr> shapes;
+    std::map<UUID, std::map<std::string, ed::MeasurementConvexHull> > convex_hulls_new;
+    std::map<UUID, std::string> types;
+    std::map<UUID, std::set<std::string> > type_sets_added;
+    std::map<UUID, std::set<std::string> > type_sets_removed;
+    std::map<UUID, double> existence_probabilities;
+    std::map<UUID, double> last_update_timestamps;
+    std::map<UUID, geo::Pose3D> poses;
+    std::map<UUID, std::map<UUID, RelationConstPtr> > relations;
+    std::map<UUID, tue::config::DataConstPointer> datas;
+    std::map<UUID, std::map<Idx, Property> > properties;
+    std::set<UUID> removed_entities;
+    std::map<UUID, std::string> added_flags;
+    std::map<UUID, std::string> removed_flags;
+    std::set<UUID> updated_entities;
+};
+
+// ----------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+// Guards building the compatibility maps of const requests, which may be shared by threads. They are rarely used,
+// so one mutex for all requests will do
+boost::mutex compatibility_maps_mutex;
+
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+const UpdateRequest::CompatibilityMaps& UpdateRequest::compatibilityMaps() const
+{
+    boost::lock_guard<boost::mutex> lg(compatibility_maps_mutex);
+
+    if (compatibility_maps_.ptr)
+        return *compatibility_maps_.ptr;
+
+    boost::shared_ptr<CompatibilityMaps> m(new CompatibilityMaps);
+    for(const_iterator it = begin(); it != end(); ++it)
+    {
+        const EntityUpdate& u = *it;
+
+        if (u.has(MEASUREMENTS))
+            m->measurements[u.id] = extra(u).measurements;
+        if (u.has(SHAPE))
+            m->shapes[u.id] = u.shape;
+        if (u.has(CONVEX_HULLS))
+            m->convex_hulls_new[u.id] = extra(u).convex_hulls;
+        if (u.has(TYPE))
+            m->types[u.id] = u.type;
+        if (u.has(TYPES_ADDED))
+            m->type_sets_added[u.id] = extra(u).types_added;
+        if (u.has(TYPES_REMOVED))
+            m->type_sets_removed[u.id] = extra(u).types_removed;
+        if (u.has(EXISTENCE_PROBABILITY))
+            m->existence_probabilities[u.id] = u.existence_probability;
+        if (u.has(LAST_UPDATE_TIMESTAMP))
+            m->last_update_timestamps[u.id] = u.last_update_timestamp;
+        if (u.has(POSE))
+            m->poses[u.id] = u.pose;
+        if (u.has(RELATIONS))
+            m->relations[u.id] = extra(u).relations;
+        if (u.has(DATA))
+            m->datas[u.id] = extra(u).data;
+        if (u.has(PROPERTIES))
+            m->properties[u.id] = extra(u).properties;
+        if (u.has(REMOVED))
+            m->removed_entities.insert(u.id);
+        if (u.has(FLAG_ADDED))
+            m->added_flags[u.id] = extra(u).added_flag;
+        if (u.has(FLAG_REMOVED))
+            m->removed_flags[u.id] = extra(u).removed_flag;
+        if (u.updated)
+            m->updated_entities.insert(u.id);
+    }
+
+    compatibility_maps_.ptr = m;
+    return *m;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+const std::map<UUID, std::vector<MeasurementConstPtr> >& UpdateRequest::measurements() const { return compatibilityMaps().measurements; }
+const std::map<UUID, geo::ShapeConstPtr>& UpdateRequest::shapes() const { return compatibilityMaps().shapes; }
+const std::map<UUID, std::map<std::string, ed::MeasurementConvexHull> >& UpdateRequest::convex_hulls_new() const { return compatibilityMaps().convex_hulls_new; }
+const std::map<UUID, std::string>& UpdateRequest::types() const { return compatibilityMaps().types; }
+const std::map<UUID, std::set<std::string> >& UpdateRequest::type_sets_added() const { return compatibilityMaps().type_sets_added; }
+const std::map<UUID, std::set<std::string> >& UpdateRequest::type_sets_removed() const { return compatibilityMaps().type_sets_removed; }
+const std::map<UUID, double>& UpdateRequest::existence_probabilities() const { return compatibilityMaps().existence_probabilities; }
+const std::map<UUID, double>& UpdateRequest::last_update_timestamps() const { return compatibilityMaps().last_update_timestamps; }
+const std::map<UUID, geo::Pose3D>& UpdateRequest::poses() const { return compatibilityMaps().poses; }
+const std::map<UUID, std::map<UUID, RelationConstPtr> >& UpdateRequest::relations() const { return compatibilityMaps().relations; }
+const std::map<UUID, tue::config::DataConstPointer>& UpdateRequest::datas() const { return compatibilityMaps().datas; }
+const std::map<UUID, std::map<Idx, Property> >& UpdateRequest::properties() const { return compatibilityMaps().properties; }
+const std::set<UUID>& UpdateRequest::removed_entities() const { return compatibilityMaps().removed_entities; }
+const std::map<UUID, std::string>& UpdateRequest::added_flags() const { return compatibilityMaps().added_flags; }
+const std::map<UUID, std::string>& UpdateRequest::removed_flags() const { return compatibilityMaps().removed_flags; }
+const std::set<UUID>& UpdateRequest::updated_entities() const { return compatibilityMaps().updated_entities; }
+
+// ----------------------------------------------------------------------------------------------------
+
+bool UpdateRequest::merge(const UpdateRequest& other)
+{
+    // First check if the requests can be merged at all, before changing anything
+    for(const_iterator it = other.begin(); it != other.end(); ++it)
+    {
+        const EntityUpdate* u = find(it->id);
+        if (!u)
+            continue;
+
+        if (u->has(REMOVED) && updatesEntity(*it))
+            return false;
+
+        if (u->has(FLAG_ADDED) && it->has(FLAG_ADDED) && extra(*u).added_flag != other.extra(*it).added_flag)
+            return false;
+
+        if (u->has(FLAG_REMOVED) && it->has(FLAG_REMOVED) && extra(*u).removed_flag != other.extra(*it).removed_flag)
+            return false;
+
+        // Each time data is applied, WorldModel::update sets the type in the entity data (if any), after TYPE and
+        // TYPES_REMOVED. A type that is set or removed after data would therefore be overruled, and combining
+        // data would skip the types in between
+        if (u->has(DATA) && it->has(TYPE | TYPES_REMOVED | DATA))
+            return false;
+    }
+
+    compatibility_maps_.ptr.reset();
+
+    for(const_iterator it = other.begin(); it != other.end(); ++it)
+    {
+        const EntityUpdate& u2 = *it;
+        EntityUpdate& u = findOrAdd(u2.id);
+
+        if (u2.updated)
+            flagUpdated(u);
+
+        if (u2.has(POSE))
+            u.pose = u2.pose;
+
+        if (u2.has(SHAPE))
+            u.shape = u2.shape;
+
+        if (u2.has(EXISTENCE_PROBABILITY))
+            u.existence_probability = u2.existence_probability;
+
+        if (u2.has(LAST_UPDATE_TIMESTAMP))
+            u.last_update_timestamp = u2.last_update_timestamp;
+
+        if (u2.has(TYPE))
+        {
+            // Setting the type adds it to the type set, so an overruled type must stay in there (unless removed)
+            if (u.has(TYPE) && u.type != u2.type && !(u.has(TYPES_REMOVED) && extra(u).types_removed.count(u.type)))
+            {
+                extra(u).types_added.insert(u.type);
+                u.fields |= TYPES_ADDED;
+            }
+
+            u.type = u2.type;
+
+            // Setting the type also adds it to the type set, which undoes an earlier removal
+            if (u.has(TYPES_REMOVED))
+                extra(u).types_removed.erase(u2.type);
+        }
+
+        if (u2.fields & EXTRA_FIELDS)
+        {
+            const EntityUpdateExtra& x2 = other.extra(u2);
+            EntityUpdateExtra& x = extra(u);
+
+            // Measurements are accumulated
+            x.measurements.insert(x.measurements.end(), x2.measurements.begin(), x2.measurements.end());
+
+            for(std::map<std::string, ed::MeasurementConvexHull>::const_iterator it2 = x2.convex_hulls.begin(); it2 != x2.convex_hulls.end(); ++it2)
+                x.convex_hulls[it2->first] = it2->second;
+
+            // Same order as in WorldModel::update: first additions, then removals
+            mergeTypeSet(x.types_added, x.types_removed, x2.types_added);
+            mergeTypeSet(x.types_removed, x.types_added, x2.types_removed);
+
+            for(std::map<UUID, RelationConstPtr>::const_iterator it2 = x2.relations.begin(); it2 != x2.relations.end(); ++it2)
+                x.relations[it2->first] = it2->second;
+
+            // Adding a flag undoes an earlier removal of the same flag, and vice versa
+            if (u2.has(FLAG_ADDED))
+            {
+                if (u.has(FLAG_REMOVED) && x.removed_flag == x2.added_flag)
+                    u.fields &= ~FLAG_REMOVED;
+
+                x.added_flag = x2.added_flag;
+                u.fields |= FLAG_ADDED;
+            }
+
+            if (u2.has(FLAG_REMOVED))
+            {
+                if (u.has(FLAG_ADDED) && x.added_flag == x2.removed_flag)
+                    u.fields &= ~FLAG_ADDED;
+
+                x.removed_flag = x2.removed_flag;
+                u.fields |= FLAG_REMOVED;
+            }
+
+            // Data is only merged into a request that does not set data (see above)
+            if (u2.has(DATA))
+                x.data = x2.data;
+
+            for(std::map<Idx, Property>::const_iterator it2 = x2.properties.begin(); it2 != x2.properties.end(); ++it2)
+                x.properties[it2->first] = it2->second;
+        }
+
+        // The flag bits are already handled above
+        u.fields |= (u2.fields & ~(FLAG_ADDED | FLAG_REMOVED));
+
+        if (u.has(TYPES_ADDED) && extra(u).types_added.empty())
+            u.fields &= ~TYPES_ADDED;
+        if (u.has(TYPES_REMOVED) && extra(u).types_removed.empty())
+            u.fields &= ~TYPES_REMOVED;
+    }
+
+    // Only a pure synchronization update if both were
+    is_sync_update = is_sync_update && other.is_sync_update;
+
+    return true;
+}
+
 // ----------------------------------------------------------------------------------------------------
 
-//void UpdateRequest::setEntity(const EntityConstPtr& e)
-//{
-//    entities[e->id()] = e;
-//}
+void mergeUpdateRequests(const std::vector<UpdateRequestConstPtr>& requests, std::vector<UpdateRequestConstPtr>& batches)
+{
+    // The batch that requests are currently merged into (a copy owned by us)
+    UpdateRequestPtr merged;
+
+    for(std::vector<UpdateRequestConstPtr>::const_iterator it = requests.begin(); it != requests.end(); ++it)
+    {
+        const UpdateRequestConstPtr& req = *it;
+        if (req->empty())
+            continue;
+
+        if (batches.empty())
+        {
+            batches.push_back(req);
+            continue;
+        }
+
+        if (!merged)
+        {
+            // Make sure we do not change the original request
+            merged.reset(new UpdateRequest(*batches.back()));
+            batches.back() = merged;
+        }
+
+        if (!merged->merge(*req))
+        {
+            batches.push_back(req);
+            merged.reset();
+        }
+    }
+}
 
 }
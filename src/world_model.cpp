@@ -3,10 +3,17 @@
 #include "ed/update_request.h"
 #include "ed/entity.h"
 #include "ed/relation.h"
+#include "ed/world_model/transform_tree.h"
+#include "ed/world_model/spatial_index.h"
+#include "ed/convex_hull_calc.h"
 
 #include <tue/config/reader.h>
 #include <boost/make_shared.hpp>
 
+#include <geolib/Shape.h>
+
+#include <algorithm>
+
 #include "ed/property_key_db.h"
 
 namespace ed
@@ -14,114 +21,213 @@ namespace ed
 
 // --------------------------------------------------------------------------------
 
-WorldModel::WorldModel(const PropertyKeyDB* prop_key_db) : revision_(0), property_info_db_(prop_key_db)
+namespace
 {
+
+// Number of entity changes (and removed entities) that is kept by default
+const std::size_t DEFAULT_CHANGE_LOG_SIZE = 1 << 16;
+
 }
 
 // --------------------------------------------------------------------------------
 
-void WorldModel::update(const UpdateRequest& req)
+WorldModel::WorldModel(const PropertyKeyDB* prop_key_db) : revision_(0), property_info_db_(prop_key_db), relations_revision_(0)
 {
-    if (req.empty())
-        return;
+    setChangeLogSize(DEFAULT_CHANGE_LOG_SIZE);
+}
 
-    // Increase revision number
-    ++revision_;
+// --------------------------------------------------------------------------------
 
-    std::map<UUID, EntityPtr> new_entities;
+namespace
+{
 
-    // Update associated measurements
-    for(std::map<UUID, std::vector<MeasurementConstPtr> >::const_iterator it = req.measurements.begin(); it != req.measurements.end(); ++it)
+// Fields of an entity update that may change its types or flags (data may contain a type)
+const unsigned int LABEL_FIELDS = UpdateRequest::TYPE | UpdateRequest::TYPES_ADDED | UpdateRequest::TYPES_REMOVED
+                                  | UpdateRequest::DATA | UpdateRequest::FLAG_ADDED | UpdateRequest::FLAG_REMOVED;
+
+// --------------------------------------------------------------------------------
+
+// Returns true if both shapes have the same mesh. Differences are usually found early (in the sizes)
+bool equalShapes(const geo::ShapeConstPtr& s1, const geo::ShapeConstPtr& s2)
+{
+    if (s1 == s2)
+        return true;
+
+    if (!s1 || !s2)
+        return false;
+
+    const geo::Mesh& m1 = s1->getMesh();
+    const geo::Mesh& m2 = s2->getMesh();
+
+    const std::vector<geo::Vector3>& points1 = m1.getPoints();
+    const std::vector<geo::Vector3>& points2 = m2.getPoints();
+    const std::vector<geo::TriangleI>& triangles1 = m1.getTriangleIs();
+    const std::vector<geo::TriangleI>& triangles2 = m2.getTriangleIs();
+
+    if (points1.size() != points2.size() || triangles1.size() != triangles2.size())
+        return false;
+
+    for(std::size_t i = 0; i < triangles1.size(); ++i)
     {
-        EntityPtr e = getOrAddEntity(it->first, new_entities);
-        const std::vector<MeasurementConstPtr>& measurements = it->second;
-        for(std::vector<MeasurementConstPtr>::const_iterator it2 = measurements.begin(); it2 != measurements.end(); ++it2)
-        {
-            e->addMeasurement(*it2);
-        }
+        const geo::TriangleI& t1 = triangles1[i];
+        const geo::TriangleI& t2 = triangles2[i];
+        if (t1.i1_ != t2.i1_ || t1.i2_ != t2.i2_ || t1.i3_ != t2.i3_)
+            return false;
     }
 
-    // Update poses
-    for(std::map<UUID, geo::Pose3D>::const_iterator it = req.poses.begin(); it != req.poses.end(); ++it)
+    for(std::size_t i = 0; i < points1.size(); ++i)
     {
-        EntityPtr e = getOrAddEntity(it->first, new_entities);
-        e->setPose(it->second);
+        const geo::Vector3& p1 = points1[i];
+        const geo::Vector3& p2 = points2[i];
+        if (p1.x != p2.x || p1.y != p2.y || p1.z != p2.z)
+            return false;
     }
 
-    // Update shapes
-    for(std::map<UUID, geo::ShapeConstPtr>::const_iterator it = req.shapes.begin(); it != req.shapes.end(); ++it)
-    {
-        EntityPtr e = getOrAddEntity(it->first, new_entities);
-        e->setShape(it->second);
+    return true;
+}
 
-        Idx idx;
-        if (findEntityIdx(e->id(), idx))
-        {
-            entity_shape_revisions_[idx] = revision_;
-        }
+// --------------------------------------------------------------------------------
+
+// Applies the changes in entity update u (of request req) to entity e
+void updateEntity(const UpdateRequest& req, const UpdateRequest::EntityUpdate& u, const EntityPtr& e)
+{
+    // Update associated measurements
+    if (u.has(UpdateRequest::MEASUREMENTS))
+    {
+        const std::vector<MeasurementConstPtr>& measurements = req.extra(u).measurements;
+        for(std::vector<MeasurementConstPtr>::const_iterator it2 = measurements.begin(); it2 != measurements.end(); ++it2)
+            e->addMeasurement(*it2);
     }
 
+    // Update pose
+    if (u.has(UpdateRequest::POSE))
+        e->setPose(u.pose);
+
+    // Update shape
+    if (u.has(UpdateRequest::SHAPE))
+        e->setShape(u.shape);
+
     // Update convex hulls new
-    for(std::map<UUID, std::map<std::string, ed::MeasurementConvexHull> >::const_iterator it = req.convex_hulls_new.begin(); it != req.convex_hulls_new.end(); ++it)
+    if (u.has(UpdateRequest::CONVEX_HULLS))
     {
-        EntityPtr e = getOrAddEntity(it->first, new_entities);
-        for(std::map<std::string, ed::MeasurementConvexHull>::const_iterator it2 = it->second.begin(); it2 != it->second.end(); ++it2)
+        const std::map<std::string, ed::MeasurementConvexHull>& chulls = req.extra(u).convex_hulls;
+        for(std::map<std::string, ed::MeasurementConvexHull>::const_iterator it2 = chulls.begin(); it2 != chulls.end(); ++it2)
         {
             const ed::MeasurementConvexHull& m = it2->second;
             e->setConvexHull(m.convex_hull, m.pose, m.timestamp, it2->first);
         }
-
-        Idx idx;
-        if (findEntityIdx(e->id(), idx))
-        {
-            entity_shape_revisions_[idx] = revision_;
-        }
     }
 
     // Update types
-    for(std::map<UUID, std::string>::const_iterator it = req.types.begin(); it != req.types.end(); ++it)
-    {
-        EntityPtr e = getOrAddEntity(it->first, new_entities);
-        e->setType(it->second);
-    }
+    if (u.has(UpdateRequest::TYPE))
+        e->setType(u.type);
 
-    for(std::map<UUID, std::set<std::string> >::const_iterator it = req.type_sets_added.begin(); it != req.type_sets_added.end(); ++it)
+    if (u.has(UpdateRequest::TYPES_ADDED))
     {
-        EntityPtr e = getOrAddEntity(it->first, new_entities);
-        const std::set<std::string>& type_set = it->second;
+        const std::set<std::string>& type_set = req.extra(u).types_added;
         for(std::set<std::string>::const_iterator it2 = type_set.begin(); it2 != type_set.end(); ++it2)
             e->addType(*it2);
     }
 
-    for(std::map<UUID, std::set<std::string> >::const_iterator it = req.type_sets_removed.begin(); it != req.type_sets_removed.end(); ++it)
+    if (u.has(UpdateRequest::TYPES_REMOVED))
     {
-        EntityPtr e = getOrAddEntity(it->first, new_entities);
-        const std::set<std::string>& type_set = it->second;
+        const std::set<std::string>& type_set = req.extra(u).types_removed;
         for(std::set<std::string>::const_iterator it2 = type_set.begin(); it2 != type_set.end(); ++it2)
             e->removeType(*it2);
     }
 
-    // Update existence probabilities
-    for(std::map<UUID, double>::const_iterator it = req.existence_probabilities.begin(); it != req.existence_probabilities.end(); ++it)
+    // Update existence probability
+    if (u.has(UpdateRequest::EXISTENCE_PROBABILITY))
+        e->setExistenceProbability(u.existence_probability);
+
+    // Update last update timestamp
+    if (u.has(UpdateRequest::LAST_UPDATE_TIMESTAMP))
+        e->setLastUpdateTimestamp(u.last_update_timestamp);
+
+    // Update flags
+    if (u.has(UpdateRequest::FLAG_ADDED))
+        e->setFlag(req.extra(u).added_flag);
+
+    if (u.has(UpdateRequest::FLAG_REMOVED))
+        e->removeFlag(req.extra(u).removed_flag);
+
+    // Update additional info (data)
+    if (u.has(UpdateRequest::DATA))
+    {
+        tue::config::DataPointer params;
+        params.add(e->data());
+        params.add(req.extra(u).data);
+
+        tue::config::Reader r(params);
+        std::string type;
+        if (r.value("type", type, tue::config::OPTIONAL))
+            e->setType(type);
+
+        e->setData(params);
+    }
+
+    if (u.has(UpdateRequest::PROPERTIES))
     {
-        EntityPtr e = getOrAddEntity(it->first, new_entities);
-        e->setExistenceProbability(it->second);
+        const std::map<Idx, Property>& props = req.extra(u).properties;
+        for(std::map<Idx, Property>::const_iterator it2 = props.begin(); it2 != props.end(); ++it2)
+        {
+            const Property& p = it2->second;
+            e->setProperty(it2->first, p);
+        }
     }
+}
+
+}
+
+// --------------------------------------------------------------------------------
+
+void WorldModel::update(const UpdateRequest& req)
+{
+    if (req.empty())
+        return;
+
+    // Increase revision number
+    ++revision_;
 
-    // Update last update timestamps
-    for(std::map<UUID, double>::const_iterator it = req.last_update_timestamps.begin(); it != req.last_update_timestamps.end(); ++it)
+    // Update the entities themselves. Each entity occurs only once in the request, so it is copied only once
+    for(UpdateRequest::const_iterator it = req.begin(); it != req.end(); ++it)
     {
-        EntityPtr e = getOrAddEntity(it->first, new_entities);
-        e->setLastUpdateTimestamp(it->second);
+        const UpdateRequest::EntityUpdate& u = *it;
+
+        // Relations and removals are handled below
+        if ((u.fields & ~(UpdateRequest::RELATIONS | UpdateRequest::REMOVED)) == 0)
+            continue;
+
+        // Keep the current entity, to update the type and flag indices afterwards
+        EntityConstPtr e_old;
+        Idx idx;
+        if (u.has(LABEL_FIELDS) && findEntityIdx(u.id, idx))
+            e_old = entities_[idx];
+
+        EntityPtr e = getOrAddEntity(u.id, idx);
+        setEntityRevision(idx, u.fields & ~(UpdateRequest::RELATIONS | UpdateRequest::REMOVED));
+
+        // Setting a shape with the same mesh is not a shape change, such that the mesh is not serialized again
+        if (u.has(UpdateRequest::CONVEX_HULLS) || (u.has(UpdateRequest::SHAPE) && !equalShapes(e->shape(), u.shape)))
+            entity_shape_revisions_.set(idx, revision_);
+
+        updateEntity(req, u, e);
+
+        if (u.has(LABEL_FIELDS))
+            updateLabelIndices(idx, e_old.get(), e.get());
     }
 
-    // Update relations
-    for(std::map<UUID, std::map<UUID, RelationConstPtr> >::const_iterator it = req.relations.begin(); it != req.relations.end(); ++it)
+    // Update relations (after all entities are added)
+    for(UpdateRequest::const_iterator it = req.begin(); it != req.end(); ++it)
     {
+        const UpdateRequest::EntityUpdate& u = *it;
+        if (!u.has(UpdateRequest::RELATIONS))
+            continue;
+
         Idx idx1;
-        if (findEntityIdx(it->first, idx1))
+        if (findEntityIdx(u.id, idx1))
         {
-            const std::map<UUID, RelationConstPtr>& rels = it->second;
+            const std::map<UUID, RelationConstPtr>& rels = req.extra(u).relations;
             for(std::map<UUID, RelationConstPtr>::const_iterator it2 = rels.begin(); it2 != rels.end(); ++it2)
             {
                 Idx idx2;
@@ -132,71 +238,123 @@ void WorldModel::update(const UpdateRequest& req)
             }
         }
         else
-            std::cout << "WorldModel::update (relation): unknown entity: '" << it->first << "'." << std::endl;
+            std::cout << "WorldModel::update (relation): unknown entity: '" << u.id << "'." << std::endl;
     }
 
-    // Update flags
-    for(std::map<UUID, std::string>::const_iterator it = req.added_flags.begin(); it != req.added_flags.end(); ++it)
+    // Remove entities
+    for(UpdateRequest::const_iterator it = req.begin(); it != req.end(); ++it)
     {
-        EntityPtr e = getOrAddEntity(it->first, new_entities);
-        e->setFlag(it->second);
+        if (it->has(UpdateRequest::REMOVED))
+            removeEntity(it->id);
     }
+}
+
+// --------------------------------------------------------------------------------
 
-    for(std::map<UUID, std::string>::const_iterator it = req.removed_flags.begin(); it != req.removed_flags.end(); ++it)
+boost::shared_ptr<const world_model::TransformTree> WorldModel::transformTree() const
+{
+    // The world model may be shared by multiple threads, which all may want to (re)build the tree
+    boost::shared_ptr<const world_model::TransformTree> tree = boost::atomic_load(&transform_tree_.ptr);
+    if (!tree || tree->revision() != relations_revision_)
     {
-        EntityPtr e = getOrAddEntity(it->first, new_entities);
-        e->removeFlag(it->second);
+        tree.reset(new world_model::TransformTree(*this, relations_revision_));
+        boost::atomic_store(&transform_tree_.ptr, tree);
     }
 
-    // Update additional info (data)
-    for(std::map<UUID, tue::config::DataConstPointer>::const_iterator it = req.datas.begin(); it != req.datas.end(); ++it)
-    {
-        EntityPtr e = getOrAddEntity(it->first, new_entities);
+    return tree;
+}
 
-        tue::config::DataPointer params;
-        params.add(e->data());
-        params.add(it->second);
+// --------------------------------------------------------------------------------
 
-        tue::config::Reader r(params);
-        std::string type;
-        if (r.value("type", type, tue::config::OPTIONAL))
-            e->setType(type);
+boost::shared_ptr<const world_model::SpatialIndex> WorldModel::spatialIndex() const
+{
+    boost::shared_ptr<const world_model::SpatialIndex> index = boost::atomic_load(&spatial_index_.ptr);
+    if (!index || index->revision() != revision_)
+    {
+        // Start from a copy of the old index (which shares its storage), and only update what changed since
+        boost::shared_ptr<world_model::SpatialIndex> new_index;
+        if (index)
+            new_index.reset(new world_model::SpatialIndex(*index));
+        else
+            new_index.reset(new world_model::SpatialIndex);
 
-        e->setData(params);
+        new_index->update(*this);
+        index = new_index;
+        boost::atomic_store(&spatial_index_.ptr, index);
     }
 
-    for(std::map<UUID, std::map<Idx, Property> >::const_iterator it = req.properties.begin(); it != req.properties.end(); ++it)
-    {
-        EntityPtr e = getOrAddEntity(it->first, new_entities);
-        const std::map<Idx, Property>& props = it->second;
+    return index;
+}
 
-        for(std::map<Idx, Property>::const_iterator it2 = props.begin(); it2 != props.end(); ++it2)
-        {
-            const Property& p = it2->second;
-            e->setProperty(it2->first, p);
-        }
+// --------------------------------------------------------------------------------
+
+void WorldModel::queryBox(const geo::Vec2& min, const geo::Vec2& max, std::vector<Idx>& idxs) const
+{
+    spatialIndex()->query(world_model::SpatialIndex::Box(min.x, min.y, max.x, max.y), idxs);
+}
+
+// --------------------------------------------------------------------------------
+
+void WorldModel::queryRadius(const geo::Vec2& center, double radius, std::vector<Idx>& idxs) const
+{
+    boost::shared_ptr<const world_model::SpatialIndex> index = spatialIndex();
+
+    std::size_t n = idxs.size();
+    index->query(world_model::SpatialIndex::Box(center.x - radius, center.y - radius,
+                                                center.x + radius, center.y + radius), idxs);
+
+    // Only keep the entities of which the closest point of the footprint is within the radius
+    std::size_t j = n;
+    world_model::SpatialIndex::Box box;
+    for(std::size_t i = n; i < idxs.size(); ++i)
+    {
+        index->footprint(idxs[i], box);
+        double dx = std::max(0.0, std::max(box.min_x - center.x, center.x - box.max_x));
+        double dy = std::max(0.0, std::max(box.min_y - center.y, center.y - box.max_y));
+        if (dx * dx + dy * dy <= radius * radius)
+            idxs[j++] = idxs[i];
     }
+    idxs.resize(j);
+}
 
-    // Remove entities
-    for(std::set<UUID>::const_iterator it = req.removed_entities.begin(); it != req.removed_entities.end(); ++it)
+// --------------------------------------------------------------------------------
+
+void WorldModel::queryPoint(const geo::Vec2& p, std::vector<Idx>& idxs) const
+{
+    std::size_t n = idxs.size();
+    spatialIndex()->query(world_model::SpatialIndex::Box(p.x, p.y, p.x, p.y), idxs);
+
+    std::size_t j = n;
+    for(std::size_t i = n; i < idxs.size(); ++i)
     {
-        removeEntity(*it);
+        const EntityConstPtr& e = entities_[idxs[i]];
+        if (convex_hull::contains(e->convexHull(), e->pose().t, p))
+            idxs[j++] = idxs[i];
     }
+    idxs.resize(j);
 }
 
 // --------------------------------------------------------------------------------
 
-struct SearchNode
+bool WorldModel::calculateParentTransform(const world_model::TransformTree& tree, Idx idx, const Time& time, geo::Pose3D& tf) const
 {
-    SearchNode() {}
+    const world_model::TransformTree::Node& node = tree.node(idx);
+    const RelationConstPtr& r = relations_[node.relation];
 
-    SearchNode(Idx parent_, Idx relation_, bool inverse_)
-        : parent(parent_), relation(relation_), inverse(inverse_) {}
+    geo::Pose3D tr;
+    if (!r || !r->calculateTransform(time, tr))
+    {
+        std::cout << "WorldModel::calculateTransform: transform could not be calculated. THIS SHOULD NEVER HAPPEN!" << std::endl;
+        return false;
+    }
 
-    Idx parent;
-    Idx relation;
-    bool inverse;
-};
+    if (node.inverse)
+        tf = tr.inverse();
+    else
+        tf = tr;
+
+    return true;
+}
 
 // --------------------------------------------------------------------------------
 
@@ -206,75 +364,172 @@ bool WorldModel::calculateTransform(const UUID& source, const UUID& target, cons
     if (!findEntityIdx(source, s) || !findEntityIdx(target, t))
         return false;
 
-    std::queue<Idx> Q;
-    std::map<Idx, SearchNode> visited;
+    boost::shared_ptr<const world_model::TransformTree> tree = transformTree();
 
-    Q.push(s);
-    visited[s] = SearchNode(INVALID_IDX, INVALID_IDX, true);
+    // Walk up from both entities to their lowest common ancestor, while calculating the transforms of
+    // the source (tf_s) and the target (tf_t) relative to the current ancestors
+    geo::Pose3D tf_s = geo::Pose3D::identity();
+    geo::Pose3D tf_t = geo::Pose3D::identity();
+    geo::Pose3D tr;
 
-    while(!Q.empty())
+    while (s != t)
     {
-        Idx n = Q.front();
-        Q.pop();
+        const world_model::TransformTree::Node& node_s = tree->node(s);
+        const world_model::TransformTree::Node& node_t = tree->node(t);
 
-        if (n == t)
+        if (node_s.depth >= node_t.depth && node_s.parent != INVALID_IDX)
+        {
+            if (!calculateParentTransform(*tree, s, time, tr))
+                return false;
+            tf_s = tr * tf_s;
+            s = node_s.parent;
+        }
+        else if (node_t.parent != INVALID_IDX)
         {
-            // Calculate transformation
-            tf = geo::Pose3D::identity();
+            if (!calculateParentTransform(*tree, t, time, tr))
+                return false;
+            tf_t = tr * tf_t;
+            t = node_t.parent;
+        }
+        else
+            return false; // Both are roots: not connected
+    }
+
+    tf = tf_s.inverse() * tf_t;
+    return true;
+}
 
-            Idx u = n;
+// --------------------------------------------------------------------------------
 
-            while (u != s)
-            {
-                std::map<Idx, SearchNode>::const_iterator it = visited.find(u);
-                const SearchNode& sn = it->second;
+namespace
+{
 
-                const RelationConstPtr& r = relations_[sn.relation];
+// Transform of an entity relative to an ancestor of the source entity in the transform tree
+struct AnchoredTransform
+{
+    AnchoredTransform() : anchor(INVALID_IDX), valid(false) {}
 
-                geo::Pose3D tr;
-                if (!r->calculateTransform(time, tr))
-                {
-                    std::cout << "WorldModel::calculateTransform: transform could not be calculated. THIS SHOULD NEVER HAPPEN!" << std::endl;
-                    return false;
-                }
+    // Position of the ancestor in the path from the source to its root
+    Idx anchor;
 
-                if (sn.inverse)
-                    tf = tr.inverse() * tf;
-                else
-                    tf = tr * tf;
+    geo::Pose3D tf;
 
-                u = sn.parent;
-            }
+    bool valid;
+};
+
+}
+
+// --------------------------------------------------------------------------------
+
+bool WorldModel::calculateTransforms(const UUID& source, const std::vector<UUID>& targets, const Time& time,
+                                     std::vector<geo::Pose3D>& tfs, std::vector<bool>& valid) const
+{
+    tfs.assign(targets.size(), geo::Pose3D::identity());
+    valid.assign(targets.size(), false);
+
+    Idx s;
+    if (!findEntityIdx(source, s))
+        return false;
+
+    boost::shared_ptr<const world_model::TransformTree> tree = transformTree();
 
-            return true;
+    // Path from the source to its root. Transforms of the source relative to the entities on this path are
+    // calculated when they are needed (source_tfs[i] is the transform relative to source_path[i])
+    std::vector<Idx> source_path;
+    std::map<Idx, Idx> source_path_pos;
+    for(Idx n = s; n != INVALID_IDX; n = tree->node(n).parent)
+    {
+        source_path_pos[n] = source_path.size();
+        source_path.push_back(n);
+    }
+
+    std::vector<geo::Pose3D> source_tfs(1, geo::Pose3D::identity());
+    bool source_tfs_complete = true;
+
+    // Transforms of all entities visited so far, relative to the first entity on the source path they lead to
+    std::map<Idx, AnchoredTransform> visited;
+
+    std::vector<Idx> path;
+    bool all_valid = true;
+
+    for(std::size_t i = 0; i < targets.size(); ++i)
+    {
+        Idx t;
+        if (!findEntityIdx(targets[i], t))
+        {
+            all_valid = false;
+            continue;
         }
 
-        // Push all nodes that point to this node
-        const std::map<Idx, Idx>& transforms_to = entities_[n]->relationsTo();
-        for(std::map<Idx, Idx>::const_iterator it = transforms_to.begin(); it != transforms_to.end(); ++it)
+        // Walk up until the source path, or an entity that was already visited for another target
+        AnchoredTransform base;
+        path.clear();
+        for(Idx n = t; ; n = tree->node(n).parent)
         {
-            Idx n2 = it->first;
-            if (visited.find(n2) == visited.end())
+            std::map<Idx, Idx>::const_iterator it_pos = source_path_pos.find(n);
+            if (it_pos != source_path_pos.end())
             {
-                visited[n2] = SearchNode(n, it->second, false);
-                Q.push(n2);
+                base.anchor = it_pos->second;
+                base.tf = geo::Pose3D::identity();
+                base.valid = true;
+                break;
             }
+
+            std::map<Idx, AnchoredTransform>::const_iterator it_visited = visited.find(n);
+            if (it_visited != visited.end())
+            {
+                base = it_visited->second;
+                break;
+            }
+
+            path.push_back(n);
+
+            if (tree->node(n).parent == INVALID_IDX)
+                break; // Reached a root that is not on the source path: not connected
         }
 
-        // Push all nodes this node points to
-        const std::map<Idx, Idx>& transforms_from = entities_[n]->relationsFrom();
-        for(std::map<Idx, Idx>::const_iterator it = transforms_from.begin(); it != transforms_from.end(); ++it)
+        // Calculate the transforms back down the path
+        geo::Pose3D tr;
+        for(std::vector<Idx>::const_reverse_iterator it = path.rbegin(); it != path.rend(); ++it)
         {
-            Idx n2 = it->first;
-            if (visited.find(n2) == visited.end())
+            if (base.valid)
             {
-                visited[n2] = SearchNode(n, it->second, true);
-                Q.push(n2);
+                if (calculateParentTransform(*tree, *it, time, tr))
+                    base.tf = base.tf * tr;
+                else
+                    base.valid = false;
             }
+
+            visited[*it] = base;
+        }
+
+        if (!base.valid)
+        {
+            all_valid = false;
+            continue;
         }
+
+        // Calculate the transforms of the source relative to its ancestors, up to the anchor of this target
+        while (source_tfs.size() <= base.anchor && source_tfs_complete)
+        {
+            Idx n = source_path[source_tfs.size() - 1];
+            if (calculateParentTransform(*tree, n, time, tr))
+                source_tfs.push_back(tr * source_tfs.back());
+            else
+                source_tfs_complete = false;
+        }
+
+        if (source_tfs.size() <= base.anchor)
+        {
+            all_valid = false;
+            continue;
+        }
+
+        tfs[i] = source_tfs[base.anchor].inverse() * base.tf;
+        valid[i] = true;
     }
 
-    return false;
+    return all_valid;
 }
 
 // --------------------------------------------------------------------------------
@@ -301,19 +556,27 @@ void WorldModel::setRelation(Idx parent, Idx child, const RelationConstPtr& r)
         p_new->setRelationTo(child, r_idx);
         c_new->setRelationFrom(parent, r_idx);
 
-        entities_[parent] = p_new;
-        entities_[child] = c_new;
+        entities_.set(parent, p_new);
+        entities_.set(child, c_new);
     }
     else
     {
-        relations_[r_idx] = r;
+        relations_.set(r_idx, r);
+        relation_revisions_.set(r_idx, revision_);
+
+        // A child that was removed and added again (at the same index) does not know the relation yet
+        if (c->relationFrom(parent) != r_idx)
+        {
+            EntityPtr c_new(new Entity(*c));
+            c_new->setRelationFrom(parent, r_idx);
+            entities_.set(child, c_new);
+            ++relations_revision_;
+        }
     }
 
     // Update entity revisions
-    for(std::size_t i = entity_revisions_.size(); i < std::max(parent, child) + 1; ++i)
-        entity_revisions_.push_back(0);
-    entity_revisions_[parent] = revision_;
-    entity_revisions_[child] = revision_;
+    setEntityRevision(parent, UpdateRequest::RELATIONS);
+    setEntityRevision(child, UpdateRequest::RELATIONS);
 }
 
 // --------------------------------------------------------------------------------
@@ -322,6 +585,8 @@ Idx WorldModel::addRelation(const RelationConstPtr& r)
 {
     Idx r_idx = relations_.size();
     relations_.push_back(r);
+    relation_revisions_.push_back(revision_);
+    ++relations_revision_;
     return r_idx;
 }
 
@@ -329,51 +594,56 @@ Idx WorldModel::addRelation(const RelationConstPtr& r)
 
 void WorldModel::setEntity(const UUID& id, const EntityConstPtr& e)
 {
-    std::map<UUID, Idx>::const_iterator it_idx = entity_map_.find(id);
-    if (it_idx == entity_map_.end())
+    Idx idx;
+    if (!entity_map_.find(id, idx))
     {
-        addNewEntity(e);
+        idx = addNewEntity(e);
+        updateLabelIndices(idx, 0, e.get());
     }
     else
     {
-        entities_[it_idx->second] = e;
+        updateLabelIndices(idx, entities_[idx].get(), e.get());
+        entities_.set(idx, e);
     }
+
+    // Anything may have changed
+    setEntityRevision(idx, ~(unsigned int)UpdateRequest::REMOVED);
+
+    // The entity may have different relations
+    ++relations_revision_;
 }
 
 // --------------------------------------------------------------------------------
 
 void WorldModel::removeEntity(const UUID& id)
 {
-    std::map<UUID, Idx>::iterator it_idx = entity_map_.find(id);
-    if (it_idx != entity_map_.end())
+    Idx idx;
+    if (entity_map_.find(id, idx))
     {
-        entities_[it_idx->second].reset();
-        entity_revisions_[it_idx->second] = revision_;
-        entity_shape_revisions_[it_idx->second] = 0;
-        entity_empty_spots_.push(it_idx->second);
-        entity_map_.erase(it_idx);
+        updateLabelIndices(idx, entities_[idx].get(), 0);
+        entities_.set(idx, EntityConstPtr());
+        setEntityRevision(idx, UpdateRequest::REMOVED);
+        removed_entities_.push_back(RemovedEntity(revision_, id));
+        entity_shape_revisions_.set(idx, 0);
+        entity_empty_spots_.push(idx);
+        entity_map_.erase(id);
+        ++relations_revision_;
     }
 }
 
 // --------------------------------------------------------------------------------
 
-EntityPtr WorldModel::getOrAddEntity(const UUID& id, std::map<UUID, EntityPtr>& new_entities)
+EntityPtr WorldModel::getOrAddEntity(const UUID& id, Idx& idx)
 {
-    // Check if the id is already in the new_entities map. If so, return it
-    std::map<UUID, EntityPtr>::const_iterator it_e = new_entities.find(id);
-    if (it_e != new_entities.end())
-        return it_e->second;
-
     EntityPtr e;
 
-    Idx idx;
     if (findEntityIdx(id, idx))
     {
         // Create a copy of the existing entity
         e = boost::make_shared<Entity>(*entities_[idx]);
 
         // Set the copy
-        entities_[idx] = e;
+        entities_.set(idx, e);
     }
     else
     {
@@ -385,12 +655,6 @@ EntityPtr WorldModel::getOrAddEntity(const UUID& id, std::map<UUID, EntityPtr>&
     // Update entity revision
     e->setRevision(revision_);
 
-    new_entities[id] = e;
-
-    for(std::size_t i = entity_revisions_.size(); i < idx + 1; ++i)
-        entity_revisions_.push_back(0);
-    entity_revisions_[idx] = revision_;
-
     return e;
 }
 
@@ -398,17 +662,15 @@ EntityPtr WorldModel::getOrAddEntity(const UUID& id, std::map<UUID, EntityPtr>&
 
 bool WorldModel::findEntityIdx(const UUID& id, Idx& idx) const
 {
-    if (id.idx != INVALID_IDX && entities_[id.idx] && entities_[id.idx]->id() == id.str())
+    if (id.idx < entities_.size() && entities_[id.idx] && entities_[id.idx]->id() == id.str())
     {
         idx = id.idx;
         return true;
     }
 
-    std::map<UUID, Idx>::const_iterator it = entity_map_.find(id);
-    if (it == entity_map_.end())
+    if (!entity_map_.find(id, idx))
         return false;
 
-    idx = it->second;
     id.idx = idx;
     return true;
 }
@@ -421,7 +683,7 @@ Idx WorldModel::addNewEntity(const EntityConstPtr& e)
     if (entity_empty_spots_.empty())
     {
         idx = entities_.size();
-        entity_map_[e->id()] = idx;
+        entity_map_.insert(e->id(), idx);
         entities_.push_back(e);
         entity_shape_revisions_.push_back(0);
     }
@@ -429,8 +691,8 @@ Idx WorldModel::addNewEntity(const EntityConstPtr& e)
     {
         idx = entity_empty_spots_.front();
         entity_empty_spots_.pop();
-        entity_map_[e->id()] = idx;
-        entities_[idx] = e;
+        entity_map_.insert(e->id(), idx);
+        entities_.set(idx, e);
     }
 
     return idx;
@@ -438,6 +700,111 @@ Idx WorldModel::addNewEntity(const EntityConstPtr& e)
 
 // --------------------------------------------------------------------------------
 
+void WorldModel::updateLabelIndices(Idx idx, const Entity* e_old, const Entity* e_new)
+{
+    static const std::set<std::string> NO_LABELS;
+
+    type_index_.update(idx, e_old ? e_old->types() : NO_LABELS, e_new ? e_new->types() : NO_LABELS);
+    flag_index_.update(idx, e_old ? e_old->flags() : NO_LABELS, e_new ? e_new->flags() : NO_LABELS);
+}
+
+// --------------------------------------------------------------------------------
+
+void WorldModel::setEntityRevision(Idx idx, unsigned int fields)
+{
+    for(std::size_t i = entity_revisions_.size(); i < idx + 1; ++i)
+    {
+        entity_revisions_.push_back(0);
+        entity_last_changes_.push_back(INVALID_IDX);
+    }
+
+    entity_revisions_.set(idx, revision_);
+
+    // If the entity was already logged in this revision, add the fields to that change
+    unsigned long seq = entity_last_changes_[idx];
+    if (seq >= entity_changes_.begin() && seq < entity_changes_.end() && entity_changes_[seq].revision == revision_)
+    {
+        entity_changes_.modify(seq).fields |= fields;
+        return;
+    }
+
+    entity_last_changes_.set(idx, entity_changes_.push_back(EntityChange(revision_, idx, fields)));
+}
+
+// --------------------------------------------------------------------------------
+
+namespace
+{
+
+bool idxLess(const WorldModel::EntityChange& c1, const WorldModel::EntityChange& c2)
+{
+    return c1.idx < c2.idx || (c1.idx == c2.idx && c1.revision < c2.revision);
+}
+
+}
+
+// --------------------------------------------------------------------------------
+
+bool WorldModel::changesSince(unsigned long revision, std::vector<EntityChange>& changes) const
+{
+    if (revision < entity_changes_.minRevision())
+        return false;
+
+    // The log is ordered by revision, so the changes after the given revision are at the end
+    std::size_t n = changes.size();
+    for(unsigned long seq = entity_changes_.upperBound(revision); seq < entity_changes_.end(); ++seq)
+        changes.push_back(entity_changes_[seq]);
+
+    // Combine the changes per entity
+    std::sort(changes.begin() + n, changes.end(), idxLess);
+
+    std::size_t j = n;
+    for(std::size_t i = n; i < changes.size(); ++i)
+    {
+        if (j > n && changes[j - 1].idx == changes[i].idx)
+        {
+            changes[j - 1].revision = changes[i].revision;
+            changes[j - 1].fields |= changes[i].fields;
+        }
+        else
+            changes[j++] = changes[i];
+    }
+    changes.resize(j);
+
+    return true;
+}
+
+// --------------------------------------------------------------------------------
+
+bool WorldModel::removedEntities(unsigned long since_revision, std::vector<UUID>& ids) const
+{
+    std::size_t n = ids.size();
+    for(unsigned long seq = removed_entities_.upperBound(since_revision); seq < removed_entities_.end(); ++seq)
+    {
+        const UUID& id = removed_entities_[seq].id;
+
+        Idx idx;
+        if (!findEntityIdx(id, idx))
+            ids.push_back(id);
+    }
+
+    // An entity may have been removed, added and removed again
+    std::sort(ids.begin() + n, ids.end());
+    ids.erase(std::unique(ids.begin() + n, ids.end()), ids.end());
+
+    return since_revision >= removed_entities_.minRevision();
+}
+
+// --------------------------------------------------------------------------------
+
+void WorldModel::setChangeLogSize(std::size_t n)
+{
+    entity_changes_.setMaxSize(n);
+    removed_entities_.setMaxSize(n);
+}
+
+// --------------------------------------------------------------------------------
+
 const PropertyKeyDBEntry* WorldModel::getPropertyInfo(const std::string& name) const
 {
     if (!property_info_db_)
@@ -0,0 +1,163 @@
+#include "ed/world_model/collision.h"
+
+#include "ed/world_model.h"
+#include "ed/entity.h"
+#include "ed/convex_hull_calc.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace ed
+{
+namespace world_model
+{
+
+namespace
+{
+
+// Added to the collision margin, to make up for rounding differences with convex_hull::collide
+const float MARGIN_SLACK = 1e-4;
+
+// ----------------------------------------------------------------------------------------------------
+
+inline bool collideBoth(const ConvexHull& c1, const geo::Vector3& pos1, const ConvexHull& c2, const geo::Vector3& pos2,
+                        float xy_padding, float z_padding)
+{
+    return convex_hull::collide(c1, pos1, c2, pos2, xy_padding, z_padding)
+            && convex_hull::collide(c2, pos2, c1, pos1, xy_padding, z_padding);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+struct SweepItem
+{
+    float min_x, min_y, max_x, max_y;
+    Idx idx;
+
+    bool operator<(const SweepItem& other) const { return min_x < other.min_x; }
+};
+
+// ----------------------------------------------------------------------------------------------------
+
+// Bounding box of the convex hull at the given position, grown by its collision margin
+void boundingBox(const ConvexHull& chull, const geo::Vector3& pos, float xy_padding, SweepItem& box)
+{
+    box.min_x = box.max_x = chull.points[0].x;
+    box.min_y = box.max_y = chull.points[0].y;
+    for(unsigned int i = 1; i < chull.points.size(); ++i)
+    {
+        const geo::Vec2f& p = chull.points[i];
+        box.min_x = std::min(box.min_x, p.x);
+        box.min_y = std::min(box.min_y, p.y);
+        box.max_x = std::max(box.max_x, p.x);
+        box.max_y = std::max(box.max_y, p.y);
+    }
+
+    float margin = collisionMargin(chull, xy_padding);
+    box.min_x += pos.x - margin;
+    box.min_y += pos.y - margin;
+    box.max_x += pos.x + margin;
+    box.max_y += pos.y + margin;
+}
+
+} // end anonymous namespace
+
+// ----------------------------------------------------------------------------------------------------
+
+float collisionMargin(const ConvexHull& chull, float xy_padding)
+{
+    std::size_t n = chull.points.size();
+    if (n < 3 || chull.normals.size() != n)
+        return std::numeric_limits<float>::infinity();
+
+    if (xy_padding <= 0)
+        return MARGIN_SLACK;
+
+    // Separating the hulls by at most the padding along every normal allows a distance of padding / cos(a / 2) at a
+    // corner where the normal turns by angle a (cos^2(a / 2) = (1 + cos(a)) / 2)
+    double min_cos2 = 1;
+    for(std::size_t i = 0; i < n; ++i)
+        min_cos2 = std::min<double>(min_cos2, (1 + chull.normals[(i + n - 1) % n].dot(chull.normals[i])) / 2);
+
+    if (min_cos2 < 1e-8)
+        return std::numeric_limits<float>::infinity();
+
+    return xy_padding / std::sqrt(min_cos2) + MARGIN_SLACK;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void collideAll(const WorldModel& wm, const ConvexHull& chull, const geo::Vector3& pos, float xy_padding,
+                float z_padding, std::vector<Idx>& idxs)
+{
+    if (chull.points.size() < 3)
+        return;
+
+    SweepItem box;
+    boundingBox(chull, pos, xy_padding, box);
+
+    std::vector<Idx> candidates;
+    wm.queryBox(geo::Vec2(box.min_x, box.min_y), geo::Vec2(box.max_x, box.max_y), candidates);
+
+    for(std::vector<Idx>::const_iterator it = candidates.begin(); it != candidates.end(); ++it)
+    {
+        const EntityConstPtr& e = wm.entities()[*it];
+        if (collideBoth(chull, pos, e->convexHull(), e->pose().t, xy_padding, z_padding))
+            idxs.push_back(*it);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void collidingPairs(const WorldModel& wm, float xy_padding, float z_padding, std::vector<std::pair<Idx, Idx> >& pairs)
+{
+    const WorldModel::EntityVector& entities = wm.entities();
+
+    std::vector<SweepItem> items;
+    items.reserve(wm.numEntities());
+    for(std::size_t i = 0; i < entities.size(); ++i)
+    {
+        const EntityConstPtr& e = entities[i];
+        if (!e || !e->has_pose() || e->convexHull().points.size() < 3)
+            continue;
+
+        items.push_back(SweepItem());
+        boundingBox(e->convexHull(), e->pose().t, xy_padding, items.back());
+        items.back().idx = i;
+    }
+
+    // Sweep along x, keeping the items of which the x-range contains the current position
+    std::sort(items.begin(), items.end());
+
+    std::vector<const SweepItem*> active;
+    for(std::vector<SweepItem>::const_iterator it = items.begin(); it != items.end(); ++it)
+    {
+        const SweepItem& item = *it;
+
+        std::size_t j = 0;
+        for(std::size_t k = 0; k < active.size(); ++k)
+        {
+            const SweepItem& other = *active[k];
+            if (other.max_x < item.min_x)
+                continue;
+
+            active[j++] = &other;
+
+            if (other.max_y < item.min_y || item.max_y < other.min_y)
+                continue;
+
+            const Entity& e1 = *entities[other.idx];
+            const Entity& e2 = *entities[item.idx];
+            if (collideBoth(e1.convexHull(), e1.pose().t, e2.convexHull(), e2.pose().t, xy_padding, z_padding))
+                pairs.push_back(std::make_pair(std::min(other.idx, item.idx), std::max(other.idx, item.idx)));
+        }
+        active.resize(j);
+
+        active.push_back(&item);
+    }
+}
+
+} // end namespace world_model
+
+} // end namespace ed
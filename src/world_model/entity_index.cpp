@@ -0,0 +1,156 @@
+#include "ed/world_model/entity_index.h"
+
+namespace ed
+{
+namespace world_model
+{
+
+// ----------------------------------------------------------------------------------------------------
+
+EntityIndex::EntityIndex() : size_(0), num_deleted_(0)
+{
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+std::size_t EntityIndex::findSlot(const UUID& id) const
+{
+    if (slots_.empty())
+        return 0;
+
+    std::size_t mask = slots_.size() - 1;
+    for(std::size_t i = id.hash() & mask; ; i = (i + 1) & mask)
+    {
+        const Slot& s = slots_[i];
+        if (s.state == EMPTY)
+            return slots_.size();
+
+        if (s.state == OCCUPIED && s.id == id)
+            return i;
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool EntityIndex::find(const UUID& id, Idx& idx) const
+{
+    std::size_t i = findSlot(id);
+    if (i == slots_.size())
+        return false;
+
+    idx = slots_[i].idx;
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void EntityIndex::insert(const UUID& id, Idx idx)
+{
+    // Keep the load factor (including tombstones) at or below 0.5
+    if (2 * (size_ + num_deleted_ + 1) > slots_.size())
+    {
+        // Only grow if the table is really filling up. Otherwise, rehashing at the
+        // same capacity is enough to get rid of the tombstones
+        std::size_t capacity = slots_.empty() ? 16 : slots_.size();
+        if (4 * (size_ + 1) > capacity)
+            capacity *= 2;
+
+        rehash(capacity);
+    }
+
+    std::size_t mask = slots_.size() - 1;
+    std::size_t i_free = slots_.size();
+
+    for(std::size_t i = id.hash() & mask; ; i = (i + 1) & mask)
+    {
+        const Slot& s = slots_[i];
+        if (s.state == EMPTY)
+        {
+            if (i_free == slots_.size())
+                i_free = i;
+            break;
+        }
+
+        if (s.state == DELETED)
+        {
+            // Remember the first tombstone, but continue looking whether the id already exists
+            if (i_free == slots_.size())
+                i_free = i;
+        }
+        else if (s.id == id)
+        {
+            if (s.idx != idx)
+                slots_.modify(i).idx = idx;
+            return;
+        }
+    }
+
+    Slot& s = slots_.modify(i_free);
+    if (s.state == DELETED)
+        --num_deleted_;
+
+    s.id = id;
+    s.idx = idx;
+    s.state = OCCUPIED;
+    ++size_;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool EntityIndex::erase(const UUID& id)
+{
+    std::size_t i = findSlot(id);
+    if (i == slots_.size())
+        return false;
+
+    Slot& s = slots_.modify(i);
+    s.id = UUID();
+    s.idx = INVALID_IDX;
+    s.state = DELETED;
+
+    --size_;
+    ++num_deleted_;
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void EntityIndex::clear()
+{
+    slots_.clear();
+    size_ = 0;
+    num_deleted_ = 0;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void EntityIndex::rehash(std::size_t capacity)
+{
+    ChunkedVector<Slot> old_slots(capacity);
+    old_slots.swap(slots_);
+
+    std::size_t mask = slots_.size() - 1;
+    for(ChunkedVector<Slot>::const_iterator it = old_slots.begin(); it != old_slots.end(); ++it)
+    {
+        if (it->state != OCCUPIED)
+            continue;
+
+        std::size_t i = it->id.hash() & mask;
+        while (slots_[i].state != EMPTY)
+            i = (i + 1) & mask;
+
+        Slot& s = slots_.modify(i);
+        s.id = it->id;
+        s.idx = it->idx;
+        s.state = OCCUPIED;
+    }
+
+    num_deleted_ = 0;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+} // end namespace world_model
+
+} // end namespace ed
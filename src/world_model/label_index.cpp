@@ -0,0 +1,111 @@
+#include "ed/world_model/label_index.h"
+
+#include <boost/make_shared.hpp>
+
+namespace ed
+{
+namespace world_model
+{
+
+namespace
+{
+
+const IdxSet EMPTY_SET;
+
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+LabelIndex::LabelIndex() : ids_(boost::make_shared<IdMap>())
+{
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool LabelIndex::findId(const std::string& label, unsigned int& id) const
+{
+    IdMap::const_iterator it = ids_->find(label);
+    if (it == ids_->end())
+        return false;
+
+    id = it->second;
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+unsigned int LabelIndex::getOrAddId(const std::string& label)
+{
+    unsigned int id;
+    if (findId(label, id))
+        return id;
+
+    // Copy on write: other copies of this index may still use the current map
+    id = sets_.size();
+
+    boost::shared_ptr<IdMap> ids = boost::make_shared<IdMap>(*ids_);
+    (*ids)[label] = id;
+    ids_ = ids;
+
+    sets_.push_back(IdxSet());
+    return id;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+const IdxSet& LabelIndex::entities(const std::string& label) const
+{
+    unsigned int id;
+    if (!findId(label, id))
+        return EMPTY_SET;
+
+    return sets_[id];
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void LabelIndex::add(Idx idx, const std::string& label)
+{
+    sets_[getOrAddId(label)].insert(idx);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void LabelIndex::remove(Idx idx, const std::string& label)
+{
+    unsigned int id;
+    if (findId(label, id))
+        sets_[id].erase(idx);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void LabelIndex::update(Idx idx, const std::set<std::string>& old_labels, const std::set<std::string>& new_labels)
+{
+    // Both sets are sorted, so walk through them together
+    std::set<std::string>::const_iterator it_old = old_labels.begin();
+    std::set<std::string>::const_iterator it_new = new_labels.begin();
+
+    while (it_old != old_labels.end() || it_new != new_labels.end())
+    {
+        if (it_new == new_labels.end() || (it_old != old_labels.end() && *it_old < *it_new))
+        {
+            remove(idx, *it_old);
+            ++it_old;
+        }
+        else if (it_old == old_labels.end() || *it_new < *it_old)
+        {
+            add(idx, *it_new);
+            ++it_new;
+        }
+        else
+        {
+            ++it_old;
+            ++it_new;
+        }
+    }
+}
+
+} // end namespace world_model
+
+} // end namespace ed
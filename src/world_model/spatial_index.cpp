@@ -0,0 +1,296 @@
+#include "ed/world_model/spatial_index.h"
+
+#include "ed/world_model.h"
+#include "ed/entity.h"
+#include "ed/update_request.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace ed
+{
+namespace world_model
+{
+
+namespace
+{
+
+// Entities that cover more cells are not put in the grid
+const std::size_t MAX_ENTITY_CELLS = 64;
+
+const std::size_t MIN_NUM_BUCKETS = 1024;
+
+// Fields of an entity update that may change its footprint
+const unsigned int GEOMETRY_FIELDS = UpdateRequest::POSE | UpdateRequest::SHAPE | UpdateRequest::CONVEX_HULLS
+                                     | UpdateRequest::REMOVED;
+
+// ----------------------------------------------------------------------------------------------------
+
+// The convex hull of an entity is relative to its position
+bool entityFootprint(const Entity& e, SpatialIndex::Box& box)
+{
+    if (!e.has_pose())
+        return false;
+
+    const geo::Vector3& t = e.pose().t;
+    box = SpatialIndex::Box(t.x, t.y, t.x, t.y);
+
+    const std::vector<geo::Vec2f>& points = e.convexHull().points;
+    for(std::vector<geo::Vec2f>::const_iterator it = points.begin(); it != points.end(); ++it)
+    {
+        float x = t.x + it->x;
+        float y = t.y + it->y;
+        box.min_x = std::min(box.min_x, x);
+        box.min_y = std::min(box.min_y, y);
+        box.max_x = std::max(box.max_x, x);
+        box.max_y = std::max(box.max_y, y);
+    }
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+inline bool intersects(const SpatialIndex::Box& b1, const SpatialIndex::Box& b2)
+{
+    return b1.min_x <= b2.max_x && b2.min_x <= b1.max_x && b1.min_y <= b2.max_y && b2.min_y <= b1.max_y;
+}
+
+} // end anonymous namespace
+
+// ----------------------------------------------------------------------------------------------------
+
+SpatialIndex::SpatialIndex(double cell_size)
+    : cell_size_(cell_size), inv_cell_size_(1.0 / cell_size), revision_(0), buckets_(MIN_NUM_BUCKETS), size_(0)
+{
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool SpatialIndex::cellRange(const Box& box, int& cx0, int& cy0, int& cx1, int& cy1, std::size_t max_cells) const
+{
+    double x0 = std::floor(box.min_x * inv_cell_size_);
+    double y0 = std::floor(box.min_y * inv_cell_size_);
+    double x1 = std::floor(box.max_x * inv_cell_size_);
+    double y1 = std::floor(box.max_y * inv_cell_size_);
+
+    // Also fails for NaN and infinite coordinates, and cell coordinates that do not fit in an int
+    if (!((x1 - x0 + 1) * (y1 - y0 + 1) <= max_cells) || !(std::fabs(x0) < 1e9 && std::fabs(y0) < 1e9))
+        return false;
+
+    cx0 = x0;
+    cy0 = y0;
+    cx1 = x1;
+    cy1 = y1;
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void SpatialIndex::addToBuckets(Idx idx, const Entry& entry)
+{
+    for(int cx = entry.cx0; cx <= entry.cx1; ++cx)
+    {
+        for(int cy = entry.cy0; cy <= entry.cy1; ++cy)
+        {
+            // Cells of the same entity may share a bucket, but the entity is only added once
+            std::vector<Idx>& b = buckets_.modify(bucket(cx, cy));
+            if (std::find(b.begin(), b.end(), idx) == b.end())
+                b.push_back(idx);
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void SpatialIndex::insert(Idx idx, const Box& box)
+{
+    while (entries_.size() <= idx)
+        entries_.push_back(Entry());
+
+    Entry& entry = entries_.modify(idx);
+    entry.box = box;
+
+    if (cellRange(box, entry.cx0, entry.cy0, entry.cx1, entry.cy1, MAX_ENTITY_CELLS))
+    {
+        entry.state = IN_GRID;
+        addToBuckets(idx, entry);
+    }
+    else
+    {
+        entry.state = LARGE;
+        large_.push_back(idx);
+    }
+
+    ++size_;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void SpatialIndex::remove(Idx idx)
+{
+    if (idx >= entries_.size() || entries_[idx].state == NOT_INDEXED)
+        return;
+
+    Entry& entry = entries_.modify(idx);
+
+    if (entry.state == IN_GRID)
+    {
+        for(int cx = entry.cx0; cx <= entry.cx1; ++cx)
+        {
+            for(int cy = entry.cy0; cy <= entry.cy1; ++cy)
+            {
+                // Cells of the same entity may share a bucket, in which case it was already removed
+                std::vector<Idx>& b = buckets_.modify(bucket(cx, cy));
+                std::vector<Idx>::iterator it = std::find(b.begin(), b.end(), idx);
+                if (it != b.end())
+                {
+                    *it = b.back();
+                    b.pop_back();
+                }
+            }
+        }
+    }
+    else
+    {
+        large_.erase(std::find(large_.begin(), large_.end(), idx));
+    }
+
+    entry.state = NOT_INDEXED;
+    --size_;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void SpatialIndex::rehash(std::size_t num_buckets)
+{
+    BucketVector buckets(num_buckets);
+    buckets_.swap(buckets);
+
+    for(std::size_t i = 0; i < entries_.size(); ++i)
+    {
+        const Entry& entry = entries_[i];
+        if (entry.state == IN_GRID)
+            addToBuckets(i, entry);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void SpatialIndex::rebuild(const WorldModel& wm)
+{
+    entries_.clear();
+    large_.clear();
+    size_ = 0;
+
+    std::size_t num_buckets = MIN_NUM_BUCKETS;
+    while (num_buckets < wm.numEntities())
+        num_buckets *= 2;
+
+    buckets_ = BucketVector(num_buckets);
+
+    const WorldModel::EntityVector& entities = wm.entities();
+    Box box;
+    for(std::size_t i = 0; i < entities.size(); ++i)
+    {
+        const EntityConstPtr& e = entities[i];
+        if (e && entityFootprint(*e, box))
+            insert(i, box);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void SpatialIndex::update(const WorldModel& wm)
+{
+    if (revision_ == wm.revision())
+        return;
+
+    std::vector<WorldModel::EntityChange> changes;
+    if (revision_ == 0 || !wm.changesSince(revision_, changes))
+    {
+        rebuild(wm);
+    }
+    else
+    {
+        const WorldModel::EntityVector& entities = wm.entities();
+        Box box;
+        for(std::vector<WorldModel::EntityChange>::const_iterator it = changes.begin(); it != changes.end(); ++it)
+        {
+            if (!(it->fields & GEOMETRY_FIELDS))
+                continue;
+
+            remove(it->idx);
+
+            const EntityConstPtr& e = entities[it->idx];
+            if (e && entityFootprint(*e, box))
+                insert(it->idx, box);
+        }
+
+        // Keep the buckets short
+        if (size_ > 2 * buckets_.size())
+            rehash(4 * buckets_.size());
+    }
+
+    revision_ = wm.revision();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void SpatialIndex::query(const Box& box, std::vector<Idx>& idxs) const
+{
+    for(std::vector<Idx>::const_iterator it = large_.begin(); it != large_.end(); ++it)
+    {
+        if (intersects(entries_[*it].box, box))
+            idxs.push_back(*it);
+    }
+
+    // For boxes that cover more cells than there are buckets, visiting all entries is cheaper
+    int qx0, qy0, qx1, qy1;
+    if (!cellRange(box, qx0, qy0, qx1, qy1, buckets_.size()))
+    {
+        for(std::size_t i = 0; i < entries_.size(); ++i)
+        {
+            const Entry& entry = entries_[i];
+            if (entry.state == IN_GRID && intersects(entry.box, box))
+                idxs.push_back(i);
+        }
+        return;
+    }
+
+    for(int cx = qx0; cx <= qx1; ++cx)
+    {
+        for(int cy = qy0; cy <= qy1; ++cy)
+        {
+            const std::vector<Idx>& b = buckets_[bucket(cx, cy)];
+            for(std::vector<Idx>::const_iterator it = b.begin(); it != b.end(); ++it)
+            {
+                const Entry& entry = entries_[*it];
+
+                // The bucket also contains entities of other cells. An entity that covers multiple cells of the
+                // query is only reported in the first of those cells
+                if (cx < entry.cx0 || cx > entry.cx1 || cy < entry.cy0 || cy > entry.cy1
+                        || cx != std::max(entry.cx0, qx0) || cy != std::max(entry.cy0, qy0))
+                    continue;
+
+                if (intersects(entry.box, box))
+                    idxs.push_back(*it);
+            }
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool SpatialIndex::footprint(Idx idx, Box& box) const
+{
+    if (idx >= entries_.size() || entries_[idx].state == NOT_INDEXED)
+        return false;
+
+    box = entries_[idx].box;
+    return true;
+}
+
+} // end namespace world_model
+
+} // end namespace ed
@@ -11,76 +11,250 @@ namespace world_model
 
 // ----------------------------------------------------------------------------------------------------
 
+TransformCrawler::TransformCrawler()
+    : wm_(0), pos_(0), revision_(0), relations_revision_(0), num_calculated_(0)
+{
+}
+
+// ----------------------------------------------------------------------------------------------------
+
 TransformCrawler::TransformCrawler(const WorldModel& wm, const UUID& root_id, const Time& time)
-    : wm_(wm), time_(time)
+    : wm_(0), pos_(0), revision_(0), relations_revision_(0), num_calculated_(0)
+{
+    start(wm, root_id, time);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void TransformCrawler::start(const WorldModel& wm, const UUID& root_id, const Time& time)
+{
+    root_id_ = root_id;
+    skip_entities_.clear();
+    restart(wm, time);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void TransformCrawler::start(const WorldModel& wm, const UUID& root_id, const Time& time,
+                             const std::vector<Idx>& skip_entities)
 {
+    root_id_ = root_id;
+    skip_entities_ = skip_entities;
+    restart(wm, time);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void TransformCrawler::restart(const WorldModel& wm, const Time& time)
+{
+    wm_ = &wm;
+    time_ = time;
+    revision_ = wm.revision();
+    relations_revision_ = wm.relationsRevision();
+
+    nodes_.clear();
+    num_calculated_ = 0;
+
     Idx root_idx;
-    if (wm_.findEntityIdx(root_id, root_idx))
+    if (wm.findEntityIdx(root_id_, root_idx))
+        crawl(root_idx);
+
+    pos_ = 0;
+    skipInvalid();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void TransformCrawler::update(const WorldModel& wm, const Time& time, const std::vector<Idx>& changed_relations)
+{
+    if (!wm_ || wm.relationsRevision() != relations_revision_)
+    {
+        restart(wm, time);
+        return;
+    }
+
+    wm_ = &wm;
+    time_ = time;
+    num_calculated_ = 0;
+
+    const WorldModel::RevisionVector& relation_revisions = wm.relation_revisions();
+
+    changed_.resize(wm.relations().size(), false);
+    for(std::vector<Idx>::const_iterator it = changed_relations.begin(); it != changed_relations.end(); ++it)
+    {
+        if (*it < changed_.size())
+            changed_[*it] = true;
+    }
+
+    // Parents come before children, so a single pass suffices. A node is changed if its relation or the transform
+    // of its parent changed. The buffer keeps its capacity, so this does not allocate once it has grown
+    node_changed_.assign(nodes_.size(), false);
+    bool ok = true;
+    for(std::size_t i = 0; i < nodes_.size(); ++i)
+    {
+        Node& node = nodes_[i];
+
+        bool parent_valid = (node.parent == INVALID_IDX || nodes_[node.parent].valid);
+        bool parent_changed = (node.parent != INVALID_IDX && node_changed_[node.parent]);
+
+        if (!parent_valid)
+        {
+            node.valid = false;
+            continue;
+        }
+
+        if (!parent_changed && !changed_[node.relation] && relation_revisions[node.relation] <= revision_ && node.valid)
+            continue;
+
+        bool was_valid = node.valid;
+        calculateTransform(node);
+        node_changed_[i] = true;
+
+        // The children of a node that became valid were never crawled, and the children of a node that became
+        // invalid are no longer crawled from it (but may be reached through other entities)
+        if (node.valid != was_valid && (node.valid || node.has_children))
+        {
+            ok = false;
+            break;
+        }
+    }
+
+    for(std::vector<Idx>::const_iterator it = changed_relations.begin(); it != changed_relations.end(); ++it)
     {
-        const EntityConstPtr& e = wm_.entities()[root_idx];
-        pushChildren(*e, geo::Pose3D::identity());
-        visited_.insert(root_idx);
+        if (*it < changed_.size())
+            changed_[*it] = false;
     }
+
+    if (!ok)
+    {
+        restart(wm, time);
+        return;
+    }
+
+    revision_ = wm.revision();
+
+    pos_ = 0;
+    skipInvalid();
 }
 
 // ----------------------------------------------------------------------------------------------------
 
 const EntityConstPtr& TransformCrawler::entity() const
 {
-    return wm_.entities()[queue_.front().entity_idx];
+    return wm_->entities()[nodes_[pos_].entity_idx];
 }
 
 // ----------------------------------------------------------------------------------------------------
 
 bool TransformCrawler::next()
 {
-    if (queue_.empty())
+    if (pos_ >= nodes_.size())
         return false;
 
-    const ed::EntityConstPtr& e = entity();
-    if (!e)
+    ++pos_;
+    skipInvalid();
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void TransformCrawler::skipInvalid()
+{
+    while (pos_ < nodes_.size() && !nodes_[pos_].valid)
+        ++pos_;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool TransformCrawler::calculateTransform(Node& node)
+{
+    ++num_calculated_;
+
+    geo::Pose3D rel_transform;
+    const RelationConstPtr& r = wm_->relations()[node.relation];
+    if (!r || !r->calculateTransform(time_, rel_transform))
+    {
+        node.valid = false;
         return false;
+    }
 
-    pushChildren(*e, transform());
+    if (node.inverse)
+        rel_transform = rel_transform.inverse();
 
-    queue_.pop();
+    if (node.parent == INVALID_IDX)
+        node.transform = rel_transform;
+    else
+        node.transform = nodes_[node.parent].transform * rel_transform;
 
+    node.valid = true;
     return true;
 }
 
 // ----------------------------------------------------------------------------------------------------
 
-void TransformCrawler::pushChildren(const Entity& e, const geo::Pose3D& transform)
+void TransformCrawler::crawl(Idx root_idx)
 {
-    // Push all nodes that point to this node
-    const std::map<Idx, Idx>& transforms_to = e.relationsTo();
-    for(std::map<Idx, Idx>::const_iterator it = transforms_to.begin(); it != transforms_to.end(); ++it)
+    // Only the entities that are visited are reset afterwards, so a crawl does not cost O(#entities)
+    if (visited_.size() < wm_->entities().size())
+        visited_.resize(wm_->entities().size(), false);
+
+    // Skipped entities are marked as visited, so they are never pushed
+    for(std::vector<Idx>::const_iterator it = skip_entities_.begin(); it != skip_entities_.end(); ++it)
     {
-        Idx n2 = it->first;
-        if (visited_.find(n2) == visited_.end())
-        {
-            geo::Pose3D rel_transform;
-            RelationConstPtr r = wm_.relations()[it->second];
-            if (r && r->calculateTransform(time_, rel_transform))
-                queue_.push(Node(n2, transform * rel_transform));
+        if (*it < visited_.size())
+            visited_[*it] = true;
+    }
 
-            visited_.insert(n2);
-        }
+    visited_[root_idx] = true;
+
+    // Breadth-first: nodes_ doubles as queue
+    pushChildren(root_idx, INVALID_IDX);
+    for(std::size_t i = 0; i < nodes_.size(); ++i)
+    {
+        // Children of entities of which the transform could not be calculated are not crawled
+        if (nodes_[i].valid)
+            pushChildren(nodes_[i].entity_idx, i);
+    }
+
+    visited_[root_idx] = false;
+    for(std::vector<Node>::const_iterator it = nodes_.begin(); it != nodes_.end(); ++it)
+        visited_[it->entity_idx] = false;
+
+    for(std::vector<Idx>::const_iterator it = skip_entities_.begin(); it != skip_entities_.end(); ++it)
+    {
+        if (*it < visited_.size())
+            visited_[*it] = false;
     }
+}
 
-    // Push all nodes this node points to
-    const std::map<Idx, Idx>& transforms_from = e.relationsFrom();
-    for(std::map<Idx, Idx>::const_iterator it = transforms_from.begin(); it != transforms_from.end(); ++it)
+// ----------------------------------------------------------------------------------------------------
+
+void TransformCrawler::pushChildren(Idx entity_idx, Idx parent)
+{
+    const WorldModel::EntityVector& entities = wm_->entities();
+
+    const EntityConstPtr& e = entities[entity_idx];
+    if (!e)
+        return;
+
+    for(unsigned int dir = 0; dir < 2; ++dir)
     {
-        Idx n2 = it->first;
-        if (visited_.find(n2) == visited_.end())
+        // First push all nodes that point to this node, then all nodes this node points to
+        const std::map<Idx, Idx>& rels = (dir == 0 ? e->relationsTo() : e->relationsFrom());
+        for(std::map<Idx, Idx>::const_iterator it = rels.begin(); it != rels.end(); ++it)
         {
-            geo::Pose3D rel_transform;
-            RelationConstPtr r = wm_.relations()[it->second];
-            if (r && r->calculateTransform(time_, rel_transform))
-                queue_.push(Node(n2, transform * rel_transform.inverse()));
+            Idx n2 = it->first;
+            if (n2 >= entities.size() || visited_[n2] || !entities[n2])
+                continue;
+
+            visited_[n2] = true;
+
+            if (parent != INVALID_IDX)
+                nodes_[parent].has_children = true;
 
-            visited_.insert(n2);
+            nodes_.push_back(Node(n2, parent, it->second, dir == 1));
+            calculateTransform(nodes_.back());
         }
     }
 }
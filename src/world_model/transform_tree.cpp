@@ -0,0 +1,69 @@
+#include "ed/world_model/transform_tree.h"
+
+#include "ed/world_model.h"
+#include "ed/entity.h"
+
+namespace ed
+{
+namespace world_model
+{
+
+// ----------------------------------------------------------------------------------------------------
+
+TransformTree::TransformTree(const WorldModel& wm, unsigned long revision) : revision_(revision)
+{
+    const WorldModel::EntityVector& entities = wm.entities();
+    nodes_.resize(entities.size());
+
+    std::vector<bool> visited(entities.size(), false);
+    std::vector<Idx> queue;
+    queue.reserve(entities.size());
+
+    // First grow the trees from entities without a parent, then from the entities left (relations in a cycle)
+    for(unsigned int pass = 0; pass < 2; ++pass)
+    {
+        for(Idx root = 0; root < entities.size(); ++root)
+        {
+            const EntityConstPtr& e_root = entities[root];
+            if (visited[root] || !e_root || (pass == 0 && !e_root->relationsFrom().empty()))
+                continue;
+
+            // Breadth-first, such that paths to the root are as short as possible
+            visited[root] = true;
+            queue.clear();
+            queue.push_back(root);
+
+            for(std::size_t i = 0; i < queue.size(); ++i)
+            {
+                Idx n = queue[i];
+                const EntityConstPtr& e = entities[n];
+
+                for(unsigned int dir = 0; dir < 2; ++dir)
+                {
+                    // Children of n (relations from n to them), and parents of n (relations from them to n)
+                    const std::map<Idx, Idx>& rels = (dir == 0 ? e->relationsTo() : e->relationsFrom());
+                    for(std::map<Idx, Idx>::const_iterator it = rels.begin(); it != rels.end(); ++it)
+                    {
+                        Idx n2 = it->first;
+                        if (n2 >= entities.size() || visited[n2] || !entities[n2])
+                            continue;
+
+                        visited[n2] = true;
+
+                        Node& node = nodes_[n2];
+                        node.parent = n;
+                        node.relation = it->second;
+                        node.inverse = (dir == 1);
+                        node.depth = nodes_[n].depth + 1;
+
+                        queue.push_back(n2);
+                    }
+                }
+            }
+        }
+    }
+}
+
+} // end namespace world_model
+
+} // end namespace ed
@@ -1,6 +1,29 @@
 #include <ed/world_model.h>
 #include <ed/update_request.h>
+#include <ed/entity.h>
 #include <ed/relations/transform_cache.h>
+#include <ed/world_model/entity_index.h>
+#include <ed/world_model/transform_crawler.h>
+#include <ed/world_model/collision.h>
+#include <ed/convex_hull_calc.h>
+#include <ed/time_cache.h>
+#include <ed/shared_time_cache.h>
+#include <ed/serialization/serialization.h>
+#include <ed/io/json_writer.h>
+#include <ed/io/json_reader.h>
+#include <ed/io/binary_writer.h>
+#include <ed/io/binary_reader.h>
+
+#include "../src/convex_hull_kernels.h"
+
+#include <geolib/Shape.h>
+#include <tue/config/writer.h>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <queue>
+#include <cmath>
 
 #include <ros/time.h>    // Why do we need this?
 
@@ -65,30 +88,2402 @@ void profile(const ed::WorldModel& wm)
 
 // ----------------------------------------------------------------------------------------------------
 
-void testCorrectness(const ed::WorldModel& wm)
+void benchmarkLookup(unsigned int num_entities)
 {
-    ed::UUID id1 = "map";
-    ed::UUID id2 = "bottle";
+    std::vector<ed::UUID> ids;
+    for(unsigned int i = 0; i < num_entities; ++i)
+    {
+        std::stringstream id;
+        id << "entity_" << i;
+        ids.push_back(id.str());
+    }
 
-    geo::Pose3D tr;
-    if (wm.calculateTransform(id1, id2, 0, tr))
+    unsigned int num_lookups = 1000000;
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // std::map vs EntityIndex lookup
+
+    std::map<ed::UUID, ed::Idx> map;
+    ed::world_model::EntityIndex index;
+    for(unsigned int i = 0; i < ids.size(); ++i)
     {
-        std::cout << tr << std::endl;
+        map[ids[i]] = i;
+        index.insert(ids[i], i);
+    }
+
+    ed::Idx sum_map = 0;
+    tue::Timer timer;
+    timer.start();
+    for(unsigned int i = 0; i < num_lookups; ++i)
+    {
+        std::map<ed::UUID, ed::Idx>::const_iterator it = map.find(ids[(i * 7919) % ids.size()]);
+        if (it != map.end())
+            sum_map += it->second;
+    }
+    double t_map = timer.getElapsedTimeInMilliSec();
+
+    ed::Idx sum_index = 0;
+    timer.start();
+    for(unsigned int i = 0; i < num_lookups; ++i)
+    {
+        ed::Idx idx;
+        if (index.find(ids[(i * 7919) % ids.size()], idx))
+            sum_index += idx;
+    }
+    double t_index = timer.getElapsedTimeInMilliSec();
+
+    if (sum_map != sum_index)
+        std::cout << "    ERROR: std::map and EntityIndex lookup results differ" << std::endl;
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // WorldModel update (all entities) and lookup
+
+    ed::WorldModel wm;
+
+    ed::UpdateRequest req_add;
+    for(unsigned int i = 0; i < ids.size(); ++i)
+        req_add.setType(ids[i], "object");
+    wm.update(req_add);
+
+    timer.start();
+    ed::UpdateRequest req_pose;
+    for(unsigned int i = 0; i < ids.size(); ++i)
+        req_pose.setPose(ids[i], geo::Pose3D(i, 0, 0));
+    double t_build = timer.getElapsedTimeInMilliSec();
+
+    timer.start();
+    wm.update(req_pose);
+    double t_update = timer.getElapsedTimeInMilliSec();
+
+    // New world model revision in which only one entity changes (as done by the server)
+    ed::UpdateRequest req_single;
+    req_single.setPose(ids.front(), geo::Pose3D(-1, 0, 0));
+
+    unsigned int num_snapshots = 100;
+    timer.start();
+    for(unsigned int i = 0; i < num_snapshots; ++i)
+    {
+        ed::WorldModel wm_new(wm);
+        wm_new.update(req_single);
+    }
+    double t_snapshot = timer.getElapsedTimeInMilliSec();
+
+    // Five plugins that each update all entities: applied one by one versus merged first (as done by the server)
+    std::vector<ed::UpdateRequestConstPtr> plugin_reqs;
+    for(unsigned int j = 0; j < 5; ++j)
+    {
+        ed::UpdateRequestPtr req(new ed::UpdateRequest);
+        for(unsigned int i = 0; i < ids.size(); ++i)
+        {
+            req->setPose(ids[i], geo::Pose3D(i, j, 0));
+            req->setExistenceProbability(ids[i], 0.1 * j);
+        }
+        plugin_reqs.push_back(req);
+    }
+
+    timer.start();
+    {
+        ed::WorldModel wm_new(wm);
+        for(unsigned int j = 0; j < plugin_reqs.size(); ++j)
+            wm_new.update(*plugin_reqs[j]);
+    }
+    double t_separate = timer.getElapsedTimeInMilliSec();
+
+    timer.start();
+    {
+        ed::WorldModel wm_new(wm);
+        std::vector<ed::UpdateRequestConstPtr> batches;
+        ed::mergeUpdateRequests(plugin_reqs, batches);
+        for(unsigned int j = 0; j < batches.size(); ++j)
+            wm_new.update(*batches[j]);
     }
+    double t_merged = timer.getElapsedTimeInMilliSec();
+
+    // Use fresh UUIDs such that the cached index inside the UUID can not be used
+    std::vector<std::string> id_strs(ids.size());
+    for(unsigned int i = 0; i < ids.size(); ++i)
+        id_strs[i] = ids[i].str();
+
+    unsigned int num_found = 0;
+    timer.start();
+    for(unsigned int i = 0; i < num_lookups; ++i)
+    {
+        if (wm.getEntity(id_strs[(i * 7919) % id_strs.size()]))
+            ++num_found;
+    }
+    double t_wm_lookup = timer.getElapsedTimeInMilliSec();
+
+    if (num_found != num_lookups)
+        std::cout << "    ERROR: not all entities found in world model" << std::endl;
+
+    std::cout << num_entities << " entities:" << std::endl;
+    std::cout << "    lookup (std::map):      " << 1e6 * t_map / num_lookups << " ns" << std::endl;
+    std::cout << "    lookup (EntityIndex):   " << 1e6 * t_index / num_lookups << " ns" << std::endl;
+    std::cout << "    lookup (WorldModel):    " << 1e6 * t_wm_lookup / num_lookups << " ns" << std::endl;
+    std::cout << "    build request (pose):   " << 1e6 * t_build / ids.size() << " ns / entity" << std::endl;
+    std::cout << "    update (pose, all):     " << t_update << " ms (" << 1e3 * ids.size() / t_update << " entities / sec)" << std::endl;
+    std::cout << "    snapshot + update (1):  " << 1e3 * t_snapshot / num_snapshots << " us" << std::endl;
+    std::cout << "    5 requests (separate):  " << t_separate << " ms" << std::endl;
+    std::cout << "    5 requests (merged):    " << t_merged << " ms" << std::endl;
 }
 
 // ----------------------------------------------------------------------------------------------------
 
-int main(int argc, char **argv)
+void benchmarkSpatialQuery(unsigned int num_entities)
 {
-    ros::Time::init();                      // Why do we need this?
+    // Entities spread over a square world with a density of one entity per square meter
+    double size = std::sqrt((double)num_entities);
+    std::vector<ed::UUID> ids(num_entities);
+    ed::UpdateRequest req;
+    for(unsigned int i = 0; i < num_entities; ++i)
+    {
+        std::stringstream ss;
+        ss << "entity-" << i;
+        ids[i] = ss.str();
+        req.setPose(ids[i], geo::Pose3D(size * (rand() / (double)RAND_MAX), size * (rand() / (double)RAND_MAX), 0));
+    }
 
     ed::WorldModel wm;
-    buildWorldModel(wm);
+    wm.update(req);
 
-    std::string cmd;
-    if (argc > 1)
-        cmd = argv[1];
+    std::cout << num_entities << " entities, radius queries of 2 m:" << std::endl;
+
+    unsigned int N = 1000;
+    std::vector<geo::Vec2> centers(N);
+    for(unsigned int i = 0; i < N; ++i)
+        centers[i] = geo::Vec2(size * (rand() / (double)RAND_MAX), size * (rand() / (double)RAND_MAX));
+
+    tue::Timer timer;
+
+    // Iterating all entities, as srvSimpleQuery did
+    std::size_t num_found_scan = 0;
+    timer.start();
+    for(unsigned int i = 0; i < N; ++i)
+    {
+        geo::Vector3 center(centers[i].x, centers[i].y, 0);
+        for(ed::WorldModel::const_iterator it = wm.begin(); it != wm.end(); ++it)
+        {
+            if ((*it)->has_pose() && ((*it)->pose().t - center).length2() <= 4)
+                ++num_found_scan;
+        }
+    }
+    std::cout << "    scan:                           " << timer.getElapsedTimeInMicroSec() / N << " us" << std::endl;
+
+    timer.start();
+    std::vector<ed::Idx> idxs;
+    wm.queryRadius(centers[0], 2, idxs);
+    std::cout << "    first query (builds index):     " << timer.getElapsedTimeInMilliSec() << " ms" << std::endl;
+
+    std::size_t num_found = 0;
+    timer.start();
+    for(unsigned int i = 0; i < N; ++i)
+    {
+        idxs.clear();
+        wm.queryRadius(centers[i], 2, idxs);
+        num_found += idxs.size();
+    }
+    std::cout << "    index:                          " << timer.getElapsedTimeInMicroSec() / N << " us ("
+              << (double)num_found_scan / N << " / " << (double)num_found / N << " entities found)" << std::endl;
+
+    // A new snapshot in which 100 entities moved only has to update those in its copy of the index
+    ed::WorldModel wm2(wm);
+    ed::UpdateRequest req_move;
+    for(unsigned int i = 0; i < 100; ++i)
+        req_move.setPose(ids[i], geo::Pose3D(size * (rand() / (double)RAND_MAX), size * (rand() / (double)RAND_MAX), 0));
+    wm2.update(req_move);
+
+    timer.start();
+    idxs.clear();
+    wm2.queryRadius(centers[0], 2, idxs);
+    std::cout << "    first query after 100 moved:    " << timer.getElapsedTimeInMilliSec() << " ms" << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void benchmarkTypeQuery(unsigned int num_entities)
+{
+    // One in a thousand entities is a person
+    ed::UpdateRequest req;
+    for(unsigned int i = 0; i < num_entities; ++i)
+    {
+        std::stringstream ss;
+        ss << "entity-" << i;
+        req.setType(ss.str(), i % 1000 == 0 ? "person" : "object");
+    }
+
+    ed::WorldModel wm;
+    wm.update(req);
+
+    std::cout << num_entities << " entities, find the " << num_entities / 1000 << " persons:" << std::endl;
+
+    unsigned int N = 100;
+    tue::Timer timer;
+
+    std::size_t num_found_scan = 0;
+    timer.start();
+    for(unsigned int i = 0; i < N; ++i)
+    {
+        for(ed::WorldModel::const_iterator it = wm.begin(); it != wm.end(); ++it)
+        {
+            if ((*it)->hasType("person"))
+                ++num_found_scan;
+        }
+    }
+    std::cout << "    scan:                           " << timer.getElapsedTimeInMicroSec() / N << " us" << std::endl;
+
+    std::size_t num_found = 0;
+    timer.start();
+    for(unsigned int i = 0; i < N; ++i)
+    {
+        const ed::world_model::IdxSet& persons = wm.entitiesWithType("person");
+        for(ed::world_model::IdxSet::const_iterator it = persons.begin(); it != persons.end(); ++it)
+        {
+            if (wm.entities()[*it])
+                ++num_found;
+        }
+    }
+    std::cout << "    index:                          " << timer.getElapsedTimeInMicroSec() / N << " us ("
+              << num_found_scan / N << " / " << num_found / N << " found)" << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+double uniform(double min, double max)
+{
+    return min + (max - min) * (rand() / (double)RAND_MAX);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void benchmarkCollision(unsigned int num_entities)
+{
+    // Random convex hulls of up to 1 by 1 meter, with one entity per 2 square meters
+    double size = std::sqrt(2.0 * num_entities);
+    ed::UpdateRequest req;
+    for(unsigned int i = 0; i < num_entities; ++i)
+    {
+        std::vector<geo::Vec2f> points(8);
+        for(unsigned int j = 0; j < points.size(); ++j)
+            points[j] = geo::Vec2f(uniform(-0.5, 0.5), uniform(-0.5, 0.5));
+
+        ed::ConvexHull chull;
+        ed::convex_hull::createAbsolute(points, 0, 1, chull);
+
+        std::stringstream ss;
+        ss << "entity-" << i;
+        req.setConvexHullNew(ss.str(), chull, geo::Pose3D(uniform(0, size), uniform(0, size), 0), 0);
+    }
+
+    ed::WorldModel wm;
+    wm.update(req);
+
+    std::cout << num_entities << " random convex hulls, find all collisions:" << std::endl;
+
+    tue::Timer timer;
+
+    // All pairs
+    std::size_t num_pairs_brute = 0;
+    timer.start();
+    for(ed::WorldModel::const_iterator it1 = wm.begin(); it1 != wm.end(); ++it1)
+    {
+        const ed::Entity& e1 = **it1;
+        for(ed::WorldModel::const_iterator it2 = it1; ++it2 != wm.end(); )
+        {
+            const ed::Entity& e2 = **it2;
+            if (ed::convex_hull::collide(e1.convexHull(), e1.pose().t, e2.convexHull(), e2.pose().t, 0.05, 0)
+                    && ed::convex_hull::collide(e2.convexHull(), e2.pose().t, e1.convexHull(), e1.pose().t, 0.05, 0))
+                ++num_pairs_brute;
+        }
+    }
+    std::cout << "    all pairs:                      " << timer.getElapsedTimeInMilliSec() << " ms" << std::endl;
+
+    std::vector<std::pair<ed::Idx, ed::Idx> > pairs;
+    timer.start();
+    ed::world_model::collidingPairs(wm, 0.05, 0, pairs);
+    std::cout << "    sweep and prune:                " << timer.getElapsedTimeInMilliSec() << " ms ("
+              << num_pairs_brute << " / " << pairs.size() << " pairs)" << std::endl;
+
+    // Every entity against the world
+    std::vector<ed::Idx> idxs;
+    timer.start();
+    for(ed::WorldModel::const_iterator it = wm.begin(); it != wm.end(); ++it)
+        ed::world_model::collideAll(wm, (*it)->convexHull(), (*it)->pose().t, 0.05, 0, idxs);
+    std::cout << "    collideAll per entity:          " << timer.getElapsedTimeInMilliSec() << " ms ("
+              << (idxs.size() - wm.numEntities()) / 2 << " pairs)" << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void benchmarkConvexHullCalc(unsigned int num_points)
+{
+    // Ellipses, close enough together that many normals have to be checked before the hulls are separated
+    std::vector<geo::Vec2f> points(num_points);
+    for(unsigned int i = 0; i < num_points; ++i)
+    {
+        double a = 2 * M_PI * i / num_points;
+        points[i] = geo::Vec2f(0.5 * std::cos(a), 0.4 * std::sin(a));
+    }
+
+    std::vector<ed::ConvexHull> chulls(1000);
+    std::vector<geo::Vector3> positions(chulls.size());
+
+    tue::Timer timer;
+    timer.start();
+    for(unsigned int i = 0; i < chulls.size(); ++i)
+    {
+        ed::convex_hull::createAbsolute(points, 0, 1, chulls[i]);
+        positions[i] = geo::Vector3(uniform(0, 30), uniform(0, 30), 0);
+    }
+    double t_create = timer.getElapsedTimeInMicroSec();
+
+    std::size_t num_collisions = 0;
+    timer.start();
+    for(unsigned int i = 0; i < chulls.size(); ++i)
+    {
+        for(unsigned int j = i + 1; j < chulls.size(); ++j)
+            num_collisions += ed::convex_hull::collide(chulls[i], positions[i], chulls[j], positions[j], 0.05, 0);
+    }
+    double t_collide = timer.getElapsedTimeInMicroSec();
+
+    std::cout << "    " << num_points << " points: create " << t_create / chulls.size() << " us, collide "
+              << 1000 * t_collide / (chulls.size() * (chulls.size() - 1) / 2) << " ns per pair ("
+              << num_collisions << " collisions)" << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void benchmarkTransforms(const ed::WorldModel& wm)
+{
+    tue::Timer timer;
+    geo::Pose3D tr;
+
+    // The first calculation also builds the transform tree
+    timer.start();
+    wm.calculateTransform("map", "e100", 0, tr);
+    std::cout << "    first transform (builds tree):  " << timer.getElapsedTimeInMilliSec() << " ms" << std::endl;
+
+    unsigned int N = 1000;
+    const char* targets[] = { "e100", "e99999" };
+    for(unsigned int i = 0; i < 2; ++i)
+    {
+        timer.start();
+        for(unsigned int j = 0; j < N; ++j)
+            wm.calculateTransform("map", targets[i], 0, tr);
+        std::cout << "    map -> " << targets[i] << ":" << std::string(20 - std::string(targets[i]).size(), ' ')
+                  << timer.getElapsedTimeInMicroSec() / N << " us" << std::endl;
+    }
+
+    // Many targets relative to the same source
+    std::vector<ed::UUID> ids;
+    for(unsigned int i = 0; i < 1000; ++i)
+    {
+        std::stringstream id;
+        id << "e" << i;
+        ids.push_back(id.str());
+    }
+
+    timer.start();
+    for(unsigned int i = 0; i < ids.size(); ++i)
+        wm.calculateTransform("map", ids[i], 0, tr);
+    std::cout << "    map -> e0..e999 (separate):     " << timer.getElapsedTimeInMilliSec() << " ms" << std::endl;
+
+    std::vector<geo::Pose3D> tfs;
+    std::vector<bool> valid;
+    timer.start();
+    wm.calculateTransforms("map", ids, 0, tfs, valid);
+    std::cout << "    map -> e0..e999 (batch):        " << timer.getElapsedTimeInMilliSec() << " ms" << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void benchmarkTransformCrawler(const ed::WorldModel& wm)
+{
+    tue::Timer timer;
+
+    ed::world_model::TransformCrawler crawler;
+    timer.start();
+    crawler.start(wm, "map", 0);
+    std::cout << "    crawl from map:                 " << timer.getElapsedTimeInMilliSec() << " ms" << std::endl;
+
+    timer.start();
+    crawler.start(wm, "map", 0);
+    std::cout << "    crawl from map (reused):        " << timer.getElapsedTimeInMilliSec() << " ms" << std::endl;
+
+    // Mark the relation to one of the last entities as changed in place
+    ed::Idx parent_idx, child_idx;
+    wm.findEntityIdx("e99989", parent_idx);
+    wm.findEntityIdx("e99990", child_idx);
+    std::vector<ed::Idx> changed_relations(1, wm.entities()[parent_idx]->relationTo(child_idx));
+
+    timer.start();
+    crawler.update(wm, 0, changed_relations);
+    std::cout << "    update (1 relation changed):    " << timer.getElapsedTimeInMilliSec() << " ms ("
+              << crawler.numCalculatedTransforms() << " transforms)" << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void benchmarkSerialization(const ed::WorldModel& wm)
+{
+    tue::Timer timer;
+
+    std::string json;
+    timer.start();
+    {
+        ed::io::JSONWriter w(json);
+        ed::serialize(wm, w);
+        w.finish();
+    }
+    std::cout << "    JSON encode:                    " << timer.getElapsedTimeInMilliSec() << " ms ("
+              << json.size() / 1024 << " KiB)" << std::endl;
+
+    std::string binary;
+    timer.start();
+    {
+        ed::io::BinaryWriter w(binary);
+        ed::serialize(wm, w);
+        w.finish();
+    }
+    std::cout << "    binary encode:                  " << timer.getElapsedTimeInMilliSec() << " ms ("
+              << binary.size() / 1024 << " KiB)" << std::endl;
+
+    timer.start();
+    {
+        ed::io::JSONReader r(json.c_str());
+        ed::UpdateRequest req;
+        ed::deserialize(r, req);
+    }
+    std::cout << "    JSON decode:                    " << timer.getElapsedTimeInMilliSec() << " ms" << std::endl;
+
+    timer.start();
+    {
+        ed::io::BinaryReader r(binary.data(), binary.size());
+        ed::UpdateRequest req;
+        ed::deserialize(r, req);
+    }
+    std::cout << "    binary decode:                  " << timer.getElapsedTimeInMilliSec() << " ms" << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// The previous, std::map based, TimeCache, for comparison
+template<typename T>
+class MapTimeCache
+{
+
+public:
+
+    typedef typename std::map<ed::Time, T>::const_iterator const_iterator;
+
+    MapTimeCache() : max_size_(0) {}
+
+    void insert(const ed::Time& t, const T& value)
+    {
+        if (max_size_ > 0 && cache_.size() == max_size_)
+            cache_.erase(cache_.begin());
+        cache_[t] = value;
+    }
+
+    void getLowerUpper(const ed::Time& t, const_iterator& lower, const_iterator& upper) const
+    {
+        upper = cache_.upper_bound(t);
+        if (upper == cache_.begin())
+            lower = cache_.end();
+        else
+        {
+            lower = upper;
+            --lower;
+        }
+    }
+
+    inline const_iterator end() const { return cache_.end(); }
+
+    void setMaxSize(unsigned int n) { max_size_ = n; }
+
+private:
+
+    std::map<ed::Time, T> cache_;
+
+    unsigned int max_size_;
+
+};
+
+// ----------------------------------------------------------------------------------------------------
+
+template<typename Cache>
+void benchmarkTimeCache(const std::string& name, unsigned int cache_size)
+{
+    unsigned int N = 100000;
+    tue::Timer timer;
+
+    // Insert (in time order)
+    Cache cache;
+    cache.setMaxSize(cache_size);
+    timer.start();
+    for(unsigned int i = 0; i < N; ++i)
+        cache.insert(0.01 * i, i);
+    double t_insert = timer.getElapsedTimeInMicroSec() * 1000 / N;
+
+    // Copy and insert, as is done for every joint state
+    boost::shared_ptr<Cache> last(new Cache(cache));
+    timer.start();
+    for(unsigned int i = 0; i < N / 10; ++i)
+    {
+        boost::shared_ptr<Cache> c(new Cache(*last));
+        c->insert(0.01 * (N + i), i);
+        last = c;
+    }
+    double t_copy = timer.getElapsedTimeInMicroSec() * 10000 / N;
+
+    // Look up
+    double sum = 0;
+    double t_first = 0.01 * (N + N / 10 - cache_size);
+    typename Cache::const_iterator lower, upper;
+    timer.start();
+    for(unsigned int i = 0; i < N; ++i)
+    {
+        last->getLowerUpper(t_first + (0.01 * cache_size * i) / N, lower, upper);
+        if (lower != last->end())
+            sum += lower->second;
+    }
+    double t_lookup = timer.getElapsedTimeInMicroSec() * 1000 / N;
+
+    std::cout << "    " << name << ": insert " << t_insert << " ns, copy + insert " << t_copy << " ns, lookup "
+              << t_lookup << " ns" << (sum < 0 ? " " : "") << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool equalPoints(const std::vector<geo::Vec2f>& points1, const std::vector<geo::Vec2f>& points2)
+{
+    if (points1.size() != points2.size())
+        return false;
+
+    for(unsigned int i = 0; i < points1.size(); ++i)
+    {
+        if (points1[i].x != points2[i].x || points1[i].y != points2[i].y)
+            return false;
+    }
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// Returns true if the hull has the same points in the same order as the one of OpenCV (which may start elsewhere)
+bool equalToOpenCVHull(const std::vector<geo::Vec2f>& points, const std::vector<geo::Vec2f>& hull)
+{
+    cv::Mat_<cv::Vec2f> points_cv(1, points.size());
+    for(unsigned int i = 0; i < points.size(); ++i)
+        points_cv.at<cv::Vec2f>(i) = cv::Vec2f(points[i].x, points[i].y);
+
+    std::vector<int> indices;
+    cv::convexHull(points_cv, indices);
+
+    if (indices.size() != hull.size() || hull.empty())
+        return false;
+
+    unsigned int offset = 0;
+    while (offset < hull.size() && (points[indices[offset]].x != hull[0].x || points[indices[offset]].y != hull[0].y))
+        ++offset;
+
+    for(unsigned int i = 0; i < hull.size(); ++i)
+    {
+        const geo::Vec2f& p = points[indices[(i + offset) % indices.size()]];
+        if (p.x != hull[i].x || p.y != hull[i].y)
+            return false;
+    }
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void testConvexHull()
+{
+    unsigned int num_errors = 0;
+    unsigned int num_merge_errors = 0;
+    for(unsigned int i = 0; i < 1000; ++i)
+    {
+        std::vector<geo::Vec2f> points(3 + i % 100);
+        for(unsigned int j = 0; j < points.size(); ++j)
+            points[j] = geo::Vec2f(uniform(-1, 1), uniform(-1, 1));
+
+        std::vector<geo::Vec2f> sorted(points), hull;
+        ed::convex_hull::calculateHull(sorted, hull);
+        if (!equalToOpenCVHull(points, hull))
+            ++num_errors;
+
+        // Merging the hulls of both halves (one of them clockwise) must give the same hull
+        std::vector<geo::Vec2f> half1(points.begin(), points.begin() + points.size() / 2), hull1;
+        std::vector<geo::Vec2f> half2(points.begin() + points.size() / 2, points.end()), hull2;
+        ed::convex_hull::calculateHull(half1, hull1);
+        ed::convex_hull::calculateHull(half2, hull2);
+        std::reverse(hull2.begin(), hull2.end());
+
+        std::vector<geo::Vec2f> merged;
+        ed::convex_hull::mergeHulls(hull1, hull2, merged);
+        if (!equalPoints(merged, hull))
+            ++num_merge_errors;
+    }
+
+    if (num_errors > 0)
+        std::cout << "ERROR: " << num_errors << " convex hulls differ from those of OpenCV" << std::endl;
+    if (num_merge_errors > 0)
+        std::cout << "ERROR: " << num_merge_errors << " merged convex hulls differ from the hull of all points" << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// The ring buffer of TimeCache must keep the same values as the previous, std::map based, cache, also if values
+// arrive out of order (or older than all others) while the cache is full
+void testTimeCache()
+{
+    unsigned int num_errors = 0;
+    for(unsigned int i = 0; i < 100; ++i)
+    {
+        ed::TimeCache<int> cache;
+        MapTimeCache<int> map_cache;
+        cache.setMaxSize(1 + i % 10);
+        map_cache.setMaxSize(1 + i % 10);
+
+        std::set<double> times;
+        double t_last = 0;
+        for(int j = 0; j < 100; ++j)
+        {
+            // Mostly in order. The times are unique, as the map based cache evicts a value when overwriting
+            double t = rand() % 4 == 0 ? uniform(0, t_last) : t_last + uniform(0.1, 1);
+            if (!times.insert(t).second)
+                continue;
+
+            t_last = std::max(t, t_last);
+            cache.insert(t, j);
+            map_cache.insert(t, j);
+
+            for(unsigned int k = 0; k < 10; ++k)
+            {
+                double t_query = uniform(0, t_last + 1);
+
+                ed::TimeCache<int>::const_iterator lower, upper;
+                cache.getLowerUpper(t_query, lower, upper);
+
+                MapTimeCache<int>::const_iterator map_lower, map_upper;
+                map_cache.getLowerUpper(t_query, map_lower, map_upper);
+
+                if ((lower == cache.end()) != (map_lower == map_cache.end())
+                        || (upper == cache.end()) != (map_upper == map_cache.end())
+                        || (lower != cache.end() && lower->second != map_lower->second)
+                        || (upper != cache.end() && upper->second != map_upper->second))
+                    ++num_errors;
+            }
+        }
+    }
+
+    if (num_errors > 0)
+        std::cout << "ERROR: " << num_errors << " time cache lookups differ from those of the std::map based cache" << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// Looks up values in a shared time cache while another thread inserts them. The value of each time is the time
+// itself, so torn or overwritten values are noticed
+struct SharedTimeCacheReader
+{
+    SharedTimeCacheReader(const ed::SharedTimeCache<float>& cache_, const boost::atomic<bool>& stop_)
+        : cache(cache_), stop(stop_), num_lookups(0), num_errors(0) {}
+
+    void operator()()
+    {
+        while (!stop)
+        {
+            unsigned long n = cache.numInserted();
+            if (n == 0)
+                continue;
+
+            // A window that ends at the current number of values, must not see the values inserted after it
+            for(unsigned int i = 0; i < 100; ++i)
+            {
+                double t = n - 1 - (num_lookups % 150) + 0.5;
+
+                ed::SharedTimeCache<float>::value_type lower, upper;
+                bool has_lower, has_upper;
+                if (!cache.getLowerUpper(t, n, lower, has_lower, upper, has_upper))
+                    continue;
+
+                if ((has_lower && (lower.second != (float)lower.first.seconds() || t < lower.first.seconds()))
+                        || (has_upper && (upper.second != (float)upper.first.seconds() || upper.first.seconds() < t
+                                          || upper.first.seconds() >= n)))
+                    ++num_errors;
+
+                ++num_lookups;
+            }
+        }
+    }
+
+    const ed::SharedTimeCache<float>& cache;
+    const boost::atomic<bool>& stop;
+    unsigned long num_lookups;
+    unsigned long num_errors;
+};
+
+// ----------------------------------------------------------------------------------------------------
+
+void testSharedTimeCache()
+{
+    ed::SharedTimeCache<float> cache(100);
+
+    boost::atomic<bool> stop(false);
+    SharedTimeCacheReader reader1(cache, stop);
+    SharedTimeCacheReader reader2(cache, stop);
+    boost::thread thread1(boost::ref(reader1));
+    boost::thread thread2(boost::ref(reader2));
+
+    for(unsigned int i = 0; i < 1000000; ++i)
+        cache.insert(i, i);
+
+    stop = true;
+    thread1.join();
+    thread2.join();
+
+    if (reader1.num_errors + reader2.num_errors > 0)
+        std::cout << "ERROR: " << reader1.num_errors + reader2.num_errors << " of "
+                  << reader1.num_lookups + reader2.num_lookups << " shared time cache lookups are wrong" << std::endl;
+
+    // A window that was overwritten by later values still gives its last value (as a joint relation in an old
+    // world model revision does)
+    ed::SharedTimeCache<float> small_cache(10);
+    for(unsigned int i = 0; i < 5; ++i)
+        small_cache.insert(i, i);
+
+    ed::SharedTimeCache<float>::Window window = small_cache.window();
+
+    ed::SharedTimeCache<float>::value_type lower, upper;
+    bool has_lower, has_upper;
+    if (!small_cache.getLowerUpper(2.5, window, lower, has_lower, upper, has_upper) || !has_lower || !has_upper
+            || lower.second != 2 || upper.second != 3)
+        std::cout << "ERROR: shared time cache window gives the wrong values" << std::endl;
+
+    for(unsigned int i = 5; i < 35; ++i)
+        small_cache.insert(i, i);
+
+    if (!small_cache.getLowerUpper(2.5, window, lower, has_lower, upper, has_upper) || has_lower || !has_upper
+            || upper.first.seconds() != 4 || upper.second != 4)
+        std::cout << "ERROR: overwritten shared time cache window does not give its last value" << std::endl;
+
+    if (!small_cache.getLowerUpper(100, window, lower, has_lower, upper, has_upper) || !has_lower || has_upper
+            || lower.second != 4)
+        std::cout << "ERROR: overwritten shared time cache window does not give its last value" << std::endl;
+
+    // Without the window, the values are gone
+    if (small_cache.getLowerUpper(2.5, window.num_inserted, lower, has_lower, upper, has_upper))
+        std::cout << "ERROR: shared time cache gives values that were overwritten" << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// 2D convex hull of the points, transformed by the pose
+// All instruction sets must give the same projections, edges, normals and (up to the summation order) area
+void testConvexHullKernels()
+{
+    const char* names[] = { "sse2", "avx" };
+
+    const ed::convex_hull::kernels::Kernels* scalar = ed::convex_hull::kernels::get("scalar");
+
+    unsigned int num_errors = 0;
+    for(unsigned int i = 0; i < 500; ++i)
+    {
+        // Points on a circle are (nearly) all on the hull, such that all strides up to 80 points are tested
+        std::vector<geo::Vec2f> points(3 + i % 80);
+        for(unsigned int j = 0; j < points.size(); ++j)
+        {
+            double a = uniform(0, 2 * M_PI);
+            points[j] = geo::Vec2f(cos(a) + 2, sin(a) - 1);
+        }
+
+        ed::ConvexHull c;
+        ed::convex_hull::createAbsolute(points, 0, 1, c);
+
+        std::size_t n = c.points.size();
+        std::size_t stride = ed::convex_hull::kernels::stride(n);
+        const float* xs = &c.point_coords[0];
+        const float* ys = xs + stride;
+
+        std::vector<float> en(4 * stride);
+        scalar->edgesAndNormals(xs, ys, n, stride, &en[0], &en[stride], &en[2 * stride], &en[3 * stride]);
+        float cross_sum = scalar->crossSum(xs, ys, n, stride);
+
+        // The hull is calculated with the kernels of the CPU
+        for(std::size_t k = 0; k < n; ++k)
+        {
+            if (c.normals[k].x != en[2 * stride + k] || c.normals[k].y != en[3 * stride + k])
+                ++num_errors;
+        }
+
+        if (std::abs(c.area - 0.5 * cross_sum) > 1e-5)
+            ++num_errors;
+
+        for(unsigned int m = 0; m < sizeof(names) / sizeof(names[0]); ++m)
+        {
+            const ed::convex_hull::kernels::Kernels* kern = ed::convex_hull::kernels::get(names[m]);
+            if (!kern)
+                continue;
+
+            std::vector<float> en2(4 * stride);
+            kern->edgesAndNormals(xs, ys, n, stride, &en2[0], &en2[stride], &en2[2 * stride], &en2[3 * stride]);
+            for(std::size_t k = 0; k < 4; ++k)
+            {
+                if (!std::equal(en.begin() + k * stride, en.begin() + k * stride + n, en2.begin() + k * stride))
+                    ++num_errors;
+            }
+
+            if (std::abs(kern->crossSum(xs, ys, n, stride) - cross_sum) > 1e-5)
+                ++num_errors;
+
+            // Projections on the normals and in random directions, from the points and from random origins
+            for(std::size_t k = 0; k < 2 * n; ++k)
+            {
+                float ox, oy, nx, ny;
+                if (k < n)
+                {
+                    ox = c.points[k].x;
+                    oy = c.points[k].y;
+                    nx = en[2 * stride + k];
+                    ny = en[3 * stride + k];
+                }
+                else
+                {
+                    ox = uniform(-3, 3);
+                    oy = uniform(-3, 3);
+                    nx = uniform(-1, 1);
+                    ny = uniform(-1, 1);
+                }
+
+                float min1, max1, min2, max2;
+                scalar->projectMinMax(xs, ys, stride, ox, oy, nx, ny, min1, max1);
+                kern->projectMinMax(xs, ys, stride, ox, oy, nx, ny, min2, max2);
+                if (min1 != min2 || max1 != max2)
+                    ++num_errors;
+            }
+        }
+    }
+
+    if (num_errors > 0)
+        std::cout << "ERROR: " << num_errors << " differences between the convex hull instruction sets" << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void projectedHull(const std::vector<geo::Vector3>& points, const geo::Pose3D& pose, std::vector<geo::Vec2f>& hull)
+{
+    std::vector<geo::Vec2f> points_2d(points.size());
+    for(unsigned int i = 0; i < points.size(); ++i)
+    {
+        geo::Vector3 p = pose * points[i];
+        points_2d[i] = geo::Vec2f(p.x, p.y);
+    }
+
+    ed::convex_hull::calculateHull(points_2d, hull);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void testShapeConvexHull()
+{
+    // The vertices of the 3D convex hull must give the same footprint as the whole mesh, for any pose
+    unsigned int num_errors = 0;
+    for(unsigned int i = 0; i < 200; ++i)
+    {
+        std::vector<geo::Vector3> points(4 + i * 5);
+        for(unsigned int j = 0; j < points.size(); ++j)
+            points[j] = geo::Vector3(uniform(-1, 1), uniform(-0.5, 0.5), uniform(0, 2));
+
+        std::vector<geo::Vector3> vertices;
+        ed::convex_hull::calculateHullVertices(points, vertices);
+
+        geo::Pose3D pose(uniform(-5, 5), uniform(-5, 5), 0, uniform(-M_PI, M_PI), uniform(-M_PI, M_PI), uniform(-M_PI, M_PI));
+
+        std::vector<geo::Vec2f> hull_points, hull_vertices;
+        projectedHull(points, pose, hull_points);
+        projectedHull(vertices, pose, hull_vertices);
+        if (!equalPoints(hull_points, hull_vertices))
+            ++num_errors;
+    }
+
+    if (num_errors > 0)
+        std::cout << "ERROR: " << num_errors << " convex hulls of shape hull vertices differ from those of the whole mesh" << std::endl;
+
+    // A shape that is changed in place, and set again, must not keep the convex hull of its old mesh
+    geo::Mesh mesh1, mesh2;
+    for(unsigned int i = 0; i < 100; ++i)
+    {
+        mesh1.addPoint(uniform(-1, 1), uniform(-1, 1), uniform(0, 1));
+        mesh2.addPoint(uniform(-2, 2), uniform(-1, 1), uniform(0, 1));
+    }
+
+    geo::ShapePtr shape(new geo::Shape);
+    shape->setMesh(mesh1);
+
+    geo::ShapePtr shape2(new geo::Shape);
+    shape2->setMesh(mesh2);
+
+    geo::Pose3D pose(1, 2, 0, 0, 0, 0.5);
+    ed::Entity e1("e1"), e2("e2");
+    e1.setShape(shape);
+    e1.setPose(pose);
+    e1.convexHull();
+
+    int shape_revision = e1.shapeRevision();
+    shape->setMesh(mesh2);
+    e1.setShape(shape);
+    e1.setPose(pose);
+
+    e2.setShape(shape2);
+    e2.setPose(pose);
+
+    if (!equalPoints(e1.convexHull().points, e2.convexHull().points))
+        std::cout << "ERROR: convex hull of an entity is not updated after its shape was changed" << std::endl;
+
+    if (e1.shapeRevision() == shape_revision)
+        std::cout << "ERROR: shape revision of an entity is not increased after its shape was changed" << std::endl;
+
+    // Setting the same, unchanged shape again is not a change
+    shape_revision = e1.shapeRevision();
+    e1.setShape(shape);
+    if (e1.shapeRevision() != shape_revision)
+        std::cout << "ERROR: shape revision of an entity is increased after setting the same shape" << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// Returns true if both world models contain the same entities with the same poses, types, flags and
+// existence probabilities
+bool equalWorldModels(const ed::WorldModel& wm1, const ed::WorldModel& wm2)
+{
+    unsigned int num_entities = 0;
+    for(ed::WorldModel::const_iterator it = wm1.begin(); it != wm1.end(); ++it)
+    {
+        const ed::EntityConstPtr& e1 = *it;
+        ed::EntityConstPtr e2 = wm2.getEntity(e1->id());
+        if (!e2)
+            return false;
+
+        if (e1->has_pose() != e2->has_pose())
+            return false;
+
+        if (e1->has_pose())
+        {
+            const geo::Pose3D& p1 = e1->pose();
+            const geo::Pose3D& p2 = e2->pose();
+            if (p1.t.x != p2.t.x || p1.t.y != p2.t.y || p1.t.z != p2.t.z)
+                return false;
+        }
+
+        if (e1->type() != e2->type() || e1->types() != e2->types() || e1->flags() != e2->flags()
+                || e1->existenceProbability() != e2->existenceProbability())
+            return false;
+
+        ++num_entities;
+    }
+
+    for(ed::WorldModel::const_iterator it = wm2.begin(); it != wm2.end(); ++it)
+        --num_entities;
+
+    return num_entities == 0;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// Applying merged update requests must give the same world model as applying them one by one
+void testMergeUpdateRequests()
+{
+    const char* types[] = { "object", "table", "person" };
+    const char* flags[] = { "self", "furniture" };
+
+    unsigned int num_errors = 0;
+    for(unsigned int i = 0; i < 100; ++i)
+    {
+        std::vector<ed::UpdateRequestConstPtr> requests;
+        for(unsigned int j = 0; j < 20; ++j)
+        {
+            ed::UpdateRequestPtr req(new ed::UpdateRequest);
+            for(unsigned int k = 0; k < 3; ++k)
+            {
+                std::stringstream id;
+                id << "e" << rand() % 5;
+
+                std::string type = types[rand() % 3];
+                std::string flag = flags[rand() % 2];
+
+                switch (rand() % 9)
+                {
+                case 0: req->setPose(id.str(), geo::Pose3D(uniform(-1, 1), uniform(-1, 1), 0)); break;
+                case 1: req->setType(id.str(), type); break;
+                case 2: req->addType(id.str(), type); break;
+                case 3: req->removeType(id.str(), type); break;
+                case 4: req->setFlag(id.str(), flag); break;
+                case 5: req->removeFlag(id.str(), flag); break;
+                case 6: req->setExistenceProbability(id.str(), uniform(0, 1)); break;
+                case 7:
+                {
+                    tue::config::DataPointer data;
+                    tue::config::Writer w(data);
+                    if (rand() % 2 == 0)
+                        w.setValue("type", type);
+                    else
+                        w.setValue("color", "red");
+                    req->addData(id.str(), data);
+                    break;
+                }
+                default:
+                    if (rand() % 3 == 0)
+                        req->removeEntity(id.str());
+                }
+            }
+
+            requests.push_back(req);
+        }
+
+        ed::WorldModel wm1;
+        for(std::vector<ed::UpdateRequestConstPtr>::const_iterator it = requests.begin(); it != requests.end(); ++it)
+            wm1.update(**it);
+
+        std::vector<ed::UpdateRequestConstPtr> batches;
+        ed::mergeUpdateRequests(requests, batches);
+
+        ed::WorldModel wm2;
+        for(std::vector<ed::UpdateRequestConstPtr>::const_iterator it = batches.begin(); it != batches.end(); ++it)
+            wm2.update(**it);
+
+        if (!equalWorldModels(wm1, wm2))
+            ++num_errors;
+    }
+
+    if (num_errors > 0)
+        std::cout << "ERROR: " << num_errors << " merged update requests give a different world model" << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// The compatibility maps of a request are kept until the request is modified
+void testUpdateRequestCompatibilityMaps()
+{
+    ed::UpdateRequest req;
+    req.setPose("a", geo::Pose3D(1, 2, 3));
+    req.setType("b", "object");
+    req.removeEntity("c");
+
+    // Iterators of two calls belong to the same map
+    unsigned int num_poses = 0;
+    for(std::map<ed::UUID, geo::Pose3D>::const_iterator it = req.poses().begin(); it != req.poses().end(); ++it)
+        ++num_poses;
+
+    if (num_poses != 1 || req.poses().find("a") == req.poses().end() || req.types().find("b") == req.types().end()
+            || req.removed_entities().size() != 1 || req.updated_entities().size() != 3)
+        std::cout << "ERROR: compatibility maps of update request are wrong" << std::endl;
+
+    // Modifying the request updates the maps
+    req.setPose("b", geo::Pose3D(4, 5, 6));
+    if (req.poses().size() != 2 || req.poses().find("b")->second.t.x != 4)
+        std::cout << "ERROR: compatibility maps of update request are not updated after a change" << std::endl;
+
+    ed::UpdateRequest req2;
+    req2.setFlag("d", "self");
+    req.merge(req2);
+    if (req.added_flags().size() != 1 || req.updated_entities().size() != 4)
+        std::cout << "ERROR: compatibility maps of update request are not updated after merging" << std::endl;
+
+    // Copies do not share the maps
+    ed::UpdateRequest req3(req);
+    req3.removeEntity("a");
+    if (req3.removed_entities().size() != 2 || req.removed_entities().size() != 1)
+        std::cout << "ERROR: compatibility maps of update request are shared by copies" << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// Applies a random update to entities e0 .. e19, and records which entities it removed
+void randomEntityUpdate(ed::WorldModel& wm, std::vector<ed::WorldModel::RemovedEntity>& removals)
+{
+    ed::UpdateRequest req;
+    std::set<std::string> ids;
+    for(unsigned int k = 0; k < 4; ++k)
+    {
+        std::stringstream ss;
+        ss << "e" << rand() % 20;
+        if (!ids.insert(ss.str()).second)
+            continue;
+
+        switch (rand() % 4)
+        {
+        case 0: req.removeEntity(ss.str()); break;
+        case 1: req.setType(ss.str(), "object"); break;
+        default: req.setPose(ss.str(), geo::Pose3D(uniform(-1, 1), uniform(-1, 1), 0));
+        }
+    }
+
+    std::vector<std::string> existed;
+    for(std::set<std::string>::const_iterator it = ids.begin(); it != ids.end(); ++it)
+    {
+        if (wm.getEntity(*it))
+            existed.push_back(*it);
+    }
+
+    wm.update(req);
+
+    for(std::vector<std::string>::const_iterator it = existed.begin(); it != existed.end(); ++it)
+    {
+        if (!wm.getEntity(*it))
+            removals.push_back(ed::WorldModel::RemovedEntity(wm.revision(), *it));
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// IDs of the entities removed after the given revision, that do not exist (again)
+std::set<ed::UUID> removedSince(const ed::WorldModel& wm, const std::vector<ed::WorldModel::RemovedEntity>& removals,
+                                unsigned long since_revision)
+{
+    std::set<ed::UUID> ids;
+    for(std::vector<ed::WorldModel::RemovedEntity>::const_iterator it = removals.begin(); it != removals.end(); ++it)
+    {
+        if (it->revision > since_revision && !wm.getEntity(it->id))
+            ids.insert(it->id);
+    }
+    return ids;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// changesSince() must give the same entities as comparing all entity revisions, and removedEntities() the
+// entities that were removed, also when entities are added again or their indices are reused by others
+void testChangeLog()
+{
+    unsigned int num_change_errors = 0;
+    unsigned int num_removal_errors = 0;
+
+    ed::WorldModel wm;
+    std::vector<ed::WorldModel::RemovedEntity> removals;
+    for(unsigned int i = 0; i < 500; ++i)
+    {
+        randomEntityUpdate(wm, removals);
+
+        unsigned long since_revision = rand() % (wm.revision() + 1);
+
+        std::vector<ed::WorldModel::EntityChange> changes;
+        std::set<ed::Idx> changed_idxs;
+        if (wm.changesSince(since_revision, changes))
+        {
+            for(std::vector<ed::WorldModel::EntityChange>::const_iterator it = changes.begin(); it != changes.end(); ++it)
+                changed_idxs.insert(it->idx);
+        }
+
+        std::set<ed::Idx> expected_idxs;
+        for(ed::Idx idx = 0; idx < wm.entity_revisions().size(); ++idx)
+        {
+            if (wm.entity_revisions()[idx] > since_revision)
+                expected_idxs.insert(idx);
+        }
+
+        if (changed_idxs != expected_idxs || changes.size() != expected_idxs.size())
+            ++num_change_errors;
+
+        std::vector<ed::UUID> removed_ids;
+        std::set<ed::UUID> expected_ids = removedSince(wm, removals, since_revision);
+        if (!wm.removedEntities(since_revision, removed_ids) || removed_ids.size() != expected_ids.size()
+                || std::set<ed::UUID>(removed_ids.begin(), removed_ids.end()) != expected_ids)
+            ++num_removal_errors;
+    }
+
+    if (num_change_errors > 0)
+        std::cout << "ERROR: " << num_change_errors << " times changesSince gave the wrong entities" << std::endl;
+    if (num_removal_errors > 0)
+        std::cout << "ERROR: " << num_removal_errors << " times removedEntities gave the wrong entities" << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// Returns true if both world models contain entities with the same IDs
+bool equalEntityIds(const ed::WorldModel& wm1, const ed::WorldModel& wm2)
+{
+    std::set<std::string> ids1, ids2;
+    for(ed::WorldModel::const_iterator it = wm1.begin(); it != wm1.end(); ++it)
+        ids1.insert((*it)->id().str());
+    for(ed::WorldModel::const_iterator it = wm2.begin(); it != wm2.end(); ++it)
+        ids2.insert((*it)->id().str());
+
+    return ids1 == ids2;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// With a bounded change log, changesSince() and removedEntities() must report when they do not reach back far
+// enough. A client that is synced with serialize() and deserialize() must still end up with the same entities, as
+// it then receives a complete snapshot
+void testChangeLogTruncation()
+{
+    unsigned int num_change_errors = 0;
+    unsigned int num_removal_errors = 0;
+    unsigned int num_sync_errors = 0;
+
+    ed::WorldModel wm;
+    wm.setChangeLogSize(64);
+    std::vector<ed::WorldModel::RemovedEntity> removals;
+
+    ed::WorldModel client;
+    std::set<ed::UUID> client_ids;
+    unsigned long client_revision = 0;
+
+    for(unsigned int i = 0; i < 3000; ++i)
+    {
+        randomEntityUpdate(wm, removals);
+
+        unsigned long since_revision = rand() % (wm.revision() + 1);
+
+        std::vector<ed::WorldModel::EntityChange> changes;
+        bool changes_complete = wm.changesSince(since_revision, changes);
+        if (changes_complete != (since_revision >= wm.entity_changes().minRevision()))
+            ++num_change_errors;
+        else if (changes_complete)
+        {
+            std::set<ed::Idx> changed_idxs;
+            for(std::vector<ed::WorldModel::EntityChange>::const_iterator it = changes.begin(); it != changes.end(); ++it)
+                changed_idxs.insert(it->idx);
+
+            for(ed::Idx idx = 0; idx < wm.entity_revisions().size(); ++idx)
+            {
+                if (wm.entity_revisions()[idx] > since_revision && changed_idxs.erase(idx) == 0)
+                    ++num_change_errors;
+            }
+
+            if (!changed_idxs.empty())
+                ++num_change_errors;
+        }
+
+        // Without the complete log, only some of the removed entities are known
+        std::vector<ed::UUID> removed_ids;
+        std::set<ed::UUID> expected_ids = removedSince(wm, removals, since_revision);
+        bool removals_complete = wm.removedEntities(since_revision, removed_ids);
+        if (removals_complete != (since_revision >= wm.removed_entities().minRevision()))
+            ++num_removal_errors;
+        else if (removals_complete ? std::set<ed::UUID>(removed_ids.begin(), removed_ids.end()) != expected_ids
+                 : !std::includes(expected_ids.begin(), expected_ids.end(), removed_ids.begin(), removed_ids.end()))
+            ++num_removal_errors;
+
+        // Sync the client now and then. Every 1000 updates, it is not synced for long enough to miss removals
+        if (!(i % 1000 == 999 || (i % 1000 < 200 && rand() % 2 == 0)))
+            continue;
+
+        std::string buffer;
+        ed::UpdateRequest req;
+        if (rand() % 2 == 0)
+        {
+            {
+                ed::io::JSONWriter w(buffer);
+                ed::serialize(wm, w, client_revision);
+                w.finish();
+            }
+
+            ed::io::JSONReader r(buffer.c_str());
+            ed::deserialize(r, req, client_ids);
+        }
+        else
+        {
+            {
+                ed::io::BinaryWriter w(buffer);
+                ed::serialize(wm, w, client_revision);
+                w.finish();
+            }
+
+            ed::io::BinaryReader r(buffer.data(), buffer.size());
+            ed::deserialize(r, req, client_ids);
+        }
+
+        client.update(req);
+        client_revision = wm.revision();
+
+        if (!equalEntityIds(wm, client))
+            ++num_sync_errors;
+    }
+
+    if (num_change_errors > 0)
+        std::cout << "ERROR: " << num_change_errors << " times changesSince was wrong with a bounded log" << std::endl;
+    if (num_removal_errors > 0)
+        std::cout << "ERROR: " << num_removal_errors << " times removedEntities was wrong with a bounded log" << std::endl;
+    if (num_sync_errors > 0)
+        std::cout << "ERROR: " << num_sync_errors << " times a synced world model differed from the original" << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// Random entities with types, poses, convex hulls and meshes
+void buildRandomWorldModel(ed::WorldModel& wm, unsigned int num_entities)
+{
+    ed::UpdateRequest req;
+    for(unsigned int i = 0; i < num_entities; ++i)
+    {
+        std::stringstream ss;
+        ss << "e" << i;
+        std::string id = ss.str();
+
+        req.setType(id, i % 2 == 0 ? "object" : "furniture");
+        req.setExistenceProbability(id, (float)uniform(0, 1));
+
+        geo::Pose3D pose((float)uniform(-10, 10), (float)uniform(-10, 10), (float)uniform(0, 1));
+        if (i % 3 == 0)
+        {
+            std::vector<geo::Vec2f> points(3 + i % 10);
+            for(unsigned int j = 0; j < points.size(); ++j)
+                points[j] = geo::Vec2f(uniform(-1, 1), uniform(-1, 1));
+
+            ed::ConvexHull chull;
+            ed::convex_hull::createAbsolute(points, (float)uniform(0, 0.5), (float)uniform(0.5, 1), chull);
+            req.setConvexHullNew(id, chull, pose, 0);
+        }
+        else if (i % 3 == 1)
+        {
+            geo::Mesh mesh;
+            for(unsigned int j = 0; j < 4; ++j)
+                mesh.addPoint(uniform(-1, 1), uniform(-1, 1), uniform(0, 1));
+            mesh.addTriangle(0, 1, 2);
+            mesh.addTriangle(0, 2, 3);
+
+            geo::ShapePtr shape(new geo::Shape);
+            shape->setMesh(mesh);
+            req.setShape(id, shape);
+            req.setPose(id, pose);
+        }
+        else
+            req.setPose(id, pose);
+    }
+
+    wm.update(req);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// Returns true if both world models are equal (see equalWorldModels), and have the same meshes and convex hulls.
+// Mesh vertices are compared as floats, as that is how they are written
+bool equalSerializedWorldModels(const ed::WorldModel& wm1, const ed::WorldModel& wm2)
+{
+    if (!equalWorldModels(wm1, wm2))
+        return false;
+
+    for(ed::WorldModel::const_iterator it = wm1.begin(); it != wm1.end(); ++it)
+    {
+        const ed::EntityConstPtr& e1 = *it;
+        ed::EntityConstPtr e2 = wm2.getEntity(e1->id());
+
+        if ((bool)e1->shape() != (bool)e2->shape())
+            return false;
+
+        if (e1->shape())
+        {
+            const geo::Mesh& m1 = e1->shape()->getMesh();
+            const geo::Mesh& m2 = e2->shape()->getMesh();
+            if (m1.getPoints().size() != m2.getPoints().size() || m1.getTriangleIs().size() != m2.getTriangleIs().size())
+                return false;
+
+            for(unsigned int i = 0; i < m1.getPoints().size(); ++i)
+            {
+                const geo::Vector3& p1 = m1.getPoints()[i];
+                const geo::Vector3& p2 = m2.getPoints()[i];
+                if ((float)p1.x != (float)p2.x || (float)p1.y != (float)p2.y || (float)p1.z != (float)p2.z)
+                    return false;
+            }
+
+            for(unsigned int i = 0; i < m1.getTriangleIs().size(); ++i)
+            {
+                const geo::TriangleI& t1 = m1.getTriangleIs()[i];
+                const geo::TriangleI& t2 = m2.getTriangleIs()[i];
+                if (t1.i1_ != t2.i1_ || t1.i2_ != t2.i2_ || t1.i3_ != t2.i3_)
+                    return false;
+            }
+        }
+        else
+        {
+            const ed::ConvexHull& c1 = e1->convexHull();
+            const ed::ConvexHull& c2 = e2->convexHull();
+            if (!equalPoints(c1.points, c2.points))
+                return false;
+
+            if (!c1.points.empty() && (c1.z_min != c2.z_min || c1.z_max != c2.z_max))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// The binary encoding must give back the same world model, and truncated data must be rejected
+void testBinarySerialization()
+{
+    ed::WorldModel wm;
+    buildRandomWorldModel(wm, 50);
+
+    std::string binary;
+    {
+        ed::io::BinaryWriter w(binary);
+        ed::serialize(wm, w);
+        w.finish();
+    }
+
+    {
+        ed::io::BinaryReader r(binary.data(), binary.size());
+        ed::UpdateRequest req;
+        ed::deserialize(r, req);
+
+        ed::WorldModel wm2;
+        wm2.update(req);
+
+        if (!r.ok() || !equalSerializedWorldModels(wm, wm2))
+            std::cout << "ERROR: binary serialization does not give back the same world model" << std::endl;
+    }
+
+    ed::WorldModel wm_small;
+    buildRandomWorldModel(wm_small, 3);
+
+    binary.clear();
+    {
+        ed::io::BinaryWriter w(binary);
+        ed::serialize(wm_small, w);
+        w.finish();
+    }
+
+    unsigned int num_accepted = 0;
+    for(std::size_t size = 0; size < binary.size(); ++size)
+    {
+        // Copy, such that reading past the end is noticed by memory checkers
+        std::vector<char> data(binary.begin(), binary.begin() + size);
+        ed::io::BinaryReader r(data.empty() ? 0 : &data[0], data.size());
+        ed::UpdateRequest req;
+        ed::deserialize(r, req);
+        if (r.ok() || !req.empty())
+            ++num_accepted;
+    }
+
+    if (num_accepted > 0)
+        std::cout << "ERROR: " << num_accepted << " truncated binary encodings were accepted" << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// The JSON encoding must give back the same world model, both when parsing a copy and when parsing in situ, and
+// truncated or malformed JSON must be rejected
+void testJSONSerialization()
+{
+    ed::WorldModel wm;
+    buildRandomWorldModel(wm, 50);
+
+    std::string json;
+    {
+        ed::io::JSONWriter w(json);
+        ed::serialize(wm, w);
+        w.finish();
+    }
+
+    {
+        ed::io::JSONReader r(json.c_str());
+        ed::UpdateRequest req;
+        ed::deserialize(r, req);
+
+        ed::WorldModel wm2;
+        wm2.update(req);
+
+        if (!r.ok() || !equalSerializedWorldModels(wm, wm2))
+            std::cout << "ERROR: JSON serialization does not give back the same world model" << std::endl;
+    }
+
+    {
+        std::vector<char> buffer(json.begin(), json.end());
+        buffer.push_back('\0');
+
+        ed::io::JSONReader r(&buffer[0], ed::io::JSONReader::IN_SITU);
+        ed::UpdateRequest req;
+        ed::deserialize(r, req);
+
+        ed::WorldModel wm2;
+        wm2.update(req);
+
+        if (!r.ok() || !equalSerializedWorldModels(wm, wm2))
+            std::cout << "ERROR: JSON serialization (in situ) does not give back the same world model" << std::endl;
+    }
+
+    ed::WorldModel wm_small;
+    buildRandomWorldModel(wm_small, 3);
+
+    json.clear();
+    {
+        ed::io::JSONWriter w(json);
+        ed::serialize(wm_small, w);
+        w.finish();
+    }
+
+    unsigned int num_accepted = 0;
+    for(std::size_t size = 0; size < json.size(); ++size)
+    {
+        ed::io::JSONReader r(json.substr(0, size).c_str());
+        if (r.ok())
+            ++num_accepted;
+    }
+
+    if (num_accepted > 0)
+        std::cout << "ERROR: " << num_accepted << " truncated JSON encodings were accepted" << std::endl;
+
+    const char* malformed[] = { "", "{", "}", "[]", "{\"entities\": [}", "{\"a\": }", "{\"a\" 1}", "{\"a\": 1,}",
+                                "{\"a\": \"b}", "{\"a\": 1} x", "{\"a\": tru}", "{\"a\": -}", "{\"a\": 1e}" };
+    for(unsigned int i = 0; i < sizeof(malformed) / sizeof(malformed[0]); ++i)
+    {
+        ed::io::JSONReader r(malformed[i]);
+        if (r.ok())
+            std::cout << "ERROR: malformed JSON was accepted: " << malformed[i] << std::endl;
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// Footprint of an entity as the spatial index computes it: the bounding box of its position and convex hull, in floats
+bool footprint(const ed::Entity& e, float& min_x, float& min_y, float& max_x, float& max_y)
+{
+    if (!e.has_pose())
+        return false;
+
+    const geo::Vector3& t = e.pose().t;
+    min_x = max_x = t.x;
+    min_y = max_y = t.y;
+
+    const std::vector<geo::Vec2f>& points = e.convexHull().points;
+    for(unsigned int i = 0; i < points.size(); ++i)
+    {
+        float x = t.x + points[i].x;
+        float y = t.y + points[i].y;
+        min_x = std::min(min_x, x);
+        min_y = std::min(min_y, y);
+        max_x = std::max(max_x, x);
+        max_y = std::max(max_y, y);
+    }
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// Compares the spatial queries with a scan over all entities. Returns the number of mismatches
+unsigned int checkSpatialQueries(const ed::WorldModel& wm)
+{
+    unsigned int num_errors = 0;
+    for(unsigned int i = 0; i < 20; ++i)
+    {
+        // Floats, such that the query boxes of the index are the same as the ones below
+        geo::Vec2 p((float)uniform(-12, 12), (float)uniform(-12, 12));
+        geo::Vec2 size((float)uniform(0, 5), (float)uniform(0, 5));
+        double radius = (float)uniform(0, 5);
+
+        std::vector<ed::Idx> box_idxs, radius_idxs, point_idxs;
+        for(unsigned int j = 0; j < wm.entities().size(); ++j)
+        {
+            const ed::EntityConstPtr& e = wm.entities()[j];
+            float min_x, min_y, max_x, max_y;
+            if (!e || !footprint(*e, min_x, min_y, max_x, max_y))
+                continue;
+
+            if (min_x <= p.x + size.x && p.x <= max_x && min_y <= p.y + size.y && p.y <= max_y)
+                box_idxs.push_back(j);
+
+            double dx = std::max(0.0, std::max(min_x - p.x, p.x - max_x));
+            double dy = std::max(0.0, std::max(min_y - p.y, p.y - max_y));
+            if (dx * dx + dy * dy <= radius * radius)
+                radius_idxs.push_back(j);
+
+            if (min_x <= p.x && p.x <= max_x && min_y <= p.y && p.y <= max_y
+                    && ed::convex_hull::contains(e->convexHull(), e->pose().t, p))
+                point_idxs.push_back(j);
+        }
+
+        std::vector<ed::Idx> idxs;
+        wm.queryBox(p, p + size, idxs);
+        std::sort(idxs.begin(), idxs.end());
+        if (idxs != box_idxs)
+            ++num_errors;
+
+        idxs.clear();
+        wm.queryRadius(p, radius, idxs);
+        std::sort(idxs.begin(), idxs.end());
+        if (idxs != radius_idxs)
+            ++num_errors;
+
+        idxs.clear();
+        wm.queryPoint(p, idxs);
+        std::sort(idxs.begin(), idxs.end());
+        if (idxs != point_idxs)
+            ++num_errors;
+    }
+
+    return num_errors;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// The spatial queries must find the same entities as a scan, after incremental updates that move, reshape and
+// remove entities (and reuse their indices), also in older copies of the world model
+void testSpatialQueries()
+{
+    geo::Mesh mesh;
+    mesh.addPoint(-0.5, -0.5, 0);
+    mesh.addPoint(0.5, -0.5, 0);
+    mesh.addPoint(0, 0.5, 1);
+    mesh.addTriangle(0, 1, 2);
+
+    geo::ShapePtr shape(new geo::Shape);
+    shape->setMesh(mesh);
+
+    std::vector<ed::WorldModelConstPtr> snapshots;
+    ed::WorldModelPtr wm(new ed::WorldModel);
+
+    unsigned int num_errors = 0;
+    for(unsigned int i = 0; i < 100; ++i)
+    {
+        ed::WorldModelPtr wm_new(new ed::WorldModel(*wm));
+
+        ed::UpdateRequest req;
+        for(unsigned int j = 0; j < 20; ++j)
+        {
+            std::stringstream ss;
+            ss << "e" << rand() % 100;
+            std::string id = ss.str();
+
+            geo::Pose3D pose(uniform(-10, 10), uniform(-10, 10), 0, 0, 0, uniform(0, 3));
+
+            switch (rand() % 5)
+            {
+            case 0:
+                req.setPose(id, pose);
+                break;
+            case 1:
+            {
+                std::vector<geo::Vec2f> points(3 + rand() % 5);
+                for(unsigned int k = 0; k < points.size(); ++k)
+                    points[k] = geo::Vec2f(uniform(-2, 2), uniform(-2, 2));
+
+                ed::ConvexHull chull;
+                ed::convex_hull::createAbsolute(points, 0, 1, chull);
+                req.setConvexHullNew(id, chull, pose, 0);
+                break;
+            }
+            case 2:
+                req.setShape(id, shape);
+                req.setPose(id, pose);
+                break;
+            case 3:
+                req.setType(id, "object");
+                break;
+            default:
+                req.removeEntity(id);
+            }
+        }
+
+        wm_new->update(req);
+
+        // Keep some of the old world models, which must not be affected by the updates of their copies
+        if (i % 10 == 0)
+            snapshots.push_back(wm);
+        wm = wm_new;
+
+        if (i % 2 == 0)
+            num_errors += checkSpatialQueries(*wm);
+    }
+
+    for(unsigned int i = 0; i < snapshots.size(); ++i)
+        num_errors += checkSpatialQueries(*snapshots[i]);
+
+    if (num_errors > 0)
+        std::cout << "ERROR: " << num_errors << " spatial queries do not give the same entities as a scan" << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// Compares the entities with each type and flag with a scan over all entities. Returns the number of mismatches
+unsigned int checkLabelIndices(const ed::WorldModel& wm, const std::vector<std::string>& labels)
+{
+    unsigned int num_errors = 0;
+    for(unsigned int i = 0; i < labels.size(); ++i)
+    {
+        std::vector<ed::Idx> with_type, with_flag;
+        for(unsigned int j = 0; j < wm.entities().size(); ++j)
+        {
+            const ed::EntityConstPtr& e = wm.entities()[j];
+            if (e && e->hasType(labels[i]))
+                with_type.push_back(j);
+            if (e && e->hasFlag(labels[i]))
+                with_flag.push_back(j);
+        }
+
+        const ed::world_model::IdxSet& types = wm.entitiesWithType(labels[i]);
+        if (std::vector<ed::Idx>(types.begin(), types.end()) != with_type || types.size() != with_type.size())
+            ++num_errors;
+
+        const ed::world_model::IdxSet& flags = wm.entitiesWithFlag(labels[i]);
+        if (std::vector<ed::Idx>(flags.begin(), flags.end()) != with_flag || flags.size() != with_flag.size())
+            ++num_errors;
+    }
+
+    return num_errors;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// Random convex hull of up to 3 by 3 meters, of which one in five is a sliver (less than 5 cm wide)
+ed::ConvexHull randomCollisionHull()
+{
+    double sx = uniform(0.05, 1.5);
+    double sy = (rand() % 5 == 0 ? uniform(0.001, 0.05) : uniform(0.05, 1.5));
+    double a = uniform(0, M_PI);
+
+    std::vector<geo::Vec2f> points(3 + rand() % 8);
+    for(unsigned int i = 0; i < points.size(); ++i)
+    {
+        double x = uniform(-sx, sx);
+        double y = uniform(-sy, sy);
+        points[i] = geo::Vec2f(x * cos(a) - y * sin(a), x * sin(a) + y * cos(a));
+    }
+
+    ed::ConvexHull chull;
+    ed::convex_hull::createAbsolute(points, uniform(-0.5, 0), uniform(0, 1), chull);
+    return chull;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool collideBoth(const ed::ConvexHull& c1, const geo::Vector3& pos1, const ed::ConvexHull& c2, const geo::Vector3& pos2,
+                 float xy_padding, float z_padding)
+{
+    return ed::convex_hull::collide(c1, pos1, c2, pos2, xy_padding, z_padding)
+            && ed::convex_hull::collide(c2, pos2, c1, pos1, xy_padding, z_padding);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// collideAll and collidingPairs must find the same entities as collideBoth on all pairs, for convex hulls of all
+// sizes (including slivers), entities without convex hull, removed entities, and different paddings
+void testCollisionQueries()
+{
+    // One entity per half square meter, such that many convex hulls are close to each other (corners included)
+    unsigned int num_entities = 600;
+    double size = std::sqrt(0.5 * num_entities);
+
+    ed::UpdateRequest req;
+    for(unsigned int i = 0; i < num_entities; ++i)
+    {
+        std::stringstream id;
+        id << "e" << i;
+
+        if (i % 50 == 0)
+            req.setPose(id.str(), geo::Pose3D(uniform(0, size), uniform(0, size), 0));
+        else
+            req.setConvexHullNew(id.str(), randomCollisionHull(),
+                                 geo::Pose3D(uniform(0, size), uniform(0, size), uniform(-0.3, 0.3)), 0);
+    }
+
+    ed::WorldModel wm;
+    wm.update(req);
+
+    ed::UpdateRequest req_remove;
+    for(unsigned int i = 0; i < num_entities; i += 17)
+    {
+        std::stringstream id;
+        id << "e" << i;
+        req_remove.removeEntity(id.str());
+    }
+    wm.update(req_remove);
+
+    const ed::WorldModel::EntityVector& entities = wm.entities();
+
+    float paddings[] = { 0, 0.05, 0.3 };
+
+    unsigned int num_errors = 0;
+    for(unsigned int k = 0; k < sizeof(paddings) / sizeof(paddings[0]); ++k)
+    {
+        float xy_padding = paddings[k];
+        float z_padding = 0.1;
+
+        for(unsigned int i = 0; i < 300; ++i)
+        {
+            ed::ConvexHull chull = randomCollisionHull();
+            geo::Vector3 pos(uniform(0, size), uniform(0, size), 0);
+
+            std::vector<ed::Idx> idxs;
+            ed::world_model::collideAll(wm, chull, pos, xy_padding, z_padding, idxs);
+            std::sort(idxs.begin(), idxs.end());
+
+            std::vector<ed::Idx> idxs_all;
+            for(ed::Idx j = 0; j < entities.size(); ++j)
+            {
+                const ed::EntityConstPtr& e = entities[j];
+                if (e && e->has_pose() && collideBoth(chull, pos, e->convexHull(), e->pose().t, xy_padding, z_padding))
+                    idxs_all.push_back(j);
+            }
+
+            if (idxs != idxs_all)
+                ++num_errors;
+        }
+
+        std::vector<std::pair<ed::Idx, ed::Idx> > pairs;
+        ed::world_model::collidingPairs(wm, xy_padding, z_padding, pairs);
+        std::sort(pairs.begin(), pairs.end());
+
+        std::vector<std::pair<ed::Idx, ed::Idx> > pairs_all;
+        for(ed::Idx i = 0; i < entities.size(); ++i)
+        {
+            const ed::EntityConstPtr& e1 = entities[i];
+            if (!e1 || !e1->has_pose())
+                continue;
+
+            for(ed::Idx j = i + 1; j < entities.size(); ++j)
+            {
+                const ed::EntityConstPtr& e2 = entities[j];
+                if (e2 && e2->has_pose()
+                        && collideBoth(e1->convexHull(), e1->pose().t, e2->convexHull(), e2->pose().t, xy_padding, z_padding))
+                    pairs_all.push_back(std::make_pair(i, j));
+            }
+        }
+
+        if (pairs != pairs_all)
+            ++num_errors;
+    }
+
+    if (num_errors > 0)
+        std::cout << "ERROR: " << num_errors << " collision queries differ from collisions of all pairs" << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// The type and flag indices must give the same entities as a scan, after adding and removing types and flags,
+// removing entities (and reusing their indices) and replacing entities, also in older copies of the world model
+void testLabelIndices()
+{
+    std::vector<std::string> labels;
+    labels.push_back("a");
+    labels.push_back("b");
+    labels.push_back("c");
+
+    std::vector<ed::WorldModelConstPtr> snapshots;
+    ed::WorldModelPtr wm(new ed::WorldModel);
+
+    unsigned int num_errors = 0;
+    for(unsigned int i = 0; i < 300; ++i)
+    {
+        ed::WorldModelPtr wm_new(new ed::WorldModel(*wm));
+
+        ed::UpdateRequest req;
+        for(unsigned int j = 0; j < 10; ++j)
+        {
+            std::stringstream ss;
+            ss << "e" << rand() % 30;
+            std::string id = ss.str();
+
+            const std::string& label = labels[rand() % labels.size()];
+
+            switch (rand() % 6)
+            {
+            case 0: req.setType(id, label); break;
+            case 1: req.addType(id, label); break;
+            case 2: req.removeType(id, label); break;
+            case 3: req.setFlag(id, label); break;
+            case 4: req.removeFlag(id, label); break;
+            default: req.removeEntity(id);
+            }
+        }
+
+        wm_new->update(req);
+
+        // Replace or remove an entity directly
+        std::stringstream ss;
+        ss << "e" << rand() % 30;
+        if (rand() % 2 == 0)
+        {
+            ed::EntityPtr e(new ed::Entity(ss.str(), labels[rand() % labels.size()]));
+            e->addType(labels[rand() % labels.size()]);
+            e->setFlag(labels[rand() % labels.size()]);
+            wm_new->setEntity(e->id(), e);
+        }
+        else
+            wm_new->removeEntity(ss.str());
+
+        // Keep some of the old world models, which must not be affected by the updates of their copies
+        if (i % 30 == 0)
+            snapshots.push_back(wm);
+        wm = wm_new;
+
+        num_errors += checkLabelIndices(*wm, labels);
+    }
+
+    for(unsigned int i = 0; i < snapshots.size(); ++i)
+        num_errors += checkLabelIndices(*snapshots[i], labels);
+
+    if (num_errors > 0)
+        std::cout << "ERROR: " << num_errors << " type or flag queries do not give the same entities as a scan" << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// Relation of which the transform can be changed in place, and that can be invalid
+class TestRelation : public ed::Relation
+{
+
+public:
+
+    TestRelation(const geo::Pose3D& pose_) : pose(pose_), valid(true) {}
+
+    bool calculateTransform(const ed::Time& t, geo::Pose3D& tf) const
+    {
+        tf = pose;
+        return valid;
+    }
+
+    geo::Pose3D pose;
+    bool valid;
+
+};
+
+// ----------------------------------------------------------------------------------------------------
+
+geo::Pose3D randomPose()
+{
+    return geo::Pose3D(uniform(-1, 1), uniform(-1, 1), uniform(-1, 1), uniform(-M_PI, M_PI), uniform(-M_PI, M_PI),
+                       uniform(-M_PI, M_PI));
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool equalPoses(const geo::Pose3D& p1, const geo::Pose3D& p2, double eps = 1e-9)
+{
+    double d = (p1.t - p2.t).length();
+    for(unsigned int i = 0; i < 3; ++i)
+        d += (p1.R.getRow(i) - p2.R.getRow(i)).length();
+    return d < eps;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// Sets a relation between entities i and j (in a random direction): a TestRelation, which is invalid with
+// probability 'p_invalid', or a TransformCache
+void setRandomRelation(ed::UpdateRequest& req, unsigned int i, unsigned int j, double p_invalid,
+                       std::vector<boost::shared_ptr<TestRelation> >& test_relations)
+{
+    std::stringstream id1, id2;
+    id1 << "e" << i;
+    id2 << "e" << j;
+
+    ed::RelationConstPtr r;
+    if (rand() % 2 == 0)
+    {
+        boost::shared_ptr<TestRelation> tr(new TestRelation(randomPose()));
+        tr->valid = (uniform(0, 1) >= p_invalid);
+        test_relations.push_back(tr);
+        r = tr;
+    }
+    else
+    {
+        boost::shared_ptr<ed::TransformCache> tc(new ed::TransformCache());
+        tc->insert(0, randomPose());
+        r = tc;
+    }
+
+    if (rand() % 2 == 0)
+        req.setRelation(id1.str(), id2.str(), r);
+    else
+        req.setRelation(id2.str(), id1.str(), r);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// Returns true if both crawlers visit the same entities in the same order, with the same transforms
+bool equalCrawls(ed::world_model::TransformCrawler& c1, ed::world_model::TransformCrawler& c2)
+{
+    for(; c1.hasNext() && c2.hasNext(); c1.next(), c2.next())
+    {
+        if (c1.entity() != c2.entity() || !equalPoses(c1.transform(), c2.transform()))
+            return false;
+    }
+
+    return !c1.hasNext() && !c2.hasNext();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// An updated crawler must give the same result as a fresh crawl, after relations were changed in place (also from
+// invalid to valid and back), set in the world model, or added and removed
+void testTransformCrawler()
+{
+    unsigned int num_errors = 0;
+    for(unsigned int trial = 0; trial < 20; ++trial)
+    {
+        unsigned int num_entities = 20 + rand() % 100;
+
+        std::vector<boost::shared_ptr<TestRelation> > test_relations;
+
+        // A forest of entities, of which some are not connected
+        ed::UpdateRequest req;
+        for(unsigned int i = 0; i < num_entities; ++i)
+        {
+            std::stringstream id;
+            id << "e" << i;
+            req.setType(id.str(), "object");
+
+            if (i > 0 && rand() % 10 != 0)
+                setRandomRelation(req, rand() % i, i, 0.1, test_relations);
+        }
+
+        ed::WorldModelPtr wm(new ed::WorldModel);
+        wm->update(req);
+
+        ed::world_model::TransformCrawler crawler, fresh;
+        crawler.start(*wm, "e0", 0);
+
+        for(unsigned int step = 0; step < 30; ++step)
+        {
+            // Each step works on a new revision of the world model, as a plugin does
+            ed::WorldModelPtr wm_new(new ed::WorldModel(*wm));
+
+            std::vector<ed::Idx> changed_relations;
+            ed::UpdateRequest req_step;
+
+            switch (rand() % 4)
+            {
+            case 0:
+            case 1:
+            {
+                // Change relations in place: transforms, and valid to invalid (or back)
+                for(unsigned int i = 0; i < test_relations.size(); ++i)
+                {
+                    if (rand() % 5 != 0)
+                        continue;
+
+                    TestRelation& r = *test_relations[i];
+                    if (rand() % 3 == 0)
+                        r.valid = !r.valid;
+                    else
+                        r.pose = randomPose();
+
+                    for(ed::Idx j = 0; j < wm_new->relations().size(); ++j)
+                    {
+                        if (wm_new->relations()[j] == test_relations[i])
+                            changed_relations.push_back(j);
+                    }
+                }
+                break;
+            }
+            case 2:
+            {
+                // Set new relations in the world model between entities that are already related (same structure)
+                for(unsigned int i = 0; i < 3; ++i)
+                {
+                    const ed::EntityConstPtr& e = wm_new->entities()[rand() % wm_new->entities().size()];
+                    if (!e || e->relationsTo().empty())
+                        continue;
+
+                    // Relations to removed entities are kept (but not crawled)
+                    const ed::EntityConstPtr& child = wm_new->entities()[e->relationsTo().begin()->first];
+                    if (!child)
+                        continue;
+
+                    boost::shared_ptr<TestRelation> r(new TestRelation(randomPose()));
+                    test_relations.push_back(r);
+                    req_step.setRelation(e->id(), child->id(), r);
+                }
+                break;
+            }
+            default:
+            {
+                // Change the structure: remove an entity (and its relations), or add relations (which may close
+                // cycles or connect components)
+                if (rand() % 2 == 0)
+                {
+                    std::stringstream id;
+                    id << "e" << 1 + rand() % (num_entities - 1);
+                    req_step.removeEntity(id.str());
+                }
+                else
+                {
+                    unsigned int i = rand() % num_entities;
+                    unsigned int j = rand() % num_entities;
+
+                    std::stringstream id1, id2;
+                    id1 << "e" << i;
+                    id2 << "e" << j;
+                    if (i != j && wm_new->getEntity(id1.str()) && wm_new->getEntity(id2.str()))
+                        setRandomRelation(req_step, i, j, 0, test_relations);
+                }
+            }
+            }
+
+            wm_new->update(req_step);
+            wm = wm_new;
+
+            crawler.update(*wm, 0, changed_relations);
+            fresh.start(*wm, "e0", 0);
+            if (!equalCrawls(crawler, fresh))
+                ++num_errors;
+        }
+    }
+
+    if (num_errors > 0)
+        std::cout << "ERROR: " << num_errors << " updated transform crawls differ from a fresh crawl" << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+struct SearchNode
+{
+    ed::Idx parent;
+    ed::Idx relation;
+    bool inverse;
+};
+
+// The breadth-first search with which WorldModel::calculateTransform used to find the path between entities
+bool calculateTransformBFS(const ed::WorldModel& wm, const ed::UUID& source, const ed::UUID& target, const ed::Time& time,
+                           geo::Pose3D& tf)
+{
+    ed::Idx s, t;
+    if (!wm.findEntityIdx(source, s) || !wm.findEntityIdx(target, t))
+        return false;
+
+    std::queue<ed::Idx> Q;
+    std::map<ed::Idx, SearchNode> visited;
+
+    SearchNode sn_root = { ed::INVALID_IDX, ed::INVALID_IDX, true };
+    Q.push(s);
+    visited[s] = sn_root;
+
+    while(!Q.empty())
+    {
+        ed::Idx n = Q.front();
+        Q.pop();
+
+        if (n == t)
+        {
+            tf = geo::Pose3D::identity();
+            for(ed::Idx u = n; u != s; )
+            {
+                const SearchNode& sn = visited[u];
+
+                geo::Pose3D tr;
+                if (!wm.relations()[sn.relation]->calculateTransform(time, tr))
+                    return false;
+
+                if (sn.inverse)
+                    tf = tr.inverse() * tf;
+                else
+                    tf = tr * tf;
+
+                u = sn.parent;
+            }
+
+            return true;
+        }
+
+        for(unsigned int dir = 0; dir < 2; ++dir)
+        {
+            // First all entities that point to this one, then all entities this one points to
+            const std::map<ed::Idx, ed::Idx>& rels = (dir == 0 ? wm.entities()[n]->relationsTo() : wm.entities()[n]->relationsFrom());
+            for(std::map<ed::Idx, ed::Idx>::const_iterator it = rels.begin(); it != rels.end(); ++it)
+            {
+                ed::Idx n2 = it->first;
+                if (!wm.entities()[n2] || visited.find(n2) != visited.end())
+                    continue;
+
+                SearchNode sn = { n, it->second, dir == 1 };
+                visited[n2] = sn;
+                Q.push(n2);
+            }
+        }
+    }
+
+    return false;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// calculateTransform and calculateTransforms must give the same transforms as a breadth-first search, on relation
+// graphs with relations in both directions, cycles, disconnected components, and entities that are removed and
+// added again. The relations are consistent (derived from absolute poses), such that any path gives the same result
+void testCalculateTransform()
+{
+    unsigned int num_entities = 60;
+
+    std::vector<ed::UUID> ids(num_entities);
+    std::vector<geo::Pose3D> poses(num_entities);
+    for(unsigned int i = 0; i < num_entities; ++i)
+    {
+        std::stringstream id;
+        id << "e" << i;
+        ids[i] = id.str();
+        poses[i] = randomPose();
+    }
+
+    ed::WorldModel wm;
+
+    // Relations between entity i and j, in a random direction
+    std::vector<std::pair<unsigned int, unsigned int> > relations;
+    for(unsigned int i = 1; i < num_entities; ++i)
+    {
+        // Every tenth entity starts a new component
+        if (i % 10 != 0)
+            relations.push_back(std::make_pair(rand() % 2 == 0 ? i : (i / 10) * 10 + rand() % (i % 10), i));
+    }
+
+    // Cycles within the components
+    for(unsigned int k = 0; k < 10; ++k)
+    {
+        unsigned int c = 10 * (rand() % (num_entities / 10));
+        relations.push_back(std::make_pair(c + rand() % 10, c + rand() % 10));
+    }
+
+    unsigned int num_errors = 0;
+    unsigned int removed = num_entities;
+    for(unsigned int step = 0; step < 20; ++step)
+    {
+        ed::UpdateRequest req;
+        if (step == 0)
+        {
+            for(unsigned int i = 0; i < num_entities; ++i)
+                req.setType(ids[i], "object");
+        }
+        else if (step % 2 == 1)
+        {
+            // Remove an entity, such that its component may fall apart
+            removed = rand() % num_entities;
+            req.removeEntity(ids[removed]);
+        }
+        else
+        {
+            // Add it again. It gets its index back, to which the relations of other entities still point
+            req.setType(ids[removed], "object");
+        }
+
+        // Set the relations of the added entities, and some others again
+        for(unsigned int i = 0; i < relations.size(); ++i)
+        {
+            unsigned int a = relations[i].first;
+            unsigned int b = relations[i].second;
+            if (a == b || (step > 0 && (step % 2 == 1 || (a != removed && b != removed && rand() % 5 != 0))))
+                continue;
+
+            // Relation from a to b: pose of b relative to a
+            boost::shared_ptr<ed::TransformCache> tc(new ed::TransformCache());
+            tc->insert(0, poses[a].inverse() * poses[b]);
+            if (rand() % 2 == 0)
+                req.setRelation(ids[a], ids[b], tc);
+            else
+            {
+                boost::shared_ptr<ed::TransformCache> tc_inv(new ed::TransformCache());
+                tc_inv->insert(0, poses[b].inverse() * poses[a]);
+                req.setRelation(ids[b], ids[a], tc_inv);
+            }
+        }
+
+        wm.update(req);
+
+        for(unsigned int k = 0; k < 5; ++k)
+        {
+            const ed::UUID& source = ids[rand() % num_entities];
+
+            std::vector<geo::Pose3D> tfs;
+            std::vector<bool> valid;
+            wm.calculateTransforms(source, ids, 0, tfs, valid);
+
+            for(unsigned int i = 0; i < num_entities; ++i)
+            {
+                geo::Pose3D tf_bfs, tf;
+                bool valid_bfs = calculateTransformBFS(wm, source, ids[i], 0, tf_bfs);
+                bool valid_tf = wm.calculateTransform(source, ids[i], 0, tf);
+
+                if (valid_tf != valid_bfs || valid[i] != valid_bfs)
+                    ++num_errors;
+                else if (valid_bfs && (!equalPoses(tf, tf_bfs, 1e-6) || !equalPoses(tfs[i], tf_bfs, 1e-6)))
+                    ++num_errors;
+            }
+        }
+    }
+
+    if (num_errors > 0)
+        std::cout << "ERROR: " << num_errors << " transforms differ from those found by breadth-first search" << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void testCorrectness(const ed::WorldModel& wm)
+{
+    ed::UUID id1 = "map";
+    ed::UUID id2 = "bottle";
+
+    geo::Pose3D tr;
+    if (wm.calculateTransform(id1, id2, 0, tr))
+    {
+        std::cout << tr << std::endl;
+    }
+
+    testConvexHull();
+    testConvexHullKernels();
+    testShapeConvexHull();
+    testTimeCache();
+    testSharedTimeCache();
+    testMergeUpdateRequests();
+    testUpdateRequestCompatibilityMaps();
+    testChangeLog();
+    testChangeLogTruncation();
+    testBinarySerialization();
+    testJSONSerialization();
+    testSpatialQueries();
+    testCollisionQueries();
+    testLabelIndices();
+    testTransformCrawler();
+    testCalculateTransform();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    ros::Time::init();                      // Why do we need this?
+
+    std::string cmd;
+    if (argc > 1)
+        cmd = argv[1];
+
+    if (cmd == "benchmark")
+    {
+        benchmarkLookup(1000);
+        benchmarkLookup(10000);
+        benchmarkLookup(100000);
+        benchmarkSpatialQuery(10000);
+        benchmarkSpatialQuery(100000);
+        benchmarkTypeQuery(100000);
+        benchmarkCollision(5000);
+
+        std::cout << "Convex hull calculations (" << ed::convex_hull::instructionSet() << "), 1000 hulls of:" << std::endl;
+        benchmarkConvexHullCalc(8);
+        benchmarkConvexHullCalc(32);
+        benchmarkConvexHullCalc(128);
+
+        ed::WorldModel wm;
+        buildWorldModel(wm);
+        std::cout << "Transforms in a chain of 100000 entities:" << std::endl;
+        benchmarkTransforms(wm);
+        benchmarkTransformCrawler(wm);
+
+        std::cout << "Serialization of 100000 entities:" << std::endl;
+        benchmarkSerialization(wm);
+
+        std::cout << "Time cache of 100 floats:" << std::endl;
+        benchmarkTimeCache<MapTimeCache<float> >("std::map  ", 100);
+        benchmarkTimeCache<ed::TimeCache<float> >("TimeCache ", 100);
+        return 0;
+    }
+
+    ed::WorldModel wm;
+    buildWorldModel(wm);
 
     if (cmd == "profile")
         profile(wm);